@@ -0,0 +1,149 @@
+/**
+ * @file    c37118.c
+ * @brief   Encode and decode IEEE C37.118-style synchrophasor data frames (no ESP-IDF dependencies)
+ * @note    Shared with the host decoder, hence no ESP-IDF headers
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#include "c37118.h"
+
+#include <string.h>
+
+/**
+ * @brief Write a 16-bit value in network byte order
+ */
+static uint8_t *put_u16(uint8_t *p, uint16_t val) {
+    p[0] = (uint8_t)(val >> 8);
+    p[1] = (uint8_t)(val);
+    return p + 2;
+}
+
+/**
+ * @brief Write a 32-bit value in network byte order
+ */
+static uint8_t *put_u32(uint8_t *p, uint32_t val) {
+    p[0] = (uint8_t)(val >> 24);
+    p[1] = (uint8_t)(val >> 16);
+    p[2] = (uint8_t)(val >> 8);
+    p[3] = (uint8_t)(val);
+    return p + 4;
+}
+
+/**
+ * @brief Write an IEEE 754 single precision value in network byte order
+ */
+static uint8_t *put_f32(uint8_t *p, float val) {
+    uint32_t raw;
+    memcpy(&raw, &val, sizeof(raw));
+    return put_u32(p, raw);
+}
+
+/**
+ * @brief Read a 16-bit value in network byte order
+ */
+static uint16_t get_u16(const uint8_t *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+/**
+ * @brief Read a 32-bit value in network byte order
+ */
+static uint32_t get_u32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+/**
+ * @brief Read an IEEE 754 single precision value in network byte order
+ */
+static float get_f32(const uint8_t *p) {
+    uint32_t raw = get_u32(p);
+    float val;
+    memcpy(&val, &raw, sizeof(val));
+    return val;
+}
+
+/**
+ * @brief CRC-CCITT (polynomial 0x1021, initial value 0xFFFF) as used for the C37.118 CHK word
+ * @param buf Data
+ * @param len Length of the data in bytes
+ * @return CRC value
+ */
+uint16_t c37118_crc(const uint8_t *buf, size_t len) {
+    uint16_t crc = 0xFFFF;
+
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t)(buf[i] << 8);
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+
+    return crc;
+}
+
+/**
+ * @brief STAT bits 05-04 for the time since the PMU clock was last locked to (or updated from) its time source
+ * @param unlocked_s Unlocked time in seconds
+ * @return STAT bits (00: under 10 s, 01: under 100 s, 10: under 1000 s, 11: 1000 s or more)
+ */
+uint16_t c37118_stat_unlocked(uint32_t unlocked_s) {
+    uint16_t code = (unlocked_s < 10) ? 0 : (unlocked_s < 100) ? 1 : (unlocked_s < 1000) ? 2 : 3;
+    return (uint16_t)(code << 4);
+}
+
+/**
+ * @brief Encode a data frame
+ * @param data Frame content
+ * @param buf Output buffer
+ * @param len Size of the output buffer
+ * @return Number of bytes written (0 if the buffer is too small)
+ */
+size_t c37118_encode(const c37118_data_t *data, uint8_t *buf, size_t len) {
+    if (len < C37118_DATA_FRAME_SIZE) {
+        return 0;
+    }
+
+    uint8_t *p = buf;
+    p = put_u16(p, C37118_SYNC_DATA);
+    p = put_u16(p, C37118_DATA_FRAME_SIZE);
+    p = put_u16(p, data->idcode);
+    p = put_u32(p, data->soc);
+    p = put_u32(p, ((uint32_t)(data->time_quality & 0x0F) << 24) | (data->fracsec & 0x00FFFFFF));
+    p = put_u16(p, data->stat);
+    p = put_f32(p, data->magnitude);
+    p = put_f32(p, data->angle);
+    p = put_f32(p, data->freq);
+    p = put_f32(p, data->dfreq);
+    put_u16(p, c37118_crc(buf, C37118_DATA_FRAME_SIZE - 2));
+
+    return C37118_DATA_FRAME_SIZE;
+}
+
+/**
+ * @brief Decode and validate a data frame
+ * @param buf Input buffer starting with the SYNC word
+ * @param len Number of bytes available in the buffer
+ * @param data Decoded frame content
+ * @return True if a complete frame with a valid SYNC, FRAMESIZE and CHK was decoded
+ */
+bool c37118_decode(const uint8_t *buf, size_t len, c37118_data_t *data) {
+    if ((len < C37118_DATA_FRAME_SIZE) || (get_u16(buf) != C37118_SYNC_DATA) || (get_u16(buf + 2) != C37118_DATA_FRAME_SIZE)) {
+        return false;
+    }
+
+    if (c37118_crc(buf, C37118_DATA_FRAME_SIZE - 2) != get_u16(buf + C37118_DATA_FRAME_SIZE - 2)) {
+        return false;
+    }
+
+    data->idcode = get_u16(buf + 4);
+    data->soc = get_u32(buf + 6);
+    data->fracsec = get_u32(buf + 10) & 0x00FFFFFF;
+    data->time_quality = buf[10];
+    data->stat = get_u16(buf + 14);
+    data->magnitude = get_f32(buf + 16);
+    data->angle = get_f32(buf + 20);
+    data->freq = get_f32(buf + 24);
+    data->dfreq = get_f32(buf + 28);
+
+    return true;
+}
@@ -0,0 +1,46 @@
+/**
+ * @file    c37118.h
+ * @brief   Encode and decode IEEE C37.118-style synchrophasor data frames (no ESP-IDF dependencies)
+ * @note    Fixed frame layout: one PMU, one phasor (float, polar), float FREQ/DFREQ, no analog/digital words
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define C37118_SYNC_DATA 0xAA01        // Data frame, version 1
+#define C37118_DATA_FRAME_SIZE 34      // Size of the data frame in bytes (incl. CHK)
+#define C37118_TIME_BASE 1000000       // FRACSEC resolution (us)
+#define C37118_STAT_NOT_SYNCED 0x2000  // STAT bit 13: PMU time not synchronised
+#define C37118_STAT_DATA_ERROR 0x4000  // STAT bit 14: data error
+#define C37118_STAT_TQ_UNKNOWN 0x01C0  // STAT bits 08-06: PMU time quality 111, max time error over 10 ms or unknown
+#define C37118_TQ_100MS 0x9            // FRACSEC time quality: clock within 100 ms of UTC
+#define C37118_TQ_FAULT 0xF            // FRACSEC time quality: clock failure, time not reliable
+
+typedef struct c37118_data {  // Content of a single data frame
+    uint16_t idcode;          // Data stream ID
+    uint32_t soc;             // Second of century (UTC seconds)
+    uint32_t fracsec;         // Fraction of second in C37118_TIME_BASE units
+    uint8_t time_quality;     // FRACSEC time quality byte (C37118_TQ_* in bits 3-0, leap second flags unused)
+    uint16_t stat;            // Status flags
+    float magnitude;          // Phasor magnitude (p.u., no amplitude measurement available)
+    float angle;              // Phasor angle in radians
+    float freq;               // Frequency in Hz
+    float dfreq;              // ROCOF in Hz/s
+} c37118_data_t;
+
+uint16_t c37118_crc(const uint8_t *buf, size_t len);
+uint16_t c37118_stat_unlocked(uint32_t unlocked_s);
+size_t c37118_encode(const c37118_data_t *data, uint8_t *buf, size_t len);
+bool c37118_decode(const uint8_t *buf, size_t len, c37118_data_t *data);
+
+#ifdef __cplusplus
+}
+#endif
@@ -17,40 +17,111 @@
 
 /* PIN Assignment */
 #define ZCO_PIN 4
+#define ZCO_PINS {ZCO_PIN}  // Zero-crossing input of every channel, the first one is the phase reference (e.g. {4, 18, 19} per phase)
+#define ZCO_CHANNELS ((uint32_t)(sizeof((const uint64_t[])ZCO_PINS) / sizeof(uint64_t)))  // Number of channels in ZCO_PINS
 #define TEST_PIN 12
 #define WS2812_PIN 5
 
 /* WS2812 & RMT*/
-#define WS2812_RMT_CHANNEL 1    // RMT channel to be used for WS2812
-#define WS2812_BITS_PER_CMD 24  // No of bits per command
-#define WS2812_T0H 14           // Bit 0, high time
-#define WS2812_T1H 28           // Bit 1, low time
-#define WS2812_T0L 32           // Bit 0, low time
-#define WS2812_T1L 24           // Bit 1, high time
+#define WS2812_RMT_CHANNEL 1     // RMT channel to be used for WS2812
+#define WS2812_BITS_PER_CMD 24   // No of bits per command
+#define WS2812_T0H 14            // Bit 0, high time
+#define WS2812_T1H 28            // Bit 1, low time
+#define WS2812_T0L 32            // Bit 0, low time
+#define WS2812_T1L 24            // Bit 1, high time
+#define WS2812_CMD_QUEUE_LEN 8   // Depth of the LED engine command queue
+#define WS2812_TASK_PRIO 1       // LED engine task priority (below measurement and MQTT tasks)
+#define WS2812_FRAME_MS 20       // Animation frame period for blink, breathe and status-code patterns
+#define WS2812_CODE_SLOT_MS 250  // Duration of one on/off slot of a status-code pattern
 
 /* WiFi */
 #define WIFI_SSID "TP_LINK_7522"
 #define WIFI_PASS "TwojaStara7522"
+#define WIFI_FAST_ATTEMPTS 2           // Immediate attempts after a disconnect (cached AP without a scan, then by SSID)
+#define WIFI_RETRY_BASE_MS 250         // Delay before the next attempt, doubled on every further failure
+#define WIFI_RETRY_MAX_MS 30000        // Longest delay between connection attempts
+#define WIFI_REBOOT_TIMEOUT_MS 600000  // Reboot if the link is still down after 10 min (last resort, recovery is in place)
 
 /* Timer */
-#define TIMER_DIVIDER (2)  //  Hardware timer clock divider (80/2 = 40 MHz)
+#define TIMER_DIVIDER (2)      // Hardware timer clock divider (80/2 = 40 MHz)
+#define TIMER_CLK_HZ 80000000  // APB clock feeding the timer divider
 #define TIMER_GROUP TIMER_GROUP_0
 #define TIMER_NUM TIMER_0
 
 /* SNTP */
 #define SNTP_SYNCH_RETRY 10    // Max number of SNTP synchronisation attempts
 #define SNTP_SYNCH_DELAY 2000  // Delay in ms between first and successive attempts to synch. time
+#define SNTP_STEP_FLAG_US 100  // SNTP corrections larger than this are flagged as time steps (1.8 deg of phase at 50 Hz)
 
 /* MQTT */
-#define MQTT_URI "mqtt://mqtt3.thingspeak.com"               // ThingSpeak MQTT URI
-#define MQTT_PORT 1883                                       // TCP Port
-#define MQTT_USERNAME "MxEJJyY4MwYHCS0TNzksJx4"              // Device Username
-#define MQTT_PASSWORD "KBbyTJRU5/dlf+Fd+40Yu7pJ"             // Device Password
-#define MQTT_ID "MxEJJyY4MwYHCS0TNzksJx4"                    // Device ID
-#define MQTT_TOPIC "channels/2033438/publish"                // Frequency/time channel topic
-#define MQTT_MEAS_PER_BURST 25                               // Number of measurement per one burst MQTT upload
-#define MQTT_MESSAGE_SIZE (60 + (MQTT_MEAS_PER_BURST * 15))  // Size of the MQTT message string
+#define MQTT_URI "mqtt://mqtt3.thingspeak.com"                    // ThingSpeak MQTT URI
+#define MQTT_PORT 1883                                            // TCP Port
+#define MQTT_USERNAME "MxEJJyY4MwYHCS0TNzksJx4"                   // Device Username
+#define MQTT_PASSWORD "KBbyTJRU5/dlf+Fd+40Yu7pJ"                  // Device Password
+#define MQTT_ID "MxEJJyY4MwYHCS0TNzksJx4"                         // Device ID
+#define MQTT_TOPIC "channels/2033438/publish"                     // Frequency/time channel topic
+#define MQTT_MEAS_PER_BURST 25                                    // Number of measurement per one burst MQTT upload (default)
+#define MQTT_MEAS_PER_BURST_MAX 50                                // Max number of measurements per burst (payload capacity)
+#define MQTT_MESSAGE_SIZE (200 + (MQTT_MEAS_PER_BURST_MAX * 55))  // Size of the MQTT message string
+#define MQTT_CONTROL_TOPIC_MAX 64                                 // Max length of a control topic (prefix, mqtt_id and suffix)
+#define MQTT_BACKLOG_BURSTS 16                                    // Bursts buffered in RAM across outages (80 s at the defaults, 26 KB)
+#define MQTT_BACKLOG_POLL_MS 50                                   // Poll interval of the upload task while the link is down
+#define MQTT_RECONNECT_MS 1000                                    // Session retry interval (and immediately once the IP is back)
+#define MQTT_KEEPALIVE_S 15                                       // Keep-alive, detects sessions that died during an outage
+#define MQTT_REBOOT_TIMEOUT_MS 900000                             // Reboot if nothing was published for 15 min since an outage (last resort)
+// #define MQTT_PMU_TOPIC "hertznet/pmu/1"                        // Topic for binary C37.118 data frames (local broker only)
+// #define MQTT_CONTROL_PREFIX "hertznet/"                        // Control topics <prefix><mqtt_id>/config|trace|link (local broker only)
+
+/* Uploader and UDP streaming (low-latency transport to a local collector, alongside MQTT) */
+#define UPLOADER_MAX_BACKENDS 4     // Max number of transport backends
+#define UDP_COLLECTOR_IP "0.0.0.0"  // Default collector address
+#define UDP_COLLECTOR_PORT 0        // Default collector port (0 disables UDP streaming)
+#define UDP_MEAS_PER_DGRAM 1        // Measurements per datagram (1 for the lowest latency)
+#define UDP_RETX_WINDOW 64          // Number of recent datagrams kept for NACK retransmission
+#define UDP_QUEUE_LEN 16            // Depth of the UDP sample queue
+#define UDP_NACK_POLL_MS 20         // Max interval between polls for NACKs
 
 /* Frequency measurement */
-#define ESP_INTR_FLAG_DEFAULT 0
-#define PULSES_PER_MEAS 10  // Number of interrupt pulses for one f measurement (50/... for meas per s)
\ No newline at end of file
+#define ZCO_INTR_FLAGS ESP_INTR_FLAG_IRAM  // Zero-crossing ISR stays enabled while the flash cache is off (trace and NVS writes)
+#define PULSES_PER_MEAS 10                 // Number of interrupt pulses for one f measurement (50/... for meas per s)
+#define F_NOMINAL_HZ 50                    // Nominal mains frequency (phase reference aligned to the UTC second)
+#define F_EDGE_QUEUE_LEN 50                // Depth of the zero-crossing timestamp queue per channel (1 s of pulses)
+
+/* Frequency/RoCoF estimator (Kalman filter after the two-point measurement) */
+#define F_EST_EDGE_JITTER_US 10.0f  // Zero-crossing timing noise (1 sigma), sets the measurement variance
+#define F_EST_ROCOF_PSD 0.0025f     // RoCoF random walk intensity [(Hz/s)^2/s], higher follows faster events
+#define F_EST_GATE_SIGMA 4.0f       // Measurements further than this from the prediction are rejected
+#define F_EST_REJECT_MAX 3          // Consecutive rejections accepted as a genuine step
+#define F_EST_MIN_HZ 45.0f          // Plausible frequency range (lower end), anything outside is always rejected
+#define F_EST_MAX_HZ 55.0f          // Plausible frequency range (upper end)
+#define F_EST_MAX_GAP_MS 2000       // Longer gaps between measurements restart the estimator...
+#define F_EST_MAX_GAP_WINDOWS 3     // ... unless shorter than this many windows (pulses_per_meas goes up to 250, i.e. 5 s)
+
+/* Raw edge trace capture (f_trace format, on demand over MQTT) */
+#define TRACE_PARTITION "trace"       // Flash partition for captures to flash (see partitions.csv)
+#define TRACE_PARTITION_SUBTYPE 0x40  // Data subtype of the trace partition
+#define TRACE_CHUNK_QUEUE_LEN 3       // Completed chunks waiting to be written or published (F_TRACE_CHUNK_MAX each)
+#define TRACE_CMD_QUEUE_LEN 4         // Depth of the capture request queue
+#define TRACE_CMD_MAX 64              // Max length of a capture request message
+#define TRACE_SECONDS_DEFAULT 60      // Capture duration if the request does not give one
+#define TRACE_SECONDS_MAX 86400       // Longest capture accepted (uplink, flash captures are limited by the partition size)
+#define TRACE_FLASH_BYTES_PER_S 800   // Trace rate assumed when sizing flash captures (~13 B per zero-crossing plus outputs and snapshots)
+#define TRACE_TASK_PRIO 5             // Capture task priority (below measurement and MQTT tasks)
+
+/* Synchrophasor output (IEEE C37.118-style data frames, reported once per measurement) */
+#define PMU_IDCODE 1                      // Data stream ID of this unit
+#define PMU_STEP_HOLDOFF_US 1000000       // Frames this close to an SNTP time step are marked as unreliable time
+#define PMU_TIME_QUALITY C37118_TQ_100MS  // FRACSEC time quality claimed while SNTP synchronised (no PPS/GPS reference)
+
+/* Deferred logging (dlog, used on the measurement and upload paths) */
+#define DLOG_RING_WORDS 1024           // Ring size per core in 32-bit words (power of two, 4 KB)
+#define DLOG_LEVEL_DEFAULT DLOG_DEBUG  // Records above this level are discarded at the call site
+#define DLOG_DRAIN_MS 20               // Drain task poll interval while the rings are empty
+#define DLOG_LINE_MAX 256              // Max length of a message formatted on the device
+// #define DLOG_OUTPUT_BINARY          // Forward binary records to host-tools/dlog_decode instead of formatting on the device
+
+/* Runtime configuration store (NVS) */
+#define CONFIG_STORE_NAMESPACE "hertznet"  // NVS namespace
+#define CONFIG_STORE_KEY "sys_cfg"         // NVS key of the configuration blob
+#define CONFIG_STORE_VERSION 2             // Configuration schema version (bump on sys_config_t layout change)
+#define CONFIG_STORE_UPDATE_MAX 512        // Max length of a configuration update message
\ No newline at end of file
@@ -0,0 +1,293 @@
+/**
+ * @file    config_store.c
+ * @brief   Typed runtime configuration stored in NVS, validated and applied atomically
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#include "config_store.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TAG "config_store"
+
+#define CONFIG_STORE_V1_SIZE offsetof(sys_config_t, udp_collector)  // Size of the schema v1 blob (v2 appended fields)
+
+typedef enum { FIELD_U32, FIELD_STR } field_type_t;  // Configuration field types
+
+typedef struct config_field {  // Configuration field descriptor
+    const char *key;           // Key used in configuration updates
+    field_type_t type;         // Field type
+    size_t offset;             // Offset of the field in sys_config_t
+    size_t size;               // Size of the field (capacity incl. terminator for strings)
+    uint32_t min;              // Min value (FIELD_U32)
+    uint32_t max;              // Max value (FIELD_U32)
+    bool hot;                  // Applied without a reboot
+    bool remote;               // May be changed by a remote update (credentials and endpoints may not)
+} config_field_t;
+
+#define U32_FIELD(name, lo, hi, is_hot, is_remote) \
+    { #name, FIELD_U32, offsetof(sys_config_t, name), sizeof(uint32_t), lo, hi, is_hot, is_remote }
+#define STR_FIELD(name, is_hot, is_remote) \
+    { #name, FIELD_STR, offsetof(sys_config_t, name), sizeof(((sys_config_t *)0)->name), 0, 0, is_hot, is_remote }
+
+static const config_field_t config_fields[] = {
+    U32_FIELD(pulses_per_meas, 1, 250, true, true),
+    U32_FIELD(meas_per_burst, 1, MQTT_MEAS_PER_BURST_MAX, true, true),
+    U32_FIELD(timer_divider, 2, 80, false, true),
+    U32_FIELD(sntp_retry, 1, 100, false, true),
+    U32_FIELD(sntp_delay_ms, 100, 60000, false, true),
+    STR_FIELD(mqtt_topic, true, false),
+    STR_FIELD(mqtt_username, false, false),
+    STR_FIELD(mqtt_password, false, false),
+    STR_FIELD(mqtt_id, false, false),
+    STR_FIELD(wifi_ssid, false, false),
+    STR_FIELD(wifi_pass, false, false),
+    STR_FIELD(udp_collector, false, false),
+    U32_FIELD(udp_port, 0, 65535, false, false),
+};
+
+#define CONFIG_FIELD_COUNT (sizeof(config_fields) / sizeof(config_fields[0]))
+
+static sys_config_t config;               // Active configuration
+static sys_config_t boot_config;          // Configuration loaded at boot (the one reboot-only fields are still running on)
+static SemaphoreHandle_t config_mutex;    // Mutex protecting the active configuration
+static volatile uint32_t config_gen = 0;  // Incremented each time a new configuration is applied
+
+/**
+ * @brief Populate the configuration with the compile-time defaults
+ * @param cfg Configuration to be populated
+ */
+static void config_store_defaults(sys_config_t *cfg) {
+    memset(cfg, 0, sizeof(sys_config_t));
+    cfg->version = CONFIG_STORE_VERSION;
+    cfg->pulses_per_meas = PULSES_PER_MEAS;
+    cfg->meas_per_burst = MQTT_MEAS_PER_BURST;
+    cfg->timer_divider = TIMER_DIVIDER;
+    cfg->sntp_retry = SNTP_SYNCH_RETRY;
+    cfg->sntp_delay_ms = SNTP_SYNCH_DELAY;
+    strlcpy(cfg->mqtt_topic, MQTT_TOPIC, sizeof(cfg->mqtt_topic));
+    strlcpy(cfg->mqtt_username, MQTT_USERNAME, sizeof(cfg->mqtt_username));
+    strlcpy(cfg->mqtt_password, MQTT_PASSWORD, sizeof(cfg->mqtt_password));
+    strlcpy(cfg->mqtt_id, MQTT_ID, sizeof(cfg->mqtt_id));
+    strlcpy(cfg->wifi_ssid, WIFI_SSID, sizeof(cfg->wifi_ssid));
+    strlcpy(cfg->wifi_pass, WIFI_PASS, sizeof(cfg->wifi_pass));
+    strlcpy(cfg->udp_collector, UDP_COLLECTOR_IP, sizeof(cfg->udp_collector));
+    cfg->udp_port = UDP_COLLECTOR_PORT;
+}
+
+/**
+ * @brief Validate a single field of the configuration
+ * @param cfg Configuration
+ * @param field Field descriptor
+ * @return True if the value is valid
+ */
+static bool config_store_field_valid(const sys_config_t *cfg, const config_field_t *field) {
+    const uint8_t *base = (const uint8_t *)cfg + field->offset;
+
+    if (field->type == FIELD_U32) {
+        uint32_t val;
+        memcpy(&val, base, sizeof(val));
+        return (val >= field->min) && (val <= field->max);
+    }
+
+    size_t len = strnlen((const char *)base, field->size);
+    return (len > 0) && (len < field->size);  // Non-empty and terminated
+}
+
+/**
+ * @brief Validate the whole configuration
+ * @param cfg Configuration
+ * @return True if every field is valid
+ */
+static bool config_store_valid(const sys_config_t *cfg) {
+    if (cfg->version != CONFIG_STORE_VERSION) {
+        return false;
+    }
+
+    for (size_t i = 0; i < CONFIG_FIELD_COUNT; i++) {
+        if (config_store_field_valid(cfg, &config_fields[i]) == false) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Write the configuration to NVS (single blob, replaced atomically by NVS)
+ * @param cfg Configuration to be persisted
+ * @return Error code
+ */
+static esp_err_t config_store_save(const sys_config_t *cfg) {
+    nvs_handle_t handle;
+    ESP_RETURN_ON_ERROR(nvs_open(CONFIG_STORE_NAMESPACE, NVS_READWRITE, &handle), TAG, "Failed to open NVS namespace");
+
+    esp_err_t err = nvs_set_blob(handle, CONFIG_STORE_KEY, cfg, sizeof(sys_config_t));
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+
+    ESP_RETURN_ON_ERROR(err, TAG, "Failed to write configuration to NVS");
+    return ESP_OK;
+}
+
+/**
+ * @brief Set a single field from its text representation
+ * @param cfg Configuration to be modified
+ * @param field Field descriptor
+ * @param value Value as text
+ * @return True if the value was parsed and is valid
+ */
+static bool config_store_set_field(sys_config_t *cfg, const config_field_t *field, const char *value) {
+    uint8_t *base = (uint8_t *)cfg + field->offset;
+
+    if (field->type == FIELD_U32) {
+        char *end = NULL;
+        unsigned long val = strtoul(value, &end, 10);
+        if ((*value == '\0') || (*end != '\0') || (val > UINT32_MAX)) {
+            return false;
+        }
+        uint32_t val_u32 = (uint32_t)val;
+        memcpy(base, &val_u32, sizeof(val_u32));
+    } else {
+        if (strlen(value) >= field->size) {
+            return false;
+        }
+        memset(base, 0, field->size);
+        memcpy(base, value, strlen(value));
+    }
+
+    return config_store_field_valid(cfg, field);
+}
+
+/**
+ * @brief Load the configuration from NVS or fall back to the compile-time defaults
+ * @return Error code
+ */
+esp_err_t config_store_init() {
+    config_mutex = xSemaphoreCreateMutex();
+    ESP_RETURN_ON_FALSE(config_mutex != NULL, ESP_ERR_NO_MEM, TAG, "Failed to create configuration mutex");
+    config_store_defaults(&config);
+
+    nvs_handle_t handle;
+    if (nvs_open(CONFIG_STORE_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {  // Namespace not created yet
+        ESP_LOGI(TAG, "No stored configuration, using defaults");
+        boot_config = config;
+        return ESP_OK;
+    }
+
+    sys_config_t stored;
+    size_t size = sizeof(stored);
+    esp_err_t err = nvs_get_blob(handle, CONFIG_STORE_KEY, &stored, &size);
+    nvs_close(handle);
+
+    if ((err == ESP_OK) && (size == CONFIG_STORE_V1_SIZE) && (stored.version == 1)) {  // Migrate v1: keep defaults for new fields
+        sys_config_t migrated = config;
+        memcpy(&migrated, &stored, CONFIG_STORE_V1_SIZE);
+        migrated.version = CONFIG_STORE_VERSION;
+        stored = migrated;
+        size = sizeof(stored);
+        ESP_LOGI(TAG, "Stored configuration migrated from schema v1");
+    }
+
+    if ((err == ESP_OK) && (size == sizeof(stored)) && config_store_valid(&stored)) {
+        config = stored;
+        ESP_LOGI(TAG, "Stored configuration loaded (schema v%u)", stored.version);
+    } else {  // Missing, from another schema version or corrupted
+        ESP_LOGW(TAG, "Stored configuration not usable (%s, %u bytes), using defaults", esp_err_to_name(err), size);
+    }
+    boot_config = config;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Get a copy of the active configuration
+ * @return Active configuration
+ */
+sys_config_t config_store_get() {
+    sys_config_t cfg;
+
+    xSemaphoreTake(config_mutex, portMAX_DELAY);
+    cfg = config;
+    xSemaphoreGive(config_mutex);
+
+    return cfg;
+}
+
+/**
+ * @brief Get the configuration generation, used by consumers to detect hot-reloaded parameters
+ * @return Number of configuration updates applied since boot
+ */
+uint32_t config_store_generation() {
+    return config_gen;
+}
+
+/**
+ * @brief Validate, persist and apply a remote configuration update ("key=value" pairs separated by '&' or new lines)
+ * @note Updates arrive over an unauthenticated topic, so credential and endpoint fields are refused (changed by reflashing only)
+ * @param update Configuration update text (does not need to be terminated)
+ * @param len Length of the update text
+ * @param ack Buffer for the acknowledgement message
+ * @param ack_len Size of the acknowledgement buffer
+ * @return Error code (nothing is applied unless every pair is valid and the update was persisted)
+ */
+esp_err_t config_store_apply(const char *update, size_t len, char *ack, size_t ack_len) {
+    char text[CONFIG_STORE_UPDATE_MAX];
+    if (len >= sizeof(text)) {
+        snprintf(ack, ack_len, "result=error&reason=too_long");
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(text, update, len);
+    text[len] = '\0';
+
+    sys_config_t candidate = config_store_get();  // Start from the active configuration
+    bool reboot = false;                          // Set if any non hot-reloadable field changes
+    char *save_ptr = NULL;
+
+    for (char *pair = strtok_r(text, "&\r\n", &save_ptr); pair != NULL; pair = strtok_r(NULL, "&\r\n", &save_ptr)) {
+        char *value = strchr(pair, '=');
+        const config_field_t *field = NULL;
+
+        if (value != NULL) {
+            *value++ = '\0';  // Split the pair into key and value
+            for (size_t i = 0; i < CONFIG_FIELD_COUNT; i++) {
+                if (strcmp(pair, config_fields[i].key) == 0) {
+                    field = &config_fields[i];
+                }
+            }
+        }
+
+        if ((field != NULL) && (field->remote == false)) {
+            snprintf(ack, ack_len, "result=error&key=%.32s&reason=local_only", pair);
+            ESP_LOGW(TAG, "Configuration update rejected (key: %s can not be changed remotely)", pair);
+            return ESP_ERR_NOT_SUPPORTED;
+        }
+        if ((field == NULL) || (config_store_set_field(&candidate, field, value) == false)) {
+            snprintf(ack, ack_len, "result=error&key=%.32s", pair);
+            ESP_LOGW(TAG, "Configuration update rejected (key: %s)", pair);
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        // Against the boot configuration: a reboot-only field stored by an earlier update is still not in effect
+        if ((field->hot == false) && (memcmp((uint8_t *)&candidate + field->offset, (uint8_t *)&boot_config + field->offset, field->size) != 0)) {
+            reboot = true;
+        }
+    }
+
+    if (config_store_save(&candidate) != ESP_OK) {
+        snprintf(ack, ack_len, "result=error&reason=nvs");
+        return ESP_FAIL;
+    }
+
+    xSemaphoreTake(config_mutex, portMAX_DELAY);
+    config = candidate;  // Swap in the new configuration as a whole
+    config_gen++;
+    xSemaphoreGive(config_mutex);
+
+    snprintf(ack, ack_len, "result=ok&gen=%u&reboot=%d", config_gen, reboot);
+    ESP_LOGI(TAG, "Configuration update applied (gen: %u, reboot required: %d)", config_gen, reboot);
+    return ESP_OK;
+}
@@ -0,0 +1,39 @@
+/**
+ * @file    config_store.h
+ * @brief   Typed runtime configuration stored in NVS, validated and applied atomically
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config_macros.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+
+typedef struct sys_config {    // Runtime configuration (persisted as one NVS blob)
+    uint32_t version;          // Schema version (CONFIG_STORE_VERSION)
+    uint32_t pulses_per_meas;  // Zero-crossings per measurement [hot]
+    uint32_t meas_per_burst;   // Measurements per MQTT burst [hot]
+    uint32_t timer_divider;    // Hardware timer clock divider [reboot]
+    uint32_t sntp_retry;       // Max number of SNTP synchronisation attempts [reboot]
+    uint32_t sntp_delay_ms;    // Delay between SNTP synchronisation attempts [reboot]
+    char mqtt_topic[64];       // Frequency/time channel topic [hot, local]
+    char mqtt_username[32];    // MQTT username [reboot, local]
+    char mqtt_password[48];    // MQTT password [reboot, local]
+    char mqtt_id[32];          // MQTT client ID, also names the control topics [reboot, local]
+    char wifi_ssid[32];        // WiFi SSID [reboot, local]
+    char wifi_pass[64];        // WiFi password [reboot, local]
+    char udp_collector[16];    // UDP collector IPv4 address [reboot, local] (schema v2)
+    uint32_t udp_port;         // UDP collector port, 0 disables UDP streaming [reboot, local] (schema v2)
+} sys_config_t;
+
+esp_err_t config_store_init();
+sys_config_t config_store_get();
+uint32_t config_store_generation();
+esp_err_t config_store_apply(const char *update, size_t len, char *ack, size_t ack_len);
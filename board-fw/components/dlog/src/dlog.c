@@ -0,0 +1,199 @@
+/**
+ * @file    dlog.c
+ * @brief   Deferred logging: format string address plus raw arguments written to per-core RAM rings, formatted off the hot path
+ * @note    Writers reserve ring space with a compare-and-swap and commit by writing the record info word last; the drain task
+ *          runs at idle priority and either formats records on the device or forwards them as binary frames to the host decoder
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#include "dlog.h"
+
+#include <stdio.h>
+
+#define TAG "dlog"
+
+#define DLOG_RING_MASK (DLOG_RING_WORDS - 1)
+#define DLOG_RECORD_MAX (DLOG_HDR_WORDS + DLOG_ARG_WORDS_MAX)  // Max record length in words
+
+_Static_assert((DLOG_RING_WORDS & DLOG_RING_MASK) == 0, "DLOG_RING_WORDS must be a power of two");
+
+typedef struct dlog_ring {                // Record ring of one core (free words are kept zero)
+    volatile uint32_t words[DLOG_RING_WORDS];
+    atomic_uint head;                     // Words reserved by writers (free-running)
+    atomic_uint tail;                     // Words consumed by the drain task (free-running)
+    atomic_uint written;                  // Records committed
+    atomic_uint dropped;                  // Records dropped because the ring was full
+    atomic_uint truncated;                // Records with arguments cut off
+} dlog_ring_t;
+
+static dlog_ring_t rings[portNUM_PROCESSORS];
+static volatile dlog_level_t dlog_level = DLOG_LEVEL_DEFAULT;  // Records above this level are discarded at the call site
+static const char dlog_drop_fmt[] = "%u records dropped on core %u (ring full)";
+
+/**
+ * @brief Write a log record (never blocks, no formatting)
+ * @note Runs from flash, must not be called from ESP_INTR_FLAG_IRAM ISRs (they run while the flash cache is disabled)
+ * @param level Level
+ * @param tag Tag (must be a string with static storage, only its address is stored)
+ * @param fmt Format string (must have static storage, only its address is stored)
+ */
+void dlog_write(dlog_level_t level, const char *tag, const char *fmt, ...) {
+    if (level > dlog_level) {
+        return;
+    }
+
+    uint32_t args[DLOG_ARG_WORDS_MAX];
+    bool truncated;
+    va_list ap;
+    va_start(ap, fmt);
+    size_t n_args = dlog_pack(args, DLOG_ARG_WORDS_MAX, &truncated, fmt, ap);
+    va_end(ap);
+
+    uint32_t core = xPortGetCoreID();  // Migrating afterwards is harmless, every ring accepts writers from any core
+    dlog_ring_t *ring = &rings[core];
+    uint32_t size = DLOG_HDR_WORDS + n_args;
+
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    do {
+        if ((head + size - atomic_load_explicit(&ring->tail, memory_order_acquire)) > DLOG_RING_WORDS) {
+            atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+            return;
+        }
+    } while (atomic_compare_exchange_weak_explicit(&ring->head, &head, head + size, memory_order_relaxed, memory_order_relaxed) == false);
+
+    ring->words[(head + 1) & DLOG_RING_MASK] = (uint32_t)(esp_timer_get_time() / 1000);
+    ring->words[(head + 2) & DLOG_RING_MASK] = (uint32_t)(uintptr_t)fmt;
+    ring->words[(head + 3) & DLOG_RING_MASK] = (uint32_t)(uintptr_t)tag;
+    for (size_t i = 0; i < n_args; i++) {
+        ring->words[(head + DLOG_HDR_WORDS + i) & DLOG_RING_MASK] = args[i];
+    }
+    atomic_thread_fence(memory_order_release);
+    ring->words[head & DLOG_RING_MASK] = DLOG_INFO_WORD(size, level, truncated, core);  // Commit
+
+    atomic_fetch_add_explicit(&ring->written, 1, memory_order_relaxed);
+    if (truncated) {
+        atomic_fetch_add_explicit(&ring->truncated, 1, memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Output one record: formatted line, or binary frame for the host decoder
+ * @param rec Record words
+ * @param size Record length in words
+ */
+static void dlog_emit(const uint32_t *rec, size_t size) {
+#ifdef DLOG_OUTPUT_BINARY
+    uint8_t frame[3 + (DLOG_RECORD_MAX * 4) + 1];
+    uint8_t sum = (uint8_t)size;
+    frame[0] = DLOG_FRAME_SYNC0;
+    frame[1] = DLOG_FRAME_SYNC1;
+    frame[2] = (uint8_t)size;
+    for (size_t i = 0; i < (size * 4); i++) {
+        frame[3 + i] = (uint8_t)(rec[i / 4] >> (8 * (i % 4)));
+        sum += frame[3 + i];
+    }
+    frame[3 + (size * 4)] = (uint8_t)(0 - sum);
+    fwrite(frame, 1, 4 + (size * 4), stdout);
+    fflush(stdout);
+#else
+    static char msg[DLOG_LINE_MAX];
+    const char *fmt = (const char *)(uintptr_t)rec[2];
+    const char *tag = (const char *)(uintptr_t)rec[3];
+    dlog_format(msg, sizeof(msg), fmt, &rec[DLOG_HDR_WORDS], size - DLOG_HDR_WORDS);
+    printf("%c (%u) %s: %s%s\n", dlog_level_char(DLOG_INFO_LEVEL(rec[0])), rec[1], tag, msg, DLOG_INFO_TRUNCATED(rec[0]) ? " [truncated]" : "");
+#endif
+}
+
+/**
+ * @brief Drain one ring
+ * @param ring Ring
+ * @return True if any record was drained
+ */
+static bool dlog_drain_ring(dlog_ring_t *ring) {
+    uint32_t rec[DLOG_RECORD_MAX];
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    bool drained = false;
+
+    while (tail != atomic_load_explicit(&ring->head, memory_order_relaxed)) {
+        uint32_t info = ring->words[tail & DLOG_RING_MASK];
+        if (info == 0) {  // Reserved but not committed yet
+            break;
+        }
+        atomic_thread_fence(memory_order_acquire);
+
+        uint32_t size = DLOG_INFO_WORDS(info);
+        for (uint32_t i = 0; i < size; i++) {
+            rec[i] = ring->words[(tail + i) & DLOG_RING_MASK];
+            ring->words[(tail + i) & DLOG_RING_MASK] = 0;  // Free words must read as uncommitted
+        }
+        tail += size;
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+        dlog_emit(rec, size);
+        drained = true;
+    }
+
+    return drained;
+}
+
+/**
+ * @brief Idle-priority task draining the rings and reporting dropped records
+ */
+static void dlog_drain_task(void *param) {
+    uint32_t dropped_seen[portNUM_PROCESSORS] = {0};
+
+    while (true) {
+        bool drained = false;
+        for (uint32_t core = 0; core < portNUM_PROCESSORS; core++) {
+            drained |= dlog_drain_ring(&rings[core]);
+
+            uint32_t dropped = atomic_load_explicit(&rings[core].dropped, memory_order_relaxed);
+            if (dropped != dropped_seen[core]) {  // Reported through the same path, so the host decoder sees it too
+                uint32_t rec[DLOG_HDR_WORDS + 2] = {DLOG_INFO_WORD(DLOG_HDR_WORDS + 2, DLOG_WARN, false, core), (uint32_t)(esp_timer_get_time() / 1000),
+                                                    (uint32_t)(uintptr_t)dlog_drop_fmt, (uint32_t)(uintptr_t)TAG, dropped - dropped_seen[core], core};
+                dropped_seen[core] = dropped;
+                dlog_emit(rec, DLOG_HDR_WORDS + 2);
+            }
+        }
+
+        if (drained == false) {
+            vTaskDelay(DLOG_DRAIN_MS / portTICK_PERIOD_MS);
+        }
+    }
+}
+
+/**
+ * @brief Change the level threshold at runtime
+ * @param level Records above this level are discarded
+ */
+void dlog_set_level(dlog_level_t level) {
+    dlog_level = level;
+}
+
+/**
+ * @brief Read the logging counters
+ * @return Counters summed over all cores
+ */
+dlog_stats_t dlog_get_stats() {
+    dlog_stats_t stats = {0};
+
+    for (uint32_t core = 0; core < portNUM_PROCESSORS; core++) {
+        stats.written += atomic_load_explicit(&rings[core].written, memory_order_relaxed);
+        stats.dropped += atomic_load_explicit(&rings[core].dropped, memory_order_relaxed);
+        stats.truncated += atomic_load_explicit(&rings[core].truncated, memory_order_relaxed);
+    }
+
+    return stats;
+}
+
+/**
+ * @brief Start the drain task (records written before are kept in the rings)
+ * @return Error code
+ */
+esp_err_t dlog_init() {
+    BaseType_t res = xTaskCreate(dlog_drain_task, "dlog_drain_task", 3072, NULL, tskIDLE_PRIORITY, NULL);
+    ESP_RETURN_ON_FALSE(res == pdPASS, ESP_ERR_NO_MEM, TAG, "Failed to create the drain task");
+    ESP_LOGI(TAG, "Deferred logging initialised (%u words per core)", DLOG_RING_WORDS);
+
+    return ESP_OK;
+}
@@ -0,0 +1,37 @@
+/**
+ * @file    dlog.h
+ * @brief   Deferred logging: format string address plus raw arguments written to per-core RAM rings, formatted off the hot path
+ * @note    Safe to call from tasks and from ISRs that run from flash; never blocks, records are dropped (and counted) when a ring is full.
+ *          Not for ISRs registered with ESP_INTR_FLAG_IRAM (e.g. the zero-crossing ISR): they run while the flash cache is disabled,
+ *          and the writer, the format string parser and the format strings all live in flash
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#pragma once
+
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "config_macros.h"
+#include "dlog_fmt.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define DLOGE(tag, fmt, ...) dlog_write(DLOG_ERROR, tag, fmt, ##__VA_ARGS__)
+#define DLOGW(tag, fmt, ...) dlog_write(DLOG_WARN, tag, fmt, ##__VA_ARGS__)
+#define DLOGI(tag, fmt, ...) dlog_write(DLOG_INFO, tag, fmt, ##__VA_ARGS__)
+#define DLOGD(tag, fmt, ...) dlog_write(DLOG_DEBUG, tag, fmt, ##__VA_ARGS__)
+#define DLOGV(tag, fmt, ...) dlog_write(DLOG_VERBOSE, tag, fmt, ##__VA_ARGS__)
+
+typedef struct dlog_stats {  // Counters since boot (summed over cores)
+    uint32_t written;        // Records written to the rings
+    uint32_t dropped;        // Records dropped because a ring was full
+    uint32_t truncated;      // Records with arguments cut off
+} dlog_stats_t;
+
+esp_err_t dlog_init();
+void dlog_write(dlog_level_t level, const char *tag, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+void dlog_set_level(dlog_level_t level);
+dlog_stats_t dlog_get_stats();
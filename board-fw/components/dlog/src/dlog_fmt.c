@@ -0,0 +1,336 @@
+/**
+ * @file    dlog_fmt.c
+ * @brief   Deferred logging record format: printf arguments packed into 32-bit words and formatted back later (no ESP-IDF dependencies)
+ * @note    Packing only walks the format string to find the argument types, all number to text conversion happens when formatting
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#include "dlog_fmt.h"
+
+#include <stdio.h>
+#include <string.h>
+
+typedef enum { ARG_NONE, ARG_INT, ARG_UINT, ARG_INT64, ARG_UINT64, ARG_DOUBLE, ARG_PTR, ARG_STR } arg_type_t;
+
+typedef struct conv_spec {  // One parsed conversion specification
+    const char *start;      // '%'
+    const char *end;        // One past the conversion character
+    bool star_width;        // Width given as an int argument
+    bool star_prec;         // Precision given as an int argument
+    arg_type_t type;        // Argument type (ARG_NONE for "%%" and unsupported conversions)
+    char conv;              // Conversion character
+} conv_spec_t;
+
+/**
+ * @brief Parse the conversion specification starting at p (p points to '%')
+ */
+static void parse_spec(const char *p, conv_spec_t *spec) {
+    int longs = 0;
+    spec->start = p++;
+    spec->star_width = false;
+    spec->star_prec = false;
+
+    while ((*p != '\0') && (strchr("-+ #0", *p) != NULL)) {  // Flags
+        p++;
+    }
+    if (*p == '*') {
+        spec->star_width = true;
+        p++;
+    }
+    while ((*p >= '0') && (*p <= '9')) {
+        p++;
+    }
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            spec->star_prec = true;
+            p++;
+        }
+        while ((*p >= '0') && (*p <= '9')) {
+            p++;
+        }
+    }
+    while ((*p != '\0') && (strchr("hlLqjzt", *p) != NULL)) {  // Length modifiers, only 64-bit ones matter on the ESP32
+        if ((*p == 'l') || (*p == 'L') || (*p == 'q') || (*p == 'j')) {
+            longs += (*p == 'l') ? 1 : 2;
+        }
+        p++;
+    }
+
+    spec->conv = *p;
+    spec->end = (*p != '\0') ? (p + 1) : p;
+    switch (spec->conv) {
+        case 'd':
+        case 'i':
+        case 'c':
+            spec->type = (longs >= 2) ? ARG_INT64 : ARG_INT;
+            break;
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+            spec->type = (longs >= 2) ? ARG_UINT64 : ARG_UINT;
+            break;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            spec->type = ARG_DOUBLE;
+            break;
+        case 'p':
+            spec->type = ARG_PTR;
+            break;
+        case 's':
+            spec->type = ARG_STR;
+            break;
+        default:  // "%%", "%n" and anything unknown take no argument
+            spec->type = ARG_NONE;
+            break;
+    }
+}
+
+/**
+ * @brief Pack the arguments of a printf-style call into 32-bit words
+ * @param words Output words
+ * @param max_words Capacity of words
+ * @param truncated Set if arguments did not fit (the remaining ones are dropped)
+ * @param fmt Format string
+ * @param ap Arguments
+ * @return Number of words used
+ */
+size_t dlog_pack(uint32_t *words, size_t max_words, bool *truncated, const char *fmt, va_list ap) {
+    size_t n = 0;
+    *truncated = false;
+
+    for (const char *p = strchr(fmt, '%'); p != NULL; p = strchr(p, '%')) {
+        conv_spec_t spec;
+        parse_spec(p, &spec);
+        p = spec.end;
+
+        size_t need = (spec.star_width ? 1 : 0) + (spec.star_prec ? 1 : 0);
+        need += ((spec.type == ARG_INT64) || (spec.type == ARG_UINT64) || (spec.type == ARG_DOUBLE)) ? 2 : ((spec.type == ARG_NONE) ? 0 : 1);
+        if ((n + need) > max_words) {
+            *truncated = true;
+            break;
+        }
+
+        if (spec.star_width) {
+            words[n++] = (uint32_t)va_arg(ap, int);
+        }
+        if (spec.star_prec) {
+            words[n++] = (uint32_t)va_arg(ap, int);
+        }
+
+        switch (spec.type) {
+            case ARG_INT:
+                words[n++] = (uint32_t)va_arg(ap, int);
+                break;
+            case ARG_UINT:
+                words[n++] = (uint32_t)va_arg(ap, unsigned int);
+                break;
+            case ARG_INT64:
+            case ARG_UINT64: {
+                uint64_t val = va_arg(ap, uint64_t);
+                words[n++] = (uint32_t)val;
+                words[n++] = (uint32_t)(val >> 32);
+                break;
+            }
+            case ARG_DOUBLE: {
+                double val = va_arg(ap, double);
+                uint64_t raw;
+                memcpy(&raw, &val, sizeof(raw));
+                words[n++] = (uint32_t)raw;
+                words[n++] = (uint32_t)(raw >> 32);
+                break;
+            }
+            case ARG_PTR:
+                words[n++] = (uint32_t)(uintptr_t)va_arg(ap, void *);
+                break;
+            case ARG_STR: {  // Copied, the string may not outlive the call: length word followed by the characters
+                const char *str = va_arg(ap, const char *);
+                size_t str_len = (str != NULL) ? strnlen(str, DLOG_STR_MAX) : 0;
+                size_t str_words = (str_len + 3) / 4;
+                if ((n + 1 + str_words) > max_words) {
+                    *truncated = true;
+                    return n;
+                }
+                words[n++] = (uint32_t)str_len;
+                memset(&words[n], 0, str_words * 4);
+                memcpy(&words[n], str, str_len);
+                n += str_words;
+                break;
+            }
+            case ARG_NONE:
+                break;
+        }
+    }
+
+    return n;
+}
+
+/**
+ * @brief Append text to the output, keeping it terminated
+ */
+static size_t append(char *out, size_t len, size_t pos, const char *text, size_t text_len) {
+    if (pos + 1 >= len) {
+        return pos;
+    }
+    if (text_len > (len - 1 - pos)) {
+        text_len = len - 1 - pos;
+    }
+    memcpy(&out[pos], text, text_len);
+    out[pos + text_len] = '\0';
+    return pos + text_len;
+}
+
+/**
+ * @brief Format a packed record
+ * @param out Output buffer (always terminated)
+ * @param len Size of the output buffer
+ * @param fmt Format string the words were packed with
+ * @param words Packed arguments
+ * @param n_words Number of packed words
+ * @return Length of the formatted text
+ */
+size_t dlog_format(char *out, size_t len, const char *fmt, const uint32_t *words, size_t n_words) {
+    size_t pos = 0;
+    size_t w = 0;
+    const char *p = fmt;
+
+    if (len == 0) {
+        return 0;
+    }
+    out[0] = '\0';
+
+    while (*p != '\0') {
+        const char *pct = strchr(p, '%');
+        if (pct == NULL) {
+            pos = append(out, len, pos, p, strlen(p));
+            break;
+        }
+        pos = append(out, len, pos, p, (size_t)(pct - p));
+
+        conv_spec_t spec;
+        parse_spec(pct, &spec);
+        p = spec.end;
+        if (spec.type == ARG_NONE) {
+            pos = append(out, len, pos, (spec.conv == '%') ? "%" : "", (spec.conv == '%') ? 1 : 0);
+            continue;
+        }
+
+        // Rebuild the specification for the host ABI: flags, width and precision as digits, own length modifier
+        char conv[40];
+        size_t c = 0;
+        int star[2];
+        int n_star = 0;
+        for (const char *s = spec.start; (s < spec.end - 1) && (c < sizeof(conv) - 8); s++) {
+            if (strchr("hlLqjzt", *s) != NULL) {
+                continue;
+            }
+            if (*s == '*') {
+                if (w >= n_words) {
+                    return pos;
+                }
+                star[n_star++] = (int)words[w++];
+                c += (size_t)snprintf(&conv[c], sizeof(conv) - c, "%d", star[n_star - 1]);
+                continue;
+            }
+            conv[c++] = *s;
+        }
+
+        char text[64];
+        int text_len = 0;
+        switch (spec.type) {
+            case ARG_INT:
+            case ARG_UINT:
+            case ARG_PTR:
+                if (w >= n_words) {
+                    return pos;
+                }
+                if (spec.type == ARG_PTR) {
+                    text_len = snprintf(text, sizeof(text), "0x%08x", (unsigned int)words[w++]);
+                    break;
+                }
+                if (spec.conv != 'c') {
+                    conv[c++] = 'l';
+                    conv[c++] = 'l';
+                }
+                conv[c++] = spec.conv;
+                conv[c] = '\0';
+                if (spec.conv == 'c') {
+                    text_len = snprintf(text, sizeof(text), conv, (int)words[w++]);
+                } else if (spec.type == ARG_INT) {
+                    text_len = snprintf(text, sizeof(text), conv, (long long)(int32_t)words[w++]);
+                } else {
+                    text_len = snprintf(text, sizeof(text), conv, (unsigned long long)words[w++]);
+                }
+                break;
+
+            case ARG_INT64:
+            case ARG_UINT64:
+            case ARG_DOUBLE: {
+                if ((w + 2) > n_words) {
+                    return pos;
+                }
+                uint64_t raw = (uint64_t)words[w] | ((uint64_t)words[w + 1] << 32);
+                w += 2;
+                if (spec.type != ARG_DOUBLE) {
+                    conv[c++] = 'l';
+                    conv[c++] = 'l';
+                }
+                conv[c++] = spec.conv;
+                conv[c] = '\0';
+                if (spec.type == ARG_DOUBLE) {
+                    double val;
+                    memcpy(&val, &raw, sizeof(val));
+                    text_len = snprintf(text, sizeof(text), conv, val);
+                } else if (spec.type == ARG_INT64) {
+                    text_len = snprintf(text, sizeof(text), conv, (long long)raw);
+                } else {
+                    text_len = snprintf(text, sizeof(text), conv, (unsigned long long)raw);
+                }
+                break;
+            }
+
+            case ARG_STR: {
+                if (w >= n_words) {
+                    return pos;
+                }
+                size_t str_len = words[w++];
+                size_t str_words = (str_len + 3) / 4;
+                if ((str_len > DLOG_STR_MAX) || ((w + str_words) > n_words)) {
+                    return pos;
+                }
+                char str[DLOG_STR_MAX + 1];
+                memcpy(str, &words[w], str_len);
+                str[str_len] = '\0';
+                w += str_words;
+                conv[c++] = 's';
+                conv[c] = '\0';
+                text_len = snprintf(text, sizeof(text), conv, str);
+                break;
+            }
+
+            case ARG_NONE:
+                break;
+        }
+
+        if (text_len > 0) {
+            pos = append(out, len, pos, text, ((size_t)text_len < sizeof(text)) ? (size_t)text_len : (sizeof(text) - 1));
+        }
+    }
+
+    return pos;
+}
+
+/**
+ * @brief Level letter as printed by ESP_LOG
+ */
+char dlog_level_char(uint32_t level) {
+    static const char letters[] = "?EWIDV";
+    return (level < (sizeof(letters) - 1)) ? letters[level] : '?';
+}
@@ -0,0 +1,47 @@
+/**
+ * @file    dlog_fmt.h
+ * @brief   Deferred logging record format: printf arguments packed into 32-bit words and formatted back later (no ESP-IDF dependencies)
+ * @note    Shared with the host decoder, argument sizes follow the ESP32 ABI (int, long and pointers are 32-bit)
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#pragma once
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DLOG_HDR_WORDS 4          // Record header: info, timestamp, format string address, tag address
+#define DLOG_ARG_WORDS_MAX 24     // Max number of argument words per record
+#define DLOG_STR_MAX 31           // Max number of characters copied per %s argument
+#define DLOG_FRAME_SYNC0 0xD1     // Binary console frame: sync bytes, word count, record words, checksum
+#define DLOG_FRAME_SYNC1 0x06
+
+typedef enum {  // Levels, as esp_log_level_t
+    DLOG_ERROR = 1,
+    DLOG_WARN = 2,
+    DLOG_INFO = 3,
+    DLOG_DEBUG = 4,
+    DLOG_VERBOSE = 5,
+} dlog_level_t;
+
+/* Record header word 0: bits 0-7 record length in words (never 0 once committed), 8-10 level, 11 truncated, 12-15 core */
+#define DLOG_INFO_WORD(words, level, truncated, core) \
+    ((uint32_t)(words) | ((uint32_t)(level) << 8) | ((truncated) ? (1u << 11) : 0u) | ((uint32_t)(core) << 12))
+#define DLOG_INFO_WORDS(info) ((info)&0xFFu)
+#define DLOG_INFO_LEVEL(info) (((info) >> 8) & 0x7u)
+#define DLOG_INFO_TRUNCATED(info) ((((info) >> 11) & 0x1u) != 0)
+#define DLOG_INFO_CORE(info) (((info) >> 12) & 0xFu)
+
+size_t dlog_pack(uint32_t *words, size_t max_words, bool *truncated, const char *fmt, va_list ap);
+size_t dlog_format(char *out, size_t len, const char *fmt, const uint32_t *words, size_t n_words);
+char dlog_level_char(uint32_t level);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,101 @@
+/**
+ * @file    f_calc.c
+ * @brief   Frequency, RoCoF and phase calculation from zero-crossing timer stamps (no ESP-IDF dependencies)
+ * @note    Kept free of ESP-IDF headers so that host tools can compile and run the exact same code
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#include "f_calc.h"
+
+/**
+ * @brief Initialise the calculation state
+ * @param calc Calculation state
+ * @param pulses_per_meas Number of zero-crossings per frequency window
+ * @param timer_hz Frequency of the timer used for stamping the zero-crossings
+ * @param nominal_hz Nominal mains frequency used as the phase reference
+ */
+void f_calc_init(f_calc_t *calc, uint32_t pulses_per_meas, uint32_t timer_hz, uint32_t nominal_hz) {
+    calc->pulses_per_meas = pulses_per_meas;
+    calc->timer_hz = timer_hz;
+    calc->nominal_hz = nominal_hz;
+    calc->edges = 0;
+    calc->window_start = 0;
+    calc->last_freq = 0.0f;
+    calc->last_time_us = 0;
+}
+
+/**
+ * @brief Convert a timer count into UTC time using the timer/UTC anchor
+ * @param tick Timer count
+ * @param anchor Timer/UTC mapping (may be taken before or after the tick)
+ * @param timer_hz Timer frequency
+ * @return UTC time in ns
+ */
+int64_t f_calc_tick_to_utc_ns(uint64_t tick, const f_calc_anchor_t *anchor, uint32_t timer_hz) {
+    int64_t dt_ticks = (int64_t)(tick - anchor->tick);  // Signed, the anchor is usually sampled after the edge
+    int64_t dt_s = dt_ticks / (int64_t)timer_hz;        // Split into whole seconds to avoid overflow for old anchors
+    int64_t dt_ns = (dt_s * 1000000000LL) + (((dt_ticks - (dt_s * (int64_t)timer_hz)) * 1000000000LL) / (int64_t)timer_hz);
+    return (anchor->utc_us * 1000) + dt_ns;
+}
+
+/**
+ * @brief Phase of a rising zero-crossing relative to an ideal nominal cosine aligned to the UTC second
+ * @param utc_ns UTC time of the rising zero-crossing in ns
+ * @param nominal_hz Nominal mains frequency
+ * @return Phase angle in degrees (-180, 180]
+ */
+float f_calc_phase(int64_t utc_ns, uint32_t nominal_hz) {
+    const int64_t period_ns = 1000000000LL / nominal_hz;
+    int64_t offset_ns = utc_ns % period_ns;  // Time since the last reference cycle started
+    if (offset_ns < 0) {
+        offset_ns += period_ns;
+    }
+
+    // cos(wt + phi) rises through zero at wt + phi = -90 deg, hence phi = -90 - wt
+    double phase = -90.0 - ((360.0 * (double)offset_ns) / (double)period_ns);
+    while (phase <= -180.0) {
+        phase += 360.0;
+    }
+
+    return (float)phase;
+}
+
+/**
+ * @brief Process one zero-crossing
+ * @param calc Calculation state
+ * @param tick Timer count captured in the ISR
+ * @param anchor Timer/UTC mapping sampled close to the zero-crossing
+ * @param out Calculation result (valid only if true is returned)
+ * @return True if the zero-crossing closed a frequency window and out was populated
+ */
+bool f_calc_edge(f_calc_t *calc, uint64_t tick, const f_calc_anchor_t *anchor, f_calc_out_t *out) {
+    if (calc->edges++ == 0) {  // The first zero-crossing only opens the first window
+        calc->window_start = tick;
+        return false;
+    }
+
+    if (((calc->edges - 1) % calc->pulses_per_meas) != 0) {  // Window not complete yet
+        return false;
+    }
+
+    uint64_t count = tick - calc->window_start;  // Timer ticks over pulses_per_meas periods
+    calc->window_start = tick;
+
+    int64_t utc_ns = f_calc_tick_to_utc_ns(tick, anchor, calc->timer_hz);
+    out->time_us = utc_ns / 1000;
+    out->phase = f_calc_phase(utc_ns, calc->nominal_hz);
+
+    // Raw two-point frequency, implausible values are rejected by the estimator rather than clamped here
+    out->freq = (float)(((uint64_t)calc->timer_hz * (uint64_t)calc->pulses_per_meas)) / (float)count;
+
+    if ((calc->edges > (calc->pulses_per_meas + 1)) && (out->time_us > calc->last_time_us)) {
+        out->rocof = (out->freq - calc->last_freq) / ((float)(out->time_us - calc->last_time_us) / 1000000.0f);
+    } else {
+        out->rocof = 0.0f;
+    }
+
+    calc->last_freq = out->freq;
+    calc->last_time_us = out->time_us;
+
+    return true;
+}
@@ -0,0 +1,45 @@
+/**
+ * @file    f_calc.h
+ * @brief   Frequency, RoCoF and phase calculation from zero-crossing timer stamps (no ESP-IDF dependencies)
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct f_calc_anchor {  // Mapping between the timer and UTC, sampled close to the edge
+    uint64_t tick;              // Timer count
+    int64_t utc_us;             // UTC time in us corresponding to the timer count
+} f_calc_anchor_t;
+
+typedef struct f_calc_out {  // Single calculation result
+    float freq;              // Frequency in Hz over the last window (unfiltered)
+    float rocof;             // Rate of change of frequency in Hz/s between the last two windows (0 for the first window)
+    float phase;             // Phase angle in degrees relative to the nominal reference aligned to the UTC second
+    int64_t time_us;         // UTC time in us of the zero-crossing closing the window
+} f_calc_out_t;
+
+typedef struct f_calc {        // Calculation state for one zero-crossing input
+    uint32_t pulses_per_meas;  // Number of zero-crossings per frequency window
+    uint32_t timer_hz;         // Timer frequency
+    uint32_t nominal_hz;       // Nominal mains frequency
+    uint64_t edges;            // Number of zero-crossings processed
+    uint64_t window_start;     // Timer count of the zero-crossing opening the current window
+    float last_freq;           // Frequency of the previous window
+    int64_t last_time_us;      // UTC time of the previous window
+} f_calc_t;
+
+void f_calc_init(f_calc_t *calc, uint32_t pulses_per_meas, uint32_t timer_hz, uint32_t nominal_hz);
+bool f_calc_edge(f_calc_t *calc, uint64_t tick, const f_calc_anchor_t *anchor, f_calc_out_t *out);
+int64_t f_calc_tick_to_utc_ns(uint64_t tick, const f_calc_anchor_t *anchor, uint32_t timer_hz);
+float f_calc_phase(int64_t utc_ns, uint32_t nominal_hz);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,99 @@
+/**
+ * @file    f_channel.c
+ * @brief   Multi-channel frequency measurement: per-input calculation and estimator state, inter-channel phase difference
+ *          (no ESP-IDF dependencies)
+ * @note    Channels share nothing but the reference phase, so each one produces exactly what a single-input board would;
+ *          the host simulator relies on this to check channel isolation
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#include "f_channel.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+/**
+ * @brief Initialise (or re-initialise) all channels, partial windows are discarded
+ * @param chs Channel set
+ * @param count Number of channels in use (at most F_CHANNELS_MAX)
+ * @param pulses_per_meas Number of zero-crossings per frequency window
+ * @param timer_hz Frequency of the timer used for stamping the zero-crossings
+ * @param nominal_hz Nominal mains frequency used as the phase reference
+ * @param est_cfg Estimator tuning, shared by all channels
+ */
+void f_channels_init(f_channels_t *chs, uint8_t count, uint32_t pulses_per_meas, uint32_t timer_hz, uint32_t nominal_hz,
+                     const f_estimator_cfg_t *est_cfg) {
+    chs->count = (count <= F_CHANNELS_MAX) ? count : F_CHANNELS_MAX;
+    for (uint8_t i = 0; i < chs->count; i++) {
+        f_calc_init(&chs->ch[i].calc, pulses_per_meas, timer_hz, nominal_hz);
+        f_estimator_init(&chs->ch[i].est, est_cfg);
+    }
+    chs->ref_valid = false;
+    chs->ref_phase = 0.0f;
+    chs->ref_freq = 0.0f;
+    chs->ref_rocof = 0.0f;
+    chs->ref_time_us = 0;
+}
+
+/**
+ * @brief Phase difference between a channel and the reference channel measured at different zero-crossings
+ * @param phase Phase of the channel in degrees
+ * @param time_us UTC time of the channel zero-crossing in us
+ * @param chs Channel set holding the last reference output
+ * @param nominal_hz Nominal mains frequency (phases are relative to the nominal reference)
+ * @return Phase difference in degrees (-180, 180]
+ */
+float f_channels_phase_diff(float phase, int64_t time_us, const f_channels_t *chs, uint32_t nominal_hz) {
+    // Relative to the nominal reference the phase rotates at (f - f_nominal), carry the reference over to time_us
+    double dt_s = (double)(time_us - chs->ref_time_us) / 1000000.0;
+    double rotation = (((double)chs->ref_freq - (double)nominal_hz) * dt_s) + (0.5 * (double)chs->ref_rocof * dt_s * dt_s);
+    double diff = (double)phase - ((double)chs->ref_phase + (360.0 * rotation));
+
+    diff = fmod(diff, 360.0);
+    if (diff <= -180.0) {
+        diff += 360.0;
+    } else if (diff > 180.0) {
+        diff -= 360.0;
+    }
+
+    return (float)diff;
+}
+
+/**
+ * @brief Process one zero-crossing of a channel
+ * @param chs Channel set
+ * @param channel Channel the zero-crossing was captured on
+ * @param tick Timer count captured in the ISR
+ * @param anchor Timer/UTC mapping sampled close to the zero-crossing
+ * @param out Result (valid only if true is returned)
+ * @return True if the zero-crossing closed a frequency window of the channel and out was populated
+ */
+bool f_channels_edge(f_channels_t *chs, uint8_t channel, uint64_t tick, const f_calc_anchor_t *anchor, f_channel_out_t *out) {
+    if (channel >= chs->count) {
+        return false;
+    }
+    f_channel_t *ch = &chs->ch[channel];
+
+    if (f_calc_edge(&ch->calc, tick, anchor, &out->calc) == false) {
+        return false;
+    }
+    f_estimator_update(&ch->est, out->calc.freq, out->calc.time_us, &out->est);
+    out->channel = channel;
+
+    if (channel == F_CHANNEL_REF) {
+        out->phase_diff = 0.0f;
+        if (ch->est.started) {
+            chs->ref_valid = true;
+            chs->ref_phase = out->calc.phase;
+            chs->ref_freq = out->est.freq;
+            chs->ref_rocof = out->est.rocof;
+            chs->ref_time_us = out->calc.time_us;
+        }
+    } else if (chs->ref_valid && (llabs(out->calc.time_us - chs->ref_time_us) <= F_CHANNEL_REF_MAX_AGE_US)) {
+        out->phase_diff = f_channels_phase_diff(out->calc.phase, out->calc.time_us, chs, ch->calc.nominal_hz);
+    } else {
+        out->phase_diff = NAN;
+    }
+
+    return true;
+}
@@ -0,0 +1,53 @@
+/**
+ * @file    f_channel.h
+ * @brief   Multi-channel frequency measurement: per-input calculation and estimator state, inter-channel phase difference
+ *          (no ESP-IDF dependencies)
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "f_calc.h"
+#include "f_estimator.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define F_CHANNELS_MAX 4                  // Max number of zero-crossing inputs (three phases plus a spare input)
+#define F_CHANNEL_REF 0                   // Reference channel for phase differences
+#define F_CHANNEL_REF_MAX_AGE_US 1000000  // Reference output older than this is not used for phase differences
+
+typedef struct f_channel {  // Measurement state of one zero-crossing input
+    f_calc_t calc;          // Frequency, RoCoF and phase calculation state
+    f_estimator_t est;      // Frequency and RoCoF estimator state
+} f_channel_t;
+
+typedef struct f_channels {          // Measurement state of all inputs of a board
+    uint8_t count;                   // Number of channels in use
+    f_channel_t ch[F_CHANNELS_MAX];  // Per-channel state
+    bool ref_valid;                  // ref_* hold an output of the reference channel
+    float ref_phase;                 // Phase of the last reference output in degrees
+    float ref_freq;                  // Estimated frequency of the last reference output in Hz
+    float ref_rocof;                 // Estimated RoCoF of the last reference output in Hz/s
+    int64_t ref_time_us;             // UTC time of the last reference output in us
+} f_channels_t;
+
+typedef struct f_channel_out {  // Single result of one channel
+    uint8_t channel;            // Channel index
+    f_calc_out_t calc;          // Window calculation result (unfiltered)
+    f_est_out_t est;            // Estimator output
+    float phase_diff;           // Phase relative to the reference channel in degrees (-180, 180], NAN if not available
+} f_channel_out_t;
+
+void f_channels_init(f_channels_t *chs, uint8_t count, uint32_t pulses_per_meas, uint32_t timer_hz, uint32_t nominal_hz,
+                     const f_estimator_cfg_t *est_cfg);
+bool f_channels_edge(f_channels_t *chs, uint8_t channel, uint64_t tick, const f_calc_anchor_t *anchor, f_channel_out_t *out);
+float f_channels_phase_diff(float phase, int64_t time_us, const f_channels_t *chs, uint32_t nominal_hz);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,145 @@
+/**
+ * @file    f_estimator.c
+ * @brief   Frequency/RoCoF state estimator (2-state Kalman filter with innovation gating, no ESP-IDF dependencies)
+ * @note    Constant-RoCoF model driven by a RoCoF random walk; fixed cost per measurement, single precision only
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#include "f_estimator.h"
+
+#define ROCOF_VAR_START 1.0f  // RoCoF variance after a restart [(Hz/s)^2], i.e. RoCoF unknown
+
+/**
+ * @brief Variance of a two-point frequency measurement caused by zero-crossing timing noise
+ * @param pulses_per_meas Number of periods per measurement window
+ * @param nominal_hz Nominal mains frequency
+ * @param edge_jitter_us Timing noise of a single zero-crossing (1 sigma) in us
+ * @return Measurement variance in Hz^2
+ */
+float f_estimator_meas_var(uint32_t pulses_per_meas, uint32_t nominal_hz, float edge_jitter_us) {
+    // f = N / T with T the difference of two noisy edges: sigma_f = f * sqrt(2) * sigma_t / T = f^2 * sqrt(2) * sigma_t / N
+    float sigma_f = ((float)nominal_hz * (float)nominal_hz * 1.41421356f * edge_jitter_us * 1e-6f) / (float)pulses_per_meas;
+    return sigma_f * sigma_f;
+}
+
+/**
+ * @brief Longest gap between measurements that does not restart the estimator, scaled with the window length
+ * @param pulses_per_meas Number of periods per measurement window
+ * @param nominal_hz Nominal mains frequency
+ * @param min_gap_us Gap accepted whatever the window length
+ * @param windows Gap accepted in measurement windows (consecutive windows are one window apart)
+ * @return Max gap in us
+ */
+int64_t f_estimator_max_gap_us(uint32_t pulses_per_meas, uint32_t nominal_hz, int64_t min_gap_us, uint32_t windows) {
+    int64_t window_us = ((int64_t)pulses_per_meas * 1000000) / nominal_hz;
+    int64_t gap_us = window_us * windows;
+    return (gap_us > min_gap_us) ? gap_us : min_gap_us;
+}
+
+/**
+ * @brief Initialise the estimator (the state is set from the first measurement)
+ * @param est Estimator state
+ * @param cfg Tuning
+ */
+void f_estimator_init(f_estimator_t *est, const f_estimator_cfg_t *cfg) {
+    est->cfg = *cfg;
+    est->started = false;
+    est->freq = 0.0f;
+    est->rocof = 0.0f;
+    est->p00 = est->p01 = est->p11 = 0.0f;
+    est->time_us = 0;
+    est->rejected = 0;
+    est->rejected_freq = 0.0f;
+    est->rejected_time_us = 0;
+    est->outliers = 0;
+}
+
+/**
+ * @brief Restart the state from a measurement
+ */
+static void f_estimator_restart(f_estimator_t *est, float freq, float rocof, int64_t time_us) {
+    est->started = true;
+    est->freq = freq;
+    est->rocof = rocof;
+    est->p00 = est->cfg.meas_var;
+    est->p01 = 0.0f;
+    est->p11 = ROCOF_VAR_START;
+    est->time_us = time_us;
+    est->rejected = 0;
+}
+
+static void f_estimator_output(const f_estimator_t *est, f_est_status_t status, f_est_out_t *out) {
+    out->freq = est->freq;
+    out->rocof = est->rocof;
+    out->freq_var = est->p00;
+    out->rocof_var = est->p11;
+    out->status = status;
+}
+
+/**
+ * @brief Process one frequency measurement
+ * @param est Estimator state
+ * @param freq Measured (two-point) frequency
+ * @param time_us UTC time of the measurement
+ * @param out Estimator output (the prediction if the measurement was rejected)
+ * @return What happened to the measurement
+ */
+f_est_status_t f_estimator_update(f_estimator_t *est, float freq, int64_t time_us, f_est_out_t *out) {
+    bool plausible = (freq >= est->cfg.f_min) && (freq <= est->cfg.f_max);
+    int64_t dt_us = time_us - est->time_us;
+
+    if ((est->started == false) || (dt_us <= 0) || (dt_us > est->cfg.max_gap_us)) {  // First measurement, time step or long gap
+        if (plausible == false) {
+            est->outliers++;
+            f_estimator_output(est, F_EST_REJECTED, out);
+            return F_EST_REJECTED;
+        }
+        f_estimator_restart(est, freq, 0.0f, time_us);
+        f_estimator_output(est, F_EST_RESET, out);
+        return F_EST_RESET;
+    }
+
+    // Predict: x = F x, P = F P F' + Q with F = [1 dt; 0 1] and Q from a RoCoF random walk
+    float dt = (float)dt_us * 1e-6f;
+    float q = est->cfg.rocof_psd;
+    est->freq += est->rocof * dt;
+    est->p00 += dt * (2.0f * est->p01 + dt * est->p11) + (q * dt * dt * dt / 3.0f);
+    est->p01 += dt * est->p11 + (q * dt * dt / 2.0f);
+    est->p11 += q * dt;
+    est->time_us = time_us;
+
+    // Gate on the normalised innovation
+    float innov = freq - est->freq;
+    float s = est->p00 + est->cfg.meas_var;
+    bool gated = (innov * innov) > (est->cfg.gate_sigma * est->cfg.gate_sigma * s);
+
+    if ((plausible == false) || gated) {
+        est->outliers++;
+        if (plausible && (++est->rejected >= est->cfg.reject_max)) {  // Persistent: a real step, follow it
+            float rocof = (est->rejected >= 2) ? (freq - est->rejected_freq) / ((float)(time_us - est->rejected_time_us) * 1e-6f) : 0.0f;
+            f_estimator_restart(est, freq, rocof, time_us);
+            f_estimator_output(est, F_EST_RESET, out);
+            return F_EST_RESET;
+        }
+        if (plausible) {
+            est->rejected_freq = freq;
+            est->rejected_time_us = time_us;
+        }
+        f_estimator_output(est, F_EST_REJECTED, out);
+        return F_EST_REJECTED;
+    }
+
+    // Update: K = P H' / S, x += K innov, P = (I - K H) P
+    float k0 = est->p00 / s;
+    float k1 = est->p01 / s;
+    float r = est->cfg.meas_var / s;  // 1 - k0 without the cancellation that zeroes it after a long window (p00 >> meas_var)
+    est->freq += k0 * innov;
+    est->rocof += k1 * innov;
+    est->p11 -= k1 * est->p01;
+    est->p01 *= r;
+    est->p00 *= r;
+    est->rejected = 0;
+
+    f_estimator_output(est, F_EST_ACCEPTED, out);
+    return F_EST_ACCEPTED;
+}
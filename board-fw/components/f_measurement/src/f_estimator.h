@@ -0,0 +1,60 @@
+/**
+ * @file    f_estimator.h
+ * @brief   Frequency/RoCoF state estimator (2-state Kalman filter with innovation gating, no ESP-IDF dependencies)
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    F_EST_RESET = 0,     // Estimator (re)started on this measurement
+    F_EST_ACCEPTED = 1,  // Measurement passed the gate and updated the state
+    F_EST_REJECTED = 2,  // Measurement rejected, output is the prediction
+} f_est_status_t;
+
+typedef struct f_estimator_cfg {  // Estimator tuning
+    float meas_var;               // Variance of the two-point frequency measurement [Hz^2]
+    float rocof_psd;              // RoCoF random walk intensity [(Hz/s)^2/s]
+    float gate_sigma;             // Innovation gate in standard deviations
+    uint32_t reject_max;          // Consecutive gated measurements accepted as a genuine step
+    float f_min;                  // Measurements outside [f_min, f_max] are always rejected [Hz]
+    float f_max;
+    int64_t max_gap_us;           // Longer gaps between measurements restart the estimator
+} f_estimator_cfg_t;
+
+typedef struct f_estimator {  // Estimator state
+    f_estimator_cfg_t cfg;    // Tuning
+    bool started;             // State initialised from a measurement
+    float freq;               // Estimated frequency [Hz]
+    float rocof;              // Estimated rate of change of frequency [Hz/s]
+    float p00, p01, p11;      // Covariance of (freq, rocof)
+    int64_t time_us;          // Time of the estimate
+    uint32_t rejected;        // Consecutive gated measurements
+    float rejected_freq;      // Last gated measurement, used to seed RoCoF on a step
+    int64_t rejected_time_us;
+    uint32_t outliers;        // Total number of rejected measurements
+} f_estimator_t;
+
+typedef struct f_est_out {  // Single estimator output
+    float freq;             // Estimated frequency [Hz]
+    float rocof;            // Estimated rate of change of frequency [Hz/s]
+    float freq_var;         // Variance of freq [Hz^2]
+    float rocof_var;        // Variance of rocof [(Hz/s)^2]
+    f_est_status_t status;  // What happened to the measurement
+} f_est_out_t;
+
+float f_estimator_meas_var(uint32_t pulses_per_meas, uint32_t nominal_hz, float edge_jitter_us);
+int64_t f_estimator_max_gap_us(uint32_t pulses_per_meas, uint32_t nominal_hz, int64_t min_gap_us, uint32_t windows);
+void f_estimator_init(f_estimator_t *est, const f_estimator_cfg_t *cfg);
+f_est_status_t f_estimator_update(f_estimator_t *est, float freq, int64_t time_us, f_est_out_t *out);
+
+#ifdef __cplusplus
+}
+#endif
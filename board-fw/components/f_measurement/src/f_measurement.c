@@ -1,66 +1,160 @@
 /**
  * @file    f_measurement.c
- * @brief   Initialising interrupt, handling the ISR events via a seperate task, calculating the frequency
+ * @brief   Initialising interrupt, handling the ISR events via a seperate task, calculating the frequency and phase
  * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
  */
 
 #include "f_measurement.h"
 
+#include <math.h>
+
+#include "config_store.h"
+#include "dlog.h"
 #include "systime.h"
 #include "timer_drv.h"
+#include "trace_capture.h"
 
 #define TAG "f_measurement"
-#define INCLUDE_vTaskSuspend 1
 
-static xQueueHandle isr_count_queue = NULL;      // Queu for sending measured time
+typedef struct f_edge {  // Zero-crossing passed from the ISR to the measurement task
+    uint64_t tick;       // Timer stamp of the zero-crossing
+    uint8_t channel;     // Input the zero-crossing was captured on
+} f_edge_t;
+
+static xQueueHandle isr_count_queue = NULL;      // Queu for sending zero-crossing timer stamps of all channels
 static xQueueHandle f_measurement_queue = NULL;  // Queu for sending measurement structs
 
-static TaskHandle_t pxMeasurementTask = NULL;  // Task handle for f_measurement task
+static TaskHandle_t pxMeasurementTask = NULL;                  // Task handle for f_measurement task
+static uint8_t channel_count = 0;                              // Number of zero-crossing inputs in use
+static volatile uint32_t edges_dropped[F_CHANNELS_MAX] = {0};  // Zero-crossings lost because the timestamp queue was full
 
 /**
- * @brief Interrupt Service Routine Handler
+ * @brief Interrupt Service Routine Handler, shared by all channels
+ * @note Runs while the flash cache is disabled (ZCO_INTR_FLAGS), so it may only call IRAM code and touch data in DRAM
+ * @param arg Channel index
  */
 static void IRAM_ATTR isr_handler(void *arg) {
-    static uint64_t isr_count_total = 0;  // Number of timer ticks since timer init
-    static uint64_t isr_pulses = 0;       // Number of interrupt pulses (isr calls)
-    static uint64_t isr_count = 0;        // Number of timer ticks since last reading
+    f_edge_t edge = {.tick = drv_timer_get_count_isr(), .channel = (uint8_t)(uintptr_t)arg};  // Timer stamp of the zero-crossing
+    BaseType_t task_woken = pdFALSE;
 
-    if (isr_pulses == 1) {
-        isr_count_total = drv_timer_get_count_isr();  // Reset the isr_count_total with the first pulse
+    if (xQueueSendFromISR(isr_count_queue, &edge, &task_woken) != pdTRUE) {  // Send the timer stamp to the measurement task
+        edges_dropped[edge.channel]++;
     }
-
-    if ((isr_pulses % PULSES_PER_MEAS) == 0) {                    // Every PULSES_PER_MEAS
-        isr_count = drv_timer_get_count_isr() - isr_count_total;  // Calc timer ticks since last reading
-        isr_count_total = drv_timer_get_count_isr();
-        xQueueSendFromISR(isr_count_queue, &isr_count, NULL);  // Send frequency value to the queue
-        vTaskResume(pxMeasurementTask);
+    if (task_woken == pdTRUE) {
+        portYIELD_FROM_ISR();
     }
+}
+
+/**
+ * @brief Sample the mapping between the timer and UTC (system time)
+ * @return Timer/UTC anchor
+ */
+static f_calc_anchor_t f_measurement_anchor() {
+    struct timeval time;  // Struct to hold current system time
+
+    uint64_t count_before = drv_timer_get_count();
+    gettimeofday(&time, NULL);
+    uint64_t count_after = drv_timer_get_count();
+
+    // Use the midpoint of the two timer readings as the timer value matching the system time
+    f_calc_anchor_t anchor = {
+        .tick = count_before + ((count_after - count_before) / 2),
+        .utc_us = ((int64_t)time.tv_sec * 1000000) + (int64_t)time.tv_usec};
+
+    return anchor;
+}
 
-    isr_pulses++;  // Increment pulses count each time ISR is executed
+/**
+ * @brief Estimator tuning for the given measurement window length
+ * @param pulses_per_meas Number of zero-crossings per measurement (sets the measurement variance and the longest gap bridged)
+ * @return Estimator configuration
+ */
+static f_estimator_cfg_t f_measurement_estimator_cfg(uint32_t pulses_per_meas) {
+    f_estimator_cfg_t est_cfg = {
+        .meas_var = f_estimator_meas_var(pulses_per_meas, F_NOMINAL_HZ, F_EST_EDGE_JITTER_US),
+        .rocof_psd = F_EST_ROCOF_PSD,
+        .gate_sigma = F_EST_GATE_SIGMA,
+        .reject_max = F_EST_REJECT_MAX,
+        .f_min = F_EST_MIN_HZ,
+        .f_max = F_EST_MAX_HZ,
+        .max_gap_us = f_estimator_max_gap_us(pulses_per_meas, F_NOMINAL_HZ, (int64_t)F_EST_MAX_GAP_MS * 1000, F_EST_MAX_GAP_WINDOWS)};
+    return est_cfg;
 }
 
 /**
- * @brief Frequency measurement task responsible for timestamping and queueing measurements
+ * @brief Frequency measurement task responsible for calculating, filtering, timestamping and queueing measurements of all channels
+ * @note  Raw edge traces record the reference channel (F_CHANNEL_REF)
  */
 static void f_measurement_task(void *param) {
+    static f_channels_t chs;                               // Calculation and estimator state of every channel
+    sys_config_t cfg = config_store_get();                 // Active runtime configuration
+    uint32_t config_gen = config_store_generation();       // Generation of cfg, used to detect remote updates
+    uint32_t timer_hz = TIMER_CLK_HZ / cfg.timer_divider;  // Timer frequency (divider applied at boot)
+    uint32_t edges_dropped_seen = 0;                       // Value of edges_dropped of the reference channel last recorded in the trace
+    uint32_t time_steps_seen = 0;                          // SNTP time steps last recorded in the trace
+    f_calc_t *ref_calc = &chs.ch[F_CHANNEL_REF].calc;      // Reference channel state, the one captured in traces
+    f_estimator_t *ref_est = &chs.ch[F_CHANNEL_REF].est;
+    f_estimator_cfg_t est_cfg = f_measurement_estimator_cfg(cfg.pulses_per_meas);
+    f_channels_init(&chs, channel_count, cfg.pulses_per_meas, timer_hz, F_NOMINAL_HZ, &est_cfg);
+
     while (true) {
-        struct timeval time;          // Struct to hold current system time
-        uint64_t count;
-        f_measurement_t meas = {.freq = -1.0, .time = 0};  // Initialise measurement struct as invalid
+        f_edge_t edge;
+        f_channel_out_t out;
+
+        if (config_store_generation() != config_gen) {  // Hot-reload the measurement window length
+            config_gen = config_store_generation();
+            cfg = config_store_get();
+            if (cfg.pulses_per_meas != ref_calc->pulses_per_meas) {
+                est_cfg = f_measurement_estimator_cfg(cfg.pulses_per_meas);  // Measurement variance depends on the window
+                f_channels_init(&chs, channel_count, cfg.pulses_per_meas, timer_hz, F_NOMINAL_HZ, &est_cfg);  // Partial windows are discarded
+                trace_capture_event(F_TRACE_EVENT_RELOAD, cfg.pulses_per_meas);
+                trace_capture_state();  // Replay continues from the re-initialised state
+                DLOGI(TAG, "Pulses per measurement changed to %u", cfg.pulses_per_meas);
+            }
+        }
 
-        if (xQueueReceive(isr_count_queue, &count, portMAX_DELAY) == pdTRUE) {
-            gettimeofday(&time, NULL);  // Copy current sys time to sys_time struct and calc time in ms
-            meas.time = (((uint64_t)time.tv_sec * 1000) + ((uint64_t)time.tv_usec / 1000));
+        if (xQueueReceive(isr_count_queue, &edge, portMAX_DELAY) == pdTRUE) {
+            f_calc_anchor_t anchor = f_measurement_anchor();  // Map the timer stamp onto UTC
 
-            // Timer f: 40 MHz, PULSES_PER_MEAS pulses
-            meas.freq = (float)(((40 * 1000000 * (uint64_t)PULSES_PER_MEAS)) / (float)count);
-            meas.freq = (meas.freq > 51.0) ? 51.0 : meas.freq;  // Set the upper limit to 51 Hz
-            meas.freq = (meas.freq < 49.0) ? 49.0 : meas.freq;  // Set the lowee limit to 49 Hz
+            if (edge.channel == F_CHANNEL_REF) {
+                trace_capture_poll(ref_calc, ref_est);  // Start/stop raw edge captures
+                if (edges_dropped[F_CHANNEL_REF] != edges_dropped_seen) {
+                    edges_dropped_seen = edges_dropped[F_CHANNEL_REF];
+                    trace_capture_event(F_TRACE_EVENT_EDGE_DROP, edges_dropped_seen);
+                }
+                systime_quality_t tq = systime_quality();
+                if (tq.steps != time_steps_seen) {  // UTC anchors jump, so does the phase
+                    time_steps_seen = tq.steps;
+                    trace_capture_event(F_TRACE_EVENT_TIME_STEP, (uint32_t)tq.last_step_us);
+                }
+                trace_capture_edge(edge.tick, &anchor);  // Everything f_calc_edge and f_estimator_update depend on
+            }
 
-            xQueueSend(f_measurement_queue, &meas, (TickType_t)0);
-        }
+            if (f_channels_edge(&chs, edge.channel, edge.tick, &anchor, &out) == true) {  // Every pulses_per_meas zero-crossings
+                const f_estimator_t *est = &chs.ch[edge.channel].est;
+                if (out.est.status == F_EST_REJECTED) {
+                    DLOGD(TAG, "Measurement rejected on channel %u: %.3f Hz (outliers: %u)", edge.channel, out.calc.freq, est->outliers);
+                }
+                if (edge.channel == F_CHANNEL_REF) {
+                    trace_capture_output(&out.calc, &out.est);  // Reference for bit-exact replay on the host
+                }
+                if (est->started == false) {  // Nothing plausible measured yet
+                    continue;
+                }
 
-        vTaskSuspend(NULL);  // Suspend itself
+                f_measurement_t meas = {
+                    .freq = out.est.freq,
+                    .rocof = out.est.rocof,
+                    .freq_std = sqrtf(out.est.freq_var),
+                    .rocof_std = sqrtf(out.est.rocof_var),
+                    .freq_raw = out.calc.freq,
+                    .phase = out.calc.phase,
+                    .phase_diff = out.phase_diff,
+                    .channel = out.channel,
+                    .time_us = (uint64_t)out.calc.time_us};
+                xQueueSend(f_measurement_queue, &meas, (TickType_t)0);
+            }
+        }
     }
 }
 
@@ -69,10 +163,11 @@ static void f_measurement_task(void *param) {
  * @return Frequency or -1 if no new value is available
  */
 f_measurement_t f_measurement_get_val() {
-    f_measurement_t meas = {.freq = -1.0, .time = 0};  // Initialise measurement struct as invalid
+    f_measurement_t meas = {.freq = -1.0, .rocof = 0.0, .freq_std = 0.0, .rocof_std = 0.0, .freq_raw = 0.0, .phase = 0.0, .phase_diff = 0.0, .channel = 0, .time_us = 0};  // Invalid
 
     if (xQueueReceive(f_measurement_queue, &meas, portMAX_DELAY) == pdTRUE) {
-        ESP_LOGI(TAG, "New measurement: %.3lf Hz | %llu ms", meas.freq, meas.time);
+        DLOGI(TAG, "New measurement (ch %u): %.3lf Hz (+/- %.1f mHz) | %.3f Hz/s | %.1f deg (%+.1f) | %llu ms", meas.channel, meas.freq,
+              (meas.freq_std * 1000.0f), meas.rocof, meas.phase, meas.phase_diff, (meas.time_us / 1000));
     }
 
     return meas;
@@ -99,31 +194,40 @@ static esp_err_t intr_gpio_config(uint64_t gpio_input_pin_sel) {
 }
 
 /**
- * @brief Initialise frequency measurement: Interrupt (GPIO, Task, Que, ISR) and Timer
- * @param gpio_interrupt pin to be used for the interrupt
+ * @brief Initialise frequency measurement: Interrupts (GPIO, Task, Que, ISR) of every channel and Timer
+ * @param gpio_interrupts pins to be used for the interrupts, one per channel (the first one is the phase reference)
+ * @param channels number of channels (1 to F_CHANNELS_MAX)
  * @return Error code
  */
-esp_err_t f_measurement_init(uint64_t gpio_interrupt) {
+esp_err_t f_measurement_init(const uint64_t *gpio_interrupts, uint8_t channels) {
+    ESP_RETURN_ON_FALSE((channels > 0) && (channels <= F_CHANNELS_MAX), ESP_ERR_INVALID_ARG, TAG, "Unsupported number of channels: %u", channels);
     ESP_RETURN_ON_ERROR(drv_timer_init(), TAG, "Timer driver initialisation failed");
+    ESP_RETURN_ON_ERROR(trace_capture_init(), TAG, "Trace capture initialisation failed");
+    channel_count = channels;
 
-    uint64_t gpio_input_pin_select = (1ULL << gpio_interrupt);
-    // Initialise gpio for the interrupt
+    uint64_t gpio_input_pin_select = 0;
+    for (uint8_t i = 0; i < channels; i++) {
+        gpio_input_pin_select |= (1ULL << gpio_interrupts[i]);
+    }
+    // Initialise gpio for the interrupts
     ESP_RETURN_ON_ERROR(intr_gpio_config(gpio_input_pin_select), TAG, "Failed to initialise GPIO Interrupt");
 
-    // Create a queue for one burst of isr count values and measurements (f & time) structs
-    isr_count_queue = xQueueCreate(MQTT_MEAS_PER_BURST, sizeof(uint64_t));
-    f_measurement_queue = xQueueCreate(MQTT_MEAS_PER_BURST, sizeof(f_measurement_t));
+    // Create a queue for zero-crossing timer stamps of all channels and for one burst of measurements (f, phase & time) structs
+    isr_count_queue = xQueueCreate(F_EDGE_QUEUE_LEN * channels, sizeof(f_edge_t));
+    f_measurement_queue = xQueueCreate(MQTT_MEAS_PER_BURST_MAX, sizeof(f_measurement_t));
 
-    // Install gpio isr service
-    ESP_RETURN_ON_ERROR(gpio_install_isr_service(ESP_INTR_FLAG_DEFAULT), TAG, "Failed to install ISR Service");
-    // Hook isr handler for specific gpio pin
-    ESP_RETURN_ON_ERROR(gpio_isr_handler_add(gpio_interrupt, isr_handler, NULL), TAG, "Failed to add ISR Handler");
+    // Install gpio isr service in IRAM, so flash erases and writes do not delay the timer stamps (the handler path is all IRAM_ATTR)
+    ESP_RETURN_ON_ERROR(gpio_install_isr_service(ZCO_INTR_FLAGS), TAG, "Failed to install ISR Service");
+    // Hook the shared isr handler for every channel pin, the channel index is passed as the argument
+    for (uint8_t i = 0; i < channels; i++) {
+        ESP_RETURN_ON_ERROR(gpio_isr_handler_add(gpio_interrupts[i], isr_handler, (void *)(uintptr_t)i), TAG, "Failed to add ISR Handler");
+    }
 
     // Start frequency measurement task
-    xTaskCreate(f_measurement_task, "f_measurement_task", 2048, NULL, (configMAX_PRIORITIES - 1), &pxMeasurementTask);
+    xTaskCreate(f_measurement_task, "f_measurement_task", 3072, NULL, (configMAX_PRIORITIES - 1), &pxMeasurementTask);
     ESP_LOGI(TAG, "Frequency measurement task created");
 
-    ESP_LOGI(TAG, "ISR Service installed, handler added, interrupt task created");
+    ESP_LOGI(TAG, "ISR Service installed, handlers added for %u channel(s), interrupt task created", channels);
     return ESP_OK;
 }
 
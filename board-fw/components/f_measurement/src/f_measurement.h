@@ -1,6 +1,6 @@
 /**
  * @file    f_measurement.h
- * @brief   Initialising interrupt, handling the ISR events via a seperate task, calculating the frequency
+ * @brief   Initialising interrupt, handling the ISR events via a seperate task, calculating the frequency and phase
  * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
  */
 
@@ -13,15 +13,25 @@
 
 #include "config_macros.h"
 #include "driver/gpio.h"
+#include "f_calc.h"
+#include "f_channel.h"
+#include "f_estimator.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
 #include "freertos/task.h"
 
 typedef struct measurement {  // Single measurement datatype
-    float freq;
-    uint64_t time;
+    float freq;               // Estimated frequency in Hz
+    float rocof;              // Estimated rate of change of frequency in Hz/s
+    float freq_std;           // Standard deviation of freq in Hz (estimator confidence)
+    float rocof_std;          // Standard deviation of rocof in Hz/s
+    float freq_raw;           // Two-point frequency measured over the window in Hz
+    float phase;              // Phase angle in degrees relative to the nominal reference aligned to the UTC second
+    float phase_diff;         // Phase angle in degrees relative to the reference channel (NAN if not available)
+    uint8_t channel;          // Zero-crossing input the measurement was taken on
+    uint64_t time_us;         // UTC timestamp of the zero-crossing closing the measurement in us
 } f_measurement_t;
 
-esp_err_t f_measurement_init(uint64_t gpio_interrupt);
+esp_err_t f_measurement_init(const uint64_t *gpio_interrupts, uint8_t channels);
 esp_err_t f_measurement_test(const uint64_t gpio_zco);
 f_measurement_t f_measurement_get_val();
\ No newline at end of file
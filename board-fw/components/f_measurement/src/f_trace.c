@@ -0,0 +1,464 @@
+/**
+ * @file    f_trace.c
+ * @brief   Raw edge trace format: zero-crossing timer stamps, timer/UTC anchors, outputs and event markers (no ESP-IDF dependencies)
+ * @note    Every chunk opens with a state snapshot and restarts the delta coding, so a lost chunk never corrupts the following ones
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#include "f_trace.h"
+
+#include <string.h>
+
+#define F_TRACE_ANCHOR_ABS 0x10  // Anchor record flag: absolute values (first anchor of a chunk)
+#define F_TRACE_EVENT_MAX 7      // Max size of an event record
+
+/**
+ * @brief Write little-endian values and variable-length integers (7 bits per byte, LSB first)
+ */
+static uint8_t *put_u32(uint8_t *p, uint32_t val) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = (uint8_t)(val >> (8 * i));
+    }
+    return p + 4;
+}
+
+static uint8_t *put_u64(uint8_t *p, uint64_t val) {
+    for (int i = 0; i < 8; i++) {
+        p[i] = (uint8_t)(val >> (8 * i));
+    }
+    return p + 8;
+}
+
+static uint8_t *put_f32(uint8_t *p, float val) {
+    uint32_t raw;
+    memcpy(&raw, &val, sizeof(raw));
+    return put_u32(p, raw);
+}
+
+static uint8_t *put_varint(uint8_t *p, uint64_t val) {
+    while (val >= 0x80) {
+        *p++ = (uint8_t)(val | 0x80);
+        val >>= 7;
+    }
+    *p++ = (uint8_t)val;
+    return p;
+}
+
+static uint8_t *put_zigzag(uint8_t *p, int64_t val) {
+    return put_varint(p, ((uint64_t)val << 1) ^ (uint64_t)(val >> 63));
+}
+
+/**
+ * @brief Read little-endian values and variable-length integers
+ */
+static uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t get_u64(const uint8_t *p) {
+    return (uint64_t)get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+
+static float get_f32(const uint8_t *p) {
+    uint32_t raw = get_u32(p);
+    float val;
+    memcpy(&val, &raw, sizeof(val));
+    return val;
+}
+
+static const uint8_t *get_varint(const uint8_t *p, const uint8_t *end, uint64_t *val) {
+    *val = 0;
+    for (int shift = 0; (p < end) && (shift < 64); shift += 7) {
+        *val |= (uint64_t)(*p & 0x7F) << shift;
+        if ((*p++ & 0x80) == 0) {
+            return p;
+        }
+    }
+    return NULL;  // Truncated or overlong
+}
+
+static const uint8_t *get_zigzag(const uint8_t *p, const uint8_t *end, int64_t *val) {
+    uint64_t raw;
+    p = get_varint(p, end, &raw);
+    *val = (int64_t)(raw >> 1) ^ -(int64_t)(raw & 1);
+    return p;
+}
+
+/**
+ * @brief CRC-32 (IEEE 802.3, as zlib), nibble table to keep the footprint small
+ * @param crc CRC of the preceding data (0 to start)
+ * @param data Data
+ * @param len Length of the data
+ * @return Updated CRC
+ */
+uint32_t f_trace_crc32(uint32_t crc, const uint8_t *data, size_t len) {
+    static const uint32_t table[16] = {0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+                                       0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc = (crc >> 4) ^ table[(crc ^ data[i]) & 0x0F];
+        crc = (crc >> 4) ^ table[(crc ^ (data[i] >> 4)) & 0x0F];
+    }
+    return ~crc;
+}
+
+/**
+ * @brief Encode a calculation/estimator state snapshot (F_TRACE_STATE_SIZE bytes)
+ */
+static uint8_t *put_state(uint8_t *p, const f_calc_t *calc, const f_estimator_t *est) {
+    p = put_u32(p, calc->pulses_per_meas);
+    p = put_u32(p, calc->timer_hz);
+    p = put_u32(p, calc->nominal_hz);
+    p = put_u64(p, calc->edges);
+    p = put_u64(p, calc->window_start);
+    p = put_f32(p, calc->last_freq);
+    p = put_u64(p, (uint64_t)calc->last_time_us);
+
+    p = put_f32(p, est->cfg.meas_var);
+    p = put_f32(p, est->cfg.rocof_psd);
+    p = put_f32(p, est->cfg.gate_sigma);
+    p = put_u32(p, est->cfg.reject_max);
+    p = put_f32(p, est->cfg.f_min);
+    p = put_f32(p, est->cfg.f_max);
+    p = put_u64(p, (uint64_t)est->cfg.max_gap_us);
+
+    *p++ = est->started ? 1 : 0;
+    p = put_f32(p, est->freq);
+    p = put_f32(p, est->rocof);
+    p = put_f32(p, est->p00);
+    p = put_f32(p, est->p01);
+    p = put_f32(p, est->p11);
+    p = put_u64(p, (uint64_t)est->time_us);
+    p = put_u32(p, est->rejected);
+    p = put_f32(p, est->rejected_freq);
+    p = put_u64(p, (uint64_t)est->rejected_time_us);
+    p = put_u32(p, est->outliers);
+    return p;
+}
+
+/**
+ * @brief Decode a calculation/estimator state snapshot (F_TRACE_STATE_SIZE bytes)
+ */
+static void get_state(const uint8_t *p, f_calc_t *calc, f_estimator_t *est) {
+    calc->pulses_per_meas = get_u32(p);
+    calc->timer_hz = get_u32(p + 4);
+    calc->nominal_hz = get_u32(p + 8);
+    calc->edges = get_u64(p + 12);
+    calc->window_start = get_u64(p + 20);
+    calc->last_freq = get_f32(p + 28);
+    calc->last_time_us = (int64_t)get_u64(p + 32);
+    p += 40;
+
+    est->cfg.meas_var = get_f32(p);
+    est->cfg.rocof_psd = get_f32(p + 4);
+    est->cfg.gate_sigma = get_f32(p + 8);
+    est->cfg.reject_max = get_u32(p + 12);
+    est->cfg.f_min = get_f32(p + 16);
+    est->cfg.f_max = get_f32(p + 20);
+    est->cfg.max_gap_us = (int64_t)get_u64(p + 24);
+    p += 32;
+
+    est->started = (p[0] != 0);
+    est->freq = get_f32(p + 1);
+    est->rocof = get_f32(p + 5);
+    est->p00 = get_f32(p + 9);
+    est->p01 = get_f32(p + 13);
+    est->p11 = get_f32(p + 17);
+    est->time_us = (int64_t)get_u64(p + 21);
+    est->rejected = get_u32(p + 29);
+    est->rejected_freq = get_f32(p + 33);
+    est->rejected_time_us = (int64_t)get_u64(p + 37);
+    est->outliers = get_u32(p + 45);
+}
+
+/**
+ * @brief Initialise the trace encoder
+ * @param w Encoder state
+ * @param calc Live calculation state (snapshotted at the start of every chunk)
+ * @param est Live estimator state (snapshotted at the start of every chunk)
+ * @param device_id Device ID written to every chunk
+ * @param capture_id Capture ID written to every chunk
+ * @param flush Consumer of completed chunks
+ * @param ctx Argument passed to flush
+ */
+void f_trace_writer_init(f_trace_writer_t *w, const f_calc_t *calc, const f_estimator_t *est, uint32_t device_id, uint32_t capture_id,
+                         f_trace_flush_t flush, void *ctx) {
+    w->calc = calc;
+    w->est = est;
+    w->flush = flush;
+    w->ctx = ctx;
+    w->hdr.device_id = device_id;
+    w->hdr.capture_id = capture_id;
+    w->hdr.seq = 0;
+    w->hdr.payload_len = 0;
+    w->len = 0;
+}
+
+/**
+ * @brief Complete the open chunk (if any) and hand it over to the consumer
+ * @param w Encoder state
+ */
+void f_trace_writer_flush(f_trace_writer_t *w) {
+    if (w->len == 0) {
+        return;
+    }
+
+    uint8_t *p = w->buf;
+    w->hdr.payload_len = (uint16_t)(w->len - F_TRACE_HEADER_SIZE);
+    p = put_u32(p, F_TRACE_MAGIC);
+    *p++ = F_TRACE_VERSION;
+    *p++ = 0;  // Reserved
+    *p++ = (uint8_t)(w->hdr.payload_len);
+    *p++ = (uint8_t)(w->hdr.payload_len >> 8);
+    p = put_u32(p, w->hdr.device_id);
+    p = put_u32(p, w->hdr.capture_id);
+    p = put_u32(p, w->hdr.seq);
+    uint32_t crc = f_trace_crc32(0, w->buf, F_TRACE_HEADER_SIZE - 4);
+    put_u32(p, f_trace_crc32(crc, &w->buf[F_TRACE_HEADER_SIZE], w->hdr.payload_len));
+
+    w->flush(w->buf, w->len, w->ctx);
+    w->hdr.seq++;
+    w->len = 0;
+}
+
+/**
+ * @brief Append a state snapshot record
+ */
+static void f_trace_put_state_record(f_trace_writer_t *w, uint8_t flags) {
+    w->buf[w->len++] = F_TRACE_REC_STATE | flags;
+    put_state(&w->buf[w->len], w->calc, w->est);
+    w->len += F_TRACE_STATE_SIZE;
+}
+
+/**
+ * @brief Make room for a record, completing the open chunk and opening a new one if needed
+ * @param w Encoder state
+ * @param size Max size of the records about to be written
+ */
+static void f_trace_reserve(f_trace_writer_t *w, size_t size) {
+    if ((w->len != 0) && ((w->len + size) > F_TRACE_CHUNK_MAX)) {
+        f_trace_writer_flush(w);
+    }
+    if (w->len == 0) {  // New chunk: restart the delta coding from a state snapshot
+        w->len = F_TRACE_HEADER_SIZE;
+        w->last_tick = 0;
+        w->last_anchor.tick = 0;
+        w->last_anchor.utc_us = 0;
+        f_trace_put_state_record(w, F_TRACE_STATE_SYNC);
+    }
+}
+
+/**
+ * @brief Record a zero-crossing and the anchor it is processed with (call before f_calc_edge)
+ * @param w Encoder state
+ * @param tick Timer count of the zero-crossing
+ * @param anchor Timer/UTC anchor passed to f_calc_edge
+ */
+void f_trace_write_edge(f_trace_writer_t *w, uint64_t tick, const f_calc_anchor_t *anchor) {
+    f_trace_reserve(w, F_TRACE_GROUP_MAX);  // Keeps the anchor, edge and output of one zero-crossing in one chunk
+    uint8_t *p = &w->buf[w->len];
+
+    if ((w->last_anchor.tick == 0) && (w->last_anchor.utc_us == 0)) {  // First anchor of the chunk
+        *p++ = F_TRACE_REC_ANCHOR | F_TRACE_ANCHOR_ABS;
+        p = put_varint(p, anchor->tick);
+        p = put_zigzag(p, anchor->utc_us);
+    } else {  // Anchor drift is small, code the residual of the prediction from the previous anchor
+        int64_t predicted_us = f_calc_tick_to_utc_ns(anchor->tick, &w->last_anchor, w->calc->timer_hz) / 1000;
+        *p++ = F_TRACE_REC_ANCHOR;
+        p = put_zigzag(p, (int64_t)(anchor->tick - w->last_anchor.tick));
+        p = put_zigzag(p, anchor->utc_us - predicted_us);
+    }
+    w->last_anchor = *anchor;
+
+    *p++ = F_TRACE_REC_EDGE;
+    p = put_varint(p, tick - w->last_tick);
+    w->last_tick = tick;
+
+    w->len = (size_t)(p - w->buf);
+}
+
+/**
+ * @brief Record the device output for the window closed by the last edge (room was reserved by f_trace_write_edge)
+ * @param w Encoder state
+ * @param calc_out Calculation output
+ * @param est_out Estimator output
+ */
+void f_trace_write_output(f_trace_writer_t *w, const f_calc_out_t *calc_out, const f_est_out_t *est_out) {
+    if (w->len == 0) {  // Edge not traced
+        return;
+    }
+
+    uint8_t *p = &w->buf[w->len];
+    *p++ = (uint8_t)(F_TRACE_REC_OUTPUT | ((est_out->status & 0x0F) << 4));
+    p = put_f32(p, est_out->freq);
+    p = put_f32(p, est_out->rocof);
+    p = put_f32(p, est_out->freq_var);
+    p = put_f32(p, est_out->rocof_var);
+    p = put_f32(p, calc_out->phase);
+    w->len = (size_t)(p - w->buf);
+}
+
+/**
+ * @brief Record the current calculation/estimator state, e.g. after the device re-initialised it
+ * @param w Encoder state
+ * @param flags F_TRACE_STATE_RESET
+ */
+void f_trace_write_state(f_trace_writer_t *w, uint8_t flags) {
+    f_trace_reserve(w, 1 + F_TRACE_STATE_SIZE);
+    f_trace_put_state_record(w, flags);
+}
+
+/**
+ * @brief Record an event marker
+ * @param w Encoder state
+ * @param event F_TRACE_EVENT_* code
+ * @param arg Event argument
+ */
+void f_trace_write_event(f_trace_writer_t *w, uint8_t event, uint32_t arg) {
+    f_trace_reserve(w, F_TRACE_EVENT_MAX);
+    uint8_t *p = &w->buf[w->len];
+    *p++ = F_TRACE_REC_EVENT;
+    *p++ = event;
+    p = put_varint(p, arg);
+    w->len = (size_t)(p - w->buf);
+}
+
+/**
+ * @brief Find the next valid chunk (magic, version, length and CRC) in a byte stream, e.g. a flash dump or a capture file
+ * @param buf Data
+ * @param len Length of the data
+ * @param hdr Header of the chunk found
+ * @param chunk_len Total length of the chunk found
+ * @return Offset of the chunk, len if there is none
+ */
+size_t f_trace_find_chunk(const uint8_t *buf, size_t len, f_trace_chunk_hdr_t *hdr, size_t *chunk_len) {
+    for (size_t off = 0; (off + F_TRACE_HEADER_SIZE) <= len; off++) {
+        const uint8_t *p = &buf[off];
+        if ((get_u32(p) != F_TRACE_MAGIC) || (p[4] != F_TRACE_VERSION)) {
+            continue;
+        }
+
+        uint16_t payload_len = (uint16_t)(p[6] | (p[7] << 8));
+        size_t total = F_TRACE_HEADER_SIZE + payload_len;
+        if ((total > F_TRACE_CHUNK_MAX) || ((off + total) > len)) {
+            continue;
+        }
+
+        uint32_t crc = f_trace_crc32(0, p, F_TRACE_HEADER_SIZE - 4);
+        if (f_trace_crc32(crc, p + F_TRACE_HEADER_SIZE, payload_len) != get_u32(p + 20)) {
+            continue;
+        }
+
+        hdr->payload_len = payload_len;
+        hdr->device_id = get_u32(p + 8);
+        hdr->capture_id = get_u32(p + 12);
+        hdr->seq = get_u32(p + 16);
+        *chunk_len = total;
+        return off;
+    }
+
+    return len;
+}
+
+/**
+ * @brief Start decoding the records of a chunk
+ * @param r Decoder state
+ * @param chunk Chunk (as located by f_trace_find_chunk)
+ * @param hdr Chunk header
+ */
+void f_trace_reader_init(f_trace_reader_t *r, const uint8_t *chunk, const f_trace_chunk_hdr_t *hdr) {
+    r->p = chunk + F_TRACE_HEADER_SIZE;
+    r->end = r->p + hdr->payload_len;
+    r->timer_hz = 0;
+    r->last_tick = 0;
+    r->last_anchor.tick = 0;
+    r->last_anchor.utc_us = 0;
+}
+
+/**
+ * @brief Decode the next record of the chunk
+ * @param r Decoder state
+ * @param rec Decoded record
+ * @return 1 if a record was decoded, 0 at the end of the chunk, -1 if the chunk is malformed
+ */
+int f_trace_read_record(f_trace_reader_t *r, f_trace_record_t *rec) {
+    if (r->p >= r->end) {
+        return 0;
+    }
+
+    const uint8_t *p = r->p;
+    uint8_t tag = *p++;
+    rec->type = (f_trace_rec_type_t)(tag & 0x0F);
+    rec->flags = tag & 0xF0;
+
+    switch (rec->type) {
+        case F_TRACE_REC_STATE:
+            if ((r->end - p) < F_TRACE_STATE_SIZE) {
+                return -1;
+            }
+            get_state(p, &rec->calc, &rec->est);
+            r->timer_hz = rec->calc.timer_hz;
+            p += F_TRACE_STATE_SIZE;
+            break;
+
+        case F_TRACE_REC_ANCHOR:
+            if (rec->flags & F_TRACE_ANCHOR_ABS) {
+                uint64_t tick;
+                p = get_varint(p, r->end, &tick);
+                rec->anchor.tick = tick;
+                p = (p != NULL) ? get_zigzag(p, r->end, &rec->anchor.utc_us) : NULL;
+            } else {
+                int64_t dtick, residual_us;
+                p = get_zigzag(p, r->end, &dtick);
+                p = (p != NULL) ? get_zigzag(p, r->end, &residual_us) : NULL;
+                if ((p == NULL) || (r->timer_hz == 0)) {
+                    return -1;
+                }
+                rec->anchor.tick = r->last_anchor.tick + (uint64_t)dtick;
+                rec->anchor.utc_us = (f_calc_tick_to_utc_ns(rec->anchor.tick, &r->last_anchor, r->timer_hz) / 1000) + residual_us;
+            }
+            r->last_anchor = rec->anchor;
+            break;
+
+        case F_TRACE_REC_EDGE: {
+            uint64_t dtick;
+            p = get_varint(p, r->end, &dtick);
+            rec->tick = r->last_tick + dtick;
+            r->last_tick = rec->tick;
+            break;
+        }
+
+        case F_TRACE_REC_OUTPUT:
+            if ((r->end - p) < 20) {
+                return -1;
+            }
+            rec->out.status = (f_est_status_t)(tag >> 4);
+            rec->out.freq = get_f32(p);
+            rec->out.rocof = get_f32(p + 4);
+            rec->out.freq_var = get_f32(p + 8);
+            rec->out.rocof_var = get_f32(p + 12);
+            rec->phase = get_f32(p + 16);
+            p += 20;
+            break;
+
+        case F_TRACE_REC_EVENT: {
+            uint64_t arg;
+            if (p >= r->end) {
+                return -1;
+            }
+            rec->event = *p++;
+            p = get_varint(p, r->end, &arg);
+            rec->arg = (uint32_t)arg;
+            break;
+        }
+
+        default:
+            return -1;
+    }
+
+    if (p == NULL) {
+        return -1;
+    }
+    r->p = p;
+    return 1;
+}
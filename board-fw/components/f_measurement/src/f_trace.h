@@ -0,0 +1,108 @@
+/**
+ * @file    f_trace.h
+ * @brief   Raw edge trace format: zero-crossing timer stamps, timer/UTC anchors, outputs and event markers (no ESP-IDF dependencies)
+ * @note    A trace is a sequence of self-contained chunks (header + records + CRC-32), all fields little-endian; shared with host replay
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "f_calc.h"
+#include "f_estimator.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define F_TRACE_MAGIC 0x52545A48u   // "HZTR"
+#define F_TRACE_VERSION 1           // Format version
+#define F_TRACE_HEADER_SIZE 24      // Size of the chunk header
+#define F_TRACE_CHUNK_MAX 2048      // Max chunk size (header + records)
+#define F_TRACE_STATE_SIZE 121      // Size of an encoded calculation/estimator state snapshot
+#define F_TRACE_GROUP_MAX 64        // Max size of the records written for one zero-crossing (anchor, edge, output)
+
+typedef enum {                // Record types (low nibble of the record tag)
+    F_TRACE_REC_STATE = 1,    // Snapshot of f_calc_t and f_estimator_t
+    F_TRACE_REC_ANCHOR = 2,   // Timer/UTC anchor used for the next edge
+    F_TRACE_REC_EDGE = 3,     // Zero-crossing timer stamp (processed with the last anchor)
+    F_TRACE_REC_OUTPUT = 4,   // Device output for the window closed by the last edge
+    F_TRACE_REC_EVENT = 5,    // Event marker
+} f_trace_rec_type_t;
+
+typedef enum {                     // Event marker codes
+    F_TRACE_EVENT_START = 1,       // Capture started (arg: destination)
+    F_TRACE_EVENT_STOP = 2,        // Capture stopped (arg: chunks dropped during the capture)
+    F_TRACE_EVENT_EDGE_DROP = 3,   // Zero-crossings lost before processing, e.g. edge queue full (arg: total since boot)
+    F_TRACE_EVENT_RELOAD = 4,      // Window length changed, calculation restarted (arg: pulses per measurement)
+    F_TRACE_EVENT_CHUNK_DROP = 5,  // Chunks dropped by the capture (arg: total dropped)
+    F_TRACE_EVENT_FLASH_FULL = 6,  // Capture stopped early, the trace partition is full (arg: chunks written)
+    F_TRACE_EVENT_TIME_STEP = 7,   // SNTP stepped the system time, UTC anchors jump (arg: step in us as int32_t)
+    F_TRACE_EVENT_USER = 16,       // User marker (arg: user value)
+} f_trace_event_t;
+
+#define F_TRACE_STATE_SYNC 0x10   // State record flag: snapshot opening a chunk (matches the replayed state)
+#define F_TRACE_STATE_RESET 0x20  // State record flag: calculation/estimator re-initialised by the device
+
+typedef struct f_trace_chunk_hdr {  // Chunk header
+    uint32_t device_id;             // Device ID
+    uint32_t capture_id;            // Capture ID, identical for every chunk of one capture
+    uint32_t seq;                   // Chunk sequence number within the capture
+    uint16_t payload_len;           // Length of the records following the header
+} f_trace_chunk_hdr_t;
+
+typedef struct f_trace_record {  // Decoded record
+    f_trace_rec_type_t type;     // Record type
+    uint8_t flags;               // Type-specific flags (high nibble of the tag)
+    f_calc_t calc;               // F_TRACE_REC_STATE
+    f_estimator_t est;           // F_TRACE_REC_STATE
+    f_calc_anchor_t anchor;      // F_TRACE_REC_ANCHOR
+    uint64_t tick;               // F_TRACE_REC_EDGE
+    f_est_out_t out;             // F_TRACE_REC_OUTPUT (freq, rocof, variances and status)
+    float phase;                 // F_TRACE_REC_OUTPUT
+    uint8_t event;               // F_TRACE_REC_EVENT
+    uint32_t arg;                // F_TRACE_REC_EVENT
+} f_trace_record_t;
+
+typedef void (*f_trace_flush_t)(const uint8_t *chunk, size_t len, void *ctx);  // Called with every completed chunk
+
+typedef struct f_trace_writer {  // Trace encoder state
+    const f_calc_t *calc;        // Live calculation state, snapshotted at the start of every chunk
+    const f_estimator_t *est;    // Live estimator state
+    f_trace_flush_t flush;       // Chunk consumer
+    void *ctx;                   // Argument of flush
+    f_trace_chunk_hdr_t hdr;     // Header of the chunk being filled
+    uint8_t buf[F_TRACE_CHUNK_MAX];
+    size_t len;                  // Bytes used in buf (0 when no chunk is open)
+    uint64_t last_tick;          // Delta reference of edge records
+    f_calc_anchor_t last_anchor; // Delta reference of anchor records
+} f_trace_writer_t;
+
+typedef struct f_trace_reader {  // Record decoder state for one chunk
+    const uint8_t *p;            // Next record
+    const uint8_t *end;          // End of the chunk payload
+    uint32_t timer_hz;           // Timer frequency from the last state record (anchor prediction)
+    uint64_t last_tick;          // Delta reference of edge records
+    f_calc_anchor_t last_anchor; // Delta reference of anchor records
+} f_trace_reader_t;
+
+uint32_t f_trace_crc32(uint32_t crc, const uint8_t *data, size_t len);
+
+void f_trace_writer_init(f_trace_writer_t *w, const f_calc_t *calc, const f_estimator_t *est, uint32_t device_id, uint32_t capture_id,
+                         f_trace_flush_t flush, void *ctx);
+void f_trace_write_edge(f_trace_writer_t *w, uint64_t tick, const f_calc_anchor_t *anchor);
+void f_trace_write_output(f_trace_writer_t *w, const f_calc_out_t *calc_out, const f_est_out_t *est_out);
+void f_trace_write_state(f_trace_writer_t *w, uint8_t flags);
+void f_trace_write_event(f_trace_writer_t *w, uint8_t event, uint32_t arg);
+void f_trace_writer_flush(f_trace_writer_t *w);
+
+size_t f_trace_find_chunk(const uint8_t *buf, size_t len, f_trace_chunk_hdr_t *hdr, size_t *chunk_len);
+void f_trace_reader_init(f_trace_reader_t *r, const uint8_t *chunk, const f_trace_chunk_hdr_t *hdr);
+int f_trace_read_record(f_trace_reader_t *r, f_trace_record_t *rec);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,322 @@
+/**
+ * @file    trace_capture.c
+ * @brief   On-demand capture of raw edge traces (f_trace format) to the trace flash partition or over the uplink
+ * @note    The measurement task only encodes records into RAM; flash writes and publishing run in a separate low-priority task
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#include "trace_capture.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dlog.h"
+
+#define TAG "trace_capture"
+
+#define TRACE_FLASH_RESERVE ((TRACE_CHUNK_QUEUE_LEN + 2) * F_TRACE_CHUNK_MAX)  // Kept free for the chunks still in flight when the capture is stopped
+
+typedef enum { TRACE_CMD_START, TRACE_CMD_STOP, TRACE_CMD_MARK } trace_cmd_type_t;
+
+typedef struct trace_cmd {  // Request passed from the uplink to the measurement task
+    trace_cmd_type_t type;  // Request type
+    trace_dest_t dest;      // TRACE_CMD_START: destination
+    uint32_t seconds;       // TRACE_CMD_START: capture duration
+    uint32_t arg;           // TRACE_CMD_MARK: user marker value
+    trace_publish_t publish;
+} trace_cmd_t;
+
+typedef struct trace_chunk {  // Completed chunk passed from the measurement task to the capture task
+    trace_dest_t dest;        // Destination
+    trace_publish_t publish;  // Uplink publisher (TRACE_DEST_UPLINK)
+    bool first;               // First chunk of a capture (restarts the flash log)
+    uint32_t capture_id;      // Capture the chunk belongs to
+    uint16_t len;             // Chunk length
+    uint8_t data[F_TRACE_CHUNK_MAX];
+} trace_chunk_t;
+
+static xQueueHandle trace_cmd_queue = NULL;    // Queue of capture requests
+static xQueueHandle trace_chunk_queue = NULL;  // Queue of completed chunks
+static const esp_partition_t *trace_partition = NULL;
+static uint32_t trace_device_id = 0;     // Device ID written to every chunk (lower 4 bytes of the MAC address)
+static volatile uint32_t flash_full_id;  // Capture that filled the trace partition (set by the capture task)
+
+/* Capture state, owned by the measurement task */
+static f_trace_writer_t writer;       // Trace encoder
+static bool active = false;           // Capture running
+static trace_dest_t active_dest;      // Destination of the running capture
+static trace_publish_t active_publish;
+static int64_t stop_at_us;            // Time (esp_timer) at which the capture ends
+static bool first_chunk;              // Next chunk is the first one of the capture
+static uint32_t chunks_dropped;       // Chunks lost because the capture task fell behind
+static uint32_t chunks_dropped_seen;  // Value of chunks_dropped last recorded as an event
+
+/**
+ * @brief Chunk consumer of the encoder: hand the chunk over to the capture task (never blocks)
+ */
+static void trace_capture_flush(const uint8_t *chunk, size_t len, void *ctx) {
+    static trace_chunk_t staging;  // Kept off the measurement task stack, copied by the queue
+
+    staging.dest = active_dest;
+    staging.publish = active_publish;
+    staging.first = first_chunk;
+    staging.capture_id = writer.hdr.capture_id;
+    staging.len = (uint16_t)len;
+    memcpy(staging.data, chunk, len);
+
+    if (xQueueSend(trace_chunk_queue, &staging, (TickType_t)0) == pdTRUE) {
+        first_chunk = false;
+    } else {
+        chunks_dropped++;  // Recorded as an event in the next chunk, the sequence gap shows the loss as well
+    }
+}
+
+/**
+ * @brief Stop the running capture and flush the last chunk
+ */
+static void trace_capture_stop() {
+    f_trace_write_event(&writer, F_TRACE_EVENT_STOP, chunks_dropped);
+    f_trace_writer_flush(&writer);
+    active = false;
+    DLOGI(TAG, "Capture stopped (chunks: %u, dropped: %u)", writer.hdr.seq, chunks_dropped);
+}
+
+/**
+ * @brief Apply pending capture requests and end the capture once its duration has elapsed (measurement task)
+ * @param calc Live calculation state
+ * @param est Live estimator state
+ */
+void trace_capture_poll(const f_calc_t *calc, const f_estimator_t *est) {
+    trace_cmd_t cmd;
+
+    while (xQueueReceive(trace_cmd_queue, &cmd, (TickType_t)0) == pdTRUE) {
+        if ((cmd.type == TRACE_CMD_START) || (cmd.type == TRACE_CMD_STOP)) {
+            if (active) {
+                trace_capture_stop();
+            }
+        }
+
+        if (cmd.type == TRACE_CMD_START) {
+            f_trace_writer_init(&writer, calc, est, trace_device_id, esp_random(), trace_capture_flush, NULL);
+            active = true;
+            active_dest = cmd.dest;
+            active_publish = cmd.publish;
+            stop_at_us = esp_timer_get_time() + ((int64_t)cmd.seconds * 1000000);
+            first_chunk = true;
+            chunks_dropped = 0;
+            chunks_dropped_seen = 0;
+            f_trace_write_event(&writer, F_TRACE_EVENT_START, cmd.dest);
+            DLOGI(TAG, "Capture %08x started (destination: %d, %u s)", writer.hdr.capture_id, cmd.dest, cmd.seconds);
+        } else if ((cmd.type == TRACE_CMD_MARK) && active) {
+            f_trace_write_event(&writer, F_TRACE_EVENT_USER, cmd.arg);
+        }
+    }
+
+    if (active && (esp_timer_get_time() >= stop_at_us)) {
+        trace_capture_stop();
+    }
+    if (active && (active_dest == TRACE_DEST_FLASH) && (flash_full_id == writer.hdr.capture_id)) {  // Stop while the reserve holds the rest
+        f_trace_write_event(&writer, F_TRACE_EVENT_FLASH_FULL, writer.hdr.seq);
+        DLOGW(TAG, "Trace partition full, capture %08x stopped early", writer.hdr.capture_id);
+        trace_capture_stop();
+    }
+    if (active && (chunks_dropped != chunks_dropped_seen)) {
+        chunks_dropped_seen = chunks_dropped;
+        f_trace_write_event(&writer, F_TRACE_EVENT_CHUNK_DROP, chunks_dropped);
+    }
+}
+
+/**
+ * @brief Record a zero-crossing and its anchor, call before f_calc_edge (measurement task)
+ */
+void trace_capture_edge(uint64_t tick, const f_calc_anchor_t *anchor) {
+    if (active) {
+        f_trace_write_edge(&writer, tick, anchor);
+    }
+}
+
+/**
+ * @brief Record the output of the window closed by the last edge (measurement task)
+ */
+void trace_capture_output(const f_calc_out_t *calc_out, const f_est_out_t *est_out) {
+    if (active) {
+        f_trace_write_output(&writer, calc_out, est_out);
+    }
+}
+
+/**
+ * @brief Record the calculation/estimator state after the measurement task re-initialised it (measurement task)
+ */
+void trace_capture_state() {
+    if (active) {
+        f_trace_write_state(&writer, F_TRACE_STATE_RESET);
+    }
+}
+
+/**
+ * @brief Record an event marker (measurement task)
+ * @param event F_TRACE_EVENT_* code
+ * @param arg Event argument
+ */
+void trace_capture_event(uint8_t event, uint32_t arg) {
+    if (active) {
+        f_trace_write_event(&writer, event, arg);
+    }
+}
+
+/**
+ * @brief Append a chunk to the trace partition, erasing sectors ahead of the write position
+ * @note Once the write position enters the reserve at the end of the partition, the measurement task is asked to stop the capture
+ * @param chunk Chunk
+ * @return Error code
+ */
+static esp_err_t trace_capture_write_flash(const trace_chunk_t *chunk) {
+    static size_t offset = 0;  // Write position in the partition
+    static size_t erased = 0;  // End of the erased area
+
+    if (chunk->first) {  // Every capture starts at the beginning of the partition
+        offset = 0;
+        erased = 0;
+    }
+    if ((offset + chunk->len) > (trace_partition->size - TRACE_FLASH_RESERVE)) {
+        flash_full_id = chunk->capture_id;
+    }
+    ESP_RETURN_ON_FALSE((offset + chunk->len) <= trace_partition->size, ESP_ERR_NO_MEM, TAG, "Trace partition full");
+
+    while ((offset + chunk->len) > erased) {
+        ESP_RETURN_ON_ERROR(esp_partition_erase_range(trace_partition, erased, SPI_FLASH_SEC_SIZE), TAG, "Failed to erase the trace partition");
+        erased += SPI_FLASH_SEC_SIZE;
+    }
+    ESP_RETURN_ON_ERROR(esp_partition_write(trace_partition, offset, chunk->data, chunk->len), TAG, "Failed to write the trace partition");
+    offset += chunk->len;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Capture task writing completed chunks to flash or publishing them over the uplink
+ */
+static void trace_capture_task(void *param) {
+    static trace_chunk_t chunk;
+
+    while (true) {
+        if (xQueueReceive(trace_chunk_queue, &chunk, portMAX_DELAY) == pdTRUE) {
+            if (chunk.dest == TRACE_DEST_FLASH) {
+                trace_capture_write_flash(&chunk);
+            } else if (chunk.publish != NULL) {
+                chunk.publish(chunk.data, chunk.len);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Parse a decimal request value, as config_store_set_field() does
+ * @param value Value text
+ * @param out Parsed value (written only if true is returned)
+ * @return False if the value is empty, has trailing characters or does not fit 32 bits
+ */
+static bool trace_capture_parse_u32(const char *value, uint32_t *out) {
+    char *end = NULL;
+    unsigned long val = strtoul(value, &end, 10);
+    if ((*value == '\0') || (*end != '\0') || (val > UINT32_MAX)) {
+        return false;
+    }
+    *out = (uint32_t)val;
+    return true;
+}
+
+/**
+ * @brief Handle a capture request ("dest=uplink|flash&seconds=N", "stop" or "mark=N")
+ * @param cmd Request text (does not need to be terminated)
+ * @param len Length of the request text
+ * @param publish Publisher used for TRACE_DEST_UPLINK captures
+ * @param ack Buffer for the acknowledgement message
+ * @param ack_len Size of the acknowledgement buffer
+ * @return Error code
+ */
+esp_err_t trace_capture_command(const char *cmd, size_t len, trace_publish_t publish, char *ack, size_t ack_len) {
+    char text[TRACE_CMD_MAX];
+    if (len >= sizeof(text)) {
+        snprintf(ack, ack_len, "result=error&reason=too_long");
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(text, cmd, len);
+    text[len] = '\0';
+
+    trace_cmd_t req = {.type = TRACE_CMD_START, .dest = TRACE_DEST_UPLINK, .seconds = TRACE_SECONDS_DEFAULT, .arg = 0, .publish = publish};
+    char *save_ptr = NULL;
+
+    for (char *pair = strtok_r(text, "&\r\n", &save_ptr); pair != NULL; pair = strtok_r(NULL, "&\r\n", &save_ptr)) {
+        char *value = strchr(pair, '=');
+        if (value != NULL) {
+            *value++ = '\0';  // Split the pair into key and value
+        }
+
+        bool valid = true;
+        if (strcmp(pair, "stop") == 0) {
+            req.type = TRACE_CMD_STOP;
+        } else if ((strcmp(pair, "mark") == 0) && (value != NULL)) {
+            req.type = TRACE_CMD_MARK;
+            valid = trace_capture_parse_u32(value, &req.arg);
+        } else if ((strcmp(pair, "seconds") == 0) && (value != NULL)) {
+            valid = trace_capture_parse_u32(value, &req.seconds) && (req.seconds > 0) && (req.seconds <= TRACE_SECONDS_MAX);
+        } else if ((strcmp(pair, "dest") == 0) && (value != NULL) && (strcmp(value, "uplink") == 0)) {
+            req.dest = TRACE_DEST_UPLINK;
+        } else if ((strcmp(pair, "dest") == 0) && (value != NULL) && (strcmp(value, "flash") == 0)) {
+            req.dest = TRACE_DEST_FLASH;
+            valid = (trace_partition != NULL);
+        } else {
+            valid = false;
+        }
+
+        if (valid == false) {
+            snprintf(ack, ack_len, "result=error&key=%.32s", pair);
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    if ((req.type == TRACE_CMD_START) && (req.dest == TRACE_DEST_FLASH)) {  // Keys come in any order, check once the destination is known
+        uint32_t max_seconds = (trace_partition->size - TRACE_FLASH_RESERVE) / TRACE_FLASH_BYTES_PER_S;
+        if (req.seconds > max_seconds) {
+            snprintf(ack, ack_len, "result=error&key=seconds&reason=partition&max=%u", max_seconds);
+            return ESP_ERR_INVALID_SIZE;
+        }
+    }
+
+    if (xQueueSend(trace_cmd_queue, &req, (TickType_t)0) != pdTRUE) {
+        snprintf(ack, ack_len, "result=error&reason=busy");
+        return ESP_FAIL;
+    }
+
+    if (req.type == TRACE_CMD_START) {
+        snprintf(ack, ack_len, "result=ok&capture=start&dest=%s&seconds=%u", (req.dest == TRACE_DEST_FLASH) ? "flash" : "uplink", req.seconds);
+    } else {
+        snprintf(ack, ack_len, "result=ok&capture=%s", (req.type == TRACE_CMD_STOP) ? "stop" : "mark");
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Initialise trace capture: queues, capture task and the (optional) trace partition
+ * @return Error code
+ */
+esp_err_t trace_capture_init() {
+    uint8_t mac[6];
+    ESP_RETURN_ON_ERROR(esp_efuse_mac_get_default(mac), TAG, "Failed to read the MAC address");
+    trace_device_id = ((uint32_t)mac[2] << 24) | ((uint32_t)mac[3] << 16) | ((uint32_t)mac[4] << 8) | (uint32_t)mac[5];
+
+    trace_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, TRACE_PARTITION_SUBTYPE, TRACE_PARTITION);
+    if (trace_partition == NULL) {
+        ESP_LOGW(TAG, "No trace partition, captures to flash disabled");
+    }
+
+    trace_cmd_queue = xQueueCreate(TRACE_CMD_QUEUE_LEN, sizeof(trace_cmd_t));
+    trace_chunk_queue = xQueueCreate(TRACE_CHUNK_QUEUE_LEN, sizeof(trace_chunk_t));
+    ESP_RETURN_ON_FALSE((trace_cmd_queue != NULL) && (trace_chunk_queue != NULL), ESP_ERR_NO_MEM, TAG, "Failed to create trace queues");
+
+    xTaskCreate(trace_capture_task, "trace_capture_task", 4096, NULL, TRACE_TASK_PRIO, NULL);
+    ESP_LOGI(TAG, "Trace capture initialised");
+
+    return ESP_OK;
+}
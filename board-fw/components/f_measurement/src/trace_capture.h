@@ -0,0 +1,39 @@
+/**
+ * @file    trace_capture.h
+ * @brief   On-demand capture of raw edge traces (f_trace format) to the trace flash partition or over the uplink
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config_macros.h"
+#include "esp_mac.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "f_calc.h"
+#include "f_estimator.h"
+#include "f_trace.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+typedef enum {
+    TRACE_DEST_UPLINK = 1,  // Chunks published by the uplink (e.g. MQTT)
+    TRACE_DEST_FLASH = 2,   // Chunks written to the trace partition, read back with parttool.py
+} trace_dest_t;
+
+typedef void (*trace_publish_t)(const uint8_t *chunk, size_t len);  // Uplink chunk publisher (called from the capture task)
+
+esp_err_t trace_capture_init();
+esp_err_t trace_capture_command(const char *cmd, size_t len, trace_publish_t publish, char *ack, size_t ack_len);
+
+/* Hooks called by the measurement task only */
+void trace_capture_poll(const f_calc_t *calc, const f_estimator_t *est);
+void trace_capture_edge(uint64_t tick, const f_calc_anchor_t *anchor);
+void trace_capture_output(const f_calc_out_t *calc_out, const f_est_out_t *est_out);
+void trace_capture_state();
+void trace_capture_event(uint8_t event, uint32_t arg);
@@ -6,11 +6,159 @@
 
 #include "mqtt_drv.h"
 
+#include <math.h>
+#include <stdlib.h>
+
+#include "c37118.h"
+#include "config_store.h"
+#include "dlog.h"
+#include "esp_netif.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "systime.h"
+#include "trace_capture.h"
+#include "ws2812_drv.h"
+
 #define TAG "mqtt_drv"
 
-esp_mqtt_client_handle_t client;          // MQTT Client handle
-static bool mqtt_connected_flag = false;  // Flag to indicate sucessfull connection to the MQTT broker
-static xQueueHandle mqtt_queue = NULL;    // Queu for data to be sent
+esp_mqtt_client_handle_t client;           // MQTT Client handle
+static bool mqtt_connected_flag = false;   // Flag to indicate sucessfull connection to the MQTT broker
+static bool link_up = true;                // WiFi associated with an IP (uploads are held while it is down)
+static bool ever_connected = false;        // Session has been up at least once (outages are counted from then on)
+static volatile uint32_t outage_start_ms;  // Time the link or session went down (0 while uploading), read by other tasks in one access
+static uint32_t outage_lost = 0;           // Samples dropped during the current outage (backlog full)
+static mqtt_link_stats_t link_stats;       // Upload outage statistics
+static xQueueHandle mqtt_queue = NULL;     // Queu for data to be sent (RAM backlog across outages)
+static sys_config_t burst_cfg;             // Configuration used for batching measurements into bursts
+static uint32_t burst_cfg_gen = 0;         // Generation of burst_cfg, used to detect remote updates
+static char link_note[64];                 // Outage statistics for the status field of the next burst (empty if none)
+
+#ifdef MQTT_CONTROL_PREFIX
+typedef struct mqtt_control_topics {          // Control topics of this unit, built from the runtime mqtt_id
+    char config[MQTT_CONTROL_TOPIC_MAX];      // Remote configuration updates
+    char config_ack[MQTT_CONTROL_TOPIC_MAX];  // Configuration update acknowledgements
+    char trace[MQTT_CONTROL_TOPIC_MAX];       // Raw edge trace capture requests
+    char trace_ack[MQTT_CONTROL_TOPIC_MAX];   // Trace capture acknowledgements
+    char trace_data[MQTT_CONTROL_TOPIC_MAX];  // Binary trace chunks (captures to the uplink)
+    char link[MQTT_CONTROL_TOPIC_MAX];        // Outage statistics (published when upload resumes)
+} mqtt_control_topics_t;
+
+static mqtt_control_topics_t control;  // Control topics (ThingSpeak only serves channels/<id>/..., hence local brokers only)
+#endif
+
+const uploader_backend_t mqtt_drv_backend = {.name = "mqtt", .init = mqtt_drv_init, .push = mqtt_drv_push};
+
+#ifdef MQTT_CONTROL_PREFIX
+/**
+ * @brief Test whether an MQTT event was received on a given topic
+ */
+static bool mqtt_drv_topic_is(esp_mqtt_event_handle_t event, const char *topic) {
+    return (event->topic_len == strlen(topic)) && (strncmp(event->topic, topic, event->topic_len) == 0);
+}
+
+/**
+ * @brief Apply a remote configuration update and publish the acknowledgement
+ * @param event MQTT event with the configuration update
+ */
+static void mqtt_drv_config_update(esp_mqtt_event_handle_t event) {
+    char ack[64];
+
+    if (event->data_len != event->total_data_len) {  // Updates are small, fragmented messages are not supported
+        snprintf(ack, sizeof(ack), "result=error&reason=fragmented");
+    } else {
+        config_store_apply(event->data, event->data_len, ack, sizeof(ack));
+    }
+
+    esp_mqtt_client_publish(client, control.config_ack, ack, 0, 1, 0);
+}
+
+/**
+ * @brief Publish a binary trace chunk (called from the trace capture task)
+ * @param chunk Chunk
+ * @param len Chunk length
+ */
+static void mqtt_drv_publish_trace(const uint8_t *chunk, size_t len) {
+    esp_mqtt_client_publish(client, control.trace_data, (const char *)chunk, len, 1, 0);
+}
+
+/**
+ * @brief Handle a trace capture request and publish the acknowledgement
+ * @param event MQTT event with the capture request
+ */
+static void mqtt_drv_trace_request(esp_mqtt_event_handle_t event) {
+    char ack[64];
+
+    if (event->data_len != event->total_data_len) {
+        snprintf(ack, sizeof(ack), "result=error&reason=fragmented");
+    } else {
+        trace_capture_command(event->data, event->data_len, mqtt_drv_publish_trace, ack, sizeof(ack));
+    }
+
+    esp_mqtt_client_publish(client, control.trace_ack, ack, 0, 1, 0);
+}
+#endif
+
+/**
+ * @brief Time since boot in ms, never 0 (reserved for "no outage"), wraps after 49 days (only differences are used)
+ */
+static uint32_t mqtt_drv_now_ms() {
+    uint32_t ms = (uint32_t)(esp_timer_get_time() / 1000);
+    return (ms != 0) ? ms : 1;
+}
+
+/**
+ * @brief Record the start of an outage (WiFi link or MQTT session lost)
+ */
+static void mqtt_drv_outage_start() {
+    if (ever_connected && (outage_start_ms == 0)) {
+        outage_lost = 0;
+        outage_start_ms = mqtt_drv_now_ms();
+    }
+}
+
+/**
+ * @brief Upload resumed after an outage: update the outage statistics and report them in the status field of the next burst
+ * @note The status field is accepted by any broker, the full statistics also go to the link control topic on local brokers
+ */
+static void mqtt_drv_outage_end() {
+    uint32_t resume_ms = mqtt_drv_now_ms() - outage_start_ms;
+    outage_start_ms = 0;
+
+    link_stats.outages++;
+    link_stats.last_resume_ms = resume_ms;
+    link_stats.total_resume_ms += resume_ms;
+    link_stats.last_samples_lost = outage_lost;
+    link_stats.samples_lost += outage_lost;
+
+    uint32_t mean_resume_ms = (uint32_t)(link_stats.total_resume_ms / link_stats.outages);
+    uint32_t backlog = uxQueueMessagesWaiting(mqtt_queue);
+    DLOGW(TAG, "Upload resumed after %u ms, %u samples lost, %u bursts to backfill (outages: %u, mean resume: %u ms, lost: %u)", resume_ms,
+          outage_lost, backlog, link_stats.outages, mean_resume_ms, link_stats.samples_lost);
+
+    snprintf(link_note, sizeof(link_note), ", Outage: %u ms, Lost: %u, Outages: %u", resume_ms, outage_lost, link_stats.outages);
+
+#ifdef MQTT_CONTROL_PREFIX
+    char msg[128];
+    snprintf(msg, sizeof(msg), "outages=%u&resume_ms=%u&lost=%u&backlog=%u&mean_resume_ms=%u&mean_lost=%u", link_stats.outages, resume_ms,
+             outage_lost, backlog, mean_resume_ms, (link_stats.samples_lost / link_stats.outages));
+    esp_mqtt_client_publish(client, control.link, msg, 0, 1, 0);
+#endif
+}
+
+/**
+ * @brief WiFi and IP events handler: hold uploads while the link is down, resume the session as soon as the IP is back
+ */
+static void mqtt_drv_link_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data) {
+    if ((event_base == IP_EVENT) && (event_id == IP_EVENT_STA_GOT_IP)) {
+        link_up = true;
+        if (mqtt_connected_flag == false) {
+            esp_mqtt_client_reconnect(client);  // Skip the rest of the reconnect timeout
+        }
+    } else {  // WIFI_EVENT_STA_DISCONNECTED or IP_EVENT_STA_LOST_IP
+        link_up = false;
+        mqtt_drv_outage_start();
+    }
+}
 
 /**
  * @brief Event handler registered to receive MQTT events. This function is called by the MQTT client event loop.
@@ -20,33 +168,48 @@ static xQueueHandle mqtt_queue = NULL;    // Queu for data to be sent
  * @param event_data The data for the event, esp_mqtt_event_handle_t
  */
 static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data) {
-    ESP_LOGD(TAG, "Event dispatched from event loop base=%s, event_id=%d", base, event_id);
+    DLOGD(TAG, "Event dispatched from event loop base=%s, event_id=%d", base, event_id);
     esp_mqtt_event_handle_t event = event_data;
     switch ((esp_mqtt_event_id_t)event_id) {
         case MQTT_EVENT_CONNECTED:
-            ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
+            DLOGI(TAG, "MQTT_EVENT_CONNECTED");
             mqtt_connected_flag = true;
+            ever_connected = true;
+#ifdef MQTT_CONTROL_PREFIX
+            esp_mqtt_client_subscribe(client, control.config, 1);  // Subscribe to remote configuration updates
+            esp_mqtt_client_subscribe(client, control.trace, 1);   // Subscribe to trace capture requests
+#endif
             break;
         case MQTT_EVENT_DISCONNECTED:
-            ESP_LOGW(TAG, "MQTT_EVENT_DISCONNECTED");
+            DLOGW(TAG, "MQTT_EVENT_DISCONNECTED");
             mqtt_connected_flag = false;
+            mqtt_drv_outage_start();
             break;
         case MQTT_EVENT_PUBLISHED:
-            ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+            DLOGI(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
             break;
         case MQTT_EVENT_DATA:
-            ESP_LOGI(TAG, "MQTT_EVENT_DATA");
+            DLOGI(TAG, "MQTT_EVENT_DATA");
+#ifdef MQTT_CONTROL_PREFIX
+            if (mqtt_drv_topic_is(event, control.config)) {
+                mqtt_drv_config_update(event);
+                break;
+            } else if (mqtt_drv_topic_is(event, control.trace)) {
+                mqtt_drv_trace_request(event);
+                break;
+            }
+#endif
             printf("Topic = %.*s\r\n", event->topic_len, event->topic);
             printf("Data = %.*s\r\n", event->data_len, event->data);
             break;
         case MQTT_EVENT_ERROR:
-            ESP_LOGI(TAG, "MQTT_EVENT_ERROR");
+            DLOGI(TAG, "MQTT_EVENT_ERROR");
             if (event->error_handle->error_type == MQTT_ERROR_TYPE_TCP_TRANSPORT) {
-                ESP_LOGE(TAG, "Last error string (%s)", strerror(event->error_handle->esp_transport_sock_errno));
+                DLOGE(TAG, "Last error string (%s)", strerror(event->error_handle->esp_transport_sock_errno));
             }
             break;
         default:
-            ESP_LOGI(TAG, "Other event id: %d", event->event_id);
+            DLOGI(TAG, "Other event id: %d", event->event_id);
             break;
     }
 }
@@ -59,77 +222,230 @@ bool mqtt_drv_connected() {
     return mqtt_connected_flag;
 }
 
+/**
+ * @brief Test whether uploads have been down for longer than in-place recovery is given (a restart is required)
+ * @return True if no burst has been published for MQTT_REBOOT_TIMEOUT_MS since the link or session was lost
+ */
+bool mqtt_drv_fault() {
+    uint32_t since = outage_start_ms;
+    return (since != 0) && ((mqtt_drv_now_ms() - since) > MQTT_REBOOT_TIMEOUT_MS);
+}
+
+/**
+ * @brief Get the upload outage statistics
+ * @return Statistics since boot
+ */
+mqtt_link_stats_t mqtt_drv_link_stats() {
+    return link_stats;
+}
+
 /**
  * @brief Send a new array of data structs to the MQTT que for data to be send
  * @param ready_data Structure with datapoints to be sent
  * @param data_size Size of the structure
  * @return Error code
  */
-esp_err_t mqtt_drv_queue_send(mqtt_payload_t ready_data, size_t data_size) {
-    if (xQueueSend(mqtt_queue, &ready_data, (TickType_t)0) == pdTRUE) {  // Send a new struct with an array of datapoints to the que
-        ESP_LOGD(TAG, "Data sucessfully sent to mqtt queue");
+static esp_err_t mqtt_drv_queue_send(const mqtt_payload_t *ready_data, size_t data_size) {
+    if (xQueueSend(mqtt_queue, ready_data, (TickType_t)0) == pdTRUE) {  // Send a new struct with an array of datapoints to the que
+        DLOGD(TAG, "Data sucessfully sent to mqtt queue");
         return ESP_OK;
     } else {
         return ESP_FAIL;
     }
 }
 
+#ifdef MQTT_PMU_TOPIC
+/**
+ * @brief Publish the datapoints as binary C37.118-style data frames
+ * @note Time comes from SNTP only, so frames never claim better than PMU_TIME_QUALITY, carry the time since the last SNTP update as
+ *       unlocked time and are marked unreliable around SNTP steps (phase comparisons between units need a PPS/GPS reference)
+ * @param data MQTT payload structure with an array of datapoints
+ */
+static void mqtt_drv_send_pmu(const mqtt_payload_t *data) {
+    uint8_t frames[MQTT_MEAS_PER_BURST_MAX * C37118_DATA_FRAME_SIZE];
+    size_t len = 0;
+    systime_quality_t tq = systime_quality();
+    uint16_t stat = tq.synchronised ? (C37118_STAT_TQ_UNKNOWN | c37118_stat_unlocked(tq.since_sync_s)) : C37118_STAT_NOT_SYNCED;
+
+    for (int i = 0; i < data->n; i++) {
+        bool near_step = (tq.steps > 0) && (llabs((int64_t)data->d[i].t_us - tq.last_step_utc_us) < PMU_STEP_HOLDOFF_US);
+        c37118_data_t frame = {
+            .idcode = PMU_IDCODE + data->d[i].channel,  // One data stream per channel
+            .soc = (uint32_t)(data->d[i].t_us / 1000000),
+            .fracsec = (uint32_t)(data->d[i].t_us % 1000000),
+            .time_quality = (tq.synchronised && (near_step == false)) ? PMU_TIME_QUALITY : C37118_TQ_FAULT,
+            .stat = stat,
+            .magnitude = 1.0f,  // Amplitude is not measured
+            .angle = (float)(data->d[i].phase_deg * M_PI / 180.0),
+            .freq = data->d[i].f_hz,
+            .dfreq = data->d[i].rocof};
+        len += c37118_encode(&frame, &frames[len], sizeof(frames) - len);
+    }
+
+    esp_mqtt_client_publish(client, MQTT_PMU_TOPIC, (const char *)frames, len, 0, 0);
+}
+#endif
+
 /**
- * @brief Send MQTT message with frequency, time and status update
- * @param data MQTT payload structure with an array of datapoints (f_hz and t_ms)
+ * @brief Send MQTT message with frequency, time, phase, RoCoF, frequency uncertainty, channel, phase difference and status update
+ * @param data MQTT payload structure with an array of datapoints (f_hz, rocof, f_std, phase_deg, channel, phase_diff_deg and t_us)
  * @param str_status Status of the device
+ * @return Message ID, -1 if the message could not be published
  */
-static void mqtt_drv_send(mqtt_payload_t data, const char *str_status) {
+static int mqtt_drv_send(const mqtt_payload_t *data, const char *str_status) {
     char message[MQTT_MESSAGE_SIZE] = "field1=";
+    uint64_t t_ms[MQTT_MEAS_PER_BURST_MAX];  // Timestamps in the compact format
 
-    for (int i = 0; i < MQTT_MEAS_PER_BURST; i++) {
-        data.d[i].t_ms -= 1600000000000;  // Decrement and divide ms data to facilitate more date per MQTT message
-        data.d[i].t_ms /= 100;
+    for (int i = 0; i < data->n; i++) {
+        t_ms[i] = (data->d[i].t_us / 1000) - 1600000000000;  // Decrement and divide ms data to facilitate more date per MQTT message
+        t_ms[i] /= 100;
     }
 
-    char str_frequency[MQTT_MEAS_PER_BURST][10];  // Declare two arrays of strings for frequency...
-    char str_time[MQTT_MEAS_PER_BURST][20];       // ... and time values
+    char str_frequency[MQTT_MEAS_PER_BURST_MAX][10];   // Declare arrays of strings for frequency...
+    char str_time[MQTT_MEAS_PER_BURST_MAX][20];        // ... time ...
+    char str_phase[MQTT_MEAS_PER_BURST_MAX][10];       // ... phase ...
+    char str_rocof[MQTT_MEAS_PER_BURST_MAX][10];       // ... RoCoF ...
+    char str_f_std[MQTT_MEAS_PER_BURST_MAX][10];       // ... frequency uncertainty ...
+    char str_channel[MQTT_MEAS_PER_BURST_MAX][4];      // ... channel ...
+    char str_phase_diff[MQTT_MEAS_PER_BURST_MAX][10];  // ... and phase difference values
 
-    for (int i = 0; i < MQTT_MEAS_PER_BURST; i++) {
-        sprintf(str_frequency[i], "%.3lf", data.d[i].f_hz);  // Convert float frequency to str
-        sprintf(str_time[i], "%llu", data.d[i].t_ms);        // Convert llu int time_ms to str
+    for (int i = 0; i < data->n; i++) {
+        sprintf(str_frequency[i], "%.3lf", data->d[i].f_hz);           // Convert float frequency to str
+        sprintf(str_time[i], "%llu", t_ms[i]);                         // Convert llu int time_ms to str
+        sprintf(str_phase[i], "%.1lf", data->d[i].phase_deg);          // Convert float phase to str
+        sprintf(str_rocof[i], "%.3lf", data->d[i].rocof);              // Convert float RoCoF to str
+        sprintf(str_f_std[i], "%.1lf", (data->d[i].f_std * 1000.0f));  // Convert frequency std to str in mHz
+        sprintf(str_channel[i], "%u", data->d[i].channel);             // Convert channel to str
+        if (isnan(data->d[i].phase_diff_deg)) {                        // Empty if there is no reference output to compare with
+            str_phase_diff[i][0] = '\0';
+        } else {
+            sprintf(str_phase_diff[i], "%.1lf", data->d[i].phase_diff_deg);  // Convert phase difference to str
+        }
     }
 
-    for (int i = 0; i < MQTT_MEAS_PER_BURST; i++) {
+    for (int i = 0; i < data->n; i++) {
         strcat(message, str_frequency[i]);  // Concatenate strings to create a message
         strcat(message, ",");               // Add a coma to format datapoints as a csv packet
     }
 
     strcat(message, "&field2=");
-    for (int i = 0; i < MQTT_MEAS_PER_BURST; i++) {
+    for (int i = 0; i < data->n; i++) {
         strcat(message, str_time[i]);  // Concatenate strings to create a message
         strcat(message, ",");
     }
 
-    char str_no_datapoints[5];                              // String to hold no of datapoints in the MQTT message
-    sprintf(str_no_datapoints, "%d", MQTT_MEAS_PER_BURST);  // Convert no of datapoints to str
+    char str_no_datapoints[5];                  // String to hold no of datapoints in the MQTT message
+    sprintf(str_no_datapoints, "%u", data->n);  // Convert no of datapoints to str
     strcat(message, "&field3=");
     strcat(message, str_no_datapoints);
 
+    strcat(message, "&field4=");
+    for (int i = 0; i < data->n; i++) {
+        strcat(message, str_phase[i]);  // Concatenate strings to create a message
+        strcat(message, ",");
+    }
+
+    strcat(message, "&field5=");
+    for (int i = 0; i < data->n; i++) {
+        strcat(message, str_rocof[i]);  // Concatenate strings to create a message
+        strcat(message, ",");
+    }
+
+    strcat(message, "&field6=");
+    for (int i = 0; i < data->n; i++) {
+        strcat(message, str_f_std[i]);  // Concatenate strings to create a message
+        strcat(message, ",");
+    }
+
+    strcat(message, "&field7=");
+    for (int i = 0; i < data->n; i++) {
+        strcat(message, str_channel[i]);  // Concatenate strings to create a message
+        strcat(message, ",");
+    }
+
+    strcat(message, "&field8=");
+    for (int i = 0; i < data->n; i++) {
+        strcat(message, str_phase_diff[i]);  // Concatenate strings to create a message
+        strcat(message, ",");
+    }
+
     strcat(message, "&status=");
     strcat(message, str_status);
 
-    esp_mqtt_client_publish(client, MQTT_TOPIC, message, 0, 0, 0);
+    sys_config_t cfg = config_store_get();  // Topic can be changed remotely
+    int msg_id = esp_mqtt_client_publish(client, cfg.mqtt_topic, message, 0, 0, 0);
+
+#ifdef MQTT_PMU_TOPIC
+    if (msg_id >= 0) {
+        mqtt_drv_send_pmu(data);
+    }
+#endif
+    return msg_id;
+}
+
+/**
+ * @brief Add a sample to the current burst and queue the burst once complete (uploader backend, non-blocking)
+ * @param sample Measurement sample
+ * @return Error code (ESP_FAIL if a complete burst could not be queued)
+ */
+esp_err_t mqtt_drv_push(const uploader_sample_t *sample) {
+    static mqtt_payload_t payload;  // Burst being assembled
+
+    if ((payload.n == 0) && (config_store_generation() != burst_cfg_gen)) {  // Apply a new burst size between bursts
+        burst_cfg_gen = config_store_generation();
+        burst_cfg = config_store_get();
+        DLOGI(TAG, "Configuration reloaded, measurements per burst: %u", burst_cfg.meas_per_burst);
+    }
+
+    payload.d[payload.n++] = *sample;  // Copy the sample to payload
+    if (payload.n < burst_cfg.meas_per_burst) {
+        return ESP_OK;
+    }
+
+    DLOGD(TAG, "Sending %u new data points to the MQTT queue", payload.n);
+    esp_err_t err = mqtt_drv_queue_send(&payload, sizeof(payload));
+    if ((err != ESP_OK) && (outage_start_ms != 0)) {  // Backlog full, the outage outlasted the RAM buffer
+        outage_lost += payload.n;
+    }
+    payload.n = 0;
+    return err;
 }
 
 /**
- * @brief Task for reading values from the data que and sending them in bursts of 10 through MQTT
+ * @brief Task for reading bursts from the data que and publishing them through MQTT, oldest first
+ * @note A burst stays queued until it is published, so the queue buffers measurements in RAM across link and session outages
  */
 static void mqtt_drv_task(void *param) {
-    mqtt_payload_t data;               // Struct with the data to be sent
+    static mqtt_payload_t data;        // Struct with the data to be sent
     static uint64_t upload_count = 1;  // Upload counter variable
-    char status[40];
+    char status[112];
     while (1) {
-        if (xQueueReceive(mqtt_queue, &data, (TickType_t)0) == pdTRUE) {    // Check if a pointer to a new data set is available (no blocking)
-            // Format device status string
-            sprintf(status, "Device OK, No. %03llu, MPB: %d, MPS: %d", upload_count++, MQTT_MEAS_PER_BURST, (50/PULSES_PER_MEAS)); 
-            mqtt_drv_send(data, status);
-            ESP_LOGI(TAG, "Datapoint succesfully published, no. %03llu", (upload_count-1));
+        if (xQueuePeek(mqtt_queue, &data, portMAX_DELAY) != pdTRUE) {  // Wait for a new data set
+            continue;
+        }
+        if ((mqtt_connected_flag == false) || (link_up == false)) {  // Hold the backlog until the link and session are back
+            vTaskDelay(pdMS_TO_TICKS(MQTT_BACKLOG_POLL_MS));
+            continue;
+        }
+
+        // Format device status string
+        sys_config_t cfg = config_store_get();
+        snprintf(status, sizeof(status), "Device OK, No. %03llu, MPB: %u, MPS: %u, CH: %u%s", upload_count, data.n,
+                 (50 / cfg.pulses_per_meas) * ZCO_CHANNELS, ZCO_CHANNELS, link_note);  // MPS over all channels
+
+        if (mqtt_drv_send(&data, status) < 0) {
+            DLOGW(TAG, "Publish failed, burst kept for a retry");
+            vTaskDelay(pdMS_TO_TICKS(MQTT_BACKLOG_POLL_MS));
+            continue;
+        }
+        xQueueReceive(mqtt_queue, &data, 0);  // Published, remove it from the backlog
+        link_note[0] = '\0';                  // Outage statistics reported once
+        DLOGI(TAG, "Datapoint succesfully published, no. %03llu", upload_count);
+        upload_count++;
+        ws2812_drv_flash(0, 250, 10, 255, 60);  // Best-effort status flash, dropped if the LED queue is full
+
+        if (outage_start_ms != 0) {
+            mqtt_drv_outage_end();
         }
     }
 }
@@ -141,15 +457,31 @@ static void mqtt_drv_task(void *param) {
 esp_err_t mqtt_drv_init() {
     esp_err_t err = ESP_OK;
 
-    // Define MQTT configuration details
+    // Define MQTT configuration details (credentials from the runtime configuration)
+    static sys_config_t cfg;
+    cfg = config_store_get();
     esp_mqtt_client_config_t mqtt_cfg = {
         .uri = MQTT_URI,
         .port = MQTT_PORT,
-        .username = MQTT_USERNAME,
-        .password = MQTT_PASSWORD,
-        .client_id = MQTT_ID,
+        .username = cfg.mqtt_username,
+        .password = cfg.mqtt_password,
+        .client_id = cfg.mqtt_id,
+        .reconnect_timeout_ms = MQTT_RECONNECT_MS,  // Retry quickly, the backlog is waiting
+        .keepalive = MQTT_KEEPALIVE_S,              // Detect sessions that died during a link outage
     };
 
+#ifdef MQTT_CONTROL_PREFIX
+    // Control topics follow the runtime mqtt_id (a reboot field, so fixed until the next boot)
+    snprintf(control.config, sizeof(control.config), MQTT_CONTROL_PREFIX "%s/config", cfg.mqtt_id);
+    snprintf(control.config_ack, sizeof(control.config_ack), MQTT_CONTROL_PREFIX "%s/config/ack", cfg.mqtt_id);
+    snprintf(control.trace, sizeof(control.trace), MQTT_CONTROL_PREFIX "%s/trace", cfg.mqtt_id);
+    snprintf(control.trace_ack, sizeof(control.trace_ack), MQTT_CONTROL_PREFIX "%s/trace/ack", cfg.mqtt_id);
+    snprintf(control.trace_data, sizeof(control.trace_data), MQTT_CONTROL_PREFIX "%s/trace/data", cfg.mqtt_id);
+    snprintf(control.link, sizeof(control.link), MQTT_CONTROL_PREFIX "%s/link", cfg.mqtt_id);
+#else
+    ESP_LOGI(TAG, "Remote configuration and trace requests disabled (MQTT_CONTROL_PREFIX not set)");
+#endif
+
     client = esp_mqtt_client_init(&mqtt_cfg);  // Initialise MQTT client
 
     if (client != NULL) {  // Check whether the returned MQTT handle is valid
@@ -161,8 +493,16 @@ esp_err_t mqtt_drv_init() {
         ESP_RETURN_ON_ERROR(err, TAG, "Failed to initialise MQTT client (NULL pointer returned)");
     }
 
-    mqtt_queue = xQueueCreate(1, sizeof(mqtt_payload_t));          // Create a queue for data to be sent
-    xTaskCreate(mqtt_drv_task, "MQTT_TASK", 8192, NULL, 10, NULL);  // Create and start the MQTT task
+    burst_cfg = config_store_get();  // Initial burst size
+    burst_cfg_gen = config_store_generation();
+
+    // Follow the WiFi link to hold uploads while it is down and resume the session as soon as it is back
+    ESP_RETURN_ON_ERROR(esp_event_handler_instance_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, mqtt_drv_link_handler, NULL, NULL), TAG, "Failed to register a WiFi event handler");
+    ESP_RETURN_ON_ERROR(esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_GOT_IP, mqtt_drv_link_handler, NULL, NULL), TAG, "Failed to register an IP event handler");
+    ESP_RETURN_ON_ERROR(esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_LOST_IP, mqtt_drv_link_handler, NULL, NULL), TAG, "Failed to register an IP event handler");
+
+    mqtt_queue = xQueueCreate(MQTT_BACKLOG_BURSTS, sizeof(mqtt_payload_t));  // Create a queue for data to be sent
+    xTaskCreate(mqtt_drv_task, "MQTT_TASK", 10240, NULL, 10, NULL);          // Create and start the MQTT task
     ESP_LOGI(TAG, "MQTT task initialised");
 
     return err;
@@ -18,16 +18,27 @@
 #include "freertos/queue.h"
 #include "freertos/task.h"
 #include "mqtt_client.h"
+#include "uploader.h"
 
-typedef struct datapoint {  // Single datapoint data type
-    float f_hz;             // Frequency in Hz
-    uint64_t t_ms;          // Timestamp in ms as Unix time
-} mqtt_datapoint_t;
+typedef uploader_sample_t mqtt_datapoint_t;  // Single datapoint data type
 
-typedef struct payload {                      // MQTT payload wrapper data type
-    mqtt_datapoint_t d[MQTT_MEAS_PER_BURST];  // An array of MQTT_MEAS_PER_BURST datapoints
+typedef struct payload {                          // MQTT payload wrapper data type
+    uint32_t n;                                   // Number of valid datapoints
+    mqtt_datapoint_t d[MQTT_MEAS_PER_BURST_MAX];  // An array of up to MQTT_MEAS_PER_BURST_MAX datapoints
 } mqtt_payload_t;
 
+typedef struct mqtt_link_stats {  // Upload outage statistics (link or session lost until the next burst is published)
+    uint32_t outages;             // Number of outages that ended
+    uint32_t last_resume_ms;      // Time to resume upload after the last outage
+    uint64_t total_resume_ms;     // Sum of the times to resume upload (mean = total_resume_ms / outages)
+    uint32_t last_samples_lost;   // Samples dropped during the last outage (RAM backlog full)
+    uint32_t samples_lost;        // Samples dropped during all outages
+} mqtt_link_stats_t;
+
+extern const uploader_backend_t mqtt_drv_backend;
+
 esp_err_t mqtt_drv_init();
-esp_err_t mqtt_drv_queue_send(mqtt_payload_t ready_data, size_t data_size);
+esp_err_t mqtt_drv_push(const uploader_sample_t *sample);
 bool mqtt_drv_connected();
+bool mqtt_drv_fault();
+mqtt_link_stats_t mqtt_drv_link_stats();
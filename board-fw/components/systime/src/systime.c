@@ -6,14 +6,56 @@
 
 #include "systime.h"
 
+#include <stdlib.h>
+
+#include "config_store.h"
+#include "esp_timer.h"
+
 #define TAG "systime"
 
+static volatile bool time_synchronised = false;                  // Set once SNTP has adjusted the system time
+static systime_quality_t quality;                                // Time quality, since_sync_s filled in on read
+static int64_t sync_timer_us;                                    // esp_timer time of the last SNTP update
+static int64_t sync_utc_us;                                      // System time set by the last SNTP update
+static portMUX_TYPE quality_mux = portMUX_INITIALIZER_UNLOCKED;  // Protects the 64-bit fields shared with other tasks
+
+/**
+ * @brief SNTP time synchronisation notification callback (LwIP task), measures the step applied to the clock
+ * @note The system time runs on esp_timer between updates, so the time it would have shown is the last update plus the esp_timer interval
+ */
+static void time_sync_notification_cb(struct timeval *tv) {
+    int64_t now_us = esp_timer_get_time();
+    int64_t utc_us = ((int64_t)tv->tv_sec * 1000000) + (int64_t)tv->tv_usec;
+    int64_t step_us = 0;
+
+    portENTER_CRITICAL(&quality_mux);
+    if (quality.synchronised) {  // The first update sets the clock from 1970, not a step
+        step_us = utc_us - (sync_utc_us + (now_us - sync_timer_us));
+    }
+    bool flagged = (llabs(step_us) > SNTP_STEP_FLAG_US);
+    if (flagged) {
+        quality.steps++;
+        quality.last_step_us = (int32_t)((step_us > INT32_MAX) ? INT32_MAX : ((step_us < INT32_MIN) ? INT32_MIN : step_us));
+        quality.last_step_utc_us = utc_us;
+    }
+    quality.synchronised = true;
+    sync_timer_us = now_us;
+    sync_utc_us = utc_us;
+    portEXIT_CRITICAL(&quality_mux);
+
+    time_synchronised = true;
+    if (flagged) {
+        ESP_LOGW(TAG, "SNTP stepped the system time by %lld us, phase is discontinuous across the step", step_us);
+    }
+}
+
 /**
  * @brief Initialise SNTP
  */
 static void initialize_sntp() {
     sntp_setoperatingmode(SNTP_OPMODE_POLL);  // Set the operation mode to poll
     sntp_setservername(0, "pool.ntp.org");    // Set the address of the NTP server
+    sntp_set_time_sync_notification_cb(time_sync_notification_cb);
     sntp_init();
 }
 
@@ -22,17 +64,40 @@ static void initialize_sntp() {
  * @return Error code
  */
 esp_err_t systime_synchronise() {
-    initialize_sntp();  // Initialise SNTP and begin time synchronisation
-    int retry = 0;      // Synchronisation attempts count
-    vTaskDelay(SNTP_SYNCH_DELAY / portTICK_PERIOD_MS);
-    while (sntp_get_sync_status() == SNTP_SYNC_STATUS_RESET && ++retry < SNTP_SYNCH_RETRY) {
-        ESP_LOGW(TAG, "Reattempting SNTP time synchronisation... (%d/%d)", retry, SNTP_SYNCH_RETRY);
-        vTaskDelay(SNTP_SYNCH_DELAY / portTICK_PERIOD_MS);
+    sys_config_t cfg = config_store_get();  // Retry count and delay from the runtime configuration
+    initialize_sntp();                      // Initialise SNTP and begin time synchronisation
+    int retry = 0;                          // Synchronisation attempts count
+    vTaskDelay(cfg.sntp_delay_ms / portTICK_PERIOD_MS);
+    while (sntp_get_sync_status() == SNTP_SYNC_STATUS_RESET && ++retry < cfg.sntp_retry) {
+        ESP_LOGW(TAG, "Reattempting SNTP time synchronisation... (%d/%u)", retry, cfg.sntp_retry);
+        vTaskDelay(cfg.sntp_delay_ms / portTICK_PERIOD_MS);
     }
     ESP_LOGI(TAG, "System time synchronised successfully");
     return ESP_OK;
 }
 
+/**
+ * @brief Check whether the system time has been synchronised with SNTP at least once
+ * @return True if synchronised, False otherwise
+ */
+bool systime_synchronised() {
+    return time_synchronised;
+}
+
+/**
+ * @brief Get the quality of the system time, used to flag timestamps and phase derived from it
+ * @return Time quality
+ */
+systime_quality_t systime_quality() {
+    portENTER_CRITICAL(&quality_mux);
+    systime_quality_t q = quality;
+    int64_t since_us = esp_timer_get_time() - sync_timer_us;
+    portEXIT_CRITICAL(&quality_mux);
+
+    q.since_sync_s = q.synchronised ? (uint32_t)(since_us / 1000000) : 0;
+    return q;
+}
+
 /**
  * @brief Get current system time
  * @return Time value structure
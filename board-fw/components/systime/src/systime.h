@@ -13,5 +13,15 @@
 #include "freertos/FreeRTOS.h"
 #include "config_macros.h"
 
+typedef struct systime_quality {  // Quality of the system time (SNTP only, no PPS/GPS reference)
+    bool synchronised;            // Synchronised with SNTP at least once
+    uint32_t since_sync_s;        // Time since the last SNTP update (the clock free-runs on the crystal in between)
+    uint32_t steps;               // SNTP updates that stepped the clock by more than SNTP_STEP_FLAG_US
+    int32_t last_step_us;         // Size of the last flagged step (new minus old time, saturated)
+    int64_t last_step_utc_us;     // UTC time at which the last flagged step was applied
+} systime_quality_t;
+
 esp_err_t systime_synchronise();
-struct timeval systime_log();
\ No newline at end of file
+bool systime_synchronised();
+systime_quality_t systime_quality();
+struct timeval systime_log();
@@ -6,6 +6,8 @@
 
 #include "timer_drv.h"
 
+#include "config_store.h"
+
 #define TAG "timer_drv"
 
 /**
@@ -17,6 +19,16 @@ uint64_t IRAM_ATTR drv_timer_get_count_isr() {
     return count;
 }
 
+/**
+ * @brief Timer get count (to be used outside of ISRs)
+ * @return Count
+ */
+uint64_t drv_timer_get_count() {
+    uint64_t count = 0;
+    timer_get_counter_value(TIMER_GROUP, TIMER_NUM, &count);
+    return count;
+}
+
 /**
  * @brief Timer initialisation
  * @return Error code
@@ -24,7 +36,7 @@ uint64_t IRAM_ATTR drv_timer_get_count_isr() {
 esp_err_t drv_timer_init() {
     timer_config_t config = {
         // Select and initialize basic parameters of the timer
-        .divider = TIMER_DIVIDER,  // Clock source is APB. Run the timer at 40 MHz (max available freq.)
+        .divider = config_store_get().timer_divider,  // Clock source is APB. Run the timer at 40 MHz (max available freq.) by default
         .counter_dir = TIMER_COUNT_UP,
         .counter_en = TIMER_START,            // Start counting when initialised
         .alarm_en = TIMER_ALARM_DIS,          // No alarms
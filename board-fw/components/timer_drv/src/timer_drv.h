@@ -12,4 +12,5 @@
 #include "config_macros.h"
 
 esp_err_t drv_timer_init();
-uint64_t drv_timer_get_count_isr();
\ No newline at end of file
+uint64_t drv_timer_get_count_isr();
+uint64_t drv_timer_get_count();
\ No newline at end of file
@@ -0,0 +1,210 @@
+/**
+ * @file    hz_stream.c
+ * @brief   HertzNet UDP stream wire format: sequence-numbered data datagrams and receiver NACKs (no ESP-IDF dependencies)
+ * @note    Shared with the host collector, hence no ESP-IDF headers
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#include "hz_stream.h"
+
+#include <string.h>
+
+/**
+ * @brief Write little-endian values
+ */
+static uint8_t *put_u8(uint8_t *p, uint8_t val) {
+    p[0] = val;
+    return p + 1;
+}
+
+static uint8_t *put_u16(uint8_t *p, uint16_t val) {
+    p[0] = (uint8_t)(val);
+    p[1] = (uint8_t)(val >> 8);
+    return p + 2;
+}
+
+static uint8_t *put_u32(uint8_t *p, uint32_t val) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = (uint8_t)(val >> (8 * i));
+    }
+    return p + 4;
+}
+
+static uint8_t *put_u64(uint8_t *p, uint64_t val) {
+    for (int i = 0; i < 8; i++) {
+        p[i] = (uint8_t)(val >> (8 * i));
+    }
+    return p + 8;
+}
+
+static uint8_t *put_f32(uint8_t *p, float val) {
+    uint32_t raw;
+    memcpy(&raw, &val, sizeof(raw));
+    return put_u32(p, raw);
+}
+
+/**
+ * @brief Read little-endian values
+ */
+static uint16_t get_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t get_u64(const uint8_t *p) {
+    return (uint64_t)get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+
+static float get_f32(const uint8_t *p) {
+    uint32_t raw = get_u32(p);
+    float val;
+    memcpy(&val, &raw, sizeof(val));
+    return val;
+}
+
+/**
+ * @brief Check the common part of the header
+ */
+static bool hz_stream_check_header(const uint8_t *buf, size_t len, size_t min_len, uint8_t type) {
+    return (len >= min_len) && (get_u16(buf) == HZ_STREAM_MAGIC) && (buf[2] == HZ_STREAM_VERSION) && (buf[3] == type);
+}
+
+/**
+ * @brief Encode a data datagram
+ * @param data Datagram content
+ * @param buf Output buffer
+ * @param len Size of the output buffer
+ * @return Number of bytes written (0 if the content is invalid or the buffer is too small)
+ */
+size_t hz_stream_encode_data(const hz_stream_data_t *data, uint8_t *buf, size_t len) {
+    size_t size = HZ_STREAM_HEADER_SIZE + ((size_t)data->count * HZ_STREAM_SAMPLE_SIZE);
+    if ((data->count > HZ_STREAM_MAX_SAMPLES) || (len < size)) {
+        return 0;
+    }
+
+    uint8_t *p = buf;
+    p = put_u16(p, HZ_STREAM_MAGIC);
+    p = put_u8(p, HZ_STREAM_VERSION);
+    p = put_u8(p, HZ_STREAM_TYPE_DATA);
+    p = put_u32(p, data->device_id);
+    p = put_u32(p, data->seq);
+    p = put_u8(p, data->flags);
+    p = put_u8(p, data->count);
+    p = put_u16(p, 0);  // Reserved
+    p = put_u64(p, data->send_us);
+    p = put_u32(p, data->session);
+
+    for (int i = 0; i < data->count; i++) {
+        p = put_u64(p, data->samples[i].t_us);
+        p = put_f32(p, data->samples[i].f_hz);
+        p = put_f32(p, data->samples[i].rocof);
+        p = put_f32(p, data->samples[i].phase_deg);
+        p = put_f32(p, data->samples[i].f_std);
+        p = put_f32(p, data->samples[i].phase_diff_deg);
+        p = put_u8(p, data->samples[i].channel);
+        p = put_u8(p, 0);   // Reserved
+        p = put_u16(p, 0);  // Reserved
+    }
+
+    return size;
+}
+
+/**
+ * @brief Decode a data datagram
+ * @param buf Received datagram
+ * @param len Length of the datagram
+ * @param data Decoded content
+ * @return True if the datagram is a valid data datagram
+ */
+bool hz_stream_decode_data(const uint8_t *buf, size_t len, hz_stream_data_t *data) {
+    if (hz_stream_check_header(buf, len, HZ_STREAM_HEADER_SIZE, HZ_STREAM_TYPE_DATA) == false) {
+        return false;
+    }
+
+    data->device_id = get_u32(buf + 4);
+    data->seq = get_u32(buf + 8);
+    data->flags = buf[12];
+    data->count = buf[13];
+    data->send_us = get_u64(buf + 16);
+    data->session = get_u32(buf + 24);
+
+    if ((data->count > HZ_STREAM_MAX_SAMPLES) || (len < (HZ_STREAM_HEADER_SIZE + ((size_t)data->count * HZ_STREAM_SAMPLE_SIZE)))) {
+        return false;
+    }
+
+    const uint8_t *p = buf + HZ_STREAM_HEADER_SIZE;
+    for (int i = 0; i < data->count; i++, p += HZ_STREAM_SAMPLE_SIZE) {
+        data->samples[i].t_us = get_u64(p);
+        data->samples[i].f_hz = get_f32(p + 8);
+        data->samples[i].rocof = get_f32(p + 12);
+        data->samples[i].phase_deg = get_f32(p + 16);
+        data->samples[i].f_std = get_f32(p + 20);
+        data->samples[i].phase_diff_deg = get_f32(p + 24);
+        data->samples[i].channel = p[28];
+    }
+
+    return true;
+}
+
+/**
+ * @brief Encode a NACK datagram
+ * @param nack NACK content
+ * @param buf Output buffer
+ * @param len Size of the output buffer
+ * @return Number of bytes written (0 if the content is invalid or the buffer is too small)
+ */
+size_t hz_stream_encode_nack(const hz_stream_nack_t *nack, uint8_t *buf, size_t len) {
+    size_t size = HZ_STREAM_NACK_HEADER_SIZE + ((size_t)nack->count * HZ_STREAM_NACK_ENTRY_SIZE);
+    if ((nack->count > HZ_STREAM_MAX_NACKS) || (len < size)) {
+        return 0;
+    }
+
+    uint8_t *p = buf;
+    p = put_u16(p, HZ_STREAM_MAGIC);
+    p = put_u8(p, HZ_STREAM_VERSION);
+    p = put_u8(p, HZ_STREAM_TYPE_NACK);
+    p = put_u32(p, nack->device_id);
+    p = put_u8(p, nack->count);
+    p = put_u8(p, 0);  // Reserved
+    p = put_u16(p, 0);
+    p = put_u32(p, nack->session);
+
+    for (int i = 0; i < nack->count; i++) {
+        p = put_u32(p, nack->entries[i].base);
+        p = put_u32(p, nack->entries[i].mask);
+    }
+
+    return size;
+}
+
+/**
+ * @brief Decode a NACK datagram
+ * @param buf Received datagram
+ * @param len Length of the datagram
+ * @param nack Decoded content
+ * @return True if the datagram is a valid NACK datagram
+ */
+bool hz_stream_decode_nack(const uint8_t *buf, size_t len, hz_stream_nack_t *nack) {
+    if (hz_stream_check_header(buf, len, HZ_STREAM_NACK_HEADER_SIZE, HZ_STREAM_TYPE_NACK) == false) {
+        return false;
+    }
+
+    nack->device_id = get_u32(buf + 4);
+    nack->count = buf[8];
+    nack->session = get_u32(buf + 12);
+
+    if ((nack->count > HZ_STREAM_MAX_NACKS) || (len < (HZ_STREAM_NACK_HEADER_SIZE + ((size_t)nack->count * HZ_STREAM_NACK_ENTRY_SIZE)))) {
+        return false;
+    }
+
+    const uint8_t *p = buf + HZ_STREAM_NACK_HEADER_SIZE;
+    for (int i = 0; i < nack->count; i++, p += HZ_STREAM_NACK_ENTRY_SIZE) {
+        nack->entries[i].base = get_u32(p);
+        nack->entries[i].mask = get_u32(p + 4);
+    }
+
+    return true;
+}
@@ -0,0 +1,69 @@
+/**
+ * @file    hz_stream.h
+ * @brief   HertzNet UDP stream wire format: sequence-numbered data datagrams and receiver NACKs (no ESP-IDF dependencies)
+ * @note    All fields are little-endian; shared with the host collector
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HZ_STREAM_MAGIC 0x5A48         // "HZ"
+#define HZ_STREAM_VERSION 4            // Wire format version (2: f_std added to samples, 3: channel and phase difference, 4: session)
+#define HZ_STREAM_TYPE_DATA 1          // Device -> collector: measurements
+#define HZ_STREAM_TYPE_NACK 2          // Collector -> device: missing sequence numbers
+#define HZ_STREAM_FLAG_RETX 0x01       // Data datagram is a retransmission
+#define HZ_STREAM_HEADER_SIZE 28       // Size of the data datagram header
+#define HZ_STREAM_SAMPLE_SIZE 32       // Size of one encoded sample
+#define HZ_STREAM_MAX_SAMPLES 16       // Max number of samples per data datagram
+#define HZ_STREAM_NACK_HEADER_SIZE 16  // Size of the NACK datagram header
+#define HZ_STREAM_NACK_ENTRY_SIZE 8    // Size of one NACK entry
+#define HZ_STREAM_MAX_NACKS 16         // Max number of entries per NACK datagram
+
+typedef struct hz_sample {  // Single measurement sample
+    uint64_t t_us;          // UTC time of the zero-crossing closing the measurement in us
+    float f_hz;             // Estimated frequency in Hz
+    float rocof;            // Estimated rate of change of frequency in Hz/s
+    float phase_deg;        // Phase angle in degrees
+    float f_std;            // Standard deviation of f_hz in Hz
+    float phase_diff_deg;   // Phase angle in degrees relative to the reference channel of the unit (NAN if not available)
+    uint8_t channel;        // Zero-crossing input of the unit the sample was measured on
+} hz_sample_t;
+
+typedef struct hz_stream_data {                  // Data datagram
+    uint32_t device_id;                          // Device ID
+    uint32_t seq;                                // Datagram sequence number
+    uint8_t flags;                               // HZ_STREAM_FLAG_*
+    uint8_t count;                               // Number of samples
+    uint64_t send_us;                            // UTC time at which the datagram was (first) sent in us
+    uint32_t session;                            // Random per boot, seq starts over whenever it changes
+    hz_sample_t samples[HZ_STREAM_MAX_SAMPLES];  // Samples
+} hz_stream_data_t;
+
+typedef struct hz_nack_entry {  // Missing sequence numbers: base and every base+1+i for bit i of mask
+    uint32_t base;              // First missing sequence number
+    uint32_t mask;              // Bitmap of further missing sequence numbers
+} hz_nack_entry_t;
+
+typedef struct hz_stream_nack {                    // NACK datagram
+    uint32_t device_id;                            // Device ID the NACK is addressed to
+    uint32_t session;                              // Session the sequence numbers belong to
+    uint8_t count;                                 // Number of entries
+    hz_nack_entry_t entries[HZ_STREAM_MAX_NACKS];  // Entries
+} hz_stream_nack_t;
+
+size_t hz_stream_encode_data(const hz_stream_data_t *data, uint8_t *buf, size_t len);
+bool hz_stream_decode_data(const uint8_t *buf, size_t len, hz_stream_data_t *data);
+size_t hz_stream_encode_nack(const hz_stream_nack_t *nack, uint8_t *buf, size_t len);
+bool hz_stream_decode_nack(const uint8_t *buf, size_t len, hz_stream_nack_t *nack);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,181 @@
+/**
+ * @file    udp_stream.c
+ * @brief   Low-latency UDP streaming of measurements to a local collector with NACK-based loss recovery
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#include "udp_stream.h"
+
+#include "config_store.h"
+#include "dlog.h"
+
+#define TAG "udp_stream"
+
+#define UDP_DGRAM_SIZE (HZ_STREAM_HEADER_SIZE + (UDP_MEAS_PER_DGRAM * HZ_STREAM_SAMPLE_SIZE))  // Size of a full datagram
+_Static_assert(UDP_MEAS_PER_DGRAM <= HZ_STREAM_MAX_SAMPLES, "UDP_MEAS_PER_DGRAM exceeds the samples a data datagram can carry");
+
+typedef struct udp_retx_slot {    // Recently sent datagram kept for retransmission
+    uint32_t seq;                 // Sequence number
+    size_t len;                   // Encoded length (0 if the slot is empty)
+    uint8_t buf[UDP_DGRAM_SIZE];  // Encoded datagram
+} udp_retx_slot_t;
+
+static xQueueHandle udp_queue = NULL;                  // Queue for samples to be streamed
+static int udp_sock = -1;                              // UDP socket
+static struct sockaddr_in collector_addr;              // Collector address
+static uint32_t udp_device_id = 0;                     // Device ID (lower 4 bytes of the MAC address)
+static uint32_t udp_session = 0;                       // Random per boot, tells the collector that seq starts over
+static udp_retx_slot_t retx_ring[UDP_RETX_WINDOW];     // Ring of recently sent datagrams, indexed by seq
+static uint32_t udp_sent = 0;                          // Number of datagrams sent
+static uint32_t udp_retx = 0;                          // Number of datagrams retransmitted
+static uint32_t udp_retx_expired = 0;                  // Number of NACKed datagrams no longer in the ring
+static uint32_t udp_send_errors = 0;                   // Number of failed sendto calls
+
+const uploader_backend_t udp_stream_backend = {.name = "udp", .init = udp_stream_init, .push = udp_stream_push};
+
+/**
+ * @brief Send an encoded datagram to the collector
+ * @param buf Encoded datagram
+ * @param len Length of the datagram
+ */
+static void udp_stream_sendto(const uint8_t *buf, size_t len) {
+    if (sendto(udp_sock, buf, len, 0, (struct sockaddr *)&collector_addr, sizeof(collector_addr)) < 0) {
+        udp_send_errors++;  // Link down or buffers full, the collector will NACK the gap
+    }
+}
+
+/**
+ * @brief Timestamp, encode, store for retransmission and send a data datagram
+ * @param dgram Datagram to be sent
+ */
+static void udp_stream_send(hz_stream_data_t *dgram) {
+    struct timeval time;
+    gettimeofday(&time, NULL);
+    dgram->send_us = ((uint64_t)time.tv_sec * 1000000) + (uint64_t)time.tv_usec;
+
+    udp_retx_slot_t *slot = &retx_ring[dgram->seq % UDP_RETX_WINDOW];
+    slot->seq = dgram->seq;
+    slot->len = hz_stream_encode_data(dgram, slot->buf, sizeof(slot->buf));
+
+    udp_stream_sendto(slot->buf, slot->len);
+    udp_sent++;
+}
+
+/**
+ * @brief Retransmit a datagram if it is still in the retransmission ring
+ * @param seq Sequence number of the missing datagram
+ */
+static void udp_stream_resend(uint32_t seq) {
+    udp_retx_slot_t *slot = &retx_ring[seq % UDP_RETX_WINDOW];
+
+    if ((slot->len == 0) || (slot->seq != seq)) {
+        udp_retx_expired++;  // Too old, the collector gives up on it after its own timeout
+        return;
+    }
+
+    slot->buf[12] |= HZ_STREAM_FLAG_RETX;  // Flags byte of the encoded header
+    udp_stream_sendto(slot->buf, slot->len);
+    udp_retx++;
+}
+
+/**
+ * @brief Read all pending NACKs from the socket and retransmit the requested datagrams
+ */
+static void udp_stream_poll_nacks() {
+    uint8_t buf[HZ_STREAM_NACK_HEADER_SIZE + (HZ_STREAM_MAX_NACKS * HZ_STREAM_NACK_ENTRY_SIZE)];
+    hz_stream_nack_t nack;
+    int len;
+
+    while ((len = recvfrom(udp_sock, buf, sizeof(buf), MSG_DONTWAIT, NULL, NULL)) > 0) {
+        if ((hz_stream_decode_nack(buf, len, &nack) == false) || (nack.device_id != udp_device_id) || (nack.session != udp_session)) {
+            continue;
+        }
+
+        for (int i = 0; i < nack.count; i++) {
+            udp_stream_resend(nack.entries[i].base);
+            for (int bit = 0; bit < 32; bit++) {
+                if (nack.entries[i].mask & (1UL << bit)) {
+                    udp_stream_resend(nack.entries[i].base + 1 + bit);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Task batching samples into datagrams, sending them and serving NACKs
+ */
+static void udp_stream_task(void *param) {
+    hz_stream_data_t dgram = {.device_id = udp_device_id, .seq = 0, .flags = 0, .count = 0, .session = udp_session};
+    uploader_sample_t sample;
+    TickType_t last_stats = xTaskGetTickCount();
+
+    while (true) {
+        if (xQueueReceive(udp_queue, &sample, pdMS_TO_TICKS(UDP_NACK_POLL_MS)) == pdTRUE) {
+            dgram.samples[dgram.count++] = (hz_sample_t){.t_us = sample.t_us,
+                                                         .f_hz = sample.f_hz,
+                                                         .rocof = sample.rocof,
+                                                         .phase_deg = sample.phase_deg,
+                                                         .f_std = sample.f_std,
+                                                         .phase_diff_deg = sample.phase_diff_deg,
+                                                         .channel = sample.channel};
+
+            if (dgram.count >= UDP_MEAS_PER_DGRAM) {  // Send as soon as the datagram is full
+                udp_stream_send(&dgram);
+                dgram.seq++;
+                dgram.count = 0;
+            }
+        }
+
+        udp_stream_poll_nacks();
+
+        if ((xTaskGetTickCount() - last_stats) >= pdMS_TO_TICKS(60000)) {
+            last_stats = xTaskGetTickCount();
+            DLOGI(TAG, "Sent: %u, retransmitted: %u, expired: %u, send errors: %u", udp_sent, udp_retx, udp_retx_expired, udp_send_errors);
+        }
+    }
+}
+
+/**
+ * @brief Hand a sample over to the UDP stream (uploader backend, non-blocking)
+ * @param sample Measurement sample
+ * @return Error code (ESP_FAIL if the sample queue is full)
+ */
+esp_err_t udp_stream_push(const uploader_sample_t *sample) {
+    if (udp_queue == NULL) {  // Streaming disabled
+        return ESP_OK;
+    }
+
+    return (xQueueSend(udp_queue, sample, (TickType_t)0) == pdTRUE) ? ESP_OK : ESP_FAIL;
+}
+
+/**
+ * @brief Create the UDP socket and start the streaming task (unless disabled in the configuration)
+ * @return Error code
+ */
+esp_err_t udp_stream_init() {
+    sys_config_t cfg = config_store_get();
+    if (cfg.udp_port == 0) {
+        ESP_LOGI(TAG, "UDP streaming disabled (udp_port = 0)");
+        return ESP_OK;
+    }
+
+    collector_addr.sin_family = AF_INET;
+    collector_addr.sin_port = htons((uint16_t)cfg.udp_port);
+    ESP_RETURN_ON_FALSE(inet_aton(cfg.udp_collector, &collector_addr.sin_addr) != 0, ESP_ERR_INVALID_ARG, TAG, "Invalid collector address");
+
+    uint8_t mac[6];
+    ESP_RETURN_ON_ERROR(esp_efuse_mac_get_default(mac), TAG, "Failed to read the MAC address");
+    udp_device_id = ((uint32_t)mac[2] << 24) | ((uint32_t)mac[3] << 16) | ((uint32_t)mac[4] << 8) | (uint32_t)mac[5];
+    udp_session = esp_random();
+
+    udp_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    ESP_RETURN_ON_FALSE(udp_sock >= 0, ESP_FAIL, TAG, "Failed to create UDP socket");
+
+    udp_queue = xQueueCreate(UDP_QUEUE_LEN, sizeof(uploader_sample_t));
+    ESP_RETURN_ON_FALSE(udp_queue != NULL, ESP_ERR_NO_MEM, TAG, "Failed to create UDP sample queue");
+    xTaskCreate(udp_stream_task, "udp_stream_task", 4096, NULL, 9, NULL);  // Just below the MQTT task
+    ESP_LOGI(TAG, "UDP streaming to %s:%u started (device ID: %08x, session: %08x)", cfg.udp_collector, cfg.udp_port, udp_device_id, udp_session);
+
+    return ESP_OK;
+}
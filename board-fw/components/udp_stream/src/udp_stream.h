@@ -0,0 +1,25 @@
+/**
+ * @file    udp_stream.h
+ * @brief   Low-latency UDP streaming of measurements to a local collector with NACK-based loss recovery
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "config_macros.h"
+#include "esp_mac.h"
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "hz_stream.h"
+#include "lwip/sockets.h"
+#include "uploader.h"
+
+extern const uploader_backend_t udp_stream_backend;
+
+esp_err_t udp_stream_init();
+esp_err_t udp_stream_push(const uploader_sample_t *sample);
@@ -0,0 +1,51 @@
+/**
+ * @file    uploader.c
+ * @brief   Fan measurements out to the registered transport backends (MQTT, UDP stream, ...)
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#include "uploader.h"
+
+#include "dlog.h"
+
+#define TAG "uploader"
+
+static const uploader_backend_t *backends[UPLOADER_MAX_BACKENDS];  // Registered transport backends
+static uint32_t backend_drops[UPLOADER_MAX_BACKENDS];              // Number of samples rejected by each backend
+static size_t backend_count = 0;                                   // Number of registered backends
+
+/**
+ * @brief Register a transport backend (before uploader_init)
+ * @param backend Backend descriptor (must stay valid)
+ * @return Error code
+ */
+esp_err_t uploader_register(const uploader_backend_t *backend) {
+    ESP_RETURN_ON_FALSE(backend_count < UPLOADER_MAX_BACKENDS, ESP_ERR_NO_MEM, TAG, "Too many transport backends");
+    backends[backend_count++] = backend;
+    ESP_LOGI(TAG, "Transport backend registered: %s", backend->name);
+    return ESP_OK;
+}
+
+/**
+ * @brief Initialise all registered transport backends
+ * @return Error code
+ */
+esp_err_t uploader_init() {
+    for (size_t i = 0; i < backend_count; i++) {
+        ESP_RETURN_ON_ERROR(backends[i]->init(), TAG, "Failed to initialise transport backend %s", backends[i]->name);
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Hand a new sample over to every registered transport backend
+ * @param sample Measurement sample
+ */
+void uploader_push(const uploader_sample_t *sample) {
+    for (size_t i = 0; i < backend_count; i++) {
+        if (backends[i]->push(sample) != ESP_OK) {  // Backends drop rather than block the measurement path
+            backend_drops[i]++;
+            DLOGW(TAG, "Sample dropped by %s (total: %u)", backends[i]->name, backend_drops[i]);
+        }
+    }
+}
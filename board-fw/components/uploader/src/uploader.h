@@ -0,0 +1,32 @@
+/**
+ * @file    uploader.h
+ * @brief   Fan measurements out to the registered transport backends (MQTT, UDP stream, ...)
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config_macros.h"
+
+typedef struct uploader_sample {  // Single measurement handed to the transports
+    float f_hz;                   // Estimated frequency in Hz
+    float rocof;                  // Estimated rate of change of frequency in Hz/s
+    float f_std;                  // Standard deviation of f_hz in Hz (estimator confidence)
+    float phase_deg;              // Phase angle in degrees relative to the UTC-aligned nominal reference
+    float phase_diff_deg;         // Phase angle in degrees relative to the reference channel (NAN if not available)
+    uint8_t channel;              // Zero-crossing input the sample was measured on
+    uint64_t t_us;                // Timestamp in us as Unix time
+} uploader_sample_t;
+
+typedef struct uploader_backend {                        // Transport backend descriptor
+    const char *name;                                    // Name used in logs
+    esp_err_t (*init)(void);                             // Initialise the transport and start its task
+    esp_err_t (*push)(const uploader_sample_t *sample);  // Hand over one sample (must not block)
+} uploader_backend_t;
+
+esp_err_t uploader_register(const uploader_backend_t *backend);
+esp_err_t uploader_init();
+void uploader_push(const uploader_sample_t *sample);
@@ -1,35 +1,141 @@
 /**
  * @file    wifi_drv.c
- * @brief   Initialize, configure and start Wi-Fi in a station mode, handle WiFi and IP events
+ * @brief   Initialize, configure and start Wi-Fi in a station mode, handle WiFi and IP events, recover the link in place
+ * @note    After a disconnect the cached AP is tried first (no scan, covers beacon loss and short AP restarts), then the SSID is
+ *          scanned for (covers roaming to another AP), then attempts back off exponentially; the measurement pipeline keeps running
+ *          throughout and the device only reboots if the link stays down for WIFI_REBOOT_TIMEOUT_MS
  * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
  */
 
 #include "wifi_drv.h"
 
+#include "config_store.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+
 #define TAG "wifi_drv"
 
-static uint8_t ip_assigned = false;       // IP assigned by the AP flag
-static uint8_t wifi_fault_event = false;  // WiFi Disconnected or IP lost flag
+static uint8_t ip_assigned = false;      // IP assigned by the AP flag
+static uint8_t associated = false;       // Associated with an AP (the IP may still be missing)
+static uint8_t ever_up = false;          // Link has been up at least once (outages are counted from then on)
+static volatile uint32_t down_since_ms;  // Time the link went down (0 while up), 32-bit so other tasks read it in one access
+static uint32_t attempt = 0;             // Connection attempts since the link went down
+static bool bssid_cached = false;        // cached_bssid and cached_channel hold the last AP
+static uint8_t cached_bssid[6];          // BSSID of the last AP the device was associated with
+static uint8_t cached_channel = 0;       // Channel of the last AP
+static wifi_config_t sta_config;         // Station configuration (SSID, password, scan settings)
+static esp_timer_handle_t retry_timer;   // Backoff timer for the next connection attempt
+static wifi_link_stats_t stats;          // Link recovery statistics
+
+/**
+ * @brief Time since boot in ms, never 0 (reserved for "link up"), wraps after 49 days (only differences are used)
+ */
+static uint32_t wifi_drv_now_ms() {
+    uint32_t ms = (uint32_t)(esp_timer_get_time() / 1000);
+    return (ms != 0) ? ms : 1;
+}
+
+/**
+ * @brief Start a connection attempt, either straight to the cached AP or by scanning for the SSID
+ * @param use_cache Join the cached BSSID on its channel (no scan)
+ */
+static void wifi_drv_connect(bool use_cache) {
+    wifi_config_t cfg = sta_config;
+
+    if (use_cache && bssid_cached) {
+        cfg.sta.bssid_set = true;
+        memcpy(cfg.sta.bssid, cached_bssid, sizeof(cfg.sta.bssid));
+        cfg.sta.channel = cached_channel;
+    }
+    esp_wifi_set_config(WIFI_IF_STA, &cfg);
+    if (esp_wifi_connect() != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to start a connection attempt");
+    }
+}
+
+/**
+ * @brief Backoff timer callback, retry by SSID
+ */
+static void wifi_drv_retry(void* arg) {
+    wifi_drv_connect(false);
+}
+
+/**
+ * @brief Make the next connection attempt: the first ones immediately, then with exponential backoff and jitter
+ */
+static void wifi_drv_next_attempt() {
+    uint32_t n = attempt++;
+
+    if (ever_up) {
+        stats.attempts++;
+    }
+    if (n < WIFI_FAST_ATTEMPTS) {
+        wifi_drv_connect(n == 0);
+        return;
+    }
+
+    uint32_t shift = n - WIFI_FAST_ATTEMPTS;
+    uint32_t delay_ms = (shift < 16) ? (WIFI_RETRY_BASE_MS << shift) : WIFI_RETRY_MAX_MS;
+    if (delay_ms > WIFI_RETRY_MAX_MS) {
+        delay_ms = WIFI_RETRY_MAX_MS;
+    }
+    delay_ms += esp_random() % ((delay_ms / 4) + 1);  // Jitter, units behind the same AP do not retry in lockstep
+    esp_timer_stop(retry_timer);
+    esp_timer_start_once(retry_timer, (uint64_t)delay_ms * 1000);
+    ESP_LOGW(TAG, "Next connection attempt in %u ms", delay_ms);
+}
+
+/**
+ * @brief Record the start of an outage
+ */
+static void wifi_drv_link_lost() {
+    ip_assigned = false;
+    if (ever_up && (down_since_ms == 0)) {
+        down_since_ms = wifi_drv_now_ms();
+        stats.outages++;
+    }
+}
 
 /**
  * @brief WIFI and IP events handler
  */
 static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data) {
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
-        esp_wifi_connect();
+        wifi_drv_next_attempt();
     } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED) {
-        ESP_LOGW(TAG, "Device connected to the AP");
+        wifi_event_sta_connected_t* event = (wifi_event_sta_connected_t*)event_data;
+        memcpy(cached_bssid, event->bssid, sizeof(cached_bssid));  // Rejoin this AP first next time
+        cached_channel = event->channel;
+        bssid_cached = true;
+        associated = true;
+        ESP_LOGW(TAG, "Device connected to the AP (channel %u)", event->channel);
     } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
-        esp_wifi_connect();
-        ESP_LOGW(TAG, "Device disconnected from the AP");
-        wifi_fault_event = true;
+        wifi_event_sta_disconnected_t* event = (wifi_event_sta_disconnected_t*)event_data;
+        associated = false;
+        stats.last_reason = event->reason;
+        wifi_drv_link_lost();
+        ESP_LOGW(TAG, "Device disconnected from the AP (reason %u)", event->reason);
+        wifi_drv_next_attempt();
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
         ip_event_got_ip_t* event = (ip_event_got_ip_t*)event_data;
         ESP_LOGI(TAG, "Got ip:" IPSTR, IP2STR(&event->ip_info.ip));
+        esp_timer_stop(retry_timer);
+        attempt = 0;
+        if (down_since_ms != 0) {
+            stats.last_outage_ms = wifi_drv_now_ms() - down_since_ms;
+            stats.total_outage_ms += stats.last_outage_ms;
+            down_since_ms = 0;
+            ESP_LOGW(TAG, "Link restored after %u ms (outages: %u, mean: %llu ms)", stats.last_outage_ms, stats.outages,
+                     (stats.total_outage_ms / stats.outages));
+        }
+        ever_up = true;
         ip_assigned = true;
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_LOST_IP) {
         ESP_LOGW(TAG, "Lost IP Event");
-        wifi_fault_event = true;
+        wifi_drv_link_lost();
+        if (associated) {
+            esp_wifi_disconnect();  // Associated without an address, rejoin to restart DHCP (continues from the disconnect event)
+        }
     }
 }
 
@@ -42,11 +148,20 @@ uint8_t wifi_drv_connected() {
 }
 
 /**
- * @brief Test whether a lost IP or WiFi Disconnected events happened and if a restart is required
- * @return wifi_fault_event flag value
+ * @brief Test whether the link has been down for longer than in-place recovery is given (a restart is required)
+ * @return True if the link has been down for more than WIFI_REBOOT_TIMEOUT_MS
  */
 uint8_t wifi_drv_fault() {
-    return wifi_fault_event;
+    uint32_t since = down_since_ms;
+    return (since != 0) && ((wifi_drv_now_ms() - since) > WIFI_REBOOT_TIMEOUT_MS);
+}
+
+/**
+ * @brief Get the link recovery statistics
+ * @return Statistics since boot
+ */
+wifi_link_stats_t wifi_drv_link_stats() {
+    return stats;
 }
 
 /**
@@ -72,11 +187,18 @@ esp_err_t wifi_drv_init() {
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();  // Use default configuration parameters
     // Initialize WiFi, allocate resource, start WiFi task
     ESP_RETURN_ON_ERROR(esp_wifi_init(&cfg), TAG, "Failed to initialise WiFi");
+    // Keep the station config in RAM: it is rebuilt from config_store on every boot and rewritten on every reconnection attempt,
+    // which would otherwise wear the NVS and disable the flash cache on each outage
+    ESP_RETURN_ON_ERROR(esp_wifi_set_storage(WIFI_STORAGE_RAM), TAG, "Failed to set the WiFi storage");
     ESP_LOGI(TAG, "WiFi initialised sucessfully");
 
+    // Timer for backed-off reconnection attempts
+    const esp_timer_create_args_t retry_args = {.callback = wifi_drv_retry, .name = "wifi_retry"};
+    ESP_RETURN_ON_ERROR(esp_timer_create(&retry_args, &retry_timer), TAG, "Failed to create the WiFi retry timer");
+
     // Register an event handler for WIFI and IP events
     ESP_RETURN_ON_ERROR(esp_event_handler_instance_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &event_handler, NULL, NULL), TAG, "Failed to register an event handler for WiFi");
-    ESP_RETURN_ON_ERROR(esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &event_handler, NULL, NULL), TAG, "Failed to register an event handler for IP events");
+    ESP_RETURN_ON_ERROR(esp_event_handler_instance_register(IP_EVENT, ESP_EVENT_ANY_ID, &event_handler, NULL, NULL), TAG, "Failed to register an event handler for IP events");
 
     // Initialize default station as network interface instance (esp-netif)
     esp_netif_t* sta_netif = esp_netif_create_default_wifi_sta();
@@ -85,8 +207,6 @@ esp_err_t wifi_drv_init() {
     // Define WiFi Station configuration
     wifi_config_t wifi_config = {
         .sta = {
-            .ssid = WIFI_SSID,
-            .password = WIFI_PASS,
             .scan_method = WIFI_FAST_SCAN,             // Use fast scan, i.e. end after find SSID match AP
             .sort_method = WIFI_CONNECT_AP_BY_SIGNAL,  // Sort AP by RSSI
             .threshold.rssi = (int8_t)(-127),          // Weakest RSSI to be considered
@@ -94,6 +214,11 @@ esp_err_t wifi_drv_init() {
         },
     };
 
+    sys_config_t sys_cfg = config_store_get();  // SSID and password from the runtime configuration
+    strlcpy((char*)wifi_config.sta.ssid, sys_cfg.wifi_ssid, sizeof(wifi_config.sta.ssid));
+    strlcpy((char*)wifi_config.sta.password, sys_cfg.wifi_pass, sizeof(wifi_config.sta.password));
+    sta_config = wifi_config;  // Base for every (re)connection attempt
+
     // Set mode to station and set WiFi configuration
     ESP_RETURN_ON_ERROR(esp_wifi_set_mode(WIFI_MODE_STA), TAG, "Failed to set the WiFi mode to STA");
     ESP_RETURN_ON_ERROR(esp_wifi_set_config(WIFI_IF_STA, &wifi_config), TAG, "Failed to set WiFi config");
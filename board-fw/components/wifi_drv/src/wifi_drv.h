@@ -1,6 +1,6 @@
 /**
  * @file    wifi_drv.h
- * @brief   Initialize, configure and start Wi-Fi in a station mode, handle WiFi and IP events
+ * @brief   Initialize, configure and start Wi-Fi in a station mode, handle WiFi and IP events, recover the link in place
  * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
  */
 
@@ -12,7 +12,16 @@
 #include "freertos/event_groups.h"
 #include "config_macros.h"
 
+typedef struct wifi_link_stats {  // Link recovery statistics (since boot)
+    uint32_t outages;             // Number of times the link went down after having been up
+    uint32_t attempts;            // Connection attempts made to recover
+    uint32_t last_outage_ms;      // Duration of the last completed outage (disconnect to IP)
+    uint64_t total_outage_ms;     // Sum of all completed outages
+    uint8_t last_reason;          // Reason code of the last disconnect
+} wifi_link_stats_t;
+
 esp_err_t wifi_drv_init();
 uint8_t wifi_drv_connected();
 uint8_t wifi_drv_fault();
 int8_t wifi_drv_get_rssi();
+wifi_link_stats_t wifi_drv_link_stats();
@@ -1,6 +1,6 @@
 /**
  * @file    ws2812_drv.c
- * @brief   Initialize and control WS2812 RGB LED
+ * @brief   Initialize and control WS2812 RGB LED through an asynchronous LED engine task
  * @note    Based on https://github.com/JSchaenzle/ESP32-NeoPixel-WS2812-RMT
  * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
  */
@@ -9,10 +9,189 @@
 
 #define TAG "ws2812_drv"
 
-static rmt_item32_t rmt_data_buffer[WS2812_BITS_PER_CMD];  // Data buffet for the RMT peripheral
+static rmt_item32_t ws2812_lut[256][8];                      // Precomputed RMT symbols for every byte value (MSB first)
+static uint8_t ws2812_tx_buffer[WS2812_BITS_PER_CMD / 8];    // Source bytes for the RMT translator
+static xQueueHandle ws2812_queue = NULL;                     // Queue for LED engine commands
+static TaskHandle_t pxLedTask = NULL;                        // Task handle for the LED engine task
 
 /**
- * @brief Configure and initialise RMT peripheral required for communicating with WS2812
+ * @brief Populate the byte to RMT symbol lookup table
+ */
+static void ws2812_drv_build_lut(void) {
+    const rmt_item32_t bit_0 = {{{WS2812_T0H, 1, WS2812_T0L, 0}}};  // Symbol for bit 0
+    const rmt_item32_t bit_1 = {{{WS2812_T1H, 1, WS2812_T1L, 0}}};  // Symbol for bit 1
+
+    for (uint32_t byte = 0; byte < 256; byte++) {
+        for (uint32_t bit = 0; bit < 8; bit++) {
+            ws2812_lut[byte][bit] = (byte & (0x80 >> bit)) ? bit_1 : bit_0;
+        }
+    }
+}
+
+/**
+ * @brief RMT translator converting source bytes into RMT symbols using the lookup table
+ * @param src Source bytes
+ * @param dest Destination RMT items
+ * @param src_size Number of source bytes
+ * @param wanted_num Number of RMT items requested by the driver
+ * @param translated_size Number of source bytes consumed
+ * @param item_num Number of RMT items written
+ */
+static void IRAM_ATTR ws2812_drv_translate(const void *src, rmt_item32_t *dest, size_t src_size, size_t wanted_num,
+                                           size_t *translated_size, size_t *item_num) {
+    const uint8_t *bytes = (const uint8_t *)src;
+    size_t size = 0;
+    size_t num = 0;
+
+    while ((size < src_size) && ((num + 8) <= wanted_num)) {  // Copy whole bytes only (8 symbols each)
+        memcpy(&dest[num], ws2812_lut[bytes[size]], sizeof(ws2812_lut[0]));
+        num += 8;
+        size++;
+    }
+
+    *translated_size = size;
+    *item_num = num;
+}
+
+/**
+ * @brief Start a non-blocking RMT transmission of the new LED state
+ * @param led_state 32-bit uint value representing new LED state
+ * @return Error code
+ */
+static esp_err_t ws2812_drv_update(led_state_t led_state) {
+    // Previous frame finished long ago (frames are >= WS2812_FRAME_MS apart), so this only guards the buffer
+    ESP_RETURN_ON_ERROR(rmt_wait_tx_done(WS2812_RMT_CHANNEL, portMAX_DELAY), TAG, "Failed to wait for RMT TX");
+
+    ws2812_tx_buffer[0] = (uint8_t)(led_state >> 16);  // Bits 24 to 17 are sent first
+    ws2812_tx_buffer[1] = (uint8_t)(led_state >> 8);
+    ws2812_tx_buffer[2] = (uint8_t)(led_state);
+
+    // Hand the bytes to the translator and return without waiting for the transmission to end
+    ESP_RETURN_ON_ERROR(rmt_write_sample(WS2812_RMT_CHANNEL, ws2812_tx_buffer, sizeof(ws2812_tx_buffer), false), TAG, "Failed to write sample through RMT");
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Scale every colour component of the LED state
+ * @param led_state 32-bit uint value representing LED state
+ * @param scale Scale factor [0-255]
+ * @return Scaled LED state
+ */
+static led_state_t ws2812_drv_scale(led_state_t led_state, uint32_t scale) {
+    uint32_t r = (((led_state >> 16) & 0xFF) * scale) / 255;
+    uint32_t g = (((led_state >> 8) & 0xFF) * scale) / 255;
+    uint32_t b = ((led_state & 0xFF) * scale) / 255;
+
+    return ((r << 16) | (g << 8) | b);
+}
+
+/**
+ * @brief Calculate the LED state for the given pattern at the given time
+ * @param cmd Active LED engine command
+ * @param elapsed_ms Time in ms since the command became active
+ * @return LED state to be displayed
+ */
+static led_state_t ws2812_drv_render(const ws2812_cmd_t *cmd, uint32_t elapsed_ms) {
+    uint32_t phase = 0;
+
+    switch (cmd->pattern) {
+        case WS2812_PATTERN_BLINK:
+            phase = elapsed_ms % cmd->param;
+            return (phase < (cmd->param / 2)) ? cmd->color : 0;
+        case WS2812_PATTERN_BREATHE:
+            phase = elapsed_ms % cmd->param;  // Ramp up during the first half of the period and down during the second
+            phase = (phase < (cmd->param / 2)) ? phase : (cmd->param - phase);
+            return ws2812_drv_scale(cmd->color, (phase * 510) / cmd->param);
+        case WS2812_PATTERN_STATUS_CODE:
+            phase = (elapsed_ms / WS2812_CODE_SLOT_MS) % ((cmd->param * 2) + 4);  // N on/off slot pairs and 4 slots of pause
+            return ((phase < (cmd->param * 2)) && ((phase % 2) == 0)) ? cmd->color : 0;
+        case WS2812_PATTERN_SOLID:
+        case WS2812_PATTERN_FLASH:
+        default:
+            return cmd->color;
+    }
+}
+
+/**
+ * @brief LED engine task: receive commands, animate the active pattern and update the LED when its state changes
+ */
+static void ws2812_drv_task(void *param) {
+    ws2812_cmd_t active = {.pattern = WS2812_PATTERN_SOLID, .color = 0, .param = 0};  // Pattern being displayed
+    ws2812_cmd_t resume = active;                                                     // Pattern to return to after a flash
+    ws2812_cmd_t cmd;
+    TickType_t start = xTaskGetTickCount();  // Tick count at which the active pattern started
+    led_state_t shown = 0xFFFFFFFF;          // Currently displayed state (invalid to force the first update)
+
+    while (true) {
+        // Solid colour needs no animation, so sleep until the next command arrives
+        TickType_t wait = (active.pattern == WS2812_PATTERN_SOLID) ? portMAX_DELAY : pdMS_TO_TICKS(WS2812_FRAME_MS);
+
+        if (xQueueReceive(ws2812_queue, &cmd, wait) == pdTRUE) {
+            if ((cmd.pattern == WS2812_PATTERN_FLASH) && (active.pattern != WS2812_PATTERN_FLASH)) {
+                resume = active;  // Remember the pattern interrupted by the flash
+            }
+            active = cmd;
+            start = xTaskGetTickCount();
+        }
+
+        uint32_t elapsed_ms = (xTaskGetTickCount() - start) * portTICK_PERIOD_MS;
+        if ((active.pattern == WS2812_PATTERN_FLASH) && (elapsed_ms >= active.param)) {
+            active = resume;  // Flash finished, return to the previous pattern
+            start = xTaskGetTickCount();
+            elapsed_ms = 0;
+        }
+
+        led_state_t led_state = ws2812_drv_render(&active, elapsed_ms);
+        if (led_state != shown) {
+            if (ws2812_drv_update(led_state) == ESP_OK) {
+                shown = led_state;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Combine r, g and b values into one LED state considering overall brightness
+ * @param r Red color intensity as 8-bit uint value
+ * @param g Green color intensity as 8-bit uint value
+ * @param b Blue color intensity as 8-bit uint value
+ * @param brightness Brightness [0-255]
+ * @return LED state
+ */
+static led_state_t ws2812_drv_color(uint32_t r, uint32_t g, uint32_t b, uint32_t brightness) {
+    // Calculate intensities for each color considering overall brightness
+    r = (r * brightness) / 255;
+    g = (g * brightness) / 255;
+    b = (b * brightness) / 255;
+
+    r <<= 16;  // Red value is stored as bits 24 to 17
+    g <<= 8;   // Green intensity is stored in bits 16 to 9
+
+    return (((r | g) | b) & (0x00FFFFFF));
+}
+
+/**
+ * @brief Send a command to the LED engine
+ * @param pattern Pattern to be displayed
+ * @param color LED state with the brightness already applied
+ * @param param Pattern parameter (see ws2812_cmd_t)
+ * @param wait Max number of ticks to wait for space in the command queue
+ * @return Error code (ESP_ERR_TIMEOUT if the queue is full)
+ */
+static esp_err_t ws2812_drv_post(ws2812_pattern_t pattern, led_state_t color, uint32_t param, TickType_t wait) {
+    ESP_RETURN_ON_FALSE(ws2812_queue != NULL, ESP_ERR_INVALID_STATE, TAG, "LED engine not initialised");
+
+    ws2812_cmd_t cmd = {.pattern = pattern, .color = color, .param = param};
+    if (xQueueSend(ws2812_queue, &cmd, wait) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Configure and initialise RMT peripheral required for communicating with WS2812 and start the LED engine
  * @return Error code
  */
 esp_err_t ws2812_drv_init(void) {
@@ -31,64 +210,84 @@ esp_err_t ws2812_drv_init(void) {
     ESP_RETURN_ON_ERROR(rmt_config(&config), TAG, "Failed to configure RMT peripheral");
     // Initialise RMT driver
     ESP_RETURN_ON_ERROR(rmt_driver_install(config.channel, 0, 0), TAG, "Failed to initialise RMT driver");
+    // Precompute RMT symbols and register the translator used by rmt_write_sample
+    ws2812_drv_build_lut();
+    ESP_RETURN_ON_ERROR(rmt_translator_init(config.channel, ws2812_drv_translate), TAG, "Failed to initialise RMT translator");
     ESP_LOGI(TAG, "RMT (WS2812) driver initialised and running");
 
+    ws2812_queue = xQueueCreate(WS2812_CMD_QUEUE_LEN, sizeof(ws2812_cmd_t));  // Create a queue for LED commands
+    ESP_RETURN_ON_FALSE(ws2812_queue != NULL, ESP_ERR_NO_MEM, TAG, "Failed to create LED command queue");
+    xTaskCreate(ws2812_drv_task, "ws2812_task", 2048, NULL, WS2812_TASK_PRIO, &pxLedTask);  // Start the LED engine
+    ESP_LOGI(TAG, "LED engine task created");
+
     return ESP_OK;
 }
 
 /**
- * @brief Populate the RMT buffer according to the new LED state
- * @param led_state 32-bit uint value representing new LED state
+ * @brief Set WS2812 color (waits for space in the command queue, never for the RMT transmission)
+ * @param r Red color intensity as 8-bit uint value
+ * @param g Green color intensity as 8-bit uint value
+ * @param b Blue color intensity as 8-bit uint value
+ * @param brightness Brightness [0-255]
+ * @return Error code
  */
-static void ws2812_drv_set_rmt_buffer(led_state_t led_state) {
-    uint32_t bit_mask = 1 << (WS2812_BITS_PER_CMD - 1);  // Prepare bit mask for testing subsequent bits
-
-    for (uint32_t bit = 0; bit < WS2812_BITS_PER_CMD; bit++) {  // Set bits in the buffer one by one
-        uint32_t bit_set = led_state & bit_mask;                // Test if the bit of interest is set in the led_state
-
-        // Depending on the bit value (1/0) use appropriate structs for the RMT buffer
-        rmt_data_buffer[bit] = bit_set ? (rmt_item32_t){{{WS2812_T1H, 1, WS2812_T1L, 0}}} : (rmt_item32_t){{{WS2812_T0H, 1, WS2812_T0L, 0}}};
-        bit_mask >>= 1;  // Advance in the testing bit mask
-    }
+esp_err_t ws2812_drv_set_color(uint32_t r, uint32_t g, uint32_t b, uint32_t brightness) {
+    return ws2812_drv_post(WS2812_PATTERN_SOLID, ws2812_drv_color(r, g, b, brightness), 0, portMAX_DELAY);
 }
 
 /**
- * @brief Update the RMT buffer, write the data and wait for the transmission to end
- * @param led_state 32-bit uint value representing new LED state
- * @return Error code
+ * @brief Blink WS2812 with 50% duty cycle (non-blocking)
+ * @param r Red color intensity as 8-bit uint value
+ * @param g Green color intensity as 8-bit uint value
+ * @param b Blue color intensity as 8-bit uint value
+ * @param brightness Brightness [0-255]
+ * @param period_ms Blink period in ms
+ * @return Error code (ESP_ERR_TIMEOUT if the queue is full)
  */
-static esp_err_t ws2812_drv_update(led_state_t led_state) {
-    ws2812_drv_set_rmt_buffer(led_state);  // Populate the RMT buffer according to the new LED state
-
-    // Write the bits from the buffer and block until the transmission is finished
-    ESP_RETURN_ON_ERROR(rmt_write_items(WS2812_RMT_CHANNEL, rmt_data_buffer, WS2812_BITS_PER_CMD, false), TAG, "Failed to write items through RMT");
-    ESP_RETURN_ON_ERROR(rmt_wait_tx_done(WS2812_RMT_CHANNEL, portMAX_DELAY), TAG, "Failed to wait for RMT TX");
+esp_err_t ws2812_drv_blink(uint32_t r, uint32_t g, uint32_t b, uint32_t brightness, uint32_t period_ms) {
+    ESP_RETURN_ON_FALSE(period_ms > 0, ESP_ERR_INVALID_ARG, TAG, "Blink period must be non-zero");
+    return ws2812_drv_post(WS2812_PATTERN_BLINK, ws2812_drv_color(r, g, b, brightness), period_ms, 0);
+}
 
-    return ESP_OK;
+/**
+ * @brief Fade WS2812 in and out (non-blocking)
+ * @param r Red color intensity as 8-bit uint value
+ * @param g Green color intensity as 8-bit uint value
+ * @param b Blue color intensity as 8-bit uint value
+ * @param brightness Peak brightness [0-255]
+ * @param period_ms Breathe period in ms
+ * @return Error code (ESP_ERR_TIMEOUT if the queue is full)
+ */
+esp_err_t ws2812_drv_breathe(uint32_t r, uint32_t g, uint32_t b, uint32_t brightness, uint32_t period_ms) {
+    ESP_RETURN_ON_FALSE(period_ms > 0, ESP_ERR_INVALID_ARG, TAG, "Breathe period must be non-zero");
+    return ws2812_drv_post(WS2812_PATTERN_BREATHE, ws2812_drv_color(r, g, b, brightness), period_ms, 0);
 }
 
 /**
- * @brief Set WS2812 color
+ * @brief Repeatedly blink WS2812 a given number of times followed by a pause (non-blocking)
  * @param r Red color intensity as 8-bit uint value
  * @param g Green color intensity as 8-bit uint value
  * @param b Blue color intensity as 8-bit uint value
  * @param brightness Brightness [0-255]
- * @return Error code
+ * @param code Number of blinks in the sequence
+ * @return Error code (ESP_ERR_TIMEOUT if the queue is full)
  */
-esp_err_t ws2812_drv_set_color(uint32_t r, uint32_t g, uint32_t b, uint32_t brightness) {
-    // Calculate intensities for each color considering overall brightness
-    r = (r * brightness) / 255;
-    g = (g * brightness) / 255;
-    b = (b * brightness) / 255;
-
-    r <<= 16;  // Red value is stored as bits 24 to 17
-    g <<= 8;   // Green intensity is stored in bits 16 to 9
-
-    led_state_t led_state = (((r | g) | b) & (0x00FFFFFF));  // Combine r, g and b values into one uint
-
-    ESP_RETURN_ON_ERROR(ws2812_drv_update(led_state), TAG, "Failed to update the LED state");  // Update the LED
+esp_err_t ws2812_drv_status_code(uint32_t r, uint32_t g, uint32_t b, uint32_t brightness, uint32_t code) {
+    ESP_RETURN_ON_FALSE(code > 0, ESP_ERR_INVALID_ARG, TAG, "Status code must be non-zero");
+    return ws2812_drv_post(WS2812_PATTERN_STATUS_CODE, ws2812_drv_color(r, g, b, brightness), code, 0);
+}
 
-    return ESP_OK;
+/**
+ * @brief Flash WS2812 once and return to the previous pattern (non-blocking)
+ * @param r Red color intensity as 8-bit uint value
+ * @param g Green color intensity as 8-bit uint value
+ * @param b Blue color intensity as 8-bit uint value
+ * @param brightness Brightness [0-255]
+ * @param duration_ms Flash duration in ms
+ * @return Error code (ESP_ERR_TIMEOUT if the queue is full)
+ */
+esp_err_t ws2812_drv_flash(uint32_t r, uint32_t g, uint32_t b, uint32_t brightness, uint32_t duration_ms) {
+    return ws2812_drv_post(WS2812_PATTERN_FLASH, ws2812_drv_color(r, g, b, brightness), duration_ms, 0);
 }
 
 /**
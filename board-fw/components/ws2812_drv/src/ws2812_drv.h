@@ -1,6 +1,6 @@
 /**
  * @file    ws2812_drv.h
- * @brief   Initialize and control WS2812 RGB LED
+ * @brief   Initialize and control WS2812 RGB LED through an asynchronous LED engine task
  * @note    Based on https://github.com/JSchaenzle/ESP32-NeoPixel-WS2812-RMT
  * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
  */
@@ -13,10 +13,30 @@
 #include "driver/rmt.h"
 #include "esp_err.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
 
 // 32-bit uint LED State type [from LSB: Byte 0 (Blue); Byte 1 (Green); Byte 2 (Red); Byte 3 (not used)]
 typedef uint32_t led_state_t;
 
+typedef enum {                   // LED engine patterns
+    WS2812_PATTERN_SOLID,        // Constant colour
+    WS2812_PATTERN_BLINK,        // 50% duty cycle on/off with the given period
+    WS2812_PATTERN_BREATHE,      // Triangular fade in/out with the given period
+    WS2812_PATTERN_STATUS_CODE,  // Repeated sequence of N blinks followed by a pause
+    WS2812_PATTERN_FLASH,        // Single flash, then return to the previous pattern
+} ws2812_pattern_t;
+
+typedef struct ws2812_cmd {    // LED engine command data type
+    ws2812_pattern_t pattern;  // Pattern to be displayed
+    led_state_t color;         // Colour with the brightness already applied
+    uint32_t param;            // Period in ms (blink/breathe), flash duration in ms or number of blinks (status code)
+} ws2812_cmd_t;
+
 esp_err_t ws2812_drv_init(void);
 esp_err_t ws2812_drv_set_color(uint32_t r, uint32_t g, uint32_t b, uint32_t brightness);
+esp_err_t ws2812_drv_blink(uint32_t r, uint32_t g, uint32_t b, uint32_t brightness, uint32_t period_ms);
+esp_err_t ws2812_drv_breathe(uint32_t r, uint32_t g, uint32_t b, uint32_t brightness, uint32_t period_ms);
+esp_err_t ws2812_drv_status_code(uint32_t r, uint32_t g, uint32_t b, uint32_t brightness, uint32_t code);
+esp_err_t ws2812_drv_flash(uint32_t r, uint32_t g, uint32_t b, uint32_t brightness, uint32_t duration_ms);
 esp_err_t ws2812_drv_startup_animation(uint32_t brightness);
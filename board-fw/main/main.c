@@ -8,29 +8,34 @@
 #include <stdlib.h>
 #include <sys/time.h>
 
+#include "config_store.h"
+#include "dlog.h"
 #include "f_measurement.h"
 #include "freertos/FreeRTOS.h"
 #include "mqtt_drv.h"
 #include "nvs_flash.h"
 #include "systime.h"
+#include "udp_stream.h"
+#include "uploader.h"
 #include "wifi_drv.h"
 #include "ws2812_drv.h"
 
 #define TAG "app"
 
 void app_main(void) {
+    ESP_ERROR_CHECK(dlog_init());  // First, so the rings are drained from boot
     ESP_ERROR_CHECK(ws2812_drv_init());
     ESP_ERROR_CHECK(ws2812_drv_startup_animation(255));
     esp_err_t err = ESP_OK;
-    mqtt_payload_t payload;  // MQTT Payload structure
 
     err = nvs_flash_init();  // Initialize NVS
     if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
         ESP_ERROR_CHECK(nvs_flash_erase());  // Erase NVS flash memory
         err = nvs_flash_init();              // And try initialising it again
     }
+    ESP_ERROR_CHECK(config_store_init());  // Load runtime configuration from NVS
 
-    ESP_ERROR_CHECK(ws2812_drv_set_color(10, 10, 100, 60));
+    ESP_ERROR_CHECK(ws2812_drv_breathe(10, 10, 100, 255, 1000));
     ESP_ERROR_CHECK(wifi_drv_init());        // Initialise WiFi
     while (wifi_drv_connected() == false) {  // Wait for the device to connect to the AP
     }
@@ -38,18 +43,21 @@ void app_main(void) {
     ESP_ERROR_CHECK(ws2812_drv_set_color(10, 10, 100, 255));
     vTaskDelay(500 / portTICK_PERIOD_MS);
 
-    ESP_ERROR_CHECK(ws2812_drv_set_color(50, 100, 10, 60));
+    ESP_ERROR_CHECK(ws2812_drv_breathe(50, 100, 10, 255, 1000));
     ESP_ERROR_CHECK(systime_synchronise());  // Synchronise system time using SNTP
     systime_log();                           // Print synchronised time
     ESP_ERROR_CHECK(ws2812_drv_set_color(50, 100, 10, 255));
     vTaskDelay(500 / portTICK_PERIOD_MS);
     ESP_ERROR_CHECK(ws2812_drv_set_color(0, 0, 0, 255));
 
-    ESP_ERROR_CHECK(mqtt_drv_init());       // Initialise MQTT
+    ESP_ERROR_CHECK(uploader_register(&mqtt_drv_backend));    // MQTT burst upload to the cloud
+    ESP_ERROR_CHECK(uploader_register(&udp_stream_backend));  // Low-latency UDP stream to a local collector
+    ESP_ERROR_CHECK(uploader_init());                         // Initialise MQTT and UDP transports
     while (mqtt_drv_connected() != true) {  // Wait for the device to connect to the MQTT broker
     }
 
-    ESP_ERROR_CHECK(f_measurement_init(ZCO_PIN));  // Initialise frequency measurement
+    static const uint64_t zco_pins[] = ZCO_PINS;                                                // Zero-crossing input of every channel
+    ESP_ERROR_CHECK(f_measurement_init(zco_pins, sizeof(zco_pins) / sizeof(zco_pins[0])));  // Initialise frequency measurement
 
 #ifdef SYS_SELF_TEST
     ESP_LOGW(TAG, "-------- Start frequency measurement test --------\n");
@@ -57,25 +65,22 @@ void app_main(void) {
 #endif
 
     /**** Infinite measure - upload loop ****/
-    int64_t n = 0;
     while (true) {
-        if (wifi_drv_fault() == true || mqtt_drv_connected() == false) {
-            ESP_LOGE(TAG, "WiFi drv fault: %d || MQTT drv connected: %d", wifi_drv_fault(), mqtt_drv_connected());
+        if (wifi_drv_fault() == true || mqtt_drv_fault() == true) {  // Links recover in place, reboot only as a last resort
+            ESP_LOGE(TAG, "Link not recovered in place (WiFi drv fault: %d, MQTT drv fault: %d)", wifi_drv_fault(), mqtt_drv_fault());
             esp_restart();  // Reboot the microcontroller
         }
-        f_measurement_t meas = f_measurement_get_val();       // Read frequency and timestamp
-        payload.d[n % MQTT_MEAS_PER_BURST].f_hz = meas.freq;  // Copy the frequency value to payload
-        payload.d[n % MQTT_MEAS_PER_BURST].t_ms = meas.time;  // Copy the timestamp to payload
+        f_measurement_t meas = f_measurement_get_val();  // Read frequency and timestamp
 
-        if (payload.d[n % MQTT_MEAS_PER_BURST].f_hz != -1.0) {  // Check if a new value was available
-            if (((n + 1) % MQTT_MEAS_PER_BURST) == 0) {         // Send MQTT_MEAS_PER_BURST new datapoints through MQTT
-                ESP_LOGD(TAG, "Sending %d new data points to the MQTT queue", MQTT_MEAS_PER_BURST);
-                ESP_ERROR_CHECK(mqtt_drv_queue_send(payload, sizeof(payload)));
-                ESP_ERROR_CHECK(ws2812_drv_set_color(0, 250, 10, 255));
-                vTaskDelay(60 / portTICK_PERIOD_MS);
-                ESP_ERROR_CHECK(ws2812_drv_set_color(0, 0, 0, 255));
-            }
-            n++;  // Increment data point number
+        if (meas.freq != -1.0) {  // Check if a new value was available
+            uploader_sample_t sample = {.f_hz = meas.freq,
+                                        .rocof = meas.rocof,
+                                        .f_std = meas.freq_std,
+                                        .phase_deg = meas.phase,
+                                        .phase_diff_deg = meas.phase_diff,
+                                        .channel = meas.channel,
+                                        .t_us = meas.time_us};
+            uploader_push(&sample);  // Hand the sample over to every transport (never blocks)
         }
     }
 }
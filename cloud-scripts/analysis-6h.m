@@ -9,9 +9,7 @@ timezone = 'Europe/Warsaw'; % Only for display (timestamps stored as GMT)
 fieldID1 = 1;   % Frequency field
 fieldID2 = 2;   % Timestamp field
 fieldID3 = 3;   % Measurement-per-packet field
-
-% Processing, filtering, analysis and visualisation config 
-max_f_diff = 0.01; % Set max freq diff to 10 mHz (i.e. max ROC = 0.05 Hz/s)
+fieldID5 = 5;   % RoCoF field (Kalman-filtered on the device)
 
 
 % -------------------- Reading and unpacking received data -------------------- %
@@ -22,10 +20,12 @@ no_datapoints = thingSpeakRead(readChannelID, Field=fieldID3, NumPoints=1)
 % Read Data csv packets using thingSpeak API and convert the output into numeric arrays
 tS_frequency_field = thingSpeakRead(readChannelID, Field=fieldID1, NumPoints=no_of_packets, OutputFormat='table');
 tS_timestamp_field = thingSpeakRead(readChannelID, Field=fieldID2, NumPoints=no_of_packets, OutputFormat='table');
+tS_rocof_field = thingSpeakRead(readChannelID, Field=fieldID5, NumPoints=no_of_packets, OutputFormat='table');
 
 % Convert frequency and timestamp field datapoints to an array of strings
 frequency_str = string(tS_frequency_field.Frequency);
 timestamp_str = string(tS_timestamp_field.Time);
+rocof_str = string(tS_rocof_field{:, end});
 
 % Unpack and store the numeric data (for the first packet)
 [plot_freq, plot_time] = unpack(frequency_str(1), timestamp_str(1), no_datapoints);
@@ -38,30 +38,13 @@ for i = 2:no_of_packets
 end
 
 
-% -------------------- Initial data processing and filtering -------------------- %
-
-% Limit the max absolute difference between two points
-for i = 1:((no_of_packets*no_datapoints)-1)
-    if( (abs( (plot_freq((i+1))-plot_freq(i)) )  > max_f_diff) )
-        if (plot_freq((i+1)) > plot_freq(i))
-            plot_freq((i+1)) = plot_freq(i) + max_f_diff;
-        else
-            plot_freq((i+1)) = plot_freq(i) - max_f_diff;
-        end
-    end
-end
-
-
 % -------------------- Data analysis & visualisation -------------------- %
 
-% Calculate maximum RoCoF (df/dt)
-dt = 1; % Set dt value [s]
+% Maximum RoCoF, estimated on the device (no slew limiting needed, outliers are rejected before upload)
 RoCoF_max = 0; % Set initial value of RoCoF to 0 Hz/s
-for i = 1:((no_of_packets*no_datapoints)-(5*dt))
-    RoCoF = abs(plot_freq((i+(5*dt))) - plot_freq(i)); % df between (5*dt) points (since 5 meas/s)
-    if(RoCoF > RoCoF_max) % Examine if a new max has been calculated
-        RoCoF_max = RoCoF;
-    end
+for i = 1:no_of_packets
+    [rocof_num_arr, ~] = unpack(rocof_str(i), timestamp_str(i), no_datapoints);
+    RoCoF_max = max(RoCoF_max, max(abs(rocof_num_arr)));
 end
 
 p1 = plot(0:100, 0:100);
@@ -78,7 +61,7 @@ t2 = text(5, 60, "Max frequency: " + round(max(plot_freq),3) + " Hz");
 t3 = text(5, 48, "Min frequency: " + round(min(plot_freq),3) + " Hz");
 t4 = text(5, 30, "Peak difference: " + round(max(plot_freq)-min(plot_freq),3) + " Hz (Max - Min)");
 t5 = text(5, 19, "Max RoCoF: " + round(RoCoF_max,2) + " Hz/s");
-t6 = text(5, 10, "(df/dt, for dt =1 s)");
+t6 = text(5, 10, "(df/dt, device estimate)");
 
 t1.Color = "#c23728";
 t2.Color = "#c23728";
@@ -10,9 +10,6 @@ fieldID1 = 1;   % Frequency field
 fieldID2 = 2;   % Timestamp field
 fieldID3 = 3;   % Measurement-per-packet field
 
-% Processing, filtering, analysis and visualisation config 
-max_f_diff = 0.01; % Set max freq diff to 10 mHz (i.e. max ROC = 50 mHz/s)
-
 
 % -------------------- Reading and unpacking received data -------------------- %
 
@@ -38,20 +35,6 @@ for i = 2:no_of_packets
 end
 
 
-% -------------------- Initial data processing and filtering -------------------- %
-
-% Limit the max absolute difference between two points
-for i = 1:((no_of_packets*no_datapoints)-1)
-    if( (abs( (plot_freq((i+1))-plot_freq(i)) )  > max_f_diff) )
-        if (plot_freq((i+1)) > plot_freq(i))
-            plot_freq((i+1)) = plot_freq(i) + max_f_diff;
-        else
-            plot_freq((i+1)) = plot_freq(i) - max_f_diff;
-        end
-    end
-end
-
-
 % -------------------- Data analysis -------------------- %
 
 mov_avg_step = no_of_packets;
@@ -0,0 +1,66 @@
+/**
+ * @file    c37118_decode.cpp
+ * @brief   Decode a stream of C37.118-style data frames published by HertzNet units into CSV
+ * @note    Usage: mosquitto_sub -t hertznet/pmu/1 | c37118_decode [file]
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "c37118.h"
+
+/**
+ * @brief Print a decoded frame as a CSV row
+ * @param frame Decoded data frame
+ */
+static void print_frame(const c37118_data_t &frame) {
+    double angle_deg = frame.angle * 180.0 / M_PI;
+    printf("%u,%u.%06u,0x%x,0x%04x,%.3f,%.4f,%.4f\n", frame.idcode, frame.soc, frame.fracsec, frame.time_quality & 0x0F, frame.stat, angle_deg,
+           frame.freq, frame.dfreq);
+}
+
+int main(int argc, char **argv) {
+    FILE *in = stdin;
+    if (argc > 1) {
+        in = fopen(argv[1], "rb");
+        if (in == nullptr) {
+            perror(argv[1]);
+            return 1;
+        }
+    }
+
+    std::vector<uint8_t> buf;  // Bytes received but not yet decoded
+    uint8_t chunk[4096];
+    size_t frames = 0;   // Number of valid frames
+    size_t skipped = 0;  // Number of bytes skipped while searching for the SYNC word
+
+    printf("idcode,utc_s,time_quality,stat,angle_deg,freq_hz,rocof_hz_s\n");
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0) {
+        buf.insert(buf.end(), chunk, chunk + n);
+
+        size_t pos = 0;
+        while ((buf.size() - pos) >= C37118_DATA_FRAME_SIZE) {
+            c37118_data_t frame;
+            if (c37118_decode(&buf[pos], buf.size() - pos, &frame)) {
+                print_frame(frame);
+                frames++;
+                pos += C37118_DATA_FRAME_SIZE;
+            } else {  // Not a valid frame at this offset, resynchronise on the next byte
+                skipped++;
+                pos++;
+            }
+        }
+        buf.erase(buf.begin(), buf.begin() + pos);
+    }
+
+    fprintf(stderr, "Decoded %zu frames, skipped %zu bytes\n", frames, skipped + buf.size());
+    if (in != stdin) {
+        fclose(in);
+    }
+
+    return 0;
+}
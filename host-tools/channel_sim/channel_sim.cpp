@@ -0,0 +1,341 @@
+/**
+ * @file    channel_sim.cpp
+ * @brief   Drive the firmware multi-channel measurement (f_channel) with simulated three-phase zero-crossings on all inputs at once
+ * @note    Usage: channel_sim [-n channels] [-s seconds] [-p pulses_per_meas] [-j jitter_us] [-o out.csv] [--bench N]
+ *          Checks frequency tracking and inter-channel phase differences, that every channel produces bit for bit what a
+ *          single-input board would, and (--bench) how the per-edge cost scales with the number of channels
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "f_calc.h"
+#include "f_channel.h"
+#include "f_estimator.h"
+
+#define TIMER_HZ 40000000                // Device timer frequency (80 MHz APB / TIMER_DIVIDER)
+#define NOMINAL_HZ 50                    // F_NOMINAL_HZ
+#define UTC_START_US 1700000000123456LL  // UTC time at timer count 0
+#define ANCHOR_LATENCY_TICKS (30 * 40)   // Anchor sampled by the measurement task ~30 us after the edge
+#define WARMUP_US 2000000                // Outputs of the first seconds are not scored (estimator start-up)
+#define PHASE_DIFF_TOL_DEG 0.5           // Max mean phase difference error accepted
+
+struct sim_params {              // Simulated grid
+    double mod_hz = 0.05;        // Frequency deviation amplitude [Hz]
+    double mod_period_s = 30.0;  // Frequency deviation period [s]
+    double jitter_us = 10.0;     // Zero-crossing timing noise (1 sigma) [us]
+};
+
+struct sim_edge {     // Zero-crossing as queued by the ISR dispatcher
+    uint64_t tick;    // Timer stamp
+    uint8_t channel;  // Input
+};
+
+struct channel_stats {          // Scoring of one channel
+    size_t outputs = 0;         // Outputs produced
+    size_t scored = 0;          // Outputs after the warm-up
+    double freq_err_sq = 0.0;   // Sum of squared frequency errors [Hz^2]
+    size_t diff_n = 0;          // Outputs with a phase difference
+    size_t diff_nan = 0;        // Outputs after the warm-up without a phase difference
+    double diff_err_sum = 0.0;  // Sum of phase difference errors [deg]
+    double diff_err_max = 0.0;  // Largest phase difference error [deg]
+    bool started = false;       // Estimator produced its first output
+    size_t restarts = 0;        // Estimator restarts after the first output (long windows must not exceed the max gap)
+};
+
+/**
+ * @brief Simulated grid frequency at time t
+ */
+static double sim_freq(const sim_params &p, double t) {
+    return NOMINAL_HZ + (p.mod_hz * sin(2.0 * M_PI * t / p.mod_period_s));
+}
+
+/**
+ * @brief Simulated grid phase in cycles at time t (integral of sim_freq)
+ */
+static double sim_cycles(const sim_params &p, double t) {
+    double k = p.mod_hz * p.mod_period_s / (2.0 * M_PI);
+    return 0.37 + (NOMINAL_HZ * t) + k - (k * cos(2.0 * M_PI * t / p.mod_period_s));
+}
+
+/**
+ * @brief Wrap an angle into (-180, 180]
+ */
+static double wrap_deg(double deg) {
+    deg = fmod(deg, 360.0);
+    if (deg <= -180.0) {
+        deg += 360.0;
+    } else if (deg > 180.0) {
+        deg -= 360.0;
+    }
+    return deg;
+}
+
+/**
+ * @brief Phase difference a channel should report: inputs are consecutive phases, each lagging the previous one by 120 deg
+ */
+static double expected_diff(uint8_t channel) {
+    return wrap_deg(-120.0 * (double)channel) + 0.0;  // No negative zero
+}
+
+/**
+ * @brief Compare outputs bit for bit (field by field, structure padding is undefined)
+ */
+static bool same_bits(float a, float b) {
+    return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+static bool same_output(const f_channel_out_t &out, const f_calc_out_t &calc, const f_est_out_t &est) {
+    return same_bits(out.calc.freq, calc.freq) && same_bits(out.calc.rocof, calc.rocof) && same_bits(out.calc.phase, calc.phase) &&
+           (out.calc.time_us == calc.time_us) && same_bits(out.est.freq, est.freq) && same_bits(out.est.rocof, est.rocof) &&
+           same_bits(out.est.freq_var, est.freq_var) && same_bits(out.est.rocof_var, est.rocof_var) && (out.est.status == est.status);
+}
+
+/**
+ * @brief Generate the rising zero-crossings of all inputs in the order the ISR dispatcher would queue them
+ * @param p Simulated grid
+ * @param channels Number of inputs
+ * @param seconds Duration
+ * @return Edges of all inputs, sorted by timer stamp
+ */
+static std::vector<sim_edge> generate(const sim_params &p, uint8_t channels, double seconds) {
+    std::vector<sim_edge> edges;
+    std::mt19937 rng(1);
+    std::normal_distribution<double> jitter(0.0, p.jitter_us * 1e-6);
+
+    for (uint8_t ch = 0; ch < channels; ch++) {
+        // Input ch rises through zero where cos(2 pi (cycles - ch / 3)) does: cycles = n + ch / 3 - 1/4
+        double offset = ((double)ch / 3.0) - 0.25;
+        double n = ceil(sim_cycles(p, 0.0) - offset);
+        double t = 0.0;
+        while (true) {
+            double target = n + offset;
+            for (int i = 0; i < 4; i++) {  // Newton iterations from the previous crossing
+                t -= (sim_cycles(p, t) - target) / sim_freq(p, t);
+            }
+            if (t > seconds) {
+                break;
+            }
+            double t_edge = t + jitter(rng);
+            edges.push_back({(uint64_t)llround(t_edge * TIMER_HZ), ch});
+            n += 1.0;
+        }
+    }
+
+    std::stable_sort(edges.begin(), edges.end(), [](const sim_edge &a, const sim_edge &b) { return a.tick < b.tick; });
+    return edges;
+}
+
+/**
+ * @brief Timer/UTC anchor the measurement task would sample for an edge
+ */
+static f_calc_anchor_t sim_anchor(uint64_t tick) {
+    uint64_t anchor_tick = tick + ANCHOR_LATENCY_TICKS;
+    f_calc_anchor_t anchor = {anchor_tick - (anchor_tick % (TIMER_HZ / 1000000)), UTC_START_US + (int64_t)(anchor_tick / (TIMER_HZ / 1000000))};
+    return anchor;
+}
+
+/**
+ * @brief Estimator tuning of the firmware (config_macros.h defaults)
+ */
+static f_estimator_cfg_t estimator_cfg(uint32_t pulses_per_meas) {
+    f_estimator_cfg_t cfg;
+    cfg.meas_var = f_estimator_meas_var(pulses_per_meas, NOMINAL_HZ, 10.0f);
+    cfg.rocof_psd = 0.0025f;
+    cfg.gate_sigma = 4.0f;
+    cfg.reject_max = 3;
+    cfg.f_min = 45.0f;
+    cfg.f_max = 55.0f;
+    cfg.max_gap_us = f_estimator_max_gap_us(pulses_per_meas, NOMINAL_HZ, 2000000, 3);
+    return cfg;
+}
+
+/**
+ * @brief Run all edges through the multi-channel engine and score the outputs
+ * @return Number of outputs that differ from an independent single-input run of the same channel
+ */
+static size_t run_check(const sim_params &p, const std::vector<sim_edge> &edges, uint8_t channels, uint32_t pulses_per_meas, FILE *csv,
+                        std::vector<channel_stats> &stats) {
+    f_estimator_cfg_t cfg = estimator_cfg(pulses_per_meas);
+    f_channels_t chs;
+    f_channels_init(&chs, channels, pulses_per_meas, TIMER_HZ, NOMINAL_HZ, &cfg);
+
+    std::vector<f_calc_t> solo_calc(channels);  // The same inputs measured one board per phase
+    std::vector<f_estimator_t> solo_est(channels);
+    for (uint8_t ch = 0; ch < channels; ch++) {
+        f_calc_init(&solo_calc[ch], pulses_per_meas, TIMER_HZ, NOMINAL_HZ);
+        f_estimator_init(&solo_est[ch], &cfg);
+    }
+
+    stats.assign(channels, channel_stats());
+    size_t mismatches = 0;
+    for (const sim_edge &e : edges) {
+        f_calc_anchor_t anchor = sim_anchor(e.tick);
+        f_channel_out_t out;
+        bool closed = f_channels_edge(&chs, e.channel, e.tick, &anchor, &out);
+
+        f_calc_out_t solo_out;
+        f_est_out_t solo_est_out;
+        bool solo_closed = f_calc_edge(&solo_calc[e.channel], e.tick, &anchor, &solo_out);
+        if (solo_closed) {
+            f_estimator_update(&solo_est[e.channel], solo_out.freq, solo_out.time_us, &solo_est_out);
+        }
+        if (closed != solo_closed) {
+            mismatches++;
+            continue;
+        }
+        if (closed == false) {
+            continue;
+        }
+        if (same_output(out, solo_out, solo_est_out) == false) {
+            mismatches++;
+        }
+
+        channel_stats &st = stats[e.channel];
+        st.outputs++;
+        if (chs.ch[e.channel].est.started == false) {
+            continue;
+        }
+        if (out.est.status == F_EST_RESET) {
+            st.restarts += st.started ? 1 : 0;
+            st.started = true;
+        }
+        double t = (double)(out.calc.time_us - UTC_START_US) / 1e6;
+        double true_freq = sim_freq(p, t);
+        if (csv != nullptr) {
+            fprintf(csv, "%u,%lld,%.5f,%.5f,%.4f,%.5f,%.2f,%.3f\n", e.channel, (long long)out.calc.time_us, out.est.freq, true_freq, out.est.rocof,
+                    sqrt(out.est.freq_var), out.calc.phase, out.phase_diff);
+        }
+        if ((out.calc.time_us - UTC_START_US) < WARMUP_US) {
+            continue;
+        }
+
+        st.scored++;
+        st.freq_err_sq += (out.est.freq - true_freq) * (out.est.freq - true_freq);
+        if (std::isnan(out.phase_diff)) {
+            st.diff_nan++;
+        } else {
+            double err = fabs(wrap_deg(out.phase_diff - expected_diff(e.channel)));
+            st.diff_n++;
+            st.diff_err_sum += err;
+            st.diff_err_max = std::max(st.diff_err_max, err);
+        }
+    }
+
+    return mismatches;
+}
+
+/**
+ * @brief Measure the processing rate of the multi-channel engine for 1..channels inputs
+ */
+static void run_bench(const sim_params &p, uint8_t channels, double seconds, uint32_t pulses_per_meas, size_t rounds) {
+    f_estimator_cfg_t cfg = estimator_cfg(pulses_per_meas);
+
+    fprintf(stderr, "Benchmark: %.0f s of mains per round, %zu rounds\n", seconds, rounds);
+    for (uint8_t n = 1; n <= channels; n++) {
+        std::vector<sim_edge> edges = generate(p, n, seconds);
+        std::vector<f_calc_anchor_t> anchors(edges.size());
+        for (size_t i = 0; i < edges.size(); i++) {
+            anchors[i] = sim_anchor(edges[i].tick);
+        }
+
+        size_t outputs = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t r = 0; r < rounds; r++) {
+            f_channels_t chs;
+            f_channels_init(&chs, n, pulses_per_meas, TIMER_HZ, NOMINAL_HZ, &cfg);
+            for (size_t i = 0; i < edges.size(); i++) {
+                f_channel_out_t out;
+                outputs += f_channels_edge(&chs, edges[i].channel, edges[i].tick, &anchors[i], &out) ? 1 : 0;
+            }
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double edges_total = (double)edges.size() * (double)rounds;
+
+        fprintf(stderr, "  %u channel(s): %.1f M edges/s, %.1f ns/edge, %.0fx real time (%zu outputs)\n", n, edges_total / elapsed / 1e6,
+                elapsed * 1e9 / edges_total, (edges_total / elapsed) / ((double)edges.size() / seconds), outputs);
+    }
+}
+
+int main(int argc, char **argv) {
+    sim_params p;
+    int channels = 3;
+    double seconds = 60.0;
+    uint32_t pulses_per_meas = 10;
+    const char *csv_path = nullptr;
+    size_t bench = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "-n") == 0) && (i + 1 < argc)) {
+            channels = atoi(argv[++i]);
+        } else if ((strcmp(argv[i], "-s") == 0) && (i + 1 < argc)) {
+            seconds = atof(argv[++i]);
+        } else if ((strcmp(argv[i], "-p") == 0) && (i + 1 < argc)) {
+            pulses_per_meas = (uint32_t)atol(argv[++i]);
+        } else if ((strcmp(argv[i], "-j") == 0) && (i + 1 < argc)) {
+            p.jitter_us = atof(argv[++i]);
+        } else if ((strcmp(argv[i], "-o") == 0) && (i + 1 < argc)) {
+            csv_path = argv[++i];
+        } else if ((strcmp(argv[i], "--bench") == 0) && (i + 1 < argc)) {
+            bench = (size_t)atol(argv[++i]);
+        } else {
+            channels = 0;  // Invalid argument, print usage
+            break;
+        }
+    }
+    if ((channels < 1) || (channels > F_CHANNELS_MAX) || (seconds <= 0.0) || (pulses_per_meas == 0)) {
+        fprintf(stderr, "Usage: %s [-n channels (1-%d)] [-s seconds] [-p pulses_per_meas] [-j jitter_us] [-o out.csv] [--bench N]\n", argv[0],
+                F_CHANNELS_MAX);
+        return 1;
+    }
+
+    if (bench > 0) {
+        run_bench(p, (uint8_t)channels, seconds, pulses_per_meas, bench);
+        return 0;
+    }
+
+    FILE *csv = nullptr;
+    if (csv_path != nullptr) {
+        csv = fopen(csv_path, "w");
+        if (csv == nullptr) {
+            perror(csv_path);
+            return 1;
+        }
+        fprintf(csv, "channel,t_us,freq_hz,true_freq_hz,rocof_hz_s,freq_std_hz,phase_deg,phase_diff_deg\n");
+    }
+
+    std::vector<sim_edge> edges = generate(p, (uint8_t)channels, seconds);
+    std::vector<channel_stats> stats;
+    size_t mismatches = run_check(p, edges, (uint8_t)channels, pulses_per_meas, csv, stats);
+    if (csv != nullptr) {
+        fclose(csv);
+    }
+
+    bool ok = (mismatches == 0);
+    fprintf(stderr, "Simulated %d channel(s) x %.0f s, %zu edges, %u pulses per measurement, %.1f us jitter\n", channels, seconds, edges.size(),
+            pulses_per_meas, p.jitter_us);
+    for (int ch = 0; ch < channels; ch++) {
+        const channel_stats &st = stats[ch];
+        double freq_rms_mhz = (st.scored > 0) ? (sqrt(st.freq_err_sq / (double)st.scored) * 1000.0) : 0.0;
+        fprintf(stderr, "  ch %d: %zu outputs, freq RMS error %.2f mHz, estimator restarts %zu", ch, st.outputs, freq_rms_mhz, st.restarts);
+        ok = ok && (st.restarts == 0);
+        if (ch != F_CHANNEL_REF) {
+            fprintf(stderr, ", phase diff %.1f deg expected: mean error %.3f deg, max %.3f deg, unavailable %zu", expected_diff((uint8_t)ch),
+                    (st.diff_n > 0) ? (st.diff_err_sum / (double)st.diff_n) : 0.0, st.diff_err_max, st.diff_nan);
+            ok = ok && (st.diff_n > 0) && ((st.diff_err_sum / (double)st.diff_n) <= PHASE_DIFF_TOL_DEG);
+        }
+        fprintf(stderr, "\n");
+    }
+    fprintf(stderr, "Channel isolation: %zu outputs differ from single-input runs\n", mismatches);
+    fprintf(stderr, "%s\n", ok ? "PASS" : "FAIL");
+
+    return ok ? 0 : 2;
+}
@@ -0,0 +1,213 @@
+/**
+ * @file    dlog_decode.cpp
+ * @brief   Decode the binary deferred log frames (DLOG_OUTPUT_BINARY) of a HertzNet unit into text log lines
+ * @note    Usage: idf.py monitor | dlog_decode build/board-fw.elf [capture]
+ *          Format strings and tags are looked up by address in the firmware ELF, other console output is passed through
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "dlog_fmt.h"
+
+#define FRAME_OVERHEAD 4  // Sync bytes, word count and checksum
+
+typedef struct section {  // Loaded ELF section holding data (format strings and tags live in .rodata/.flash.rodata)
+    uint32_t addr;        // Device address
+    uint32_t size;        // Size in bytes
+    uint32_t offset;      // Offset in the ELF file
+} section_t;
+
+static std::vector<uint8_t> elf;        // Firmware image
+static std::vector<section_t> sections;  // Allocated PROGBITS sections of the image
+
+static uint32_t rd16(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8);
+}
+
+static uint32_t rd32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/**
+ * @brief Load the firmware ELF (32-bit, little-endian) and collect its allocated data sections
+ * @param path ELF file
+ * @return True on success
+ */
+static bool load_elf(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (f == nullptr) {
+        perror(path);
+        return false;
+    }
+    uint8_t buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        elf.insert(elf.end(), buf, buf + n);
+    }
+    fclose(f);
+
+    if ((elf.size() < 52) || (memcmp(elf.data(), "\x7f" "ELF", 4) != 0) || (elf[4] != 1) || (elf[5] != 1)) {
+        fprintf(stderr, "%s: not a 32-bit little-endian ELF file\n", path);
+        return false;
+    }
+
+    uint32_t shoff = rd32(&elf[32]);
+    uint32_t shentsize = rd16(&elf[46]);
+    uint32_t shnum = rd16(&elf[48]);
+    if ((shentsize < 40) || (((uint64_t)shoff + ((uint64_t)shentsize * shnum)) > elf.size())) {
+        fprintf(stderr, "%s: invalid section header table\n", path);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < shnum; i++) {
+        const uint8_t *sh = &elf[shoff + (i * shentsize)];
+        uint32_t type = rd32(&sh[4]);
+        uint32_t flags = rd32(&sh[8]);
+        section_t sec = {rd32(&sh[12]), rd32(&sh[20]), rd32(&sh[16])};
+        if ((type == 1) && ((flags & 0x2) != 0) && (((uint64_t)sec.offset + sec.size) <= elf.size())) {  // SHT_PROGBITS, SHF_ALLOC
+            sections.push_back(sec);
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Look up a string by its device address
+ * @return String in the ELF image, nullptr if the address is not in a data section or the string is not terminated
+ */
+static const char *lookup_string(uint32_t addr) {
+    for (const section_t &sec : sections) {
+        if ((addr >= sec.addr) && ((addr - sec.addr) < sec.size)) {
+            const char *str = (const char *)&elf[sec.offset + (addr - sec.addr)];
+            size_t max_len = sec.size - (addr - sec.addr);
+            return (memchr(str, '\0', max_len) != nullptr) ? str : nullptr;
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * @brief Print a decoded record as an ESP_LOG-style line
+ * @param words Record words
+ * @param n_words Record length in words
+ */
+static void print_record(const uint32_t *words, size_t n_words) {
+    const char *fmt = lookup_string(words[2]);
+    const char *tag = lookup_string(words[3]);
+    char msg[512];
+    char tag_buf[16];
+
+    if (tag == nullptr) {
+        snprintf(tag_buf, sizeof(tag_buf), "0x%08x", words[3]);
+        tag = tag_buf;
+    }
+    if (fmt != nullptr) {
+        dlog_format(msg, sizeof(msg), fmt, &words[DLOG_HDR_WORDS], n_words - DLOG_HDR_WORDS);
+    } else {  // Firmware and ELF do not match: show the raw record
+        int pos = snprintf(msg, sizeof(msg), "<unknown format 0x%08x>", words[2]);
+        for (size_t i = DLOG_HDR_WORDS; (i < n_words) && (pos > 0) && ((size_t)pos < sizeof(msg)); i++) {
+            pos += snprintf(&msg[pos], sizeof(msg) - pos, " %08x", words[i]);
+        }
+    }
+
+    printf("%c (%u) %s: %s%s\n", dlog_level_char(DLOG_INFO_LEVEL(words[0])), words[1], tag, msg, DLOG_INFO_TRUNCATED(words[0]) ? " [truncated]" : "");
+}
+
+/**
+ * @brief Check for a valid frame at the start of buf
+ * @return Frame length, 0 if there is none, -1 if more bytes are needed to decide
+ */
+static int check_frame(const uint8_t *buf, size_t len) {
+    if ((buf[0] != DLOG_FRAME_SYNC0) || ((len > 1) && (buf[1] != DLOG_FRAME_SYNC1))) {
+        return 0;
+    }
+    if (len < 3) {
+        return -1;
+    }
+
+    size_t n_words = buf[2];
+    if ((n_words < DLOG_HDR_WORDS) || (n_words > (DLOG_HDR_WORDS + DLOG_ARG_WORDS_MAX))) {
+        return 0;
+    }
+    size_t frame_len = FRAME_OVERHEAD + (n_words * 4);
+    if (len < frame_len) {
+        return -1;
+    }
+
+    uint8_t sum = 0;
+    for (size_t i = 2; i < frame_len; i++) {
+        sum += buf[i];
+    }
+    return ((sum == 0) && (DLOG_INFO_WORDS(rd32(&buf[3])) == n_words)) ? (int)frame_len : 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <firmware.elf> [capture]\n", argv[0]);
+        return 1;
+    }
+    if (load_elf(argv[1]) == false) {
+        return 1;
+    }
+
+    FILE *in = stdin;
+    if (argc > 2) {
+        in = fopen(argv[2], "rb");
+        if (in == nullptr) {
+            perror(argv[2]);
+            return 1;
+        }
+    }
+
+    std::vector<uint8_t> buf;  // Bytes received but not yet decoded
+    uint8_t chunk[4096];
+    size_t records = 0;  // Number of decoded records
+    size_t unknown = 0;  // Number of records with a format string not found in the ELF
+    size_t n;
+    bool eof = false;
+    while (eof == false) {
+        n = fread(chunk, 1, sizeof(chunk), in);
+        if (n > 0) {
+            buf.insert(buf.end(), chunk, chunk + n);
+        } else {
+            eof = true;
+        }
+
+        size_t pos = 0;
+        while (pos < buf.size()) {
+            int frame_len = check_frame(&buf[pos], buf.size() - pos);
+            if (frame_len > 0) {
+                uint32_t words[DLOG_HDR_WORDS + DLOG_ARG_WORDS_MAX];
+                size_t n_words = buf[pos + 2];
+                for (size_t i = 0; i < n_words; i++) {
+                    words[i] = rd32(&buf[pos + 3 + (i * 4)]);
+                }
+                print_record(words, n_words);
+                records++;
+                unknown += (lookup_string(words[2]) == nullptr) ? 1 : 0;
+                pos += (size_t)frame_len;
+            } else if ((frame_len < 0) && (eof == false)) {  // Frame may continue in the next read
+                break;
+            } else {  // Plain console output (boot messages, ESP_LOG), passed through up to the next possible frame
+                const uint8_t *next = (const uint8_t *)memchr(&buf[pos + 1], DLOG_FRAME_SYNC0, buf.size() - pos - 1);
+                size_t text_len = (next != nullptr) ? (size_t)(next - &buf[pos]) : (buf.size() - pos);
+                fwrite(&buf[pos], 1, text_len, stdout);
+                pos += text_len;
+            }
+        }
+        buf.erase(buf.begin(), buf.begin() + pos);
+        fflush(stdout);
+    }
+
+    fprintf(stderr, "Decoded %zu records (%zu with unknown format)\n", records, unknown);
+    if (in != stdin) {
+        fclose(in);
+    }
+
+    return 0;
+}
@@ -0,0 +1,197 @@
+/**
+ * @file    fleet_codec.cpp
+ * @brief   Uplink payloads of an emulated HertzNet unit, byte-for-byte what the firmware sends (ThingSpeak MQTT text, C37.118 frames,
+ *          UDP stream datagrams)
+ * @note    Formatting mirrors mqtt_drv_send(), mqtt_drv_send_pmu() and udp_stream; keep them in step when the firmware changes
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#include "fleet_codec.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#include "c37118.h"
+#include "hz_stream.h"
+
+#define TS_EPOCH_MS 1600000000000ULL  // Offset of the compact ThingSpeak time field
+#define TS_STATUS_KEY "No. "          // Upload counter in the status field
+
+/**
+ * @brief ThingSpeak MQTT message, as built by mqtt_drv_send()
+ * @param samples Samples of the burst
+ * @param n Number of samples
+ * @param upload_no Upload counter of the unit (starts at 1)
+ * @param pulses_per_meas Zero-crossings per measurement
+ * @param channels Zero-crossing inputs of the unit (status field MPS counts all of them)
+ * @return Message text
+ */
+std::string fleet_encode_thingspeak(const fleet_sample *samples, size_t n, uint64_t upload_no, uint32_t pulses_per_meas, uint8_t channels) {
+    std::string msg = "field1=";
+    char str[96];
+
+    msg.reserve(200 + (n * 55));
+    for (size_t i = 0; i < n; i++) {
+        snprintf(str, sizeof(str), "%.3lf,", (double)samples[i].f_hz);
+        msg += str;
+    }
+    msg += "&field2=";
+    for (size_t i = 0; i < n; i++) {
+        snprintf(str, sizeof(str), "%llu,", (unsigned long long)(((samples[i].t_us / 1000) - TS_EPOCH_MS) / 100));
+        msg += str;
+    }
+    snprintf(str, sizeof(str), "&field3=%zu", n);
+    msg += str;
+    msg += "&field4=";
+    for (size_t i = 0; i < n; i++) {
+        snprintf(str, sizeof(str), "%.1lf,", (double)samples[i].phase_deg);
+        msg += str;
+    }
+    msg += "&field5=";
+    for (size_t i = 0; i < n; i++) {
+        snprintf(str, sizeof(str), "%.3lf,", (double)samples[i].rocof);
+        msg += str;
+    }
+    msg += "&field6=";
+    for (size_t i = 0; i < n; i++) {
+        snprintf(str, sizeof(str), "%.1lf,", (double)(samples[i].f_std * 1000.0f));
+        msg += str;
+    }
+    msg += "&field7=";
+    for (size_t i = 0; i < n; i++) {
+        snprintf(str, sizeof(str), "%u,", samples[i].channel);
+        msg += str;
+    }
+    msg += "&field8=";
+    for (size_t i = 0; i < n; i++) {
+        if (std::isnan(samples[i].phase_diff_deg)) {
+            msg += ",";
+        } else {
+            snprintf(str, sizeof(str), "%.1lf,", (double)samples[i].phase_diff_deg);
+            msg += str;
+        }
+    }
+    snprintf(str, sizeof(str), "&status=Device OK, " TS_STATUS_KEY "%03llu, MPB: %zu, MPS: %u, CH: %u", (unsigned long long)upload_no, n,
+             (50 / pulses_per_meas) * channels, channels);
+    msg += str;
+
+    return msg;
+}
+
+/**
+ * @brief Outage statistics appended to the status field of the first burst after an outage, as built by mqtt_drv_outage_end()
+ * @param outage_ms Time from the connection loss to the upload resuming
+ * @param lost Samples dropped during the outage (backlog full)
+ * @param outages Outages of the unit so far
+ * @return Status field suffix
+ */
+std::string fleet_encode_link_note(uint32_t outage_ms, uint32_t lost, uint32_t outages) {
+    char str[64];
+    snprintf(str, sizeof(str), ", Outage: %u ms, Lost: %u, Outages: %u", outage_ms, lost, outages);
+    return str;
+}
+
+/**
+ * @brief Binary C37.118 data frames, as built by mqtt_drv_send_pmu() (one data stream per channel)
+ * @param samples Samples of the burst
+ * @param n Number of samples
+ * @param idcode_base Data stream ID of channel 0
+ * @return Concatenated frames
+ */
+std::string fleet_encode_pmu(const fleet_sample *samples, size_t n, uint16_t idcode_base) {
+    std::string frames(n * C37118_DATA_FRAME_SIZE, '\0');
+    size_t len = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        c37118_data_t frame = {};
+        frame.idcode = (uint16_t)(idcode_base + samples[i].channel);
+        frame.soc = (uint32_t)(samples[i].t_us / 1000000);
+        frame.fracsec = (uint32_t)(samples[i].t_us % 1000000);
+        frame.time_quality = C37118_TQ_100MS;  // SNTP-synchronised unit, updated within the last 10 s
+        frame.stat = C37118_STAT_TQ_UNKNOWN;
+        frame.magnitude = 1.0f;
+        frame.angle = (float)(samples[i].phase_deg * M_PI / 180.0);
+        frame.freq = samples[i].f_hz;
+        frame.dfreq = samples[i].rocof;
+        len += c37118_encode(&frame, (uint8_t *)&frames[len], frames.size() - len);
+    }
+    frames.resize(len);
+
+    return frames;
+}
+
+/**
+ * @brief UDP stream data datagram, as built by udp_stream (send time is taken now)
+ * @param samples Samples of the datagram (at most HZ_STREAM_MAX_SAMPLES)
+ * @param n Number of samples
+ * @param device_id Device ID of the unit
+ * @param seq Datagram sequence number
+ * @param session Session of the unit (random per boot)
+ * @param buf Output buffer
+ * @param len Size of buf
+ * @return Datagram length, 0 if buf is too small
+ */
+size_t fleet_encode_udp(const fleet_sample *samples, size_t n, uint32_t device_id, uint32_t seq, uint32_t session, uint8_t *buf, size_t len) {
+    hz_stream_data_t dgram = {};
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    dgram.device_id = device_id;
+    dgram.seq = seq;
+    dgram.session = session;
+    dgram.flags = 0;
+    dgram.count = (uint8_t)((n < HZ_STREAM_MAX_SAMPLES) ? n : HZ_STREAM_MAX_SAMPLES);
+    dgram.send_us = ((uint64_t)ts.tv_sec * 1000000) + ((uint64_t)ts.tv_nsec / 1000);
+    for (size_t i = 0; i < dgram.count; i++) {
+        hz_sample_t &s = dgram.samples[i];
+        s.t_us = samples[i].t_us;
+        s.f_hz = samples[i].f_hz;
+        s.rocof = samples[i].rocof;
+        s.phase_deg = samples[i].phase_deg;
+        s.f_std = samples[i].f_std;
+        s.phase_diff_deg = samples[i].phase_diff_deg;
+        s.channel = samples[i].channel;
+    }
+
+    return hz_stream_encode_data(&dgram, buf, len);
+}
+
+/**
+ * @brief Upload counter from the status field of a ThingSpeak message
+ * @return False if the message has no counter
+ */
+bool fleet_thingspeak_upload_no(const uint8_t *payload, size_t len, uint64_t &upload_no) {
+    static const char key[] = "&status=Device OK, " TS_STATUS_KEY;
+    const char *text = (const char *)payload;
+    const char *end = text + len;
+    const char *pos = (const char *)memmem(text, len, key, sizeof(key) - 1);
+
+    if (pos == nullptr) {
+        return false;
+    }
+    pos += sizeof(key) - 1;
+    upload_no = 0;
+    const char *digits = pos;
+    while ((pos < end) && (*pos >= '0') && (*pos <= '9')) {
+        upload_no = (upload_no * 10) + (uint64_t)(*pos++ - '0');
+    }
+
+    return pos != digits;
+}
+
+/**
+ * @brief Time of the first frame of a C37.118 message
+ * @return False if the message does not start with a valid data frame
+ */
+bool fleet_pmu_first_time(const uint8_t *payload, size_t len, uint64_t &t_us) {
+    c37118_data_t frame;
+
+    if (c37118_decode(payload, len, &frame) == false) {
+        return false;
+    }
+    t_us = ((uint64_t)frame.soc * 1000000) + frame.fracsec;
+
+    return true;
+}
@@ -0,0 +1,29 @@
+/**
+ * @file    fleet_codec.h
+ * @brief   Uplink payloads of an emulated HertzNet unit, byte-for-byte what the firmware sends (ThingSpeak MQTT text, C37.118 frames,
+ *          UDP stream datagrams)
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+struct fleet_sample {      // Measurement sample as handed to the uploader backends (uploader_sample_t)
+    uint64_t t_us;         // UTC time of the zero-crossing closing the measurement in us
+    float f_hz;            // Estimated frequency in Hz
+    float rocof;           // Estimated RoCoF in Hz/s
+    float f_std;           // Standard deviation of f_hz in Hz
+    float phase_deg;       // Phase angle in degrees
+    float phase_diff_deg;  // Phase relative to the reference channel in degrees (NAN if not available)
+    uint8_t channel;       // Zero-crossing input
+};
+
+std::string fleet_encode_thingspeak(const fleet_sample *samples, size_t n, uint64_t upload_no, uint32_t pulses_per_meas, uint8_t channels);
+std::string fleet_encode_link_note(uint32_t outage_ms, uint32_t lost, uint32_t outages);
+std::string fleet_encode_pmu(const fleet_sample *samples, size_t n, uint16_t idcode_base);
+size_t fleet_encode_udp(const fleet_sample *samples, size_t n, uint32_t device_id, uint32_t seq, uint32_t session, uint8_t *buf, size_t len);
+bool fleet_thingspeak_upload_no(const uint8_t *payload, size_t len, uint64_t &upload_no);
+bool fleet_pmu_first_time(const uint8_t *payload, size_t len, uint64_t &t_us);
@@ -0,0 +1,1350 @@
+/**
+ * @file    fleet_load.cpp
+ * @brief   Emulate a fleet of HertzNet units against a local MQTT broker (or the UDP collector) and measure the capacity of the
+ *          uplink and ingest path
+ * @note    Usage: fleet_load [-n units] [-t seconds] [-w workers] [-b host:port] [--codec ts|pmu|udp] [-q 0|1] [--mpb N] [--mps N]
+ *                 [--channels N] [--ramp s] [--backlog N] [--storm T[,frac[,outage[,spread]]]] [--seed N] [-i interval_s]
+ *                 [-o intervals.csv] [--max-loss pct] [--max-p99 ms]
+ *          Every unit keeps its own connection and sends exactly what the firmware sends (ThingSpeak text from mqtt_drv_send, C37.118
+ *          frames from mqtt_drv_send_pmu or UDP stream datagrams); a subscriber on the same broker matches every message back to the
+ *          unit that sent it for end-to-end latency, loss and duplicates. Storms drop connections of a share of the fleet at once,
+ *          offline units buffer bursts and backfill them on reconnect. In UDP mode, latency and loss are reported by udp_collector
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fleet_codec.h"
+#include "hz_stream.h"
+#include "mqtt_wire.h"
+
+#define NOMINAL_HZ 50                     // F_NOMINAL_HZ
+#define PMU_IDCODE_BASE 1                 // PMU_IDCODE
+#define TS_TOPIC_PREFIX "channels/"       // ThingSpeak topic: channels/<unit>/publish
+#define PMU_TOPIC_PREFIX "hertznet/pmu/"  // C37.118 topic: hertznet/pmu/<unit>
+#define MQTT_BACKLOG_DEFAULT 16           // Bursts an offline unit keeps (MQTT_BACKLOG_BURSTS)
+#define UDP_BACKLOG_DEFAULT 16            // Datagrams an offline unit keeps (UDP_QUEUE_LEN)
+#define UDP_RETX_WINDOW 64                // Datagrams kept for NACK retransmission (UDP_RETX_WINDOW)
+#define SENT_RING 64                      // Recent messages per unit kept for matching at the subscriber
+#define OUT_BUF_MAX (256 * 1024)          // Unsent bytes per connection before new messages are dropped (broker not keeping up)
+#define RECONNECT_DELAY_US 1000000        // Delay before reconnecting after a failure or unexpected disconnect (plus up to as much jitter)
+#define CONNECT_TIMEOUT_US 10000000       // Connection attempts (TCP and CONNACK) abandoned after this time
+#define STOP_FLUSH_US 2000000             // Time given to the units to flush and disconnect at the end of the run
+#define SUB_READY_TIMEOUT_US 5000000      // Time the subscriber has to connect and subscribe before the units start
+#define DRAIN_US 3000000                  // Time the subscriber keeps receiving after the units stopped
+#define EPOLL_BATCH 256                   // Events handled per epoll_wait call
+#define RECV_CHUNK 65536                  // Bytes read per recv call
+
+enum class codec_t { thingspeak, pmu, udp };
+
+struct storm_params {        // Connection storm
+    double at_s;             // Time from the start of the run [s]
+    double frac = 1.0;       // Share of the fleet that loses its connection
+    double outage_s = 10.0;  // Time the units stay offline [s]
+    double spread_s = 1.0;   // Reconnects spread uniformly over this time after the outage [s]
+};
+
+struct fleet_params {                     // Run configuration
+    size_t units = 1000;                  // Number of emulated units
+    double seconds = 60.0;                // Duration of the run [s]
+    size_t workers = 0;                   // Event loop threads (0: one per CPU)
+    std::string host = "127.0.0.1";       // Broker (or collector) host
+    uint16_t port = 0;                    // Broker (or collector) port (0: 1883 for MQTT)
+    codec_t codec = codec_t::thingspeak;  // Uplink payload
+    uint8_t qos = 0;                      // MQTT QoS of the unit publishes and the subscription
+    uint32_t mpb = 25;                    // Measurements per burst (MQTT_MEAS_PER_BURST)
+    uint32_t mps = 5;                     // Measurements per second per channel (50 / PULSES_PER_MEAS)
+    uint8_t channels = 1;                 // Zero-crossing inputs per unit
+    double ramp_s = 5.0;                  // Units start evenly spread over this time [s]
+    long backlog = -1;                    // Messages an offline unit keeps (-1: firmware default of the codec)
+    std::vector<storm_params> storms;     // Connection storms
+    uint64_t seed = 1;                    // Random seed (jitter, noise)
+    double interval_s = 5.0;              // Progress report interval [s]
+    const char *csv_path = nullptr;       // Per-interval statistics
+    double max_loss_pct = -1.0;           // Fail the run above this loss (-1: no limit)
+    double max_p99_ms = -1.0;             // Fail the run above this p99 latency (-1: no limit)
+};
+
+enum class unit_state { idle, connecting, handshake, online, offline };
+
+struct pending_msg {      // Complete message not yet handed to the connection
+    uint64_t seq;         // Upload number (starts at 1)
+    uint64_t t_first_us;  // Time of the first sample (C37.118 matching key)
+    uint64_t t_last_us;   // Time of the newest sample
+    std::string payload;  // Encoded message
+};
+
+struct sent_rec {         // Message handed to the connection, waiting for the subscriber
+    uint64_t seq = 0;     // Upload number (0: empty)
+    uint64_t t_first_us;  // Time of the first sample
+    uint64_t t_last_us;   // Time of the newest sample
+    int64_t sent_us;      // Monotonic time of the (first) publish
+    bool received;        // Seen by the subscriber
+};
+
+struct udp_slot {                                                // Recently sent datagram kept for retransmission
+    uint32_t seq;                                                // Sequence number
+    uint8_t len = 0;                                             // Encoded length (0: empty)
+    uint8_t buf[HZ_STREAM_HEADER_SIZE + HZ_STREAM_SAMPLE_SIZE];  // Encoded datagram
+};
+
+struct unit {                                               // Emulated unit
+    uint32_t id;                                            // Unit number (topic, client ID, UDP device ID)
+    uint32_t session;                                       // UDP stream session (random, as drawn on every boot)
+    std::string topic;                                      // Publish topic
+    unit_state state = unit_state::idle;                    // Connection state
+    int fd = -1;                                            // Broker connection
+    uint32_t conn_gen = 0;                                  // Incremented on every connection attempt and close (stale timers)
+    bool want_out = false;                                  // EPOLLOUT registered
+    bool ever_online = false;                               // Connected before (reconnect statistics)
+    int64_t offline_since_us = 0;                           // Monotonic time the connection was lost (0: online or never connected)
+    uint32_t outage_lost = 0;                               // Samples dropped during the current outage (backlog full)
+    uint32_t outages = 0;                                   // Connection losses since start
+    std::string link_note;                                  // Outage statistics for the status field of the next burst (empty if none)
+    double phase0;                                          // Phase offset of the unit [deg]
+    std::vector<fleet_sample> burst;                        // Burst being assembled
+    std::deque<pending_msg> backlog;                        // Complete bursts waiting for the connection
+    std::deque<std::pair<uint16_t, pending_msg>> inflight;  // QoS 1 publishes waiting for PUBACK (resent after a reconnect)
+    std::deque<fleet_sample> udp_backlog;                   // Samples waiting for the unit to come back (UDP)
+    std::vector<udp_slot> retx;                             // Recently sent datagrams (UDP)
+    std::string out;                                        // Bytes to be written to the connection
+    size_t out_off = 0;                                     // Bytes of out already written
+    std::string in;                                         // Bytes received, not yet parsed
+    uint64_t seq = 0;                                       // Bursts (MQTT) or datagrams (UDP) generated
+    uint16_t packet_id = 0;                                 // Last MQTT packet identifier
+    std::array<sent_rec, SENT_RING> sent;                   // Recently published messages (guarded by the worker lock)
+};
+
+struct timer_ev {  // Scheduled unit event
+    int64_t when;  // Monotonic time [us]
+    uint32_t idx;  // Unit index
+    uint8_t kind;  // EV_*
+    uint32_t gen;  // Connection generation the event belongs to
+    bool operator>(const timer_ev &o) const {
+        return when > o.when;
+    }
+};
+
+enum : uint8_t { EV_SAMPLE, EV_CONNECT, EV_TIMEOUT };
+
+struct worker_counters {                      // Sender statistics of one worker
+    std::atomic<uint64_t> published{0};       // Messages handed to the connection (MQTT) or datagrams sent (UDP)
+    std::atomic<uint64_t> bytes_out{0};       // Bytes written to the sockets
+    std::atomic<uint64_t> acks{0};            // PUBACKs received
+    std::atomic<uint64_t> resent{0};          // Unacknowledged QoS 1 publishes sent again after a reconnect
+    std::atomic<uint64_t> backfilled{0};      // Messages sent from the offline backlog
+    std::atomic<uint64_t> backlog_drops{0};   // Messages dropped, offline backlog full
+    std::atomic<uint64_t> overflow_drops{0};  // Messages dropped, connection not draining
+    std::atomic<uint64_t> discarded{0};       // Messages lost unsent when a connection closed
+    std::atomic<uint64_t> connects{0};        // Successful connections
+    std::atomic<uint64_t> reconnects{0};      // Successful connections of units that were connected before
+    std::atomic<uint64_t> connect_fails{0};   // Failed or timed out connection attempts
+    std::atomic<uint64_t> disconnects{0};     // Unexpected disconnects
+    std::atomic<uint64_t> storm_drops{0};     // Connections dropped by storms
+    std::atomic<uint64_t> nacks{0};           // NACK datagrams received (UDP)
+    std::atomic<uint64_t> retx{0};            // Datagrams retransmitted (UDP)
+    std::atomic<uint64_t> retx_expired{0};    // NACKed datagrams no longer kept (UDP)
+    std::atomic<int64_t> online{0};           // Units online
+};
+
+struct worker {                                                                           // Event loop thread and the units it runs
+    size_t index;                                                                         // Worker number
+    int ep = -1;                                                                          // epoll instance
+    int udp_fd = -1;                                                                      // Socket to the collector (UDP)
+    std::vector<uint32_t> units;                                                          // Unit indices
+    std::priority_queue<timer_ev, std::vector<timer_ev>, std::greater<timer_ev>> timers;  // Scheduled events
+    std::mt19937_64 rng;                                                                  // Jitter and measurement noise
+    size_t next_storm = 0;                                                                // Next storm to apply
+    size_t want_out_count = 0;                                                            // Units with unsent bytes
+    bool stopping = false;                                                                // Units flushing and disconnecting
+    std::mutex lock;                                                                      // Guards the sent rings of the units
+    worker_counters cnt;                                                                  // Statistics
+};
+
+struct sub_stats {                    // Subscriber statistics
+    std::mutex lock;                  // Guards everything below
+    uint64_t received = 0;            // Messages received
+    uint64_t bytes_in = 0;            // Payload bytes received
+    uint64_t matched = 0;             // First receptions matched to a sent message
+    uint64_t unmatched = 0;           // Receptions of messages no longer in the sent ring (counted as delivered, no latency)
+    uint64_t duplicates = 0;          // Repeated receptions
+    uint64_t foreign = 0;             // Messages not from this fleet
+    std::vector<double> latency;      // Publish to subscriber latency, current interval [ms]
+    std::vector<double> age;          // Newest sample to subscriber, current interval [ms]
+    std::vector<double> latency_all;  // Publish to subscriber latency, whole run [ms]
+    std::vector<double> age_all;      // Newest sample to subscriber, whole run [ms]
+};
+
+static fleet_params cfg;
+static sockaddr_in target;  // Broker or collector address
+static std::vector<unit> units;
+static std::vector<std::unique_ptr<worker>> workers;
+static sub_stats sub;
+static int64_t start_us;                     // Monotonic start of the run
+static std::atomic<bool> stop_units{false};  // End of the run, units disconnect
+static std::atomic<bool> stop_sub{false};    // End of the drain, subscriber exits
+static std::atomic<bool> sub_ready{false};   // Subscription acknowledged
+static volatile sig_atomic_t interrupted = 0;
+
+static void on_signal(int) {
+    interrupted = 1;
+}
+
+static int64_t mono_us() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((int64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+static uint64_t utc_us() {
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000) + ((uint64_t)ts.tv_nsec / 1000);
+}
+
+static double wrap_deg(double deg) {
+    deg = fmod(deg, 360.0);
+    if (deg <= -180.0) {
+        deg += 360.0;
+    } else if (deg > 180.0) {
+        deg -= 360.0;
+    }
+    return deg;
+}
+
+static bool is_mqtt() {
+    return cfg.codec != codec_t::udp;
+}
+
+static worker &worker_of(uint32_t idx) {
+    return *workers[idx % workers.size()];
+}
+
+static void schedule(worker &w, int64_t when, uint32_t idx, uint8_t kind) {
+    w.timers.push({when, idx, kind, units[idx].conn_gen});
+}
+
+static int64_t jitter_us(worker &w, int64_t max_us) {
+    return (max_us > 0) ? (int64_t)(w.rng() % (uint64_t)max_us) : 0;
+}
+
+/**
+ * @brief Measurement of one channel of a unit: common grid frequency with slow swings, per-unit noise
+ */
+static fleet_sample make_sample(worker &w, const unit &u, uint64_t t_us, uint8_t channel) {
+    static const double mod_hz[2] = {0.05, 0.01};        // Frequency swing amplitudes [Hz]
+    static const double mod_period_s[2] = {300.0, 7.3};  // Frequency swing periods [s]
+    std::normal_distribution<double> noise(0.0, 0.001);  // Per-unit measurement noise [Hz]
+    double t = (double)(t_us % 86400000000ULL) / 1000000.0;
+    double f = NOMINAL_HZ;
+    double rocof = 0.0;
+    double cycles = 0.0;
+
+    for (int i = 0; i < 2; i++) {
+        double arg = 2.0 * M_PI * t / mod_period_s[i];
+        f += mod_hz[i] * sin(arg);
+        rocof += mod_hz[i] * (2.0 * M_PI / mod_period_s[i]) * cos(arg);
+        cycles -= mod_hz[i] * (mod_period_s[i] / (2.0 * M_PI)) * cos(arg);
+    }
+
+    fleet_sample s;
+    double diff = (-120.0 * channel) + 0.0;  // Three-phase inputs (no negative zero on the reference)
+    s.t_us = t_us;
+    s.f_hz = (float)(f + noise(w.rng));
+    s.rocof = (float)(rocof + (noise(w.rng) * 5.0));
+    s.f_std = 0.0015f;
+    s.phase_deg = (float)wrap_deg(u.phase0 + (360.0 * cycles) + diff);
+    s.phase_diff_deg = (float)wrap_deg(diff);
+    s.channel = channel;
+    return s;
+}
+
+/**
+ * @brief Register or drop interest in EPOLLOUT (connection in progress or unsent bytes)
+ */
+static void set_want_out(worker &w, uint32_t idx, bool want) {
+    unit &u = units[idx];
+    if (u.want_out == want) {
+        return;
+    }
+    u.want_out = want;
+    if (want) {
+        w.want_out_count++;
+    } else {
+        w.want_out_count--;
+    }
+    epoll_event ev = {};
+    ev.events = want ? (uint32_t)(EPOLLIN | EPOLLOUT) : (uint32_t)EPOLLIN;
+    ev.data.u64 = idx;
+    epoll_ctl(w.ep, EPOLL_CTL_MOD, u.fd, &ev);
+}
+
+/**
+ * @brief Record the start of an outage (the first burst after it reports the outage in its status field)
+ */
+static void unit_outage_start(unit &u) {
+    u.offline_since_us = mono_us();
+    u.outage_lost = 0;
+}
+
+/**
+ * @brief Close the connection of a unit; unacknowledged QoS 1 publishes go back to the front of the backlog
+ */
+static void unit_close(worker &w, uint32_t idx) {
+    unit &u = units[idx];
+    if (u.fd >= 0) {
+        if (u.want_out) {
+            w.want_out_count--;
+            u.want_out = false;
+        }
+        close(u.fd);  // Also removes it from the epoll set
+        u.fd = -1;
+    }
+    if (u.state == unit_state::online) {
+        w.cnt.online--;
+        unit_outage_start(u);
+    }
+    if ((u.out_off < u.out.size()) && (cfg.qos == 0)) {
+        w.cnt.discarded++;  // At least one publish was cut off (QoS 1 ones are resent)
+    }
+    while (u.inflight.empty() == false) {
+        u.backlog.push_front(std::move(u.inflight.back().second));
+        u.inflight.pop_back();
+    }
+    u.out.clear();
+    u.out_off = 0;
+    u.in.clear();
+    u.state = unit_state::offline;
+    u.conn_gen++;
+}
+
+/**
+ * @brief Give up on the connection and try again later
+ */
+static void unit_retry(worker &w, uint32_t idx, bool failed_attempt) {
+    bool was_online = (units[idx].state == unit_state::online);
+    unit_close(w, idx);
+    if (w.stopping) {
+        return;
+    }
+    if (failed_attempt) {
+        w.cnt.connect_fails++;
+    } else if (was_online) {
+        w.cnt.disconnects++;
+    }
+    schedule(w, mono_us() + RECONNECT_DELAY_US + jitter_us(w, RECONNECT_DELAY_US), idx, EV_CONNECT);
+}
+
+/**
+ * @brief Write as much of the pending output as the socket takes
+ */
+static void unit_flush(worker &w, uint32_t idx) {
+    unit &u = units[idx];
+    while (u.out_off < u.out.size()) {
+        ssize_t n = send(u.fd, u.out.data() + u.out_off, u.out.size() - u.out_off, MSG_NOSIGNAL);
+        if (n > 0) {
+            u.out_off += (size_t)n;
+            w.cnt.bytes_out += (uint64_t)n;
+        } else if ((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+            break;
+        } else {
+            unit_retry(w, idx, false);
+            return;
+        }
+    }
+    if (u.out_off == u.out.size()) {
+        u.out.clear();
+        u.out_off = 0;
+    }
+    set_want_out(w, idx, u.out_off < u.out.size());
+}
+
+/**
+ * @brief Queue a PUBLISH on an online unit and record it for the subscriber
+ */
+static void unit_publish(worker &w, uint32_t idx, pending_msg &&msg) {
+    unit &u = units[idx];
+    if ((u.out.size() - u.out_off) > OUT_BUF_MAX) {
+        w.cnt.overflow_drops++;
+        return;
+    }
+
+    uint16_t packet_id = 0;
+    if (cfg.qos > 0) {
+        if (++u.packet_id == 0) {
+            u.packet_id = 1;
+        }
+        packet_id = u.packet_id;
+    }
+    mqtt_publish(u.out, u.topic, msg.payload.data(), msg.payload.size(), cfg.qos, packet_id);
+
+    {
+        std::lock_guard<std::mutex> guard(w.lock);
+        sent_rec &rec = u.sent[msg.seq % SENT_RING];
+        if (rec.seq != msg.seq) {  // First publish (resends keep the original time)
+            rec.seq = msg.seq;
+            rec.t_first_us = msg.t_first_us;
+            rec.t_last_us = msg.t_last_us;
+            rec.sent_us = mono_us();
+            rec.received = false;
+            w.cnt.published++;
+        } else {
+            w.cnt.resent++;
+        }
+    }
+    if (cfg.qos > 0) {
+        u.inflight.emplace_back(packet_id, std::move(msg));
+    }
+}
+
+/**
+ * @brief Send one UDP datagram and keep it for retransmission
+ */
+static void unit_send_udp(worker &w, uint32_t idx, const fleet_sample &s) {
+    unit &u = units[idx];
+    uint32_t seq = (uint32_t)u.seq++;
+    udp_slot &slot = u.retx[seq % UDP_RETX_WINDOW];
+    slot.seq = seq;
+    slot.len = (uint8_t)fleet_encode_udp(&s, 1, u.id, seq, u.session, slot.buf, sizeof(slot.buf));
+    if (send(w.udp_fd, slot.buf, slot.len, 0) == (ssize_t)slot.len) {
+        w.cnt.published++;
+        w.cnt.bytes_out += slot.len;
+    } else {
+        w.cnt.overflow_drops++;
+    }
+}
+
+/**
+ * @brief The unit is connected: send the backlog (backfill burst)
+ */
+static void unit_online(worker &w, uint32_t idx) {
+    unit &u = units[idx];
+    u.state = unit_state::online;
+    w.cnt.online++;
+    w.cnt.connects++;
+    if (u.ever_online) {
+        w.cnt.reconnects++;
+    }
+    u.ever_online = true;
+    if (u.offline_since_us != 0) {  // Back after an outage, as mqtt_drv_outage_end()
+        u.outages++;
+        if (cfg.codec == codec_t::thingspeak) {
+            u.link_note = fleet_encode_link_note((uint32_t)((mono_us() - u.offline_since_us) / 1000), u.outage_lost, u.outages);
+        }
+        u.offline_since_us = 0;
+    }
+
+    if (is_mqtt()) {
+        if ((u.backlog.empty() == false) && (u.link_note.empty() == false)) {  // The status field ends the message, append the note
+            u.backlog.front().payload += u.link_note;
+            u.link_note.clear();
+        }
+        while (u.backlog.empty() == false) {
+            w.cnt.backfilled++;
+            unit_publish(w, idx, std::move(u.backlog.front()));
+            u.backlog.pop_front();
+        }
+        unit_flush(w, idx);
+    } else {
+        while (u.udp_backlog.empty() == false) {
+            w.cnt.backfilled++;
+            unit_send_udp(w, idx, u.udp_backlog.front());
+            u.udp_backlog.pop_front();
+        }
+    }
+}
+
+/**
+ * @brief Start a connection attempt (UDP units just come back online)
+ */
+static void unit_connect(worker &w, uint32_t idx) {
+    unit &u = units[idx];
+    if (is_mqtt() == false) {
+        unit_online(w, idx);
+        return;
+    }
+
+    u.conn_gen++;
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        unit_retry(w, idx, true);
+        return;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if ((connect(fd, (const sockaddr *)&target, sizeof(target)) != 0) && (errno != EINPROGRESS)) {
+        close(fd);
+        unit_retry(w, idx, true);
+        return;
+    }
+
+    u.fd = fd;
+    u.state = unit_state::connecting;
+    u.want_out = true;
+    w.want_out_count++;
+    epoll_event ev = {};
+    ev.events = EPOLLIN | EPOLLOUT;
+    ev.data.u64 = idx;
+    epoll_ctl(w.ep, EPOLL_CTL_ADD, fd, &ev);
+    schedule(w, mono_us() + CONNECT_TIMEOUT_US, idx, EV_TIMEOUT);
+}
+
+/**
+ * @brief Burst complete: publish it, or keep it while offline
+ */
+static void unit_burst_done(worker &w, uint32_t idx) {
+    unit &u = units[idx];
+    pending_msg msg;
+    msg.seq = ++u.seq;
+    msg.t_first_us = u.burst.front().t_us;
+    msg.t_last_us = u.burst.back().t_us;
+    if (cfg.codec == codec_t::thingspeak) {
+        msg.payload = fleet_encode_thingspeak(u.burst.data(), u.burst.size(), msg.seq, 50 / cfg.mps, cfg.channels);
+        if (u.state == unit_state::online) {  // Outage without a backlog, the next burst reports it
+            msg.payload += u.link_note;
+            u.link_note.clear();
+        }
+    } else {
+        msg.payload = fleet_encode_pmu(u.burst.data(), u.burst.size(), PMU_IDCODE_BASE);
+    }
+    size_t n = u.burst.size();
+    u.burst.clear();
+
+    if (u.state == unit_state::online) {
+        unit_publish(w, idx, std::move(msg));
+        unit_flush(w, idx);
+    } else if (u.backlog.size() < (size_t)cfg.backlog) {
+        u.backlog.push_back(std::move(msg));
+    } else {
+        w.cnt.backlog_drops++;
+        u.outage_lost += (uint32_t)n;
+    }
+}
+
+/**
+ * @brief Measurement period elapsed: one sample per channel
+ */
+static void unit_sample(worker &w, uint32_t idx) {
+    unit &u = units[idx];
+    uint64_t t_us = utc_us();
+
+    for (uint8_t ch = 0; ch < cfg.channels; ch++) {
+        uint64_t lag_us = (uint64_t)(cfg.channels - 1 - ch) * 1000000 / (3 * NOMINAL_HZ);  // Later phases cross zero a third of a cycle apart
+        fleet_sample s = make_sample(w, u, t_us - lag_us, ch);
+        if (is_mqtt()) {
+            u.burst.push_back(s);
+            if (u.burst.size() >= cfg.mpb) {
+                unit_burst_done(w, idx);
+            }
+        } else if (u.state == unit_state::online) {
+            unit_send_udp(w, idx, s);
+        } else if (u.udp_backlog.size() < (size_t)cfg.backlog) {
+            u.udp_backlog.push_back(s);
+        } else {
+            w.cnt.backlog_drops++;
+        }
+    }
+}
+
+/**
+ * @brief Handle the control packets received by a unit
+ */
+static void unit_receive(worker &w, uint32_t idx) {
+    unit &u = units[idx];
+    char buf[4096];
+
+    while (true) {
+        ssize_t n = recv(u.fd, buf, sizeof(buf), 0);
+        if (n > 0) {
+            u.in.append(buf, (size_t)n);
+            continue;
+        }
+        if ((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+            break;
+        }
+        unit_retry(w, idx, u.state != unit_state::online);  // Closed by the broker or reset
+        return;
+    }
+
+    size_t pos = 0;
+    mqtt_packet pkt;
+    long len;
+    while ((len = mqtt_parse((const uint8_t *)u.in.data() + pos, u.in.size() - pos, pkt)) > 0) {
+        pos += (size_t)len;
+        if ((pkt.type == MQTT_CONNACK) && (u.state == unit_state::handshake)) {
+            if ((pkt.len < 2) || (pkt.body[1] != 0)) {
+                fprintf(stderr, "Unit %u: connection refused (code %d)\n", u.id, (pkt.len < 2) ? -1 : pkt.body[1]);
+                unit_retry(w, idx, true);
+                return;
+            }
+            unit_online(w, idx);
+            if (u.fd < 0) {
+                return;  // Backfill failed
+            }
+        } else if ((pkt.type == MQTT_PUBACK) && (pkt.len >= 2)) {
+            uint16_t packet_id = (uint16_t)((pkt.body[0] << 8) | pkt.body[1]);
+            auto it = std::find_if(u.inflight.begin(), u.inflight.end(), [packet_id](const auto &e) { return e.first == packet_id; });
+            if (it != u.inflight.end()) {
+                u.inflight.erase(it);
+                w.cnt.acks++;
+            }
+        }
+    }
+    if (len < 0) {
+        fprintf(stderr, "Unit %u: malformed packet from the broker\n", u.id);
+        unit_retry(w, idx, false);
+        return;
+    }
+    u.in.erase(0, pos);
+}
+
+/**
+ * @brief Socket event of a unit
+ */
+static void unit_event(worker &w, uint32_t idx, uint32_t events) {
+    unit &u = units[idx];
+
+    if (u.state == unit_state::connecting) {
+        int err = 0;
+        socklen_t err_len = sizeof(err);
+        getsockopt(u.fd, SOL_SOCKET, SO_ERROR, &err, &err_len);
+        if ((err != 0) || (events & (EPOLLERR | EPOLLHUP))) {
+            unit_retry(w, idx, true);
+            return;
+        }
+        if ((events & EPOLLOUT) == 0) {
+            return;
+        }
+        u.state = unit_state::handshake;
+        uint32_t burst_s = (cfg.mpb + cfg.mps - 1) / cfg.mps;
+        mqtt_connect(u.out, "hertznet-" + std::to_string(u.id), (uint16_t)std::min<uint32_t>(65535, std::max<uint32_t>(60, 2 * burst_s)));
+        unit_flush(w, idx);
+        return;
+    }
+
+    if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+        unit_receive(w, idx);
+    }
+    if ((u.fd >= 0) && (events & EPOLLOUT)) {
+        unit_flush(w, idx);
+    }
+}
+
+/**
+ * @brief Retransmit the datagrams a NACK asks for
+ */
+static void udp_nack(worker &w, const hz_stream_nack_t &nack) {
+    uint32_t idx = nack.device_id - 1;
+    if ((idx >= units.size()) || (&worker_of(idx) != &w) || (nack.session != units[idx].session)) {
+        return;
+    }
+    unit &u = units[idx];
+    w.cnt.nacks++;
+
+    for (int i = 0; i < nack.count; i++) {
+        for (int bit = -1; bit < 32; bit++) {
+            if ((bit >= 0) && ((nack.entries[i].mask & (1u << bit)) == 0)) {
+                continue;
+            }
+            uint32_t seq = nack.entries[i].base + (uint32_t)(bit + 1);
+            udp_slot &slot = u.retx[seq % UDP_RETX_WINDOW];
+            if ((slot.len == 0) || (slot.seq != seq)) {
+                w.cnt.retx_expired++;
+                continue;
+            }
+            slot.buf[12] |= HZ_STREAM_FLAG_RETX;  // Flags byte of the encoded header
+            if (send(w.udp_fd, slot.buf, slot.len, 0) == (ssize_t)slot.len) {
+                w.cnt.retx++;
+                w.cnt.bytes_out += slot.len;
+            }
+        }
+    }
+}
+
+static void udp_receive(worker &w) {
+    uint8_t buf[512];
+    ssize_t n;
+    while ((n = recv(w.udp_fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+        hz_stream_nack_t nack;
+        if (hz_stream_decode_nack(buf, (size_t)n, &nack)) {
+            udp_nack(w, nack);
+        }
+    }
+}
+
+/**
+ * @brief Drop the connections of the units hit by a storm and schedule their simultaneous return
+ */
+static void apply_storm(worker &w, const storm_params &storm) {
+    int64_t back_us = start_us + (int64_t)((storm.at_s + storm.outage_s) * 1e6);
+
+    for (uint32_t idx : w.units) {
+        unit &u = units[idx];
+        double pick = (double)((u.id * 2654435761u) % 1000000u) / 1e6;  // Same units for the same share, independent of workers
+        if ((pick >= storm.frac) || (u.state == unit_state::idle)) {
+            continue;
+        }
+        if ((u.state == unit_state::online) || (u.fd >= 0)) {
+            w.cnt.storm_drops++;
+        }
+        if (u.state == unit_state::online) {
+            w.cnt.online--;
+            unit_outage_start(u);
+        }
+        u.state = unit_state::idle;  // Not counted as an unexpected disconnect
+        unit_close(w, idx);
+        schedule(w, back_us + jitter_us(w, (int64_t)(storm.spread_s * 1e6)), idx, EV_CONNECT);
+    }
+}
+
+static void run_timers(worker &w, int64_t now) {
+    int64_t period_us = 1000000 / cfg.mps;
+
+    while ((w.timers.empty() == false) && (w.timers.top().when <= now)) {
+        timer_ev ev = w.timers.top();
+        w.timers.pop();
+        unit &u = units[ev.idx];
+
+        switch (ev.kind) {
+            case EV_SAMPLE:
+                unit_sample(w, ev.idx);
+                w.timers.push({ev.when + period_us, ev.idx, EV_SAMPLE, 0});
+                break;
+            case EV_CONNECT:
+                if ((ev.gen == u.conn_gen) && ((u.state == unit_state::idle) || (u.state == unit_state::offline))) {
+                    unit_connect(w, ev.idx);
+                }
+                break;
+            case EV_TIMEOUT:
+                if ((ev.gen == u.conn_gen) && ((u.state == unit_state::connecting) || (u.state == unit_state::handshake))) {
+                    unit_retry(w, ev.idx, true);
+                }
+                break;
+        }
+    }
+}
+
+/**
+ * @brief End of the run: disconnect the online units cleanly, abandon attempts in progress
+ */
+static void begin_stop(worker &w) {
+    w.stopping = true;
+    for (uint32_t idx : w.units) {
+        unit &u = units[idx];
+        if ((u.state == unit_state::online) && is_mqtt()) {
+            mqtt_disconnect(u.out);
+            unit_flush(w, idx);
+        } else if (u.fd >= 0) {
+            unit_close(w, idx);
+        }
+    }
+}
+
+static void worker_run(worker &w) {
+    epoll_event events[EPOLL_BATCH];
+    int64_t period_us = 1000000 / cfg.mps;
+    int64_t stop_deadline = 0;
+
+    for (size_t k = 0; k < w.units.size(); k++) {  // Units start evenly spread over the ramp, sampling at a random phase
+        uint32_t idx = w.units[k];
+        int64_t begin = start_us + (int64_t)(cfg.ramp_s * 1e6 * (double)idx / (double)units.size());
+        schedule(w, begin, idx, EV_CONNECT);
+        w.timers.push({begin + jitter_us(w, period_us), idx, EV_SAMPLE, 0});
+    }
+
+    while (true) {
+        int64_t now = mono_us();
+        if ((w.stopping == false) && stop_units) {
+            begin_stop(w);
+            stop_deadline = now + STOP_FLUSH_US;
+        }
+        if (w.stopping) {
+            if ((w.want_out_count == 0) || (now >= stop_deadline)) {
+                break;
+            }
+        } else {
+            while ((w.next_storm < cfg.storms.size()) && (now >= start_us + (int64_t)(cfg.storms[w.next_storm].at_s * 1e6))) {
+                apply_storm(w, cfg.storms[w.next_storm++]);
+            }
+            run_timers(w, now);
+        }
+
+        int timeout_ms = 10;
+        if ((w.stopping == false) && (w.timers.empty() == false)) {
+            int64_t wait_us = w.timers.top().when - mono_us();
+            timeout_ms = (int)std::clamp<int64_t>((wait_us + 999) / 1000, 0, 10);
+        }
+        int n = epoll_wait(w.ep, events, EPOLL_BATCH, timeout_ms);
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.u64 == UINT64_MAX) {
+                udp_receive(w);
+            } else {
+                unit_event(w, (uint32_t)events[i].data.u64, events[i].events);
+            }
+        }
+    }
+
+    for (uint32_t idx : w.units) {
+        if (units[idx].fd >= 0) {
+            unit_close(w, idx);
+        }
+    }
+}
+
+/**
+ * @brief Unit a received message belongs to, from its topic
+ * @return False if the topic is not one of the fleet
+ */
+static bool topic_unit(const mqtt_publish_view &pub, uint32_t &idx) {
+    const char *prefix = (cfg.codec == codec_t::thingspeak) ? TS_TOPIC_PREFIX : PMU_TOPIC_PREFIX;
+    size_t prefix_len = strlen(prefix);
+    if ((pub.topic_len <= prefix_len) || (memcmp(pub.topic, prefix, prefix_len) != 0)) {
+        return false;
+    }
+    uint64_t id = 0;
+    for (size_t i = prefix_len; (i < pub.topic_len) && (pub.topic[i] != '/'); i++) {
+        if ((pub.topic[i] < '0') || (pub.topic[i] > '9')) {
+            return false;
+        }
+        id = (id * 10) + (uint64_t)(pub.topic[i] - '0');
+    }
+    idx = (uint32_t)(id - 1);
+    return (id >= 1) && (id <= units.size());
+}
+
+/**
+ * @brief Match a received message to the message the unit published
+ */
+static void sub_message(const mqtt_publish_view &pub) {
+    int64_t now = mono_us();
+    uint64_t now_utc = utc_us();
+    uint32_t idx;
+    uint64_t key;
+    bool found = false;
+    bool duplicate = false;
+    double latency_ms = 0.0;
+    double age_ms = 0.0;
+
+    bool valid = topic_unit(pub, idx);
+    if (valid) {
+        valid = (cfg.codec == codec_t::thingspeak) ? fleet_thingspeak_upload_no(pub.payload, pub.payload_len, key)
+                                                   : fleet_pmu_first_time(pub.payload, pub.payload_len, key);
+    }
+    if (valid) {
+        worker &w = worker_of(idx);
+        std::lock_guard<std::mutex> guard(w.lock);
+        for (sent_rec &rec : units[idx].sent) {
+            if ((rec.seq != 0) && (((cfg.codec == codec_t::thingspeak) ? rec.seq : rec.t_first_us) == key)) {
+                found = true;
+                duplicate = rec.received;
+                rec.received = true;
+                latency_ms = (double)(now - rec.sent_us) / 1000.0;
+                age_ms = (double)((int64_t)(now_utc - rec.t_last_us)) / 1000.0;
+                break;
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> guard(sub.lock);
+    sub.received++;
+    sub.bytes_in += pub.payload_len;
+    if (valid == false) {
+        sub.foreign++;
+    } else if (found == false) {
+        sub.unmatched++;
+    } else if (duplicate) {
+        sub.duplicates++;
+    } else {
+        sub.matched++;
+        sub.latency.push_back(latency_ms);
+        sub.age.push_back(age_ms);
+    }
+}
+
+static bool send_all(int fd, const std::string &buf) {
+    size_t off = 0;
+    while (off < buf.size()) {
+        ssize_t n = send(fd, buf.data() + off, buf.size() - off, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        off += (size_t)n;
+    }
+    return true;
+}
+
+/**
+ * @brief Subscriber session: subscribe to the whole fleet and match every message until stopped or disconnected
+ */
+static void sub_session() {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    timeval tv = {0, 100000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    int rcvbuf = 4 * 1024 * 1024;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    if (connect(fd, (const sockaddr *)&target, sizeof(target)) != 0) {
+        close(fd);
+        return;
+    }
+
+    std::string out;
+    std::string filter = (cfg.codec == codec_t::thingspeak) ? (TS_TOPIC_PREFIX "+/publish") : (PMU_TOPIC_PREFIX "+");
+    mqtt_connect(out, "fleet_load-sub-" + std::to_string(getpid()), 60);
+    mqtt_subscribe(out, 1, filter, cfg.qos);
+    if (send_all(fd, out) == false) {
+        close(fd);
+        return;
+    }
+
+    std::vector<uint8_t> in(RECV_CHUNK * 4);
+    size_t have = 0;
+    int64_t last_ping = mono_us();
+    while (stop_sub == false) {
+        if (in.size() - have < RECV_CHUNK) {
+            in.resize(in.size() * 2);
+        }
+        ssize_t n = recv(fd, in.data() + have, in.size() - have, 0);
+        if (n == 0 || ((n < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))) {
+            fprintf(stderr, "Subscriber disconnected\n");
+            break;
+        }
+        have += (n > 0) ? (size_t)n : 0;
+
+        out.clear();
+        size_t pos = 0;
+        mqtt_packet pkt;
+        long len;
+        while ((len = mqtt_parse(in.data() + pos, have - pos, pkt)) > 0) {
+            pos += (size_t)len;
+            mqtt_publish_view pub;
+            if (mqtt_parse_publish(pkt, pub)) {
+                sub_message(pub);
+                if (pub.qos > 0) {
+                    mqtt_puback(out, pub.packet_id);
+                }
+            } else if (pkt.type == MQTT_SUBACK) {
+                sub_ready = true;
+            }
+        }
+        if (len < 0) {
+            fprintf(stderr, "Subscriber: malformed packet from the broker\n");
+            break;
+        }
+        memmove(in.data(), in.data() + pos, have - pos);
+        have -= pos;
+
+        if ((mono_us() - last_ping) > 30000000) {  // Keep-alive
+            static const char pingreq[2] = {(char)(MQTT_PINGREQ << 4), 0};
+            out.append(pingreq, sizeof(pingreq));
+            last_ping = mono_us();
+        }
+        if ((out.empty() == false) && (send_all(fd, out) == false)) {
+            break;
+        }
+    }
+    close(fd);
+}
+
+static void sub_run() {
+    while (stop_sub == false) {
+        sub_session();
+        if (stop_sub == false) {
+            usleep(RECONNECT_DELAY_US);
+        }
+    }
+}
+
+static double percentile(std::vector<double> &v, double p) {
+    if (v.empty()) {
+        return NAN;
+    }
+    size_t k = (size_t)(p * (double)(v.size() - 1));
+    std::nth_element(v.begin(), v.begin() + k, v.end());
+    return v[k];
+}
+
+struct totals {  // Sum of the worker statistics
+    uint64_t published = 0, bytes_out = 0, acks = 0, resent = 0, backfilled = 0, backlog_drops = 0, overflow_drops = 0, discarded = 0;
+    uint64_t connects = 0, reconnects = 0, connect_fails = 0, disconnects = 0, storm_drops = 0, nacks = 0, retx = 0, retx_expired = 0;
+    int64_t online = 0;
+};
+
+static totals sum_workers() {
+    totals t;
+    for (const auto &w : workers) {
+        const worker_counters &c = w->cnt;
+        t.published += c.published;
+        t.bytes_out += c.bytes_out;
+        t.acks += c.acks;
+        t.resent += c.resent;
+        t.backfilled += c.backfilled;
+        t.backlog_drops += c.backlog_drops;
+        t.overflow_drops += c.overflow_drops;
+        t.discarded += c.discarded;
+        t.connects += c.connects;
+        t.reconnects += c.reconnects;
+        t.connect_fails += c.connect_fails;
+        t.disconnects += c.disconnects;
+        t.storm_drops += c.storm_drops;
+        t.nacks += c.nacks;
+        t.retx += c.retx;
+        t.retx_expired += c.retx_expired;
+        t.online += c.online;
+    }
+    return t;
+}
+
+/**
+ * @brief Progress line (stderr) and CSV row for one report interval
+ */
+static void report_interval(FILE *csv, double t_s, double dt_s, const totals &now, const totals &prev, uint64_t rx, uint64_t rx_prev) {
+    std::vector<double> latency, age;
+    {
+        std::lock_guard<std::mutex> guard(sub.lock);
+        latency.swap(sub.latency);
+        age.swap(sub.age);
+        sub.latency_all.insert(sub.latency_all.end(), latency.begin(), latency.end());
+        sub.age_all.insert(sub.age_all.end(), age.begin(), age.end());
+    }
+    double tx_rate = (double)(now.published - prev.published) / dt_s;
+    double tx_kbps = (double)(now.bytes_out - prev.bytes_out) / dt_s / 1000.0;
+    double rx_rate = (double)(rx - rx_prev) / dt_s;
+    double p50 = percentile(latency, 0.50);
+    double p99 = percentile(latency, 0.99);
+
+    fprintf(stderr, "%6.0f s: %lld/%zu online, tx %.0f msg/s %.1f kB/s", t_s, (long long)now.online, units.size(), tx_rate, tx_kbps);
+    if (is_mqtt()) {
+        fprintf(stderr, ", rx %.0f msg/s, latency p50 %.2f ms p99 %.2f ms, backlog drops %llu, reconnects %llu\n", rx_rate, p50, p99,
+                (unsigned long long)now.backlog_drops, (unsigned long long)now.reconnects);
+    } else {
+        fprintf(stderr, ", NACKs %llu, retransmitted %llu\n", (unsigned long long)now.nacks, (unsigned long long)now.retx);
+    }
+    if (csv != nullptr) {
+        fprintf(csv, "%.1f,%lld,%.1f,%.1f,%.1f,%.3f,%.3f,%llu,%llu,%llu\n", t_s, (long long)now.online, tx_rate, tx_kbps, rx_rate, p50, p99,
+                (unsigned long long)now.backlog_drops, (unsigned long long)now.reconnects, (unsigned long long)now.connect_fails);
+        fflush(csv);
+    }
+}
+
+static bool parse_storm(const char *arg, storm_params &storm) {
+    double v[4] = {0.0, 1.0, 10.0, 1.0};
+    int n = sscanf(arg, "%lf,%lf,%lf,%lf", &v[0], &v[1], &v[2], &v[3]);
+    storm = {v[0], v[1], v[2], v[3]};
+    return (n >= 1) && (v[0] >= 0.0) && (v[1] > 0.0) && (v[1] <= 1.0) && (v[2] >= 0.0) && (v[3] >= 0.0);
+}
+
+static bool parse_host_port(const char *arg, std::string &host, uint16_t &port) {
+    const char *colon = strrchr(arg, ':');
+    if (colon == nullptr) {
+        host = arg;
+        return true;
+    }
+    host.assign(arg, colon - arg);
+    port = (uint16_t)atoi(colon + 1);
+    return port != 0;
+}
+
+static bool resolve(const std::string &host, uint16_t port, sockaddr_in &addr) {
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    addrinfo *res = nullptr;
+    if (getaddrinfo(host.c_str(), nullptr, &hints, &res) != 0) {
+        return false;
+    }
+    addr = *(const sockaddr_in *)res->ai_addr;
+    addr.sin_port = htons(port);
+    freeaddrinfo(res);
+    return true;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-n units] [-t seconds] [-w workers] [-b host:port] [--codec ts|pmu|udp] [-q 0|1] [--mpb N] [--mps N]\n"
+            "          [--channels N] [--ramp s] [--backlog N] [--storm T[,frac[,outage[,spread]]]] [--seed N] [-i interval_s]\n"
+            "          [-o intervals.csv] [--max-loss pct] [--max-p99 ms]\n",
+            prog);
+}
+
+int main(int argc, char **argv) {
+    bool ok = true;
+    for (int i = 1; (i < argc) && ok; i++) {
+        const char *opt = argv[i];
+        const char *val = (i + 1 < argc) ? argv[i + 1] : nullptr;
+        if (val == nullptr) {
+            ok = false;
+        } else if (strcmp(opt, "-n") == 0) {
+            cfg.units = (size_t)atol(val);
+        } else if (strcmp(opt, "-t") == 0) {
+            cfg.seconds = atof(val);
+        } else if (strcmp(opt, "-w") == 0) {
+            cfg.workers = (size_t)atol(val);
+        } else if (strcmp(opt, "-b") == 0) {
+            ok = parse_host_port(val, cfg.host, cfg.port);
+        } else if (strcmp(opt, "--codec") == 0) {
+            ok = (strcmp(val, "ts") == 0) || (strcmp(val, "pmu") == 0) || (strcmp(val, "udp") == 0);
+            cfg.codec = (strcmp(val, "pmu") == 0) ? codec_t::pmu : ((strcmp(val, "udp") == 0) ? codec_t::udp : codec_t::thingspeak);
+        } else if (strcmp(opt, "-q") == 0) {
+            cfg.qos = (uint8_t)atoi(val);
+            ok = (cfg.qos <= 1);
+        } else if (strcmp(opt, "--mpb") == 0) {
+            cfg.mpb = (uint32_t)atol(val);
+        } else if (strcmp(opt, "--mps") == 0) {
+            cfg.mps = (uint32_t)atol(val);
+        } else if (strcmp(opt, "--channels") == 0) {
+            cfg.channels = (uint8_t)atoi(val);
+        } else if (strcmp(opt, "--ramp") == 0) {
+            cfg.ramp_s = atof(val);
+        } else if (strcmp(opt, "--backlog") == 0) {
+            cfg.backlog = atol(val);
+        } else if (strcmp(opt, "--storm") == 0) {
+            storm_params storm;
+            ok = parse_storm(val, storm);
+            cfg.storms.push_back(storm);
+        } else if (strcmp(opt, "--seed") == 0) {
+            cfg.seed = strtoull(val, nullptr, 10);
+        } else if (strcmp(opt, "-i") == 0) {
+            cfg.interval_s = atof(val);
+        } else if (strcmp(opt, "-o") == 0) {
+            cfg.csv_path = val;
+        } else if (strcmp(opt, "--max-loss") == 0) {
+            cfg.max_loss_pct = atof(val);
+        } else if (strcmp(opt, "--max-p99") == 0) {
+            cfg.max_p99_ms = atof(val);
+        } else {
+            ok = false;
+        }
+        i++;
+    }
+    if (cfg.port == 0) {
+        cfg.port = is_mqtt() ? 1883 : 0;
+    }
+    if (cfg.workers == 0) {
+        cfg.workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if (cfg.backlog < 0) {
+        cfg.backlog = is_mqtt() ? MQTT_BACKLOG_DEFAULT : UDP_BACKLOG_DEFAULT;
+    }
+    if ((ok == false) || (cfg.units == 0) || (cfg.units > UINT32_MAX) || (cfg.seconds <= 0.0) || (cfg.mpb == 0) || (cfg.mpb > 50) ||
+        (cfg.mps == 0) || (cfg.mps > 50) || (50 % cfg.mps != 0) || (cfg.channels == 0) || (cfg.channels > 4) || (cfg.port == 0) ||
+        (cfg.interval_s <= 0.0)) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (resolve(cfg.host, cfg.port, target) == false) {
+        fprintf(stderr, "Cannot resolve %s\n", cfg.host.c_str());
+        return 1;
+    }
+    cfg.workers = std::min(cfg.workers, cfg.units);
+
+    rlimit lim;  // One socket per unit
+    getrlimit(RLIMIT_NOFILE, &lim);
+    lim.rlim_cur = lim.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &lim);
+    if (is_mqtt() && ((cfg.units + 64) > lim.rlim_cur)) {
+        fprintf(stderr, "Open file limit %llu is too low for %zu units\n", (unsigned long long)lim.rlim_cur, cfg.units);
+        return 1;
+    }
+
+    FILE *csv = nullptr;
+    if (cfg.csv_path != nullptr) {
+        csv = fopen(cfg.csv_path, "w");
+        if (csv == nullptr) {
+            perror(cfg.csv_path);
+            return 1;
+        }
+        fprintf(csv, "t_s,online,tx_msg_s,tx_kB_s,rx_msg_s,latency_p50_ms,latency_p99_ms,backlog_drops,reconnects,connect_fails\n");
+    }
+
+    units.resize(cfg.units);
+    for (size_t i = 0; i < cfg.workers; i++) {
+        workers.push_back(std::make_unique<worker>());
+        worker &w = *workers.back();
+        w.index = i;
+        w.rng.seed(cfg.seed + i);
+        w.ep = epoll_create1(EPOLL_CLOEXEC);
+        if (is_mqtt() == false) {  // Datagrams of all units of a worker share a socket, NACKs come back to it
+            w.udp_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            int sndbuf = 4 * 1024 * 1024;
+            setsockopt(w.udp_fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+            connect(w.udp_fd, (const sockaddr *)&target, sizeof(target));
+            epoll_event ev = {};
+            ev.events = EPOLLIN;
+            ev.data.u64 = UINT64_MAX;
+            epoll_ctl(w.ep, EPOLL_CTL_ADD, w.udp_fd, &ev);
+        }
+    }
+    std::mt19937_64 rng(cfg.seed);
+    uint32_t boot = std::random_device()();  // Every run is a new boot of the fleet for the collector
+    for (size_t i = 0; i < cfg.units; i++) {
+        unit &u = units[i];
+        u.id = (uint32_t)(i + 1);
+        u.session = (uint32_t)rng() ^ boot;
+        u.topic = (cfg.codec == codec_t::thingspeak) ? (TS_TOPIC_PREFIX + std::to_string(u.id) + "/publish")
+                                                     : (PMU_TOPIC_PREFIX + std::to_string(u.id));
+        u.phase0 = (double)(rng() % 360000) / 1000.0;
+        u.burst.reserve(cfg.mpb);
+        if (is_mqtt() == false) {
+            u.retx.resize(UDP_RETX_WINDOW);
+        }
+        workers[i % cfg.workers]->units.push_back((uint32_t)i);
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    std::thread subscriber;
+    if (is_mqtt()) {
+        subscriber = std::thread(sub_run);
+        int64_t deadline = mono_us() + SUB_READY_TIMEOUT_US;
+        while ((sub_ready == false) && (mono_us() < deadline) && (interrupted == 0)) {
+            usleep(10000);
+        }
+        if (sub_ready == false) {
+            fprintf(stderr, "No subscription acknowledged by %s:%u, is the broker running?\n", cfg.host.c_str(), cfg.port);
+            stop_sub = true;
+            subscriber.join();
+            return 1;
+        }
+    }
+
+    const char *codec_name = (cfg.codec == codec_t::thingspeak) ? "ThingSpeak" : ((cfg.codec == codec_t::pmu) ? "C37.118" : "UDP stream");
+    fprintf(stderr, "Fleet: %zu units x %u channel(s), %s to %s:%u, %u measurements/s", cfg.units, cfg.channels, codec_name, cfg.host.c_str(),
+            cfg.port, cfg.mps);
+    if (is_mqtt()) {
+        fprintf(stderr, ", %u per burst, QoS %u", cfg.mpb, cfg.qos);
+    }
+    fprintf(stderr, ", backlog %ld, %zu worker(s), %.0f s\n", cfg.backlog, cfg.workers, cfg.seconds);
+
+    start_us = mono_us();
+    std::vector<std::thread> threads;
+    for (auto &w : workers) {
+        threads.emplace_back(worker_run, std::ref(*w));
+    }
+
+    totals prev;
+    uint64_t rx_prev = 0;
+    int64_t last_report = start_us;
+    int64_t end_us = start_us + (int64_t)(cfg.seconds * 1e6);
+    while ((mono_us() < end_us) && (interrupted == 0)) {
+        usleep(20000);
+        int64_t now = mono_us();
+        if ((now - last_report) >= (int64_t)(cfg.interval_s * 1e6)) {
+            totals t = sum_workers();
+            uint64_t rx;
+            {
+                std::lock_guard<std::mutex> guard(sub.lock);
+                rx = sub.received;
+            }
+            report_interval(csv, (double)(now - start_us) / 1e6, (double)(now - last_report) / 1e6, t, prev, rx, rx_prev);
+            prev = t;
+            rx_prev = rx;
+            last_report = now;
+        }
+    }
+    double run_s = (double)(mono_us() - start_us) / 1e6;
+
+    stop_units = true;
+    for (auto &t : threads) {
+        t.join();
+    }
+    totals t = sum_workers();
+
+    if (is_mqtt()) {  // Wait for the messages still on their way
+        int64_t deadline = mono_us() + DRAIN_US;
+        while (mono_us() < deadline) {
+            {
+                std::lock_guard<std::mutex> guard(sub.lock);
+                if ((sub.matched + sub.unmatched) >= t.published) {
+                    break;
+                }
+            }
+            usleep(20000);
+        }
+        stop_sub = true;
+        subscriber.join();
+    }
+    if (csv != nullptr) {
+        fclose(csv);
+    }
+
+    std::vector<double> latency, age;
+    {
+        std::lock_guard<std::mutex> guard(sub.lock);
+        sub.latency_all.insert(sub.latency_all.end(), sub.latency.begin(), sub.latency.end());
+        sub.age_all.insert(sub.age_all.end(), sub.age.begin(), sub.age.end());
+        latency.swap(sub.latency_all);
+        age.swap(sub.age_all);
+    }
+
+    fprintf(stderr, "Sent: %llu messages (%.1f msg/s), %.2f MB (%.1f kB/s), backfilled %llu, dropped at the units: %llu backlog full, %llu send "
+            "buffer full, %llu cut off by disconnects\n",
+            (unsigned long long)t.published, (double)t.published / run_s, (double)t.bytes_out / 1e6, (double)t.bytes_out / run_s / 1000.0,
+            (unsigned long long)t.backfilled, (unsigned long long)t.backlog_drops, (unsigned long long)t.overflow_drops,
+            (unsigned long long)t.discarded);
+    fprintf(stderr, "Connections: %llu established, %llu reconnects, %llu failed attempts, %llu unexpected disconnects, %llu dropped by storms\n",
+            (unsigned long long)t.connects, (unsigned long long)t.reconnects, (unsigned long long)t.connect_fails,
+            (unsigned long long)t.disconnects, (unsigned long long)t.storm_drops);
+
+    bool pass = true;
+    if (is_mqtt()) {
+        uint64_t delivered = sub.matched + sub.unmatched;
+        uint64_t lost = (t.published > delivered) ? (t.published - delivered) : 0;
+        double loss_pct = (t.published > 0) ? (100.0 * (double)lost / (double)t.published) : 0.0;
+        if (cfg.qos > 0) {
+            fprintf(stderr, "QoS 1: %llu PUBACKs, %llu resent after reconnects\n", (unsigned long long)t.acks, (unsigned long long)t.resent);
+        }
+        fprintf(stderr, "Received: %llu messages (%.1f msg/s), %.2f MB payload, lost in transit %llu (%.3f%%), duplicates %llu, unmatched %llu, foreign %llu\n",
+                (unsigned long long)sub.received, (double)sub.received / run_s, (double)sub.bytes_in / 1e6, (unsigned long long)lost, loss_pct,
+                (unsigned long long)sub.duplicates, (unsigned long long)sub.unmatched, (unsigned long long)sub.foreign);
+        double p99 = percentile(latency, 0.99);
+        if (latency.empty()) {
+            fprintf(stderr, "Latency (publish to subscriber): no samples\n");
+        } else {
+            fprintf(stderr, "Latency (publish to subscriber): n=%zu p50=%.2f ms p90=%.2f ms p99=%.2f ms p99.9=%.2f ms max=%.2f ms\n",
+                    latency.size(), percentile(latency, 0.50), percentile(latency, 0.90), p99, percentile(latency, 0.999),
+                    *std::max_element(latency.begin(), latency.end()));
+            fprintf(stderr, "Newest sample age at the subscriber: p50=%.1f ms p99=%.1f ms max=%.1f ms\n", percentile(age, 0.50),
+                    percentile(age, 0.99), *std::max_element(age.begin(), age.end()));
+        }
+        if ((cfg.max_loss_pct >= 0.0) && (loss_pct > cfg.max_loss_pct)) {
+            fprintf(stderr, "FAIL: loss %.3f%% above %.3f%%\n", loss_pct, cfg.max_loss_pct);
+            pass = false;
+        }
+        if ((cfg.max_p99_ms >= 0.0) && ((latency.empty()) || (p99 > cfg.max_p99_ms))) {
+            fprintf(stderr, "FAIL: p99 latency %.2f ms above %.2f ms\n", p99, cfg.max_p99_ms);
+            pass = false;
+        }
+    } else {
+        fprintf(stderr, "UDP: %llu NACKs, %llu datagrams retransmitted, %llu no longer kept (latency and loss: see udp_collector)\n",
+                (unsigned long long)t.nacks, (unsigned long long)t.retx, (unsigned long long)t.retx_expired);
+    }
+
+    return pass ? 0 : 2;
+}
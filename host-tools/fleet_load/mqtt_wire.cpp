@@ -0,0 +1,155 @@
+/**
+ * @file    mqtt_wire.cpp
+ * @brief   Minimal MQTT 3.1.1 packet encoding and parsing (the subset used by HertzNet units: CONNECT, PUBLISH QoS 0/1, SUBSCRIBE)
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#include "mqtt_wire.h"
+
+#define MQTT_REMLEN_MAX 268435455  // Largest remaining length that fits the 4-byte encoding
+
+/**
+ * @brief Append the fixed header: packet type and flags, remaining length as a variable byte integer
+ */
+static void put_fixed_header(std::string &out, uint8_t type, uint8_t flags, size_t remaining) {
+    out.push_back((char)((type << 4) | flags));
+    do {
+        uint8_t byte = remaining % 128;
+        remaining /= 128;
+        if (remaining > 0) {
+            byte |= 0x80;
+        }
+        out.push_back((char)byte);
+    } while (remaining > 0);
+}
+
+static void put_u16(std::string &out, uint16_t val) {
+    out.push_back((char)(val >> 8));
+    out.push_back((char)(val & 0xFF));
+}
+
+static void put_str(std::string &out, const std::string &str) {
+    put_u16(out, (uint16_t)str.size());
+    out.append(str);
+}
+
+/**
+ * @brief Append a CONNECT packet (clean session, no will, no credentials)
+ */
+void mqtt_connect(std::string &out, const std::string &client_id, uint16_t keepalive_s) {
+    put_fixed_header(out, MQTT_CONNECT, 0, 10 + 2 + client_id.size());
+    put_str(out, "MQTT");
+    out.push_back(4);     // Protocol level 3.1.1
+    out.push_back(0x02);  // Clean session
+    put_u16(out, keepalive_s);
+    put_str(out, client_id);
+}
+
+/**
+ * @brief Size of a PUBLISH packet
+ */
+size_t mqtt_publish_size(size_t topic_len, size_t payload_len, uint8_t qos) {
+    size_t remaining = 2 + topic_len + ((qos > 0) ? 2 : 0) + payload_len;
+    size_t len_bytes = (remaining < 128) ? 1 : ((remaining < 16384) ? 2 : ((remaining < 2097152) ? 3 : 4));
+    return 1 + len_bytes + remaining;
+}
+
+/**
+ * @brief Append a PUBLISH packet
+ */
+void mqtt_publish(std::string &out, const std::string &topic, const void *payload, size_t len, uint8_t qos, uint16_t packet_id) {
+    put_fixed_header(out, MQTT_PUBLISH, (uint8_t)(qos << 1), 2 + topic.size() + ((qos > 0) ? 2 : 0) + len);
+    put_str(out, topic);
+    if (qos > 0) {
+        put_u16(out, packet_id);
+    }
+    out.append((const char *)payload, len);
+}
+
+/**
+ * @brief Append a SUBSCRIBE packet with a single topic filter
+ */
+void mqtt_subscribe(std::string &out, uint16_t packet_id, const std::string &filter, uint8_t qos) {
+    put_fixed_header(out, MQTT_SUBSCRIBE, 0x02, 2 + 2 + filter.size() + 1);
+    put_u16(out, packet_id);
+    put_str(out, filter);
+    out.push_back((char)qos);
+}
+
+/**
+ * @brief Append a PUBACK packet
+ */
+void mqtt_puback(std::string &out, uint16_t packet_id) {
+    put_fixed_header(out, MQTT_PUBACK, 0, 2);
+    put_u16(out, packet_id);
+}
+
+/**
+ * @brief Append a DISCONNECT packet
+ */
+void mqtt_disconnect(std::string &out) {
+    put_fixed_header(out, MQTT_DISCONNECT, 0, 0);
+}
+
+/**
+ * @brief Parse the control packet at the start of buf
+ * @param buf Received bytes
+ * @param len Number of received bytes
+ * @param pkt Parsed packet (valid if a positive value is returned)
+ * @return Packet length, 0 if more bytes are needed, -1 if the stream is malformed
+ */
+long mqtt_parse(const uint8_t *buf, size_t len, mqtt_packet &pkt) {
+    size_t remaining = 0;
+    size_t pos = 1;
+
+    for (size_t mult = 1;; mult *= 128) {
+        if (pos >= len) {
+            return 0;
+        }
+        if (pos > 4) {
+            return -1;  // Remaining length longer than 4 bytes
+        }
+        uint8_t byte = buf[pos++];
+        remaining += (size_t)(byte & 0x7F) * mult;
+        if ((byte & 0x80) == 0) {
+            break;
+        }
+    }
+    if (remaining > MQTT_REMLEN_MAX) {
+        return -1;
+    }
+    if ((len - pos) < remaining) {
+        return 0;
+    }
+
+    pkt.type = buf[0] >> 4;
+    pkt.flags = buf[0] & 0x0F;
+    pkt.body = &buf[pos];
+    pkt.len = remaining;
+    return (long)(pos + remaining);
+}
+
+/**
+ * @brief Split a PUBLISH packet into topic, packet identifier and payload
+ * @return False if the packet is not a well-formed PUBLISH
+ */
+bool mqtt_parse_publish(const mqtt_packet &pkt, mqtt_publish_view &pub) {
+    if ((pkt.type != MQTT_PUBLISH) || (pkt.len < 2)) {
+        return false;
+    }
+    pub.qos = (pkt.flags >> 1) & 0x03;
+    pub.topic_len = ((size_t)pkt.body[0] << 8) | pkt.body[1];
+    size_t pos = 2 + pub.topic_len;
+    if ((pub.qos > 2) || (pos + ((pub.qos > 0) ? 2 : 0) > pkt.len)) {
+        return false;
+    }
+    pub.topic = (const char *)&pkt.body[2];
+    pub.packet_id = 0;
+    if (pub.qos > 0) {
+        pub.packet_id = (uint16_t)((pkt.body[pos] << 8) | pkt.body[pos + 1]);
+        pos += 2;
+    }
+    pub.payload = &pkt.body[pos];
+    pub.payload_len = pkt.len - pos;
+    return true;
+}
@@ -0,0 +1,48 @@
+/**
+ * @file    mqtt_wire.h
+ * @brief   Minimal MQTT 3.1.1 packet encoding and parsing (the subset used by HertzNet units: CONNECT, PUBLISH QoS 0/1, SUBSCRIBE)
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+enum mqtt_type : uint8_t {  // Control packet types
+    MQTT_CONNECT = 1,
+    MQTT_CONNACK = 2,
+    MQTT_PUBLISH = 3,
+    MQTT_PUBACK = 4,
+    MQTT_SUBSCRIBE = 8,
+    MQTT_SUBACK = 9,
+    MQTT_PINGREQ = 12,
+    MQTT_PINGRESP = 13,
+    MQTT_DISCONNECT = 14,
+};
+
+struct mqtt_packet {      // Parsed control packet (points into the receive buffer)
+    uint8_t type;         // mqtt_type
+    uint8_t flags;        // Lower nibble of the fixed header
+    const uint8_t *body;  // Variable header and payload
+    size_t len;           // Length of body
+};
+
+struct mqtt_publish_view {   // Parsed PUBLISH packet
+    const char *topic;       // Topic name (not terminated)
+    size_t topic_len;        // Length of topic
+    uint16_t packet_id;      // Packet identifier (QoS > 0 only)
+    uint8_t qos;             // QoS level
+    const uint8_t *payload;  // Application message
+    size_t payload_len;      // Length of payload
+};
+
+void mqtt_connect(std::string &out, const std::string &client_id, uint16_t keepalive_s);
+void mqtt_publish(std::string &out, const std::string &topic, const void *payload, size_t len, uint8_t qos, uint16_t packet_id);
+void mqtt_subscribe(std::string &out, uint16_t packet_id, const std::string &filter, uint8_t qos);
+void mqtt_puback(std::string &out, uint16_t packet_id);
+void mqtt_disconnect(std::string &out);
+size_t mqtt_publish_size(size_t topic_len, size_t payload_len, uint8_t qos);
+long mqtt_parse(const uint8_t *buf, size_t len, mqtt_packet &pkt);
+bool mqtt_parse_publish(const mqtt_packet &pkt, mqtt_publish_view &pub);
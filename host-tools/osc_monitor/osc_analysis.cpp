@@ -0,0 +1,308 @@
+/**
+ * @file    osc_analysis.cpp
+ * @brief   Streaming spectral analysis of per-unit frequency series: Welch PSD, sliding-DFT band energies and oscillation modes
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#include "osc_analysis.h"
+
+#include <algorithm>
+#include <cmath>
+
+#define KERNEL_HALF_POWER_BW 2.45  // Half-power bandwidth of a pure tone after the Hann window and [1 2 1] smoothing [bins]
+#define SDFT_DAMPING 0.99999     // Pole radius of the sliding DFT, keeps rounding errors from accumulating
+
+/**
+ * @brief Prepare twiddles and the bit-reversal table for a real FFT of length n (power of two, n >= 4)
+ */
+real_fft::real_fft(size_t n) : n_(n), twiddle_(n / 4), split_(n / 2 + 1), bitrev_(n / 2), work_(n / 2) {
+    size_t m = n / 2;
+    for (size_t k = 0; k < m / 2; k++) {
+        twiddle_[k] = std::polar(1.0, -2.0 * M_PI * (double)k / (double)m);
+    }
+    for (size_t k = 0; k <= m; k++) {
+        split_[k] = std::polar(1.0, -2.0 * M_PI * (double)k / (double)n);
+    }
+
+    size_t bits = 0;
+    while (((size_t)1 << bits) < m) {
+        bits++;
+    }
+    for (size_t i = 0; i < m; i++) {
+        uint32_t r = 0;
+        for (size_t b = 0; b < bits; b++) {
+            r |= (uint32_t)((i >> b) & 1) << (bits - 1 - b);
+        }
+        bitrev_[i] = r;
+    }
+}
+
+/**
+ * @brief Forward transform: even/odd samples are packed into one half-length complex FFT and separated afterwards
+ * @param in n real samples
+ * @param out n/2 + 1 complex bins (DC to Nyquist)
+ */
+void real_fft::forward(const double *in, std::complex<double> *out) {
+    size_t m = n_ / 2;
+    for (size_t i = 0; i < m; i++) {
+        work_[bitrev_[i]] = {in[2 * i], in[2 * i + 1]};
+    }
+
+    for (size_t len = 2; len <= m; len <<= 1) {  // Iterative radix-2 butterflies
+        size_t half = len / 2;
+        size_t step = m / len;
+        for (size_t i = 0; i < m; i += len) {
+            for (size_t k = 0; k < half; k++) {
+                std::complex<double> u = work_[i + k];
+                std::complex<double> v = work_[i + k + half] * twiddle_[k * step];
+                work_[i + k] = u + v;
+                work_[i + k + half] = u - v;
+            }
+        }
+    }
+
+    out[0] = {work_[0].real() + work_[0].imag(), 0.0};
+    out[m] = {work_[0].real() - work_[0].imag(), 0.0};
+    for (size_t k = 1; k < m; k++) {
+        std::complex<double> z = work_[k];
+        std::complex<double> zc = std::conj(work_[m - k]);
+        std::complex<double> even = 0.5 * (z + zc);
+        std::complex<double> odd = std::complex<double>(0.0, -0.5) * (z - zc);
+        out[k] = even + split_[k] * odd;
+    }
+}
+
+osc_workspace::osc_workspace(const osc_params &p) : params(p), fft(p.welch_len), window(p.welch_len), window_power(0.0), segment(p.welch_len), spec(p.welch_len / 2 + 1) {
+    for (size_t i = 0; i < p.welch_len; i++) {
+        window[i] = 0.5 - 0.5 * cos(2.0 * M_PI * (double)i / (double)p.welch_len);
+        window_power += window[i] * window[i];
+    }
+}
+
+/**
+ * @brief Find oscillation modes in a one-sided PSD
+ * @param psd PSD of the frequency deviation [Hz^2/Hz]
+ * @param bins Number of PSD bins
+ * @param df Bin spacing [Hz]
+ * @param params Analysis parameters
+ * @return Modes sorted by amplitude, largest first
+ */
+std::vector<osc_mode> osc_detect_modes(const double *psd, size_t bins, double df, const osc_params &params) {
+    std::vector<osc_mode> modes;
+    size_t k_lo = std::max<size_t>(1, (size_t)ceil(params.f_min / df));
+    size_t k_hi = std::min(bins - 2, (size_t)floor(params.f_max / df));
+    if (k_hi <= k_lo + 1) {
+        return modes;
+    }
+
+    std::vector<double> sm(psd, psd + bins);  // [1 2 1] smoothed PSD: steadier peaks and half-power crossings
+    for (size_t k = 1; k + 1 < bins; k++) {
+        sm[k] = 0.25 * psd[k - 1] + 0.5 * psd[k] + 0.25 * psd[k + 1];
+    }
+
+    std::vector<double> sorted(sm.begin() + k_lo, sm.begin() + k_hi + 1);  // Noise floor: lower quartile, robust to broad modes
+    std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 4, sorted.end());
+    double noise = sorted[sorted.size() / 4];
+
+    for (size_t k = k_lo + 1; k < k_hi; k++) {
+        double p = sm[k];
+        if ((p <= sm[k - 1]) || (p < sm[k + 1]) || (p < noise * params.peak_ratio)) {
+            continue;
+        }
+
+        double a = sm[k - 1], c = sm[k + 1];
+        double delta = 0.5 * (a - c) / (a - 2.0 * p + c);  // Parabolic peak interpolation
+
+        double half = 0.5 * p;  // Half-power crossings, linearly interpolated
+        size_t l = k, r = k;
+        while ((l > 1) && (sm[l] > half)) {
+            l--;
+        }
+        while ((r < bins - 1) && (sm[r] > half)) {
+            r++;
+        }
+        double f_l = (double)l + (half - sm[l]) / (sm[l + 1] - sm[l]);
+        double f_r = (double)r - (half - sm[r]) / (sm[r - 1] - sm[r]);
+        double bw = (f_r - f_l) * df;
+        double bw_mode = std::max(bw - KERNEL_HALF_POWER_BW * df, 0.0);  // Remove the spread of a pure tone
+
+        double var = 0.0;  // Power above the noise floor around the peak
+        size_t w = std::max<size_t>(2, (size_t)ceil(bw / df));
+        for (size_t i = (k > w) ? (k - w) : 1; (i <= k + w) && (i < bins); i++) {
+            var += std::max(psd[i] - noise, 0.0) * df;
+        }
+
+        osc_mode mode;
+        mode.freq_hz = ((double)k + delta) * df;
+        mode.damping = bw_mode / (2.0 * mode.freq_hz);
+        mode.amp_mhz = sqrt(2.0 * var) * 1000.0;
+        mode.snr_db = 10.0 * log10(p / noise);
+        if ((mode.amp_mhz >= params.min_amp_mhz) && (mode.damping <= params.max_damping)) {
+            modes.push_back(mode);
+        }
+    }
+
+    std::sort(modes.begin(), modes.end(), [](const osc_mode &x, const osc_mode &y) { return x.amp_mhz > y.amp_mhz; });
+    return modes;
+}
+
+osc_analyzer::osc_analyzer(uint32_t device, const osc_params &params)
+    : device_(device),
+      params_(params),
+      period_us_((uint64_t)llround(1e6 / params.fs)),
+      hist_(params.welch_len),
+      sdft_hist_(params.sdft_len) {
+    double df = params.fs / (double)params.welch_len;
+    psd_bins_ = std::min(params.welch_len / 2 + 1, (size_t)floor(params.f_max / df) + 2);
+    seg_psd_.assign(params.welch_avg * psd_bins_, 0.0);
+    psd_avg_.assign(psd_bins_, 0.0);
+
+    double df_s = params.fs / (double)params.sdft_len;
+    sdft_k0_ = std::max<size_t>(1, (size_t)ceil(params.bands[0] / df_s));
+    sdft_k1_ = (size_t)floor(params.bands[OSC_BANDS] / df_s);
+    sdft_rn_ = pow(SDFT_DAMPING, (double)params.sdft_len);
+    for (size_t k = sdft_k0_; k <= sdft_k1_; k++) {
+        sdft_rot_.push_back(SDFT_DAMPING * std::polar(1.0, 2.0 * M_PI * (double)k / (double)params.sdft_len));
+    }
+    sdft_.assign(sdft_rot_.size(), 0.0);
+}
+
+void osc_analyzer::reset() {
+    std::fill(hist_.begin(), hist_.end(), 0.0f);
+    std::fill(sdft_hist_.begin(), sdft_hist_.end(), 0.0f);
+    std::fill(sdft_.begin(), sdft_.end(), 0.0);
+    hist_pos_ = hist_fill_ = since_seg_ = 0;
+    seg_pos_ = seg_fill_ = 0;
+    sdft_pos_ = 0;
+    last_t_us_ = 0;
+}
+
+/**
+ * @brief Feed one measurement; short gaps are filled with the last value, long gaps restart the analysis
+ * @param t_us UTC timestamp of the measurement
+ * @param f_hz Frequency
+ * @param ws Worker scratch
+ * @param sink Output
+ */
+void osc_analyzer::push(uint64_t t_us, float f_hz, osc_workspace &ws, osc_sink &sink) {
+    if (last_t_us_ != 0) {
+        if (t_us <= last_t_us_) {  // Duplicate or out of order
+            return;
+        }
+        uint64_t steps = (t_us - last_t_us_ + period_us_ / 2) / period_us_;
+        if (steps > params_.max_gap + 1) {
+            reset();
+        } else {
+            for (uint64_t i = 1; i < steps; i++) {
+                add_sample(last_x_, last_t_us_ + i * period_us_, ws, sink);
+            }
+        }
+    }
+
+    float x = (float)((double)f_hz - params_.nominal_hz);
+    add_sample(x, t_us, ws, sink);
+    last_x_ = x;
+    last_t_us_ = t_us;
+}
+
+void osc_analyzer::add_sample(float x, uint64_t t_us, osc_workspace &ws, osc_sink &sink) {
+    float old = sdft_hist_[sdft_pos_];  // Sliding DFT: X = r e^(j2pik/N) X + x(n) - r^N x(n-N)
+    sdft_hist_[sdft_pos_] = x;
+    sdft_pos_ = (sdft_pos_ + 1) % params_.sdft_len;
+    double in = (double)x - sdft_rn_ * (double)old;
+    for (size_t i = 0; i < sdft_.size(); i++) {
+        sdft_[i] = sdft_rot_[i] * sdft_[i] + in;
+    }
+
+    hist_[hist_pos_] = x;
+    hist_pos_ = (hist_pos_ + 1) % params_.welch_len;
+    hist_fill_ = std::min(hist_fill_ + 1, params_.welch_len);
+    since_seg_++;
+    if ((hist_fill_ == params_.welch_len) && (since_seg_ >= params_.welch_len / 2)) {  // 50% overlap
+        since_seg_ = 0;
+        welch_update(t_us, ws, sink);
+    }
+}
+
+/**
+ * @brief Add the latest segment to the Welch average, detect modes and emit summary and alert records
+ */
+void osc_analyzer::welch_update(uint64_t t_us, osc_workspace &ws, osc_sink &sink) {
+    size_t n = params_.welch_len;
+
+    double mean_i = 0.5 * (double)(n - 1), mean_x = 0.0;  // Linear detrend (least squares)
+    for (size_t i = 0; i < n; i++) {
+        ws.segment[i] = hist_[(hist_pos_ + i) % n];  // Oldest sample first
+        mean_x += ws.segment[i];
+    }
+    mean_x /= (double)n;
+    double sxy = 0.0, sxx = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        sxy += ((double)i - mean_i) * (ws.segment[i] - mean_x);
+        sxx += ((double)i - mean_i) * ((double)i - mean_i);
+    }
+    double slope = sxy / sxx;
+    for (size_t i = 0; i < n; i++) {
+        ws.segment[i] = (ws.segment[i] - mean_x - slope * ((double)i - mean_i)) * ws.window[i];
+    }
+
+    ws.fft.forward(ws.segment.data(), ws.spec.data());
+
+    double scale = 2.0 / (params_.fs * ws.window_power);  // One-sided PSD [Hz^2/Hz]
+    double *seg = &seg_psd_[seg_pos_ * psd_bins_];
+    for (size_t k = 0; k < psd_bins_; k++) {
+        seg[k] = std::norm(ws.spec[k]) * scale;
+    }
+    seg_pos_ = (seg_pos_ + 1) % params_.welch_avg;
+    seg_fill_ = std::min(seg_fill_ + 1, params_.welch_avg);
+
+    std::fill(psd_avg_.begin(), psd_avg_.end(), 0.0);  // Recomputed rather than running, so no drift
+    for (size_t s = 0; s < seg_fill_; s++) {
+        for (size_t k = 0; k < psd_bins_; k++) {
+            psd_avg_[k] += seg_psd_[s * psd_bins_ + k] / (double)seg_fill_;
+        }
+    }
+
+    std::vector<osc_mode> modes = osc_detect_modes(psd_avg_.data(), psd_bins_, params_.fs / (double)n, params_);
+
+    osc_summary rec = {};
+    rec.device = device_;
+    rec.t_us = t_us;
+    double df_s = params_.fs / (double)params_.sdft_len;
+    double norm = 2.0 / ((double)params_.sdft_len * (double)params_.sdft_len);
+    for (size_t i = 0; i < sdft_.size(); i++) {
+        double f = (double)(sdft_k0_ + i) * df_s;
+        for (int b = 0; b < OSC_BANDS; b++) {
+            if ((f >= params_.bands[b]) && ((f < params_.bands[b + 1]) || (b == OSC_BANDS - 1))) {
+                rec.band_rms_mhz[b] += std::norm(sdft_[i]) * norm;  // Variance, converted below
+                break;
+            }
+        }
+    }
+    for (int b = 0; b < OSC_BANDS; b++) {
+        rec.band_rms_mhz[b] = sqrt(rec.band_rms_mhz[b]) * 1000.0;
+    }
+    rec.n_modes = modes.size();
+    if (modes.empty() == false) {
+        rec.dominant = modes[0];
+    }
+    sink.summary(rec);
+
+    const osc_mode *poor = nullptr;  // Largest poorly damped mode
+    for (const osc_mode &mode : modes) {
+        if ((mode.amp_mhz >= params_.alert_amp_mhz) && (mode.damping < params_.alert_damping)) {
+            poor = &mode;
+            break;
+        }
+    }
+    if ((poor != nullptr) == alert_) {
+        alert_votes_ = 0;
+    } else if (++alert_votes_ >= params_.alert_persist) {  // Raise or clear only once the new state persists
+        alert_ = (poor != nullptr);
+        alert_votes_ = 0;
+        if (poor != nullptr) {
+            alert_mode_ = *poor;
+        }
+        sink.alert({device_, t_us, alert_, alert_mode_});
+    }
+}
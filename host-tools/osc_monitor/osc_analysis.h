@@ -0,0 +1,124 @@
+/**
+ * @file    osc_analysis.h
+ * @brief   Streaming spectral analysis of per-unit frequency series: Welch PSD, sliding-DFT band energies and oscillation modes
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#pragma once
+
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define OSC_BANDS 3  // Number of sliding-DFT bands
+
+struct osc_params {                                       // Analysis parameters shared by all units
+    double fs = 50.0;                                     // Sample rate [Hz]
+    double nominal_hz = 50.0;                             // Nominal frequency, removed before analysis [Hz]
+    size_t welch_len = 2048;                              // Welch segment length, power of two (41 s at 50 Hz, 0.024 Hz resolution)
+    size_t welch_avg = 16;                                // Number of 50% overlapping segments averaged
+    size_t sdft_len = 1000;                               // Sliding DFT window (20 s at 50 Hz, 0.05 Hz bins)
+    double f_min = 0.05;                                  // Lowest oscillation frequency of interest [Hz]
+    double f_max = 2.0;                                   // Highest oscillation frequency of interest [Hz]
+    double bands[OSC_BANDS + 1] = {0.05, 0.2, 1.0, 2.0};  // Band edges: slow, inter-area, local plant [Hz]
+    double peak_ratio = 20.0;                             // Min peak to noise floor ratio (13 dB)
+    double max_damping = 0.3;                             // Broader peaks are not treated as oscillatory modes
+    double min_amp_mhz = 2.0;                             // Min mode amplitude reported [mHz]
+    double alert_amp_mhz = 5.0;                           // Alert if a mode is at least this large [mHz] ...
+    double alert_damping = 0.05;                          // ... and less damped than this (damping ratio)
+    size_t alert_persist = 2;                             // Consecutive Welch updates needed to raise or clear an alert
+    size_t max_gap = 100;                                 // Longest gap filled by holding the last value [samples]
+};
+
+struct osc_mode {    // Detected oscillation mode
+    double freq_hz;  // Peak frequency (parabolic interpolation)
+    double damping;  // Damping ratio from the half-power bandwidth
+    double amp_mhz;  // Amplitude (peak, from the integrated peak power) [mHz]
+    double snr_db;   // Peak to noise floor ratio [dB]
+};
+
+struct osc_summary {                 // Summary record emitted on every Welch update
+    uint32_t device;                 // Unit ID
+    uint64_t t_us;                   // Time of the last sample
+    double band_rms_mhz[OSC_BANDS];  // RMS frequency deviation per band (sliding DFT) [mHz]
+    size_t n_modes;                  // Number of detected modes
+    osc_mode dominant;               // Largest mode (valid if n_modes > 0)
+};
+
+struct osc_alert {    // Alert raised or cleared for a poorly damped oscillation
+    uint32_t device;  // Unit ID
+    uint64_t t_us;    // Time of the last sample
+    bool raised;      // True when raised, false when cleared
+    osc_mode mode;    // Mode that triggered the alert (last one when cleared)
+};
+
+class osc_sink {  // Consumer of analysis output (called from worker threads)
+   public:
+    virtual ~osc_sink() = default;
+    virtual void summary(const osc_summary &rec) = 0;
+    virtual void alert(const osc_alert &rec) = 0;
+};
+
+class real_fft {  // Real-input FFT of a power-of-two length through a half-length complex FFT
+   public:
+    explicit real_fft(size_t n);
+    void forward(const double *in, std::complex<double> *out);  // out: n/2 + 1 bins
+    size_t size() const { return n_; }
+
+   private:
+    size_t n_;
+    std::vector<std::complex<double>> twiddle_;  // Half-length complex FFT twiddles
+    std::vector<std::complex<double>> split_;    // Twiddles separating the even/odd packed spectrum
+    std::vector<uint32_t> bitrev_;
+    std::vector<std::complex<double>> work_;
+};
+
+class osc_workspace {  // Per-worker scratch shared by all units of the worker (not thread-safe)
+   public:
+    explicit osc_workspace(const osc_params &params);
+
+    const osc_params &params;
+    real_fft fft;
+    std::vector<double> window;              // Hann window
+    double window_power;                     // Sum of squared window values
+    std::vector<double> segment;             // Detrended, windowed segment
+    std::vector<std::complex<double>> spec;  // Segment spectrum
+};
+
+std::vector<osc_mode> osc_detect_modes(const double *psd, size_t bins, double df, const osc_params &params);
+
+class osc_analyzer {  // Streaming analysis state of one unit
+   public:
+    osc_analyzer(uint32_t device, const osc_params &params);
+    void push(uint64_t t_us, float f_hz, osc_workspace &ws, osc_sink &sink);
+
+   private:
+    void add_sample(float x, uint64_t t_us, osc_workspace &ws, osc_sink &sink);
+    void welch_update(uint64_t t_us, osc_workspace &ws, osc_sink &sink);
+    void reset();
+
+    uint32_t device_;
+    const osc_params &params_;
+    uint64_t last_t_us_ = 0;                      // Time of the last sample
+    float last_x_ = 0;                            // Last deviation from nominal, used to fill short gaps
+    uint64_t period_us_;                          // Nominal sampling period
+    std::vector<float> hist_;                     // Input history (ring, welch_len samples)
+    size_t hist_pos_ = 0;                         // Next write position in hist_
+    size_t hist_fill_ = 0;                        // Number of valid samples in hist_
+    size_t since_seg_ = 0;                        // Samples since the last Welch segment
+    size_t psd_bins_;                             // Number of PSD bins kept (0 .. f_max)
+    std::vector<double> seg_psd_;                 // Periodograms of the last welch_avg segments (ring)
+    std::vector<double> psd_avg_;                 // Average of seg_psd_ (Welch PSD)
+    size_t seg_pos_ = 0;                          // Next segment slot
+    size_t seg_fill_ = 0;                         // Number of valid segments
+    size_t sdft_k0_, sdft_k1_;                    // Sliding DFT bin range
+    std::vector<std::complex<double>> sdft_;      // Sliding DFT bins
+    std::vector<std::complex<double>> sdft_rot_;  // Per-bin rotation (damped)
+    std::vector<float> sdft_hist_;                // Sliding DFT input (ring, sdft_len samples)
+    size_t sdft_pos_ = 0;                         // Next write position in sdft_hist_
+    double sdft_rn_;                              // r^N of the damped sliding DFT
+    bool alert_ = false;                          // Alert currently raised
+    size_t alert_votes_ = 0;                      // Consecutive updates disagreeing with alert_
+    osc_mode alert_mode_ = {};                    // Mode of the active alert
+};
@@ -0,0 +1,305 @@
+/**
+ * @file    osc_monitor.cpp
+ * @brief   Real-time oscillation monitoring of the whole fleet on a bounded worker pool, with a synthetic throughput benchmark
+ * @note    Usage: udp_collector 47001 /dev/stdout | osc_monitor [-w workers] [-r rate_hz]
+ *                 osc_monitor --bench <units> [seconds] [-w workers]
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "osc_analysis.h"
+
+#define BATCH_SIZE 512    // Samples handed to a worker at once
+#define QUEUE_BATCHES 64  // Max batches waiting per worker (producer blocks beyond that)
+
+struct sample_rec {   // Measurement routed to a worker
+    uint32_t device;  // Unit ID
+    float f_hz;       // Frequency
+    uint64_t t_us;    // UTC timestamp
+};
+
+class batch_queue {  // Bounded blocking queue of sample batches (single producer, single consumer)
+   public:
+    void push(std::vector<sample_rec> &&batch) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this] { return queue_.size() < QUEUE_BATCHES; });
+        queue_.push_back(std::move(batch));
+        not_empty_.notify_one();
+    }
+
+    bool pop(std::vector<sample_rec> &batch) {  // False once closed and drained
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this] { return (queue_.empty() == false) || closed_; });
+        if (queue_.empty()) {
+            return false;
+        }
+        batch = std::move(queue_.front());
+        queue_.pop_front();
+        not_full_.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_empty_.notify_all();
+    }
+
+   private:
+    std::mutex mutex_;
+    std::condition_variable not_empty_, not_full_;
+    std::deque<std::vector<sample_rec>> queue_;
+    bool closed_ = false;
+};
+
+class worker_pool {  // Units are sharded over workers by ID, so each unit's state is only touched by one thread
+   public:
+    worker_pool(size_t workers, const osc_params &params, osc_sink &sink) : params_(params), sink_(sink), queues_(workers), pending_(workers) {
+        for (size_t i = 0; i < workers; i++) {
+            threads_.emplace_back(&worker_pool::run, this, i);
+        }
+    }
+
+    void push(const sample_rec &rec) {
+        size_t w = shard(rec.device);
+        pending_[w].push_back(rec);
+        if (pending_[w].size() >= BATCH_SIZE) {
+            queues_[w].push(std::move(pending_[w]));
+            pending_[w] = std::vector<sample_rec>();
+            pending_[w].reserve(BATCH_SIZE);
+        }
+    }
+
+    void finish() {
+        for (size_t w = 0; w < queues_.size(); w++) {
+            if (pending_[w].empty() == false) {
+                queues_[w].push(std::move(pending_[w]));
+            }
+            queues_[w].close();
+        }
+        for (std::thread &t : threads_) {
+            t.join();
+        }
+    }
+
+   private:
+    size_t shard(uint32_t device) const {
+        return (size_t)((device * 2654435761u) >> 16) % queues_.size();  // Spread sequential IDs evenly
+    }
+
+    void run(size_t w) {
+        osc_workspace ws(params_);
+        std::unordered_map<uint32_t, osc_analyzer> units;
+        std::vector<sample_rec> batch;
+        while (queues_[w].pop(batch)) {
+            for (const sample_rec &rec : batch) {
+                auto it = units.find(rec.device);
+                if (it == units.end()) {
+                    it = units.emplace(rec.device, osc_analyzer(rec.device, params_)).first;
+                }
+                it->second.push(rec.t_us, rec.f_hz, ws, sink_);
+            }
+        }
+    }
+
+    const osc_params &params_;
+    osc_sink &sink_;
+    std::vector<batch_queue> queues_;
+    std::vector<std::vector<sample_rec>> pending_;  // Batches being filled by the producer
+    std::vector<std::thread> threads_;
+};
+
+class print_sink : public osc_sink {  // CSV records on stdout
+   public:
+    void summary(const osc_summary &r) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        printf("summary,%08x,%.3f,%.2f,%.2f,%.2f,%zu,%.3f,%.3f,%.2f\n", r.device, (double)r.t_us / 1e6, r.band_rms_mhz[0], r.band_rms_mhz[1],
+               r.band_rms_mhz[2], r.n_modes, r.n_modes ? r.dominant.freq_hz : 0.0, r.n_modes ? r.dominant.damping : 0.0,
+               r.n_modes ? r.dominant.amp_mhz : 0.0);
+    }
+
+    void alert(const osc_alert &r) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        printf("alert,%08x,%.3f,%s,%.3f,%.3f,%.2f\n", r.device, (double)r.t_us / 1e6, r.raised ? "raised" : "cleared", r.mode.freq_hz, r.mode.damping,
+               r.mode.amp_mhz);
+        fflush(stdout);
+    }
+
+   private:
+    std::mutex mutex_;
+};
+
+class bench_sink : public osc_sink {  // Keeps the last summary of each unit (unit IDs 0..n-1, one writer per unit)
+   public:
+    explicit bench_sink(size_t units) : last(units), alerted(units, 0) {}
+
+    void summary(const osc_summary &r) override {
+        last[r.device] = r;
+        summaries++;
+    }
+
+    void alert(const osc_alert &r) override {
+        alerted[r.device] = r.raised;
+        alerts++;
+    }
+
+    std::vector<osc_summary> last;
+    std::vector<uint8_t> alerted;
+    std::atomic<uint64_t> summaries{0};
+    std::atomic<uint64_t> alerts{0};
+};
+
+struct synth_unit {  // Frequency of one synthetic unit: nominal + AR(2) resonance (true mode) + white measurement noise
+    double c1, c2;   // AR(2) coefficients
+    double drive;    // Driving noise standard deviation
+    double y1 = 0, y2 = 0;
+    double freq_hz, damping;  // True mode
+};
+
+static uint64_t rng_state = 88172645463325252ull;
+
+static double gauss() {  // xorshift64 + sum of uniforms, good enough for synthetic noise
+    double sum = 0.0;
+    for (int i = 0; i < 4; i++) {
+        rng_state ^= rng_state << 13;
+        rng_state ^= rng_state >> 7;
+        rng_state ^= rng_state << 17;
+        sum += (double)(rng_state >> 11) * (1.0 / 9007199254740992.0);
+    }
+    return (sum - 2.0) * sqrt(3.0);
+}
+
+static synth_unit make_unit(size_t i, double fs, double rms_hz) {
+    synth_unit u;
+    u.freq_hz = 0.2 + 1.2 * (double)(i % 7) / 6.0;  // 0.2 .. 1.4 Hz
+    u.damping = (i % 2) ? 0.03 : 0.10;              // Half poorly damped
+    double w0 = 2.0 * M_PI * u.freq_hz / fs;
+    double r = exp(-u.damping * w0);
+    u.c1 = 2.0 * r * cos(w0 * sqrt(1.0 - u.damping * u.damping));
+    u.c2 = -r * r;
+    double gain = (1.0 - u.c2) / ((1.0 + u.c2) * ((1.0 - u.c2) * (1.0 - u.c2) - u.c1 * u.c1));  // AR(2) output/input variance
+    u.drive = rms_hz / sqrt(gain);
+    return u;
+}
+
+static int run_bench(size_t units, double seconds, size_t workers, osc_params &params) {
+    const double mode_rms_hz = 0.010, noise_hz = 0.002;
+    bench_sink sink(units);
+    std::vector<synth_unit> synth;
+    for (size_t i = 0; i < units; i++) {
+        synth.push_back(make_unit(i, params.fs, mode_rms_hz));
+    }
+
+    size_t steps = (size_t)(seconds * params.fs);
+    uint64_t period_us = (uint64_t)llround(1e6 / params.fs);
+    uint64_t t0_us = 1700000000ull * 1000000ull;
+
+    fprintf(stderr, "Benchmark: %zu units x %.0f s at %.0f samples/s on %zu workers\n", units, seconds, params.fs, workers);
+    auto start = std::chrono::steady_clock::now();
+    {
+        worker_pool pool(workers, params, sink);
+        for (size_t n = 0; n < steps; n++) {
+            uint64_t t_us = t0_us + n * period_us;
+            for (size_t i = 0; i < units; i++) {
+                synth_unit &u = synth[i];
+                double y = u.c1 * u.y1 + u.c2 * u.y2 + u.drive * gauss();
+                u.y2 = u.y1;
+                u.y1 = y;
+                pool.push({(uint32_t)i, (float)(params.nominal_hz + y + noise_hz * gauss()), t_us});
+            }
+        }
+        pool.finish();
+    }
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    double samples = (double)steps * (double)units;
+    double required = (double)units * params.fs;
+    double rate = samples / wall;
+    size_t found = 0, alerts_ok = 0;
+    double damping_err = 0.0;
+    for (size_t i = 0; i < units; i++) {
+        const osc_summary &s = sink.last[i];
+        bool poor = synth[i].damping < params.alert_damping;
+        if ((s.n_modes > 0) && (fabs(s.dominant.freq_hz - synth[i].freq_hz) < 0.05)) {
+            found++;
+            damping_err += fabs(s.dominant.damping - synth[i].damping);
+        }
+        if ((sink.alerted[i] != 0) == poor) {
+            alerts_ok++;
+        }
+    }
+
+    fprintf(stderr, "Processed %.0f samples in %.2f s: %.0f samples/s, real time needs %.0f samples/s (%.1fx real time)\n", samples, wall, rate,
+            required, rate / required);
+    fprintf(stderr, "Summaries: %llu, alert transitions: %llu\n", (unsigned long long)sink.summaries.load(), (unsigned long long)sink.alerts.load());
+    fprintf(stderr, "Mode found within 0.05 Hz: %zu/%zu, mean damping error: %.3f, alert state correct: %zu/%zu\n", found, units,
+            found ? damping_err / (double)found : 0.0, alerts_ok, units);
+
+    return (rate >= required) ? 0 : 1;
+}
+
+/**
+ * @brief Read udp_collector CSV rows (device_id,seq,t_us,freq_hz,...) from stdin
+ */
+static int run_stream(size_t workers, osc_params &params) {
+    print_sink sink;
+    worker_pool pool(workers, params, sink);
+    printf("# summary,device_id,utc_s,slow_rms_mhz,inter_area_rms_mhz,local_rms_mhz,modes,mode_hz,damping,amp_mhz\n");
+    printf("# alert,device_id,utc_s,state,mode_hz,damping,amp_mhz\n");
+
+    char line[256];
+    while (fgets(line, sizeof(line), stdin) != nullptr) {
+        unsigned int device, seq, channel = 0;
+        unsigned long long t_us;
+        float f_hz;
+        int fields = sscanf(line, "%x,%u,%llu,%f,%*f,%*f,%*f,%*d,%u", &device, &seq, &t_us, &f_hz, &channel);
+        if ((fields >= 4) && (channel == 0)) {  // Header and malformed rows are skipped, all inputs of a unit see the same frequency
+            pool.push({device, f_hz, t_us});
+        }
+    }
+    pool.finish();
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    osc_params params;
+    size_t workers = std::max(1u, std::thread::hardware_concurrency());
+    size_t bench_units = 0;
+    double bench_seconds = 600.0;
+
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "-w") == 0) && (i + 1 < argc)) {
+            workers = std::max(1, atoi(argv[++i]));
+        } else if ((strcmp(argv[i], "-r") == 0) && (i + 1 < argc)) {
+            params.fs = atof(argv[++i]);
+        } else if ((strcmp(argv[i], "--bench") == 0) && (i + 1 < argc)) {
+            bench_units = (size_t)atol(argv[++i]);
+            if ((i + 1 < argc) && (argv[i + 1][0] != '-')) {
+                bench_seconds = atof(argv[++i]);
+            }
+        } else {
+            fprintf(stderr, "Usage: %s [-w workers] [-r rate_hz] < collector.csv\n       %s --bench <units> [seconds] [-w workers]\n", argv[0], argv[0]);
+            return 1;
+        }
+    }
+    params.sdft_len = (size_t)llround(params.fs * 20.0);  // Keep 0.05 Hz sliding DFT bins at any rate
+
+    if (bench_units > 0) {
+        return run_bench(bench_units, bench_seconds, workers, params);
+    }
+    return run_stream(workers, params);
+}
@@ -0,0 +1,241 @@
+/**
+ * @file    presence_index.cpp
+ * @brief   Incremental latest-value and presence index of the fleet: last sample, last-seen time, upload rate, sequence gaps and health
+ *          per unit, kept in a sharded concurrent hash map by the ingest path and snapshotted to disk
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#include "presence_index.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <type_traits>
+
+static_assert(std::is_trivially_copyable<presence_entry>::value, "Snapshot records are written as is");
+static_assert((PRESENCE_SHARDS & (PRESENCE_SHARDS - 1)) == 0, "PRESENCE_SHARDS must be a power of two");
+
+struct presence_snapshot_header {  // Snapshot file header, followed by count presence_entry records
+    uint32_t magic;                // PRESENCE_SNAPSHOT_MAGIC
+    uint16_t version;              // PRESENCE_SNAPSHOT_VERSION
+    uint16_t record_size;          // sizeof(presence_entry), rejects snapshots of a different build
+    uint64_t count;                // Number of records
+};
+
+presence_index::presence_index(const presence_params &params) : params_(params) {}
+
+/**
+ * @brief Shard of a unit (device IDs are often consecutive, so they are mixed before taking the top bits)
+ */
+presence_index::shard &presence_index::shard_of(uint32_t device_id) {
+    return shards_[(device_id * 0x9E3779B1u) >> (32 - __builtin_ctz(PRESENCE_SHARDS))];
+}
+
+const presence_index::shard &presence_index::shard_of(uint32_t device_id) const {
+    return shards_[(device_id * 0x9E3779B1u) >> (32 - __builtin_ctz(PRESENCE_SHARDS))];
+}
+
+/**
+ * @brief Update the entry of a unit with a datagram delivered in sequence order
+ * @param dgram Data datagram
+ * @param rx_us Host time the datagram was received
+ * @note Sequence numbers skipped within a session were given up on by the collector and count as gaps, a new session is a restart
+ */
+void presence_index::update(const hz_stream_data_t &dgram, int64_t rx_us) {
+    shard &sh = shard_of(dgram.device_id);
+    std::lock_guard<std::mutex> lock(sh.mutex);
+
+    auto found = sh.units.find(dgram.device_id);
+    if (found == sh.units.end()) {
+        presence_entry fresh = {};
+        fresh.device_id = dgram.device_id;
+        fresh.session = dgram.session;
+        fresh.last_seq = dgram.seq - 1;
+        fresh.first_seen_us = rx_us;
+        fresh.last_seen_us = rx_us;
+        found = sh.units.emplace(dgram.device_id, fresh).first;
+    }
+    presence_entry &e = found->second;
+
+    double decay = std::exp(-(double)std::max<int64_t>(rx_us - e.last_seen_us, 0) / (params_.tau_s * 1e6));
+    e.rate_acc *= decay;
+    e.recv_acc *= decay;
+    e.lost_acc *= decay;
+
+    if (dgram.session != e.session) {  // Unit restarted, the sequence starts over
+        e.session = dgram.session;
+        e.restarts++;
+    } else {
+        uint32_t skipped = dgram.seq - e.last_seq - 1;  // The collector delivers a session in order
+        e.gaps += skipped;
+        e.lost_acc += (double)skipped;
+    }
+
+    e.last_seq = dgram.seq;
+    e.last_seen_us = std::max(e.last_seen_us, rx_us);
+    e.datagrams++;
+    e.recv_acc += 1.0;
+    e.samples += dgram.count;
+    e.rate_acc += dgram.count;
+    for (int i = 0; i < dgram.count; i++) {
+        const hz_sample_t &s = dgram.samples[i];
+        if (s.channel < 32) {
+            e.channel_mask |= 1u << s.channel;
+        }
+        if (s.channel == 0) {
+            e.last = s;
+        }
+    }
+}
+
+/**
+ * @brief Derive the status of a unit from its entry
+ */
+presence_status presence_index::status(const presence_entry &e, int64_t now_us) const {
+    presence_status st;
+    st.device_id = e.device_id;
+    st.age_s = (double)std::max<int64_t>(now_us - e.last_seen_us, 0) / 1e6;
+    st.last_seen_us = e.last_seen_us;
+    st.last = e.last;
+    st.samples = e.samples;
+    st.gaps = e.gaps;
+    st.restarts = e.restarts;
+    st.channel_mask = e.channel_mask;
+
+    // Averages over tau_s, normalised by the part of the window the unit has been known for (at least 1 s)
+    double known_s = std::max((double)(now_us - e.first_seen_us) / 1e6, 1.0);
+    double window_s = params_.tau_s * (1.0 - std::exp(-known_s / params_.tau_s));
+    st.rate_hz = e.rate_acc * std::exp(-st.age_s / params_.tau_s) / window_s;
+    double total = e.recv_acc + e.lost_acc;
+    st.loss = (total > 0.0) ? (e.lost_acc / total) : 0.0;
+
+    if (st.age_s > params_.offline_s) {
+        st.health = PRESENCE_OFFLINE;
+    } else if (st.age_s > params_.stale_s) {
+        st.health = PRESENCE_STALE;
+    } else if (st.loss > params_.max_loss) {
+        st.health = PRESENCE_DEGRADED;
+    } else {
+        st.health = PRESENCE_ONLINE;
+    }
+    return st;
+}
+
+/**
+ * @brief Status of one unit
+ * @return False if the unit has never been seen
+ */
+bool presence_index::get(uint32_t device_id, int64_t now_us, presence_status &out) const {
+    const shard &sh = shard_of(device_id);
+    std::lock_guard<std::mutex> lock(sh.mutex);
+    auto found = sh.units.find(device_id);
+    if (found == sh.units.end()) {
+        return false;
+    }
+    out = status(found->second, now_us);
+    return true;
+}
+
+/**
+ * @brief Status of every unit, one shard locked at a time (writers to other shards carry on)
+ * @return Number of units
+ */
+size_t presence_index::status_all(int64_t now_us, std::vector<presence_status> &out) const {
+    out.clear();
+    out.reserve(size());
+    for (const shard &sh : shards_) {
+        std::lock_guard<std::mutex> lock(sh.mutex);
+        for (const auto &unit : sh.units) {
+            out.push_back(status(unit.second, now_us));
+        }
+    }
+    return out.size();
+}
+
+size_t presence_index::size() const {
+    size_t n = 0;
+    for (const shard &sh : shards_) {
+        std::lock_guard<std::mutex> lock(sh.mutex);
+        n += sh.units.size();
+    }
+    return n;
+}
+
+/**
+ * @brief Write a snapshot of the index: entries are copied shard by shard and written without holding any lock
+ * @note Written to a temporary file and renamed, so readers never see a partial snapshot
+ */
+bool presence_index::save(const std::string &path) const {
+    std::vector<presence_entry> entries;
+    entries.reserve(size());
+    for (const shard &sh : shards_) {
+        std::lock_guard<std::mutex> lock(sh.mutex);
+        for (const auto &unit : sh.units) {
+            entries.push_back(unit.second);
+        }
+    }
+
+    presence_snapshot_header hdr = {PRESENCE_SNAPSHOT_MAGIC, PRESENCE_SNAPSHOT_VERSION, sizeof(presence_entry), entries.size()};
+    std::string tmp = path + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (f == nullptr) {
+        return false;
+    }
+    bool ok = (fwrite(&hdr, sizeof(hdr), 1, f) == 1);
+    if (ok && (entries.empty() == false)) {
+        ok = (fwrite(entries.data(), sizeof(presence_entry), entries.size(), f) == entries.size());
+    }
+    ok = (fclose(f) == 0) && ok;
+    if (ok == false) {
+        remove(tmp.c_str());
+        return false;
+    }
+    return rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+/**
+ * @brief Merge a snapshot into the index (entries of units already in the index are replaced)
+ * @return False if the file cannot be read or is not a snapshot of this format
+ */
+bool presence_index::load(const std::string &path) {
+    FILE *f = fopen(path.c_str(), "rb");
+    if (f == nullptr) {
+        return false;
+    }
+    presence_snapshot_header hdr;
+    bool ok = (fread(&hdr, sizeof(hdr), 1, f) == 1) && (hdr.magic == PRESENCE_SNAPSHOT_MAGIC) && (hdr.version == PRESENCE_SNAPSHOT_VERSION) &&
+              (hdr.record_size == sizeof(presence_entry));
+    if (ok) {  // Reject a count the file cannot hold before allocating for it
+        long start = ftell(f);
+        ok = (fseek(f, 0, SEEK_END) == 0) && (hdr.count <= (uint64_t)(ftell(f) - start) / sizeof(presence_entry)) && (fseek(f, start, SEEK_SET) == 0);
+    }
+    std::vector<presence_entry> entries;
+    if (ok) {
+        entries.resize(hdr.count);
+        ok = (fread(entries.data(), sizeof(presence_entry), entries.size(), f) == entries.size());
+    }
+    fclose(f);
+    if (ok == false) {
+        return false;
+    }
+
+    for (const presence_entry &e : entries) {
+        shard &sh = shard_of(e.device_id);
+        std::lock_guard<std::mutex> lock(sh.mutex);
+        sh.units[e.device_id] = e;
+    }
+    return true;
+}
+
+const char *presence_health_str(presence_health health) {
+    switch (health) {
+        case PRESENCE_ONLINE:
+            return "online";
+        case PRESENCE_DEGRADED:
+            return "degraded";
+        case PRESENCE_STALE:
+            return "stale";
+        default:
+            return "offline";
+    }
+}
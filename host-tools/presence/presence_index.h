@@ -0,0 +1,96 @@
+/**
+ * @file    presence_index.h
+ * @brief   Incremental latest-value and presence index of the fleet: last sample, last-seen time, upload rate, sequence gaps and health
+ *          per unit, kept in a sharded concurrent hash map by the ingest path and snapshotted to disk
+ * @note    Readers get the status of all N units in O(N) memory reads, without fetching or parsing any uploaded data
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "hz_stream.h"
+
+#define PRESENCE_SHARDS 64                  // Independently locked shards of the index (power of two)
+#define PRESENCE_SNAPSHOT_MAGIC 0x49505A48  // "HZPI"
+#define PRESENCE_SNAPSHOT_VERSION 2         // Snapshot file format version (2: stream session)
+
+enum presence_health : uint8_t {  // Health of a unit, derived from its entry at read time
+    PRESENCE_ONLINE = 0,          // Streaming
+    PRESENCE_DEGRADED = 1,        // Streaming, but losing more than max_loss of its datagrams
+    PRESENCE_STALE = 2,           // Silent for longer than stale_s (link outage or reboot in progress)
+    PRESENCE_OFFLINE = 3,         // Silent for longer than offline_s
+};
+
+struct presence_params {         // Health thresholds and averaging
+    double offline_s = 60.0;     // Silence after which a unit is offline (same threshold as device-status.m)
+    double stale_s = 5.0;        // Silence after which a unit is stale
+    double max_loss = 0.01;      // Share of lost datagrams above which a unit is degraded
+    double tau_s = 10.0;         // Time constant of the rate and loss averages
+};
+
+struct presence_entry {     // Index entry of one unit (fixed size, written to snapshots as is)
+    uint32_t device_id;     // Device ID
+    uint32_t session;       // Stream session of the last datagram (new one on every boot)
+    uint32_t last_seq;      // Sequence number of the last datagram
+    int64_t first_seen_us;  // Host time of the first datagram
+    int64_t last_seen_us;   // Host time of the last datagram
+    hz_sample_t last;       // Last sample of the reference channel (channel 0)
+    double rate_acc;        // Samples, exponentially decayed with tau_s (as of last_seen_us)
+    double recv_acc;        // Datagrams received, decayed
+    double lost_acc;        // Datagrams missing from the sequence, decayed
+    uint64_t samples;       // Samples received
+    uint64_t datagrams;     // Datagrams received
+    uint64_t gaps;          // Datagrams missing from the sequence (lost for good)
+    uint32_t restarts;      // Session changes (unit rebooted)
+    uint32_t channel_mask;  // Channels seen, bit per channel
+};
+
+struct presence_status {     // Status of one unit as seen by a reader
+    uint32_t device_id;      // Device ID
+    presence_health health;  // Health at the time of the read
+    double age_s;            // Time since the last datagram [s]
+    double rate_hz;          // Samples per second averaged over tau_s, decaying while the unit is silent
+    double loss;             // Share of datagrams lost, averaged over tau_s
+    int64_t last_seen_us;    // Host time of the last datagram
+    hz_sample_t last;        // Last sample of the reference channel
+    uint64_t samples;        // Samples received
+    uint64_t gaps;           // Datagrams missing from the sequence
+    uint32_t restarts;       // Session changes (unit rebooted)
+    uint32_t channel_mask;   // Channels seen
+};
+
+class presence_index {  // Units are sharded by ID, so writers and readers of different shards never contend
+   public:
+    explicit presence_index(const presence_params &params = presence_params());
+
+    void update(const hz_stream_data_t &dgram, int64_t rx_us);                   // Ingest path: datagrams of a unit in sequence order
+    bool get(uint32_t device_id, int64_t now_us, presence_status &out) const;    // Status of one unit, false if unknown
+    size_t status_all(int64_t now_us, std::vector<presence_status> &out) const;  // Status of every unit (out is replaced)
+    size_t size() const;
+    bool save(const std::string &path) const;  // Write a snapshot (atomically replaces path)
+    bool load(const std::string &path);        // Merge a snapshot into the index
+    const presence_params &params() const { return params_; }
+
+   private:
+    struct alignas(64) shard {  // Own cache line, so neighbouring shard locks do not bounce
+        mutable std::mutex mutex;
+        std::unordered_map<uint32_t, presence_entry> units;
+    };
+
+    shard &shard_of(uint32_t device_id);
+    const shard &shard_of(uint32_t device_id) const;
+    presence_status status(const presence_entry &e, int64_t now_us) const;
+
+    presence_params params_;
+    std::array<shard, PRESENCE_SHARDS> shards_;
+};
+
+const char *presence_health_str(presence_health health);
@@ -0,0 +1,208 @@
+/**
+ * @file    presence_status.cpp
+ * @brief   Status of every unit from the presence index snapshot written by udp_collector (dashboard feed), with a fleet-size benchmark
+ * @note    Usage: presence_status <index_file> [--csv] [--offline-s S] [--stale-s S] [--max-loss L]
+ *                 presence_status --bench <units> [seconds] [-w writers]
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "presence_index.h"
+
+#define BENCH_DGRAM_SAMPLES 5  // Samples per synthetic datagram (50 samples/s in 10 datagrams/s)
+#define BENCH_LOSS_EVERY 500   // Every n-th synthetic datagram is skipped (0.2% loss)
+
+static int64_t now_us() {
+    timeval tv;
+    gettimeofday(&tv, nullptr);
+    return ((int64_t)tv.tv_sec * 1000000) + tv.tv_usec;
+}
+
+static double elapsed_s(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * @brief Print the status of every unit, ordered by device ID
+ */
+static void print_status(std::vector<presence_status> &units, bool as_csv) {
+    std::sort(units.begin(), units.end(), [](const presence_status &a, const presence_status &b) { return a.device_id < b.device_id; });
+
+    if (as_csv) {
+        printf("device_id,health,age_s,rate_hz,loss,gaps,restarts,channels,t_us,freq_hz,rocof_hz_s,freq_std_hz,phase_deg\n");
+        for (const presence_status &u : units) {
+            printf("%08x,%s,%.3f,%.2f,%.5f,%llu,%u,%x,%llu,%.4f,%.4f,%.5f,%.2f\n", u.device_id, presence_health_str(u.health), u.age_s, u.rate_hz,
+                   u.loss, (unsigned long long)u.gaps, u.restarts, u.channel_mask, (unsigned long long)u.last.t_us, u.last.f_hz, u.last.rocof,
+                   u.last.f_std, u.last.phase_deg);
+        }
+        return;
+    }
+
+    size_t health[PRESENCE_OFFLINE + 1] = {};
+    printf("%-8s  %-8s  %10s  %8s  %7s  %8s  %8s  %10s  %9s\n", "unit", "health", "age [s]", "rate", "loss", "gaps", "restarts", "f [Hz]",
+           "RoCoF");
+    for (const presence_status &u : units) {
+        health[u.health]++;
+        printf("%08x  %-8s  %10.1f  %8.2f  %6.2f%%  %8llu  %8u  %10.4f  %9.4f\n", u.device_id, presence_health_str(u.health), u.age_s, u.rate_hz,
+               (u.loss * 100.0), (unsigned long long)u.gaps, u.restarts, u.last.f_hz, u.last.rocof);
+    }
+    printf("Units: %zu (online: %zu, degraded: %zu, stale: %zu, offline: %zu)\n", units.size(), health[PRESENCE_ONLINE], health[PRESENCE_DEGRADED],
+           health[PRESENCE_STALE], health[PRESENCE_OFFLINE]);
+}
+
+/**
+ * @brief Ingest synthetic streams of the whole fleet from several writer threads while a reader polls the status of every unit
+ * @note Reports ingest throughput, read latency of the full status (alone and under load) and snapshot save/load times
+ */
+static int run_bench(size_t units, double seconds, size_t writers) {
+    presence_index index;
+    std::atomic<bool> stop(false);
+    std::atomic<uint64_t> ingested(0);
+
+    auto writer = [&](size_t w) {
+        hz_stream_data_t dgram = {};
+        dgram.count = BENCH_DGRAM_SAMPLES;
+        std::vector<uint32_t> seq(units, 0);
+        uint64_t n = 0;
+        while (stop.load(std::memory_order_relaxed) == false) {
+            int64_t t_us = now_us();
+            for (size_t u = w; u < units; u += writers) {  // Each unit is written by one thread, in sequence order
+                seq[u] += ((seq[u] % BENCH_LOSS_EVERY) == (BENCH_LOSS_EVERY - 1)) ? 2 : 1;
+                dgram.device_id = (uint32_t)u;
+                dgram.seq = seq[u];
+                for (int i = 0; i < BENCH_DGRAM_SAMPLES; i++) {
+                    dgram.samples[i].t_us = (uint64_t)t_us;
+                    dgram.samples[i].f_hz = 50.0f + 0.01f * sinf((float)(seq[u] + u));
+                    dgram.samples[i].channel = 0;
+                }
+                index.update(dgram, t_us);
+                n++;
+            }
+        }
+        ingested += n;
+    };
+
+    std::vector<presence_status> status;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t w = 0; w < writers; w++) {
+        threads.emplace_back(writer, w);
+    }
+
+    std::vector<double> read_ms;
+    while (elapsed_s(start) < seconds) {
+        auto t0 = std::chrono::steady_clock::now();
+        index.status_all(now_us(), status);
+        read_ms.push_back(elapsed_s(t0) * 1000.0);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));  // Dashboard refreshing 10 times per second
+    }
+    stop = true;
+    for (std::thread &t : threads) {
+        t.join();
+    }
+    double run_s = elapsed_s(start);
+
+    std::sort(read_ms.begin(), read_ms.end());
+    double loaded_p50 = read_ms.empty() ? 0.0 : read_ms[read_ms.size() / 2];
+    double loaded_max = read_ms.empty() ? 0.0 : read_ms.back();
+
+    auto t0 = std::chrono::steady_clock::now();
+    const int reads = 20;
+    for (int i = 0; i < reads; i++) {
+        index.status_all(now_us(), status);
+    }
+    double idle_ms = elapsed_s(t0) * 1000.0 / reads;
+
+    std::string path = "/tmp/presence_bench_" + std::to_string(getpid()) + ".idx";
+    t0 = std::chrono::steady_clock::now();
+    bool saved = index.save(path);
+    double save_ms = elapsed_s(t0) * 1000.0;
+    presence_index restored;
+    t0 = std::chrono::steady_clock::now();
+    bool loaded = saved && restored.load(path);
+    double load_ms = elapsed_s(t0) * 1000.0;
+    remove(path.c_str());
+    if (loaded == false) {
+        fprintf(stderr, "Snapshot round trip failed (%s)\n", path.c_str());
+        return 1;
+    }
+
+    size_t degraded = 0;
+    for (const presence_status &u : status) {
+        degraded += (u.health != PRESENCE_ONLINE) ? 1 : 0;
+    }
+    printf("Units: %zu, writers: %zu, %.1f s\n", units, writers, run_s);
+    printf("  ingest:     %.0f datagrams/s (%.1f Hz per unit)\n", ingested / run_s, ingested / run_s / units);
+    printf("  status_all: %.2f ms idle (%.1f ns per unit), %.2f ms p50 / %.2f ms max under ingest (%zu reads)\n", idle_ms,
+           idle_ms * 1e6 / units, loaded_p50, loaded_max, read_ms.size());
+    printf("  snapshot:   save %.1f ms, load %.1f ms, %zu bytes per unit\n", save_ms, load_ms, sizeof(presence_entry));
+    printf("  health:     %zu of %zu units not online\n", degraded, status.size());
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    presence_params params;
+    const char *path = nullptr;
+    bool as_csv = false;
+    size_t bench_units = 0;
+    double bench_seconds = 5.0;
+    size_t writers = std::max(1u, std::thread::hardware_concurrency() / 2);
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--csv") == 0) {
+            as_csv = true;
+        } else if ((strcmp(argv[i], "--offline-s") == 0) && (i + 1 < argc)) {
+            params.offline_s = atof(argv[++i]);
+        } else if ((strcmp(argv[i], "--stale-s") == 0) && (i + 1 < argc)) {
+            params.stale_s = atof(argv[++i]);
+        } else if ((strcmp(argv[i], "--max-loss") == 0) && (i + 1 < argc)) {
+            params.max_loss = atof(argv[++i]);
+        } else if ((strcmp(argv[i], "-w") == 0) && (i + 1 < argc)) {
+            writers = std::max(1, atoi(argv[++i]));
+        } else if ((strcmp(argv[i], "--bench") == 0) && (i + 1 < argc)) {
+            bench_units = (size_t)atol(argv[++i]);
+            if ((i + 1 < argc) && (argv[i + 1][0] != '-')) {
+                bench_seconds = atof(argv[++i]);
+            }
+        } else if (argv[i][0] != '-') {
+            path = argv[i];
+        } else {
+            path = nullptr;
+            break;
+        }
+    }
+
+    if (bench_units > 0) {
+        return run_bench(bench_units, bench_seconds, writers);
+    }
+    if (path == nullptr) {
+        fprintf(stderr,
+                "Usage: %s <index_file> [--csv] [--offline-s S] [--stale-s S] [--max-loss L]\n       %s --bench <units> [seconds] [-w writers]\n",
+                argv[0], argv[0]);
+        return 1;
+    }
+
+    presence_index index(params);
+    if (index.load(path) == false) {
+        fprintf(stderr, "Cannot read the presence index snapshot %s\n", path);
+        return 1;
+    }
+    std::vector<presence_status> units;
+    index.status_all(now_us(), units);
+    print_status(units, as_csv);
+    return 0;
+}
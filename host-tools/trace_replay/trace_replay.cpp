@@ -0,0 +1,382 @@
+/**
+ * @file    trace_replay.cpp
+ * @brief   Replay raw edge traces through the firmware f_calc/f_estimator code and check the device output bit for bit
+ * @note    Usage: trace_replay [-o out.csv] [-c capture_id] [--bench N] [--psd q] [--gate sigma] trace.bin [...]
+ *          Traces: mosquitto_sub -N -t hertznet/<id>/trace/data > trace.bin, or a dump of the trace partition
+ *          (parttool.py read_partition --partition-name trace --output trace.bin)
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <vector>
+
+#include "f_calc.h"
+#include "f_estimator.h"
+#include "f_trace.h"
+
+#define OP_GAP 0  // Replay op for chunks missing from the trace (not a record type)
+
+struct replay_op {    // Decoded record, compact so that long traces replay from memory
+    uint8_t type;     // f_trace_rec_type_t or OP_GAP
+    uint8_t flags;    // Record flags
+    uint32_t seq;     // Chunk sequence number
+    union {
+        f_calc_anchor_t anchor;  // F_TRACE_REC_ANCHOR
+        uint64_t tick;           // F_TRACE_REC_EDGE
+        struct {
+            f_est_out_t out;
+            float phase;
+        } output;                // F_TRACE_REC_OUTPUT
+        struct {
+            uint8_t code;
+            uint32_t arg;
+        } event;                 // F_TRACE_REC_EVENT
+        size_t state;            // F_TRACE_REC_STATE: index into the snapshot table
+    };
+};
+
+struct snapshot {    // Calculation/estimator state recorded by the device
+    f_calc_t calc;
+    f_estimator_t est;
+};
+
+struct trace {                     // One capture, decoded
+    uint32_t device_id = 0;
+    uint32_t capture_id = 0;
+    size_t chunks = 0;             // Chunks decoded
+    size_t missing = 0;            // Chunks missing from the sequence
+    size_t malformed = 0;          // Chunks with undecodable records (CRC was valid)
+    std::vector<replay_op> ops;
+    std::vector<snapshot> states;
+};
+
+struct tuning {              // Estimator overrides (negative: keep the device value)
+    float rocof_psd = -1.0f;
+    float gate_sigma = -1.0f;
+    bool any() const { return (rocof_psd >= 0.0f) || (gate_sigma >= 0.0f); }
+};
+
+struct replay_stats {
+    uint64_t edges = 0;            // Zero-crossings processed
+    uint64_t outputs = 0;          // Windows computed
+    uint64_t compared = 0;         // Outputs compared with the device
+    uint64_t mismatches = 0;       // Outputs differing from the device in any bit
+    uint64_t state_checks = 0;     // Chunk-opening snapshots compared with the replayed state
+    uint64_t state_mismatches = 0; // Snapshots differing from the replayed state
+    uint64_t resyncs = 0;          // Restarts from a snapshot after a gap
+    double sq_diff = 0.0;          // Sum of squared frequency differences to the device [Hz^2]
+    uint64_t events[32] = {};      // Event markers by code
+};
+
+static bool same_bits(float a, float b) {
+    return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+static bool same_calc(const f_calc_t &a, const f_calc_t &b) {
+    return (a.pulses_per_meas == b.pulses_per_meas) && (a.timer_hz == b.timer_hz) && (a.nominal_hz == b.nominal_hz) && (a.edges == b.edges) &&
+           (a.window_start == b.window_start) && same_bits(a.last_freq, b.last_freq) && (a.last_time_us == b.last_time_us);
+}
+
+static bool same_est(const f_estimator_t &a, const f_estimator_t &b) {
+    return (a.started == b.started) && same_bits(a.freq, b.freq) && same_bits(a.rocof, b.rocof) && same_bits(a.p00, b.p00) &&
+           same_bits(a.p01, b.p01) && same_bits(a.p11, b.p11) && (a.time_us == b.time_us) && (a.rejected == b.rejected) &&
+           same_bits(a.rejected_freq, b.rejected_freq) && (a.rejected_time_us == b.rejected_time_us) && (a.outliers == b.outliers);
+}
+
+static bool same_output(const f_est_out_t &a, float phase_a, const f_est_out_t &b, float phase_b) {
+    return (a.status == b.status) && same_bits(a.freq, b.freq) && same_bits(a.rocof, b.rocof) && same_bits(a.freq_var, b.freq_var) &&
+           same_bits(a.rocof_var, b.rocof_var) && same_bits(phase_a, phase_b);
+}
+
+static bool read_file(const char *path, std::vector<uint8_t> &data) {
+    FILE *f = fopen(path, "rb");
+    if (f == nullptr) {
+        perror(path);
+        return false;
+    }
+    uint8_t buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        data.insert(data.end(), buf, buf + n);
+    }
+    fclose(f);
+    return true;
+}
+
+/**
+ * @brief Locate every valid chunk and decode one capture (the first one found unless capture_id is given)
+ */
+static bool load_trace(const std::vector<uint8_t> &data, bool select, uint32_t capture_id, trace &tr) {
+    std::map<uint32_t, std::pair<size_t, size_t>> chunks;  // Sequence number -> offset, length (deduplicated, ordered)
+    std::map<uint32_t, size_t> others;                     // Chunks of other captures
+
+    size_t off = 0;
+    while (off < data.size()) {
+        f_trace_chunk_hdr_t hdr;
+        size_t len = 0;
+        off += f_trace_find_chunk(&data[off], data.size() - off, &hdr, &len);
+        if (len == 0) {
+            break;
+        }
+        if (select == false) {  // Follow the first capture found
+            select = true;
+            capture_id = hdr.capture_id;
+            tr.device_id = hdr.device_id;
+        }
+        if (hdr.capture_id == capture_id) {
+            tr.device_id = hdr.device_id;
+            chunks.emplace(hdr.seq, std::make_pair(off, len));
+        } else {
+            others[hdr.capture_id]++;
+        }
+        off += len;
+    }
+    for (const auto &o : others) {
+        fprintf(stderr, "Skipped %zu chunks of capture %08x\n", o.second, o.first);
+    }
+    if (chunks.empty()) {
+        return false;
+    }
+    tr.capture_id = capture_id;
+
+    bool first = true;
+    uint32_t expected = 0;
+    for (const auto &c : chunks) {
+        if ((first == false) && (c.first != expected)) {
+            tr.missing += c.first - expected;
+            tr.ops.push_back(replay_op{OP_GAP, 0, c.first, {}});
+        }
+        first = false;
+        expected = c.first + 1;
+
+        f_trace_chunk_hdr_t hdr;
+        size_t len;
+        const uint8_t *chunk = &data[c.second.first];
+        f_trace_find_chunk(chunk, c.second.second, &hdr, &len);
+
+        f_trace_reader_t reader;
+        f_trace_record_t rec;
+        f_trace_reader_init(&reader, chunk, &hdr);
+        int res;
+        while ((res = f_trace_read_record(&reader, &rec)) == 1) {
+            replay_op op{(uint8_t)rec.type, rec.flags, c.first, {}};
+            switch (rec.type) {
+                case F_TRACE_REC_STATE:
+                    op.state = tr.states.size();
+                    tr.states.push_back(snapshot{rec.calc, rec.est});
+                    break;
+                case F_TRACE_REC_ANCHOR:
+                    op.anchor = rec.anchor;
+                    break;
+                case F_TRACE_REC_EDGE:
+                    op.tick = rec.tick;
+                    break;
+                case F_TRACE_REC_OUTPUT:
+                    op.output.out = rec.out;
+                    op.output.phase = rec.phase;
+                    break;
+                case F_TRACE_REC_EVENT:
+                    op.event.code = rec.event;
+                    op.event.arg = rec.arg;
+                    break;
+            }
+            tr.ops.push_back(op);
+        }
+        if (res < 0) {  // Records after the damage are lost, treat as a gap
+            tr.malformed++;
+            tr.ops.push_back(replay_op{OP_GAP, 0, c.first, {}});
+        }
+        tr.chunks++;
+    }
+
+    return true;
+}
+
+static void apply_tuning(f_estimator_t &est, const tuning &tune) {
+    if (tune.rocof_psd >= 0.0f) {
+        est.cfg.rocof_psd = tune.rocof_psd;
+    }
+    if (tune.gate_sigma >= 0.0f) {
+        est.cfg.gate_sigma = tune.gate_sigma;
+    }
+}
+
+/**
+ * @brief Run the trace through f_calc and f_estimator exactly as the measurement task does
+ */
+static replay_stats replay(const trace &tr, const tuning &tune, FILE *csv) {
+    replay_stats st;
+    f_calc_t calc = {};
+    f_estimator_t est = {};
+    f_calc_anchor_t anchor = {};
+    f_calc_out_t out = {};
+    f_est_out_t est_out = {};
+    bool synced = false;   // State restored from a snapshot and complete since
+    bool pending = false;  // Window computed, waiting for the device output
+
+    for (const replay_op &op : tr.ops) {
+        switch (op.type) {
+            case OP_GAP:
+                synced = false;
+                pending = false;
+                break;
+
+            case F_TRACE_REC_STATE: {
+                const snapshot &snap = tr.states[op.state];
+                if (synced && (op.flags & F_TRACE_STATE_SYNC)) {  // Replayed state must match the device at every chunk start
+                    st.state_checks++;
+                    bool match = same_calc(calc, snap.calc) && (tune.any() || same_est(est, snap.est));
+                    if (match) {
+                        break;
+                    }
+                    st.state_mismatches++;
+                    if (tune.any()) {  // Estimator differs on purpose, only the calculation is resynchronised
+                        calc = snap.calc;
+                        break;
+                    }
+                } else if (op.flags & F_TRACE_STATE_SYNC) {
+                    st.resyncs++;
+                }
+                calc = snap.calc;
+                est = snap.est;
+                apply_tuning(est, tune);
+                synced = true;
+                pending = false;
+                break;
+            }
+
+            case F_TRACE_REC_ANCHOR:
+                anchor = op.anchor;
+                break;
+
+            case F_TRACE_REC_EDGE:
+                if (synced == false) {
+                    break;
+                }
+                st.edges++;
+                if (f_calc_edge(&calc, op.tick, &anchor, &out)) {
+                    f_estimator_update(&est, out.freq, out.time_us, &est_out);
+                    st.outputs++;
+                    pending = true;
+                    if (csv != nullptr) {
+                        fprintf(csv, "%lld,%.6f,%.6f,%.6f,%.6f,%.3f,%d\n", (long long)out.time_us, out.freq, est_out.freq, est_out.rocof,
+                                sqrtf(est_out.freq_var), out.phase, (int)est_out.status);
+                    }
+                }
+                break;
+
+            case F_TRACE_REC_OUTPUT:
+                if (pending) {
+                    st.compared++;
+                    if (same_output(est_out, out.phase, op.output.out, op.output.phase) == false) {
+                        st.mismatches++;
+                    }
+                    double diff = (double)est_out.freq - (double)op.output.out.freq;
+                    st.sq_diff += diff * diff;
+                    pending = false;
+                }
+                break;
+
+            case F_TRACE_REC_EVENT:
+                st.events[op.event.code & 31]++;
+                break;
+        }
+    }
+
+    return st;
+}
+
+int main(int argc, char **argv) {
+    const char *csv_path = nullptr;
+    bool select = false;
+    uint32_t capture_id = 0;
+    size_t bench = 0;
+    tuning tune;
+    std::vector<uint8_t> data;
+    size_t files = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "-o") == 0) && (i + 1 < argc)) {
+            csv_path = argv[++i];
+        } else if ((strcmp(argv[i], "-c") == 0) && (i + 1 < argc)) {
+            select = true;
+            capture_id = (uint32_t)strtoul(argv[++i], nullptr, 16);
+        } else if ((strcmp(argv[i], "--bench") == 0) && (i + 1 < argc)) {
+            bench = (size_t)atol(argv[++i]);
+        } else if ((strcmp(argv[i], "--psd") == 0) && (i + 1 < argc)) {
+            tune.rocof_psd = (float)atof(argv[++i]);
+        } else if ((strcmp(argv[i], "--gate") == 0) && (i + 1 < argc)) {
+            tune.gate_sigma = (float)atof(argv[++i]);
+        } else if (argv[i][0] != '-') {
+            if (read_file(argv[i], data) == false) {
+                return 1;
+            }
+            files++;
+        } else {
+            files = 0;
+            break;
+        }
+    }
+    if (files == 0) {
+        fprintf(stderr, "Usage: %s [-o out.csv] [-c capture_id] [--bench N] [--psd q] [--gate sigma] trace.bin [...]\n", argv[0]);
+        return 1;
+    }
+
+    trace tr;
+    if (load_trace(data, select, capture_id, tr) == false) {
+        fprintf(stderr, "No trace chunks found\n");
+        return 1;
+    }
+    fprintf(stderr, "Capture %08x of device %08x: %zu chunks, %zu missing, %zu malformed, %zu records\n", tr.capture_id, tr.device_id, tr.chunks,
+            tr.missing, tr.malformed, tr.ops.size());
+
+    FILE *csv = nullptr;
+    if (csv_path != nullptr) {
+        csv = fopen(csv_path, "w");
+        if (csv == nullptr) {
+            perror(csv_path);
+            return 1;
+        }
+        fprintf(csv, "t_us,freq_raw_hz,freq_hz,rocof_hz_s,freq_std_hz,phase_deg,status\n");
+    }
+    replay_stats st = replay(tr, tune, csv);
+    if (csv != nullptr) {
+        fclose(csv);
+    }
+
+    fprintf(stderr, "Replayed %llu edges, %llu windows (%llu resyncs after gaps)\n", (unsigned long long)st.edges, (unsigned long long)st.outputs,
+            (unsigned long long)st.resyncs);
+    fprintf(stderr, "Events: %llu edge drops, %llu window changes, %llu chunk drops, %llu SNTP time steps, %llu user markers%s\n",
+            (unsigned long long)st.events[F_TRACE_EVENT_EDGE_DROP], (unsigned long long)st.events[F_TRACE_EVENT_RELOAD],
+            (unsigned long long)st.events[F_TRACE_EVENT_CHUNK_DROP], (unsigned long long)st.events[F_TRACE_EVENT_TIME_STEP],
+            (unsigned long long)st.events[F_TRACE_EVENT_USER],
+            st.events[F_TRACE_EVENT_FLASH_FULL] ? " (stopped early, trace partition full)" : "");
+    if (tune.any()) {
+        fprintf(stderr, "Tuning overridden: RMS frequency difference to the device %.3f mHz over %llu windows\n",
+                st.compared ? 1000.0 * sqrt(st.sq_diff / (double)st.compared) : 0.0, (unsigned long long)st.compared);
+    } else {
+        fprintf(stderr, "Bit-exact check: %llu/%llu outputs and %llu/%llu chunk snapshots differ from the device\n", (unsigned long long)st.mismatches,
+                (unsigned long long)st.compared, (unsigned long long)st.state_mismatches, (unsigned long long)st.state_checks);
+    }
+
+    if (bench > 0) {
+        uint64_t edges = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < bench; i++) {
+            edges += replay(tr, tune, nullptr).edges;
+        }
+        double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double nominal_hz = tr.states.empty() ? 50.0 : (double)tr.states[0].calc.nominal_hz;
+        fprintf(stderr, "Benchmark: %llu edges in %.3f s, %.0f edges/s (%.0fx real time)\n", (unsigned long long)edges, wall, (double)edges / wall,
+                (double)edges / wall / nominal_hz);
+    }
+
+    return ((tune.any() == false) && ((st.mismatches > 0) || (st.state_mismatches > 0))) ? 2 : 0;
+}
@@ -0,0 +1,374 @@
+/**
+ * @file    udp_collector.cpp
+ * @brief   Collect HertzNet UDP measurement streams from many units, recover losses with NACKs, report latency and keep the presence index
+ * @note    Usage: udp_collector <port> [csv_file] [-i index_file] [-s snapshot_s]
+ * @author  Karol Wojslaw (karol.wojslaw@student.manchester.ac.uk)
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "hz_stream.h"
+#include "presence_index.h"
+
+#define RECV_BATCH 64                 // Datagrams read per recvmmsg call
+#define NACK_INTERVAL_US 20000        // Min time between NACKs to the same unit
+#define GIVE_UP_US 2000000            // Missing datagram is declared lost after this time
+#define MAX_GAP 4096                  // Longer gaps within a session are not NACKed, the stream skips ahead
+#define REPORT_INTERVAL_US 10000000   // Statistics printed every 10 s
+#define SNAPSHOT_INTERVAL_S 5         // Default interval between presence index snapshots
+
+#define DGRAM_MAX (HZ_STREAM_HEADER_SIZE + (HZ_STREAM_MAX_SAMPLES * HZ_STREAM_SAMPLE_SIZE))  // Largest valid data datagram
+
+struct latency_stats {          // Latency samples collected in the current report interval
+    std::vector<double> first;  // First deliveries [ms]
+    std::vector<double> retx;   // Recovered by retransmission [ms]
+};
+
+struct stream_state {                          // Reassembly state of one unit
+    sockaddr_in addr;                          // Address NACKs are sent to
+    uint32_t session = 0;                      // Current session of the unit (new one on every boot)
+    uint32_t prev_session = 0;                 // Previous session, its late datagrams are dropped
+    uint32_t next_seq = 0;                     // Next sequence number to be delivered in order
+    uint32_t max_seq = 0;                      // Highest sequence number received
+    std::map<uint32_t, hz_stream_data_t> ooo;  // Received out of order, waiting for the gap to be filled
+    std::map<uint32_t, int64_t> missing;       // Missing sequence numbers and the time they were detected
+    int64_t last_nack_us = 0;                  // Time of the last NACK
+    uint64_t delivered = 0;                    // Datagrams delivered
+    uint64_t recovered = 0;                    // Datagrams recovered by retransmission
+    uint64_t lost = 0;                         // Datagrams given up on
+    uint64_t duplicates = 0;                   // Duplicates and late retransmissions
+};
+
+static volatile sig_atomic_t running = 1;
+static FILE *csv = nullptr;
+static presence_index presence;  // Latest value and presence of every unit, read by dashboards from its snapshots
+
+static void on_signal(int) {
+    running = 0;
+}
+
+static int64_t now_us() {
+    timeval tv;
+    gettimeofday(&tv, nullptr);
+    return ((int64_t)tv.tv_sec * 1000000) + tv.tv_usec;
+}
+
+/**
+ * @brief Deliver a datagram in sequence order (presence index and CSV output)
+ */
+static void deliver(stream_state &st, const hz_stream_data_t &dgram, int64_t t_us) {
+    st.delivered++;
+    presence.update(dgram, t_us);
+    if (csv == nullptr) {
+        return;
+    }
+    for (int i = 0; i < dgram.count; i++) {
+        const hz_sample_t &s = dgram.samples[i];
+        fprintf(csv, "%08x,%u,%llu,%.4f,%.4f,%.2f,%.5f,%d,%u,%.2f\n", dgram.device_id, dgram.seq, (unsigned long long)s.t_us, s.f_hz, s.rocof,
+                s.phase_deg, s.f_std, (dgram.flags & HZ_STREAM_FLAG_RETX) ? 1 : 0, s.channel, s.phase_diff_deg);
+    }
+}
+
+/**
+ * @brief Deliver every datagram that is now in order
+ */
+static void drain(stream_state &st, int64_t t_us) {
+    auto it = st.ooo.begin();
+    while ((it != st.ooo.end()) && (it->first == st.next_seq)) {
+        deliver(st, it->second, t_us);
+        st.next_seq++;
+        it = st.ooo.erase(it);
+    }
+}
+
+/**
+ * @brief Handle a received data datagram
+ */
+static void on_data(std::unordered_map<uint32_t, stream_state> &streams, const hz_stream_data_t &dgram, const sockaddr_in &from, int64_t rx_us,
+                    latency_stats &lat) {
+    auto found = streams.find(dgram.device_id);
+    bool fresh = (found == streams.end());
+    stream_state &st = streams[dgram.device_id];
+
+    if ((fresh == false) && (dgram.session != st.session) && (dgram.session == st.prev_session)) {  // Delayed from before the restart
+        st.duplicates++;
+        return;
+    }
+    st.addr = from;
+
+    if (fresh || (dgram.session != st.session)) {  // New unit or restarted: the sequence starts over
+        if (fresh == false) {
+            fprintf(stderr, "Unit %08x restarted (session %08x, seq %u)\n", dgram.device_id, dgram.session, dgram.seq);
+            st.lost += st.missing.size();  // The previous session cannot retransmit any more, deliver what it left
+            for (auto &entry : st.ooo) {
+                deliver(st, entry.second, rx_us);
+            }
+            st.prev_session = st.session;
+        }
+        st.session = dgram.session;
+        st.ooo.clear();
+        st.missing.clear();
+        st.next_seq = dgram.seq;
+        st.max_seq = dgram.seq;
+    } else if ((int32_t)(dgram.seq - st.max_seq) > MAX_GAP) {  // Too far ahead to NACK, skip the gap
+        fprintf(stderr, "Unit %08x skipped from seq %u to %u\n", dgram.device_id, st.next_seq, dgram.seq);
+        st.lost += (dgram.seq - st.next_seq) - st.ooo.size();
+        for (auto &entry : st.ooo) {
+            deliver(st, entry.second, rx_us);
+        }
+        st.ooo.clear();
+        st.missing.clear();
+        st.next_seq = dgram.seq;
+        st.max_seq = dgram.seq;
+    }
+
+    int32_t ahead = (int32_t)(dgram.seq - st.next_seq);
+    if ((ahead < 0) || (st.ooo.count(dgram.seq) != 0)) {  // Already delivered or buffered
+        st.duplicates++;
+        return;
+    }
+
+    bool retx = (dgram.flags & HZ_STREAM_FLAG_RETX) != 0;
+    for (int i = 0; i < dgram.count; i++) {
+        (retx ? lat.retx : lat.first).push_back((double)(rx_us - (int64_t)dgram.samples[i].t_us) / 1000.0);
+    }
+
+    if ((int32_t)(dgram.seq - st.max_seq) > 0) {  // Everything between the previous max and this one is missing
+        for (uint32_t seq = st.max_seq + 1; seq != dgram.seq; seq++) {
+            st.missing.emplace(seq, rx_us);
+        }
+        st.max_seq = dgram.seq;
+    }
+    if (st.missing.erase(dgram.seq) != 0) {
+        st.recovered++;
+    }
+
+    st.ooo.emplace(dgram.seq, dgram);
+    drain(st, rx_us);
+}
+
+/**
+ * @brief Give up on old gaps and send NACKs for the remaining ones
+ */
+static void service(int sock, std::unordered_map<uint32_t, stream_state> &streams, int64_t t_us) {
+    for (auto &entry : streams) {
+        stream_state &st = entry.second;
+
+        while (st.missing.empty() == false && (t_us - st.missing.begin()->second) > GIVE_UP_US) {  // Skip the oldest gap
+            uint32_t seq = st.missing.begin()->first;
+            st.missing.erase(st.missing.begin());
+            st.lost++;
+            if (st.next_seq == seq) {
+                st.next_seq++;
+                drain(st, t_us);
+            }
+        }
+
+        if (st.missing.empty() || (t_us - st.last_nack_us) < NACK_INTERVAL_US) {
+            continue;
+        }
+
+        hz_stream_nack_t nack;
+        nack.device_id = entry.first;
+        nack.session = st.session;
+        nack.count = 0;
+        for (auto it = st.missing.begin(); it != st.missing.end() && nack.count < HZ_STREAM_MAX_NACKS; nack.count++) {
+            hz_nack_entry_t &e = nack.entries[nack.count];
+            e.base = (it++)->first;
+            e.mask = 0;
+            while (it != st.missing.end() && (it->first - e.base - 1) < 32) {
+                e.mask |= 1u << (it->first - e.base - 1);
+                it++;
+            }
+        }
+
+        uint8_t buf[HZ_STREAM_NACK_HEADER_SIZE + (HZ_STREAM_MAX_NACKS * HZ_STREAM_NACK_ENTRY_SIZE)];
+        size_t len = hz_stream_encode_nack(&nack, buf, sizeof(buf));
+        sendto(sock, buf, len, 0, (const sockaddr *)&st.addr, sizeof(st.addr));
+        st.last_nack_us = t_us;
+    }
+}
+
+/**
+ * @brief Print a latency distribution
+ */
+static void print_latency(const char *name, std::vector<double> &v) {
+    if (v.empty()) {
+        fprintf(stderr, "  %-6s latency: no samples\n", name);
+        return;
+    }
+    auto pct = [&v](double p) {
+        size_t k = (size_t)(p * (double)(v.size() - 1));
+        std::nth_element(v.begin(), v.begin() + k, v.end());
+        return v[k];
+    };
+    double p50 = pct(0.50);
+    double p99 = pct(0.99);
+    double max = *std::max_element(v.begin(), v.end());
+    fprintf(stderr, "  %-6s latency: n=%zu p50=%.1f ms p99=%.1f ms max=%.1f ms\n", name, v.size(), p50, p99, max);
+}
+
+static void report(const std::unordered_map<uint32_t, stream_state> &streams, latency_stats &lat) {
+    uint64_t delivered = 0, recovered = 0, lost = 0, duplicates = 0;
+    for (const auto &entry : streams) {
+        delivered += entry.second.delivered;
+        recovered += entry.second.recovered;
+        lost += entry.second.lost;
+        duplicates += entry.second.duplicates;
+    }
+    fprintf(stderr, "Units: %zu, delivered: %llu, recovered: %llu, lost: %llu, duplicates: %llu\n", streams.size(), (unsigned long long)delivered,
+            (unsigned long long)recovered, (unsigned long long)lost, (unsigned long long)duplicates);
+    print_latency("first", lat.first);
+    print_latency("retx", lat.retx);
+    lat.first.clear();
+    lat.retx.clear();
+
+    static std::vector<presence_status> units;
+    size_t health[PRESENCE_OFFLINE + 1] = {};
+    presence.status_all(now_us(), units);
+    for (const presence_status &unit : units) {
+        health[unit.health]++;
+    }
+    fprintf(stderr, "  presence: online=%zu degraded=%zu stale=%zu offline=%zu\n", health[PRESENCE_ONLINE], health[PRESENCE_DEGRADED],
+            health[PRESENCE_STALE], health[PRESENCE_OFFLINE]);
+}
+
+/**
+ * @brief Snapshot the presence index to disk periodically, off the receive path
+ */
+static void snapshot_task(const char *path, int interval_s) {
+    while (running) {
+        for (int i = 0; (i < (interval_s * 10)) && running; i++) {
+            usleep(100000);
+        }
+        if (presence.save(path) == false) {
+            perror(path);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    const char *port = nullptr;
+    const char *csv_path = nullptr;
+    const char *index_path = nullptr;
+    int snapshot_s = SNAPSHOT_INTERVAL_S;
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "-i") == 0) && (i + 1 < argc)) {
+            index_path = argv[++i];
+        } else if ((strcmp(argv[i], "-s") == 0) && (i + 1 < argc)) {
+            snapshot_s = std::max(atoi(argv[++i]), 1);
+        } else if (port == nullptr) {
+            port = argv[i];
+        } else {
+            csv_path = argv[i];
+        }
+    }
+    if (port == nullptr) {
+        fprintf(stderr, "Usage: %s <port> [csv_file] [-i index_file] [-s snapshot_s]\n", argv[0]);
+        return 1;
+    }
+    if (csv_path != nullptr) {
+        csv = fopen(csv_path, "w");
+        if (csv == nullptr) {
+            perror(csv_path);
+            return 1;
+        }
+        fprintf(csv, "device_id,seq,t_us,freq_hz,rocof_hz_s,phase_deg,freq_std_hz,retx,channel,phase_diff_deg\n");
+    }
+    if ((index_path != nullptr) && presence.load(index_path)) {  // Units keep their last value and statistics across collector restarts
+        fprintf(stderr, "Presence index restored from %s (%zu units)\n", index_path, presence.size());
+    }
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    int rcvbuf = 4 * 1024 * 1024;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    sockaddr_in local = {};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons((uint16_t)atoi(port));
+    if (bind(sock, (const sockaddr *)&local, sizeof(local)) != 0) {
+        perror("bind");
+        return 1;
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    std::thread snapshot;
+    if (index_path != nullptr) {
+        snapshot = std::thread(snapshot_task, index_path, snapshot_s);
+    }
+
+    static uint8_t bufs[RECV_BATCH][DGRAM_MAX];
+    sockaddr_in addrs[RECV_BATCH];
+    iovec iovs[RECV_BATCH];
+    mmsghdr msgs[RECV_BATCH];
+    for (int i = 0; i < RECV_BATCH; i++) {
+        iovs[i] = {bufs[i], sizeof(bufs[i])};
+        msgs[i] = {};
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &addrs[i];
+    }
+
+    std::unordered_map<uint32_t, stream_state> streams;
+    latency_stats lat;
+    uint64_t invalid = 0;
+    uint64_t truncated = 0;
+    int64_t last_report = now_us();
+
+    fprintf(stderr, "Listening on UDP port %s\n", port);
+    while (running) {
+        pollfd pfd = {sock, POLLIN, 0};
+        if (poll(&pfd, 1, NACK_INTERVAL_US / 1000) > 0) {
+            for (int i = 0; i < RECV_BATCH; i++) {
+                msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+            }
+            int n = recvmmsg(sock, msgs, RECV_BATCH, MSG_DONTWAIT, nullptr);
+            int64_t rx_us = now_us();  // One timestamp per batch, datagrams in a batch arrived together
+            for (int i = 0; i < n; i++) {
+                hz_stream_data_t dgram;
+                if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {  // Longer than any valid datagram
+                    truncated++;
+                } else if (hz_stream_decode_data(bufs[i], msgs[i].msg_len, &dgram)) {
+                    on_data(streams, dgram, addrs[i], rx_us, lat);
+                } else {
+                    invalid++;
+                }
+            }
+        }
+
+        int64_t t_us = now_us();
+        service(sock, streams, t_us);
+        if ((t_us - last_report) >= REPORT_INTERVAL_US) {
+            last_report = t_us;
+            report(streams, lat);
+        }
+    }
+
+    report(streams, lat);
+    fprintf(stderr, "Invalid datagrams: %llu, truncated: %llu\n", (unsigned long long)invalid, (unsigned long long)truncated);
+    if (snapshot.joinable()) {
+        snapshot.join();  // Writes a final snapshot on the way out
+    }
+    if (csv != nullptr) {
+        fclose(csv);
+    }
+    close(sock);
+
+    return 0;
+}